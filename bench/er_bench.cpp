@@ -0,0 +1,487 @@
+// er_bench: Google Benchmark suite for Flags4096, index deltas, the Redis query paths and
+// the async client.
+//
+//   er_bench [--universe=10000,1000000] [--bits=32] [--distribution=uniform|skewed]
+//            [--member_limit=10000] [--redis=0] [benchmark flags ...]
+//
+// Machine-readable results: --benchmark_format=json, or --benchmark_out=<file>
+// --benchmark_out_format=json. The options above are recorded in the JSON "context".
+//
+// The Redis benchmarks (ER_REDIS_HOST / ER_REDIS_PORT) write elements "bench:<i>"
+// into the default keyspace: run them against a scratch Redis. Universes are seeded
+// in ascending order, each one extending the previous.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "er/Flags4096.hpp"
+#include "er/RedisClient.hpp"
+#include "er/async_redis_client.hpp"
+#include "er/bulk_writer.hpp"
+#include "er/keys.hpp"
+#include "er/query.hpp"
+
+namespace {
+
+enum class Distribution { kUniform, kSkewed };
+
+struct Options {
+    std::vector<std::size_t> universes{10000};
+    std::size_t bits_per_element = 32;
+    Distribution distribution = Distribution::kUniform;
+    std::size_t member_limit = 10000;
+    bool redis = true;
+};
+
+Options g_opts;
+
+// ---- data ----
+
+// Deterministic flags of element i: bits_per_element draws (duplicates collapse).
+// kSkewed squares the draw toward bit 0, so low bits have long postings and high
+// bits short ones; kUniform spreads them evenly.
+er::Flags4096 element_flags(std::uint64_t i, std::size_t n_bits, Distribution dist) {
+    std::mt19937_64 rng(i * 0x9E3779B97F4A7C15ull + 1);
+    std::uniform_real_distribution<double> u(0.0, 1.0);
+    er::Flags4096 f;
+    for (std::size_t k = 0; k < n_bits; ++k) {
+        double x = u(rng);
+        if (dist == Distribution::kSkewed) x = x * x * x;
+        const auto bit = std::min<std::size_t>(static_cast<std::size_t>(x * er::Flags4096::kBits), er::Flags4096::kBits - 1);
+        (void)f.set(bit);
+    }
+    return f;
+}
+
+// Flags with exactly n set bits, spread with a fixed stride.
+er::Flags4096 dense_flags(std::size_t n, std::size_t offset = 0) {
+    er::Flags4096 f;
+    if (n == 0) return f;
+    const std::size_t stride = std::max<std::size_t>(1, er::Flags4096::kBits / n);
+    for (std::size_t k = 0; k < n; ++k) (void)f.set((offset + k * stride) % er::Flags4096::kBits);
+    return f;
+}
+
+// Set-bit counts the Flags4096 benchmarks run at.
+void densities(benchmark::internal::Benchmark* b) {
+    for (int n : {16, 256, 2048, 4096}) b->Arg(n);
+}
+
+// ---- Flags4096 ----
+
+void BM_FlagsSet(benchmark::State& state) {
+    er::Flags4096 f;
+    std::size_t bit = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(f.set(bit));
+        bit = (bit + 97) & (er::Flags4096::kBits - 1);
+    }
+}
+BENCHMARK(BM_FlagsSet);
+
+void BM_FlagsTest(benchmark::State& state) {
+    const auto f = dense_flags(static_cast<std::size_t>(state.range(0)));
+    std::size_t bit = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(f.test(bit));
+        bit = (bit + 97) & (er::Flags4096::kBits - 1);
+    }
+}
+BENCHMARK(BM_FlagsTest)->Arg(256);
+
+void BM_FlagsAnd(benchmark::State& state) {
+    const auto a = dense_flags(2048), b = dense_flags(2048, 1);
+    for (auto _ : state) benchmark::DoNotOptimize(a & b);
+}
+BENCHMARK(BM_FlagsAnd);
+
+void BM_FlagsOr(benchmark::State& state) {
+    const auto a = dense_flags(2048), b = dense_flags(2048, 1);
+    for (auto _ : state) benchmark::DoNotOptimize(a | b);
+}
+BENCHMARK(BM_FlagsOr);
+
+void BM_FlagsXor(benchmark::State& state) {
+    const auto a = dense_flags(2048), b = dense_flags(2048, 1);
+    for (auto _ : state) benchmark::DoNotOptimize(a ^ b);
+}
+BENCHMARK(BM_FlagsXor);
+
+void BM_FlagsPopcount(benchmark::State& state) {
+    const auto a = dense_flags(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state) benchmark::DoNotOptimize(a.popcount());
+}
+BENCHMARK(BM_FlagsPopcount)->Apply(densities);
+
+void BM_FlagsAndCount(benchmark::State& state) {
+    const auto a = dense_flags(2048), b = dense_flags(2048, 1);
+    for (auto _ : state) benchmark::DoNotOptimize(a.and_count(b));
+}
+BENCHMARK(BM_FlagsAndCount);
+
+void BM_FlagsToBytes(benchmark::State& state) {
+    const auto f = dense_flags(static_cast<std::size_t>(state.range(0)));
+    std::array<std::uint8_t, er::Flags4096::kBytes> buf{};
+    for (auto _ : state) {
+        f.to_bytes_be(std::span<std::uint8_t, er::Flags4096::kBytes>(buf));
+        benchmark::DoNotOptimize(buf.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations()) * static_cast<std::int64_t>(er::Flags4096::kBytes));
+}
+BENCHMARK(BM_FlagsToBytes)->Arg(256);
+
+void BM_FlagsFromBytes(benchmark::State& state) {
+    const auto bytes = dense_flags(static_cast<std::size_t>(state.range(0))).to_bytes_be();
+    for (auto _ : state) benchmark::DoNotOptimize(er::Flags4096::from_bytes_be(bytes.data(), bytes.size()));
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations()) * static_cast<std::int64_t>(er::Flags4096::kBytes));
+}
+BENCHMARK(BM_FlagsFromBytes)->Arg(256);
+
+void BM_FlagsToHex(benchmark::State& state) {
+    const auto f = dense_flags(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state) benchmark::DoNotOptimize(f.to_hex());
+}
+BENCHMARK(BM_FlagsToHex)->Arg(256);
+
+void BM_FlagsFromHex(benchmark::State& state) {
+    const std::string hex = dense_flags(static_cast<std::size_t>(state.range(0))).to_hex();
+    for (auto _ : state) benchmark::DoNotOptimize(er::Flags4096::from_hex(hex));
+}
+BENCHMARK(BM_FlagsFromHex)->Arg(256);
+
+void BM_FlagsSetBits(benchmark::State& state) {
+    const auto f = dense_flags(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state) benchmark::DoNotOptimize(f.set_bits());
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_FlagsSetBits)->Apply(densities);
+
+// The allocation-free counterpart of set_bits().
+void BM_FlagsBitRange(benchmark::State& state) {
+    const auto f = dense_flags(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state) {
+        std::size_t sum = 0;
+        for (std::size_t bit : f.bits()) sum += bit;
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_FlagsBitRange)->Apply(densities);
+
+// ---- index delta: what upsert_element / BulkWriter compute per put ----
+
+// range(0) set bits, range(1) percent of them moved to other positions.
+void BM_IndexDelta(benchmark::State& state) {
+    const auto n = static_cast<std::size_t>(state.range(0));
+    const auto moved = n * static_cast<std::size_t>(state.range(1)) / 100;
+    const auto old_flags = dense_flags(n);
+    auto new_flags = old_flags;
+    std::size_t k = 0;
+    for (std::size_t bit : old_flags.bits()) {
+        if (k++ >= moved) break;
+        (void)new_flags.reset(bit);
+        (void)new_flags.set((bit + 1) % er::Flags4096::kBits);
+    }
+    for (auto _ : state) {
+        const auto delta = er::Flags4096::diff(old_flags, new_flags);
+        std::size_t touched = 0;
+        for (std::size_t bit : delta.added) touched += bit;
+        for (std::size_t bit : delta.removed) touched += bit;
+        benchmark::DoNotOptimize(touched);
+    }
+}
+BENCHMARK(BM_IndexDelta)->ArgsProduct({{16, 256, 2048}, {0, 10, 100}});
+
+// ---- query planning: what every query pays on the client before its round trip ----
+
+// range(0)-bit AND, compiled against the interned key table.
+void BM_QueryCompile(benchmark::State& state) {
+    er::query::Node root{er::query::Node::Kind::kAnd, 0, {}};
+    for (std::size_t bit : dense_flags(static_cast<std::size_t>(state.range(0))).bits())
+        root.children.push_back(er::query::Node{er::query::Node::Kind::kBit, bit, {}});
+    for (auto _ : state) {
+        auto plan = er::query::compile(root);
+        benchmark::DoNotOptimize(plan.keys.data());
+    }
+}
+BENCHMARK(BM_QueryCompile)->Arg(8)->Arg(500);
+
+// ---- Redis: put / find_all / find_all_not over a seeded universe ----
+
+std::string redis_host() {
+    const char* host = std::getenv("ER_REDIS_HOST");
+    return host && *host ? host : "localhost";
+}
+
+int redis_port() {
+    const char* port = std::getenv("ER_REDIS_PORT");
+    return port && *port ? std::atoi(port) : 6379;
+}
+
+er::RedisClient* redis() {
+    static std::optional<er::RedisClient> client;
+    static bool tried = false;
+    if (!tried) {
+        tried = true;
+        auto c = er::RedisClient::connect(redis_host(), redis_port());
+        if (c) client.emplace(std::move(c).value());
+        if (client && !client->ping()) client.reset();
+        if (!client) std::cerr << "er_bench: no Redis, skipping the Redis benchmarks\n";
+    }
+    return client ? &*client : nullptr;
+}
+
+std::string element_name(std::uint64_t i) {
+    return "bench:" + std::to_string(i);
+}
+
+// Grows the seeded universe to n elements (BulkWriter batches). Returns false and
+// skips the benchmark on failure.
+bool ensure_universe(benchmark::State& state, er::RedisClient& r, std::size_t n) {
+    static std::size_t seeded = 0;
+    if (seeded >= n) return true;
+    er::BulkWriter writer(r);
+    for (std::size_t i = seeded; i < n; ++i) {
+        if (auto ok = writer.add(element_name(i), element_flags(i, g_opts.bits_per_element, g_opts.distribution)); !ok) {
+            state.SkipWithError(ok.error().msg.c_str());
+            return false;
+        }
+    }
+    if (auto ok = writer.flush(); !ok) {
+        state.SkipWithError(ok.error().msg.c_str());
+        return false;
+    }
+    seeded = n;
+    return true;
+}
+
+// Bits the queries intersect: the two most common ones under kSkewed, two
+// ordinary ones under kUniform.
+constexpr std::size_t kQueryBitA = 1;
+constexpr std::size_t kQueryBitB = 2;
+
+void BM_RedisPut(benchmark::State& state, std::size_t universe) {
+    er::RedisClient* r = redis();
+    if (!r) { state.SkipWithError("no Redis"); return; }
+    if (!ensure_universe(state, *r, universe)) return;
+    // Pass p rewrites every element in order: even passes with other flags, odd
+    // passes back to the seeded ones, so every put carries a real delta.
+    const auto pass_flags = [&](std::uint64_t id, std::uint64_t pass) {
+        return element_flags(pass % 2 == 0 ? id + universe : id, g_opts.bits_per_element, g_opts.distribution);
+    };
+    std::uint64_t i = 0, bits_changed = 0;
+    for (auto _ : state) {
+        const std::uint64_t id = i % universe;
+        auto ok = r->upsert_element(element_name(id), pass_flags(id, i / universe));
+        if (!ok) { state.SkipWithError(ok.error().msg.c_str()); return; }
+        bits_changed += static_cast<std::uint64_t>(ok.value().bits_added + ok.value().bits_removed);
+        ++i;
+    }
+    state.counters["bits_changed_per_put"] =
+        benchmark::Counter(static_cast<double>(bits_changed), benchmark::Counter::kAvgIterations);
+
+    // restore the elements still holding even-pass flags
+    const std::uint64_t pass = i / universe, done = i % universe;
+    const std::uint64_t lo = pass % 2 == 0 ? 0 : done, hi = pass % 2 == 0 ? done : universe;
+    er::BulkWriter writer(*r);
+    for (std::uint64_t id = lo; id < hi; ++id) {
+        if (!writer.add(element_name(id), element_flags(id, g_opts.bits_per_element, g_opts.distribution))) return;
+    }
+    (void)writer.flush();
+}
+
+void run_query(benchmark::State& state, std::size_t universe, const er::query::Node& root, bool members) {
+    er::RedisClient* r = redis();
+    if (!r) { state.SkipWithError("no Redis"); return; }
+    if (!ensure_universe(state, *r, universe)) return;
+    const auto plan = er::query::compile(root);
+    long long matched = 0;
+    for (auto _ : state) {
+        if (members) {
+            auto m = er::query::members(*r, plan, g_opts.member_limit);
+            if (!m) { state.SkipWithError(m.error().msg.c_str()); return; }
+            matched = static_cast<long long>(m.value().size());
+        } else {
+            auto n = er::query::count(*r, plan);
+            if (!n) { state.SkipWithError(n.error().msg.c_str()); return; }
+            matched = n.value();
+        }
+    }
+    state.counters["matched"] = static_cast<double>(matched);
+}
+
+// ---- async client: ping, set ops and a script through EventLoop::run ----
+
+constexpr er::LuaScript kBenchScardLua{"bench_scard", "return redis.call('SCARD', KEYS[1])"};
+
+// One PING, range(0) SADDs in flight at once, a script reading SCARD back, then the
+// SREMs in flight again. Every reply is checked, so a broken client fails the run.
+er::Task<er::Result<long long>> async_round(er::AsyncRedisClient& c, const std::string& key,
+                                            const std::vector<std::string>& members) {
+    using R = er::Result<long long>;
+    if (auto ok = co_await c.ping(); !ok) co_return R::err(ok.error().code, ok.error().msg);
+
+    std::vector<er::Task<R>> pending;
+    pending.reserve(members.size());
+    for (const auto& m : members) pending.push_back(c.sadd(key, m));
+    for (auto& t : pending) {
+        auto n = co_await t;
+        if (!n) co_return n;
+        if (n.value() != 1) co_return R::err(er::Errc::kInternal, "async SADD: member was already there");
+    }
+    std::vector<std::string> keys{key};
+    auto size = co_await c.eval_integer(kBenchScardLua, std::move(keys), {});
+    if (!size) co_return size;
+    if (size.value() != static_cast<long long>(members.size()))
+        co_return R::err(er::Errc::kInternal, "async EVALSHA: SCARD does not match the SADDs");
+
+    pending.clear();
+    for (const auto& m : members) pending.push_back(c.srem(key, m));
+    for (auto& t : pending) {
+        auto n = co_await t;
+        if (!n) co_return n;
+        if (n.value() != 1) co_return R::err(er::Errc::kInternal, "async SREM: member was missing");
+    }
+    co_return size;
+}
+
+void BM_AsyncRoundTrip(benchmark::State& state) {
+    if (!redis()) { state.SkipWithError("no Redis"); return; }
+    auto loop = er::EventLoop::create();
+    if (!loop) { state.SkipWithError(loop.error().msg.c_str()); return; }
+    auto client = er::AsyncRedisClient::connect(*loop.value(), redis_host(), redis_port());
+    if (!client) { state.SkipWithError(client.error().msg.c_str()); return; }
+
+    const std::string key = er::keys::tmp("bench-async");
+    std::vector<std::string> members;
+    for (std::int64_t i = 0; i < state.range(0); ++i) members.push_back("m" + std::to_string(i));
+    for (auto _ : state) {
+        auto n = loop.value()->run(async_round(*client.value(), key, members));
+        if (!n) { state.SkipWithError(n.error().msg.c_str()); return; }
+    }
+    state.counters["commands_per_round"] = static_cast<double>(2 + 2 * members.size());
+}
+
+er::query::Node bit(std::size_t b) {
+    return er::query::Node{er::query::Node::Kind::kBit, b, {}};
+}
+
+// find_all a b
+er::query::Node all_node() {
+    using er::query::Node;
+    return er::query::normalize(Node{Node::Kind::kAnd, 0, {bit(kQueryBitA), bit(kQueryBitB)}});
+}
+
+// find_all_not a b: a & !b
+er::query::Node all_not_node() {
+    using er::query::Node;
+    return er::query::normalize(Node{Node::Kind::kAnd, 0, {bit(kQueryBitA), Node{Node::Kind::kNot, 0, {bit(kQueryBitB)}}}});
+}
+
+void register_redis_benchmarks() {
+    benchmark::RegisterBenchmark("BM_AsyncRoundTrip", BM_AsyncRoundTrip)->Arg(1)->Arg(64)->UseRealTime();
+
+    auto universes = g_opts.universes;
+    std::sort(universes.begin(), universes.end());
+    universes.erase(std::unique(universes.begin(), universes.end()), universes.end());
+    for (std::size_t n : universes) {
+        const std::string suffix = "/universe:" + std::to_string(n);
+        benchmark::RegisterBenchmark(("BM_RedisPut" + suffix).c_str(), BM_RedisPut, n)->UseRealTime();
+        benchmark::RegisterBenchmark(("BM_RedisFindAllCount" + suffix).c_str(),
+                                     [n](benchmark::State& s) { run_query(s, n, all_node(), false); })->UseRealTime();
+        benchmark::RegisterBenchmark(("BM_RedisFindAllMembers" + suffix).c_str(),
+                                     [n](benchmark::State& s) { run_query(s, n, all_node(), true); })->UseRealTime();
+        benchmark::RegisterBenchmark(("BM_RedisFindAllNotCount" + suffix).c_str(),
+                                     [n](benchmark::State& s) { run_query(s, n, all_not_node(), false); })->UseRealTime();
+        benchmark::RegisterBenchmark(("BM_RedisFindAllNotMembers" + suffix).c_str(),
+                                     [n](benchmark::State& s) { run_query(s, n, all_not_node(), true); })->UseRealTime();
+    }
+}
+
+// ---- options ----
+
+bool parse_size(std::string_view v, std::size_t& out) {
+    auto [ptr, ec] = std::from_chars(v.data(), v.data() + v.size(), out);
+    return !v.empty() && ec == std::errc() && ptr == v.data() + v.size();
+}
+
+// Consumes the er_bench options from argv, leaving the benchmark flags in place.
+bool parse_options(int& argc, char** argv) {
+    int out = 1;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg(argv[i]);
+        const auto value = [&](std::string_view flag) -> std::optional<std::string_view> {
+            if (!arg.starts_with(flag) || arg.size() <= flag.size() || arg[flag.size()] != '=') return std::nullopt;
+            return arg.substr(flag.size() + 1);
+        };
+        if (auto v = value("--universe")) {
+            g_opts.universes.clear();
+            while (!v->empty()) {
+                const auto comma = v->find(',');
+                std::size_t n = 0;
+                if (!parse_size(v->substr(0, comma), n) || n == 0) return false;
+                g_opts.universes.push_back(n);
+                *v = comma == std::string_view::npos ? std::string_view() : v->substr(comma + 1);
+            }
+            if (g_opts.universes.empty()) return false;
+        } else if (auto v = value("--bits")) {
+            if (!parse_size(*v, g_opts.bits_per_element) || g_opts.bits_per_element == 0) return false;
+        } else if (auto v = value("--distribution")) {
+            if (*v == "uniform") g_opts.distribution = Distribution::kUniform;
+            else if (*v == "skewed") g_opts.distribution = Distribution::kSkewed;
+            else return false;
+        } else if (auto v = value("--member_limit")) {
+            if (!parse_size(*v, g_opts.member_limit)) return false;
+        } else if (auto v = value("--redis")) {
+            g_opts.redis = (*v != "0");
+        } else {
+            argv[out++] = argv[i];
+        }
+    }
+    argc = out;
+    return true;
+}
+
+std::string join(const std::vector<std::size_t>& v) {
+    std::string s;
+    for (std::size_t i = 0; i < v.size(); ++i) {
+        if (i) s.push_back(',');
+        s.append(std::to_string(v[i]));
+    }
+    return s;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (!parse_options(argc, argv)) {
+        std::cerr << "usage: er_bench [--universe=N[,N...]] [--bits=N] [--distribution=uniform|skewed]\n"
+                     "                [--member_limit=N] [--redis=0] [benchmark flags ...]\n";
+        return 1;
+    }
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+
+    benchmark::AddCustomContext("er_universe", join(g_opts.universes));
+    benchmark::AddCustomContext("er_bits_per_element", std::to_string(g_opts.bits_per_element));
+    benchmark::AddCustomContext("er_distribution", g_opts.distribution == Distribution::kSkewed ? "skewed" : "uniform");
+    benchmark::AddCustomContext("er_member_limit", std::to_string(g_opts.member_limit));
+    if (g_opts.redis) register_redis_benchmarks();
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -1,17 +1,29 @@
 #include <iostream>
+#include <chrono>
 #include <string>
 #include <vector>
+#include <memory>
 #include <cstdlib>
 #include <cstdint>
 #include <charconv>
-#include <unordered_set>
 #include <sstream>
+#include <fstream>
 #include <string_view>
 
 #include "er/Element.hpp"
 #include "er/RedisClient.hpp"
 #include "er/Flags4096.hpp"
+#include "er/bitmap_index.hpp"
+#include "er/bulk_writer.hpp"
+#include "er/hybrid.hpp"
+#include "er/json.hpp"
 #include "er/keys.hpp"
+#include "er/namespace.hpp"
+#include "er/query.hpp"
+#include "er/sharded_index.hpp"
+#include "er/similarity.hpp"
+#include "er/snapshot.hpp"
+#include "er/stats.hpp"
 
 static void usage() {
     std::cout <<
@@ -21,47 +33,88 @@ static void usage() {
       "Options:\n"
       "  --keys-only          For *_store commands, print only the tmp key\n"
       "  (or set ER_KEYS_ONLY=1)\n"
+      "  --count              For find_* / query commands, print only the Count\n"
+      "  --limit <n>          For find_* / query commands, return at most n members\n"
+      "  --total              With --limit, Count is the full cardinality, not the\n"
+      "                       number of members printed\n"
+      "  --no-cache           For *_store commands, always recompute into a fresh tmp key\n"
+      "  (or set ER_NO_CACHE=1; by default results are cached per canonical query,\n"
+      "   copied into each caller's key until a put/del changes one of their indexes)\n"
+      "  --into <key>         For *_store commands, recompute into <key> (under er:tmp:),\n"
+      "                       overwriting it in place instead of creating a new key\n"
+      "  --backend set|bitmap Index postings: SETs of names (default) or bitmaps over\n"
+      "                       dense element ids (or set ER_INDEX_BACKEND)\n"
+      "  --stats              Print per-command Redis stats as JSON to stderr on exit\n"
+      "  --shards <n>         Sharded index: elements hashed over n {er:sN} shards,\n"
+      "                       spread over a Redis Cluster when the node is one (or set\n"
+      "                       ER_SHARDS); put, get, query and find_* only\n"
+      "  --hybrid <rows>      serve: queries estimated at >= rows members run on an\n"
+      "                       in-memory snapshot while it is current (see serve)\n"
+      "  --prefix <p>         Key namespace: every key under <p> instead of er\n"
+      "                       (e.g. acme:prod; or set ER_PREFIX)\n"
       "  (Redis: ER_REDIS_HOST, ER_REDIS_PORT)\n"
       "\n"
       "Commands:\n"
       "  er_cli put <name> <bit> [bit2 bit3 ...]\n"
       "  er_cli get <name>\n"
       "  er_cli del <name> [--force]\n"
+      "  er_cli load [<file>|-] [--binary] [--batch <n>]\n"
+      "      text: one element per line, \"<name> <bit> [bit ...]\" ('#' comments)\n"
+      "      binary: repeated <u16 LE name_len><name><512B flags_bin>\n"
+      "  er_cli export <file>\n"
+      "      every element's flags to a checksummed snapshot file (mmap-able)\n"
+      "  er_cli import <file> [--batch <n>] [--no-verify]\n"
+      "      writes a snapshot file's elements and rebuilds their index postings\n"
+      "  er_cli bitstats [--rebuild] [bit ...]\n"
+      "      per-bit element counts with one HMGET (--rebuild recounts them first,\n"
+      "      needed once for data written before the counts were kept)\n"
       "  er_cli find <bit>\n"
       "  er_cli find_all <bit1> <bit2> [bit3 ...]\n"
       "  er_cli find_any <bit1> <bit2> [bit3 ...]\n"
       "  er_cli find_not <include_bit> <exclude_bit1> [exclude_bit2 ...]\n"
       "  er_cli find_universe_not <exclude_bit1> [exclude_bit2 ...]\n"
       "  er_cli find_all_not <include_bit> <exclude_bit1> [exclude_bit2 ...]\n"
+      "  er_cli query <expr>\n"
+      "      expr: bits with & | ! and parentheses, e.g. \"(12 & 40) | (7 & !99)\"\n"
+      "  er_cli snapshot [--file <file>] <find_all|find_any|find_not|find_universe_not> <bit> [bit ...]\n"
+      "      loads all flags once (or maps an exported file) and scans them in memory\n"
+      "      (timings on stderr)\n"
+      "  er_cli similar <name> [--k <n>] [--metric jaccard|hamming] [--snapshot]\n"
+      "      top-k closest elements; candidates share a bit with <name>, or with\n"
+      "      --snapshot every element is scored in memory\n"
+      "  er_cli serve\n"
+      "      long-lived: one JSON request per stdin line, one JSON response per\n"
+      "      stdout line, e.g. {\"id\":1,\"op\":\"query\",\"expr\":\"1 & 2\",\"count\":true}\n"
+      "      ops: ping, put, get, del, query, store, release, similar, stats,\n"
+      "      refresh (reloads the --hybrid snapshot)\n"
+      "      (see docs/ARCHITECTURE.md)\n"
       "\n"
       "Store+TTL:\n"
       "  er_cli find_all_store <ttl_sec> <bit1> <bit2> [bit3 ...]\n"
       "  er_cli find_any_store <ttl_sec> <bit1> <bit2> [bit3 ...]\n"
       "  er_cli find_not_store <ttl_sec> <include_bit> <exclude_bit1> [exclude_bit2 ...]\n"
-      "  er_cli show <redis_set_key>\n"
+      "  er_cli show <redis_set_key> [--page [<count>]] [--cursor <c>]\n"
+      "      --page: stream with SSCAN; --cursor: one page, prints the next cursor\n"
       "  er_cli find_universe_not_store <ttl_sec> <exclude_bit1> [exclude_bit2 ...]\n"
-      "  er_cli find_all_not_store <ttl_sec> <include_bit> <exclude_bit1> [exclude_bit2 ...]\n";
+      "  er_cli find_all_not_store <ttl_sec> <include_bit> <exclude_bit1> [exclude_bit2 ...]\n"
+      "  er_cli query_store <ttl_sec> <expr>\n"
+      "  er_cli release <tmp_key> [tmp_key ...]\n"
+      "      drop stored results (er:tmp:* keys from *_store or --into; not shared\n"
+      "      cache entries) before their TTL\n";
 }
 
-static std::string key_for(const std::string& name) {
-    return er::keys::element(name);
+static std::string key_for(const std::string& name, std::string_view prefix) {
+    return er::keys::element(name, prefix);
 }
 
-static std::string idx_key_for_bit(std::size_t bit) {
-    return er::keys::idx_bit(bit);
+static std::string_view idx_key_for_bit(std::size_t bit, std::string_view prefix) {
+    return er::keys::KeyTable::of(prefix).idx_bit(bit);
 }
 
 static bool load_existing_flags(er::RedisClient& r, const std::string& key, er::Flags4096& out_flags) {
-    auto blob = r.hget_bin(key, "flags_bin");
-    if (blob && blob.value().size() == 512) {
-        auto f = er::Flags4096::from_bytes_be(
-            reinterpret_cast<const std::uint8_t*>(blob.value().data()),
-            blob.value().size()
-        );
-        if (f) {
-            out_flags = std::move(f).value();
-            return true;
-        }
+    if (auto f = r.hget_flags(key, "flags_bin"); f) {
+        out_flags = std::move(f).value();
+        return true;
     }
 
     auto hex = r.hget(key, "flags_hex");
@@ -77,26 +130,13 @@ static bool load_existing_flags(er::RedisClient& r, const std::string& key, er::
     return false;
 }
 
-static void update_index_for_put(er::RedisClient& r,
-                                 const std::string& name,
-                                 const er::Flags4096& oldf,
-                                 const er::Flags4096& newf) {
-    const auto old_bits = oldf.set_bits();
-    const auto new_bits = newf.set_bits();
-
-    std::unordered_set<std::size_t> old_set(old_bits.begin(), old_bits.end());
-    std::unordered_set<std::size_t> new_set(new_bits.begin(), new_bits.end());
-
-    for (auto b : old_set) {
-        if (new_set.find(b) == new_set.end()) {
-            (void)r.srem(idx_key_for_bit(b), name);
-        }
-    }
-    for (auto b : new_set) {
-        if (old_set.find(b) == old_set.end()) {
-            (void)r.sadd(idx_key_for_bit(b), name);
-        }
-    }
+// Removes an element in one script (see RedisClient::delete_element). Returns
+// whether the element's flags were found.
+static er::Result<bool> delete_element(er::RedisClient& r, er::IndexBackend backend, std::string_view prefix,
+                                       const std::string& name, bool force) {
+    auto del = r.delete_element(name, force, backend, prefix);
+    if (!del) return er::Result<bool>::err(del.error().code, "DEL failed: " + del.error().msg);
+    return er::Result<bool>::ok(del.value().found);
 }
 
 static er::Result<std::size_t> parse_bit_arg(std::string_view s) noexcept {
@@ -123,28 +163,1010 @@ static er::Result<int> parse_ttl_arg(std::string_view s) noexcept {
     return er::Result<int>::ok(ttl);
 }
 
-static er::Result<std::vector<std::string>> build_idx_keys_from_bits(int argc, char** argv, int start_i) {
-    std::vector<std::string> idx_keys;
+static er::Result<std::vector<std::string_view>> build_idx_keys_from_bits(int argc, char** argv, int start_i,
+                                                                         std::string_view prefix) {
+    std::vector<std::string_view> idx_keys;
     idx_keys.reserve(static_cast<std::size_t>(argc - start_i));
     for (int i = start_i; i < argc; ++i) {
         auto bit = parse_bit_arg(argv[i]);
-        if (!bit) return er::Result<std::vector<std::string>>::err(bit.error().code, bit.error().msg);
-        idx_keys.push_back(idx_key_for_bit(bit.value()));
+        if (!bit) return er::Result<std::vector<std::string_view>>::err(bit.error().code, bit.error().msg);
+        idx_keys.push_back(idx_key_for_bit(bit.value(), prefix));
     }
-    return er::Result<std::vector<std::string>>::ok(std::move(idx_keys));
+    return er::Result<std::vector<std::string_view>>::ok(std::move(idx_keys));
 }
 
-static std::string make_tmp_key(const std::string& tag, int ttl) {
-    // unique tmp key per call (no collisions between concurrent runs)
-    return er::keys::tmp(tag + ":ttl" + std::to_string(ttl));
+static std::string make_tmp_key(const std::string& tag, int ttl, std::string_view prefix) {
+    // unique tmp key per call (host, pid and counter: no collisions between concurrent runs)
+    return er::keys::tmp(tag + ":ttl" + std::to_string(ttl), prefix);
 }
 
-static void print_members(const std::string& label, const std::vector<std::string>& members) {
+static void print_members(const std::string& label, const std::vector<std::string>& members, long long count) {
     std::cout << label << "\n";
-    std::cout << "Count: " << members.size() << "\n";
+    std::cout << "Count: " << count << "\n";
     for (const auto& m : members) std::cout << " - " << m << "\n";
 }
 
+static void print_members(const std::string& label, const std::vector<std::string>& members) {
+    print_members(label, members, static_cast<long long>(members.size()));
+}
+
+struct Invocation {
+    std::string host;
+    int port = 6379;
+    bool keys_only = false;
+    er::IndexBackend backend = er::IndexBackend::kSet;   // --backend set|bitmap
+    bool no_cache = false;     // --no-cache: *_store commands always recompute
+    std::string into{};        // --into KEY: *_store commands overwrite KEY in place
+    bool count_only = false;   // --count: print only the cardinality
+    std::size_t limit = 0;     // --limit N: at most N members (0 = all)
+    bool total = false;        // --total: Count is the full cardinality even with --limit
+    bool stats = false;        // --stats: per-command stats on stderr at exit
+    std::size_t shards = 0;    // --shards N: sharded index (0 = the single-node layout)
+    std::size_t hybrid = 0;    // --hybrid N: serve runs queries of >= N estimated rows on a snapshot
+    std::string prefix{er::keys::kPrefixDefault};   // --prefix P: key namespace (see er/namespace.hpp)
+    bool help = false;
+    std::string error{};
+    int cmd_index = 1;
+};
+
+static bool is_find_no_store(std::string_view op) noexcept {
+    return op == "find" || op == "find_all" || op == "find_any" || op == "find_not"
+        || op == "find_universe_not" || op == "find_all_not";
+}
+
+// The find_* shapes as query expressions (see er/query.hpp); bits must not be empty.
+static er::query::Node find_node(std::string_view op, const std::vector<std::size_t>& bits) {
+    using er::query::Node;
+    std::vector<Node> terms;
+    terms.reserve(bits.size());
+    for (std::size_t i = 0; i < bits.size(); ++i) {
+        Node leaf{Node::Kind::kBit, bits[i], {}};
+        // find_not / find_all_not: first bit is the include, the rest are excluded
+        const bool negate = (op == "find_universe_not") ||
+                            ((op == "find_not" || op == "find_all_not") && i > 0);
+        if (negate) terms.push_back(Node{Node::Kind::kNot, 0, {std::move(leaf)}});
+        else terms.push_back(std::move(leaf));
+    }
+    if (op == "find") return std::move(terms.front());
+    const auto kind = (op == "find_any") ? Node::Kind::kOr : Node::Kind::kAnd;
+    return Node{kind, 0, std::move(terms)};
+}
+
+// Same, with the bits parsed from argv[first..].
+static er::Result<er::query::Node> find_node(std::string_view op, int argc, char** argv, int first = 1) {
+    std::vector<std::size_t> bits;
+    for (int i = first; i < argc; ++i) {
+        auto bit = parse_bit_arg(argv[i]);
+        if (!bit) return er::Result<er::query::Node>::err(bit.error().code, bit.error().msg);
+        bits.push_back(bit.value());
+    }
+    return er::Result<er::query::Node>::ok(find_node(op, bits));
+}
+
+// Runs a plan honoring --count / --limit / --total and prints it in the usual "Count:"
+// format. --total with --limit costs a second script for the count (same process).
+static int print_query(er::RedisClient& r, const Invocation& inv, const std::string& label, const er::query::Plan& plan) {
+    const bool bitmap = (inv.backend == er::IndexBackend::kBitmap);
+    const auto count = [&](std::size_t limit) {
+        return bitmap ? er::BitmapIndex(r, inv.prefix).count(plan, limit) : er::query::count(r, plan, limit, inv.prefix);
+    };
+    if (inv.count_only) {
+        auto n = count(inv.total ? 0 : inv.limit);
+        if (!n) { std::cerr << "QUERY failed: " << n.error().msg << "\n"; return 15; }
+        std::cout << "Count: " << n.value() << "\n";
+        return 0;
+    }
+    auto members = bitmap ? er::BitmapIndex(r, inv.prefix).members(plan, inv.limit)
+                          : er::query::members(r, plan, inv.limit, inv.prefix);
+    if (!members) { std::cerr << "QUERY failed: " << members.error().msg << "\n"; return 15; }
+    if (inv.total && inv.limit > 0 && members.value().size() >= inv.limit) {
+        auto n = count(0);
+        if (!n) { std::cerr << "QUERY failed: " << n.error().msg << "\n"; return 15; }
+        print_members(label, members.value(), n.value());
+        return 0;
+    }
+    print_members(label, members.value());
+    return 0;
+}
+
+// Output of the *_store commands: the tmp key, then the count (--count), the first
+// --limit members (SSCAN, the set is not read in full) or all members.
+static int print_stored(er::RedisClient& r, const Invocation& inv, const std::string& tmp_key, int ttl_sec,
+                        long long stored) {
+    if (inv.keys_only) {
+        std::cout << tmp_key << "\n";
+        return 0;
+    }
+    std::cout << "TMP_KEY: " << tmp_key << " (ttl=" << ttl_sec << "s)\n";
+    if (inv.count_only) {
+        std::cout << "Count: " << stored << "\n";
+        return 0;
+    }
+
+    std::vector<std::string> members;
+    if (inv.limit > 0) {
+        std::uint64_t cursor = 0;
+        do {
+            auto page = r.sscan(tmp_key, cursor, inv.limit);
+            if (!page) { std::cerr << "SSCAN tmp_key failed: " << page.error().msg << "\n"; return 12; }
+            for (auto& m : page.value().members) {
+                if (members.size() < inv.limit) members.push_back(std::move(m));
+            }
+            cursor = page.value().cursor;
+        } while (cursor != 0 && members.size() < inv.limit);
+    } else {
+        auto all = r.smembers(tmp_key);
+        if (!all) { std::cerr << "SMEMBERS tmp_key failed: " << all.error().msg << "\n"; return 12; }
+        members = std::move(all).value();
+    }
+    print_members("Result:", members);
+    return 0;
+}
+
+struct StoredQuery {
+    std::string key;
+    long long count = 0;
+};
+
+// Stores a query result with a TTL in a fresh tmp key. By default it is copied from the
+// shared cache entry for the canonical query, evaluated again only once the index
+// versions it saw changed; --no-cache always evaluates, --into stores into the given key.
+static er::Result<StoredQuery> store_node(er::RedisClient& r, const Invocation& inv, const std::string& tag,
+                                          const er::query::Node& node, int ttl_sec) {
+    const auto plan = er::query::compile(node, inv.prefix);
+    StoredQuery out;
+    er::Result<long long> card = er::Result<long long>::ok(0);
+    if (!inv.into.empty()) {
+        if (auto ok = er::query::check_output_key(inv.into, inv.prefix); !ok)
+            return er::Result<StoredQuery>::err(ok.error().code, ok.error().msg);
+        out.key = inv.into;
+        card = (inv.backend == er::IndexBackend::kBitmap) ? er::BitmapIndex(r, inv.prefix).store(plan, ttl_sec, out.key)
+                                                          : er::query::store(r, plan, ttl_sec, out.key, inv.prefix);
+    } else if (inv.backend == er::IndexBackend::kBitmap) {
+        // bitmap results are not cached: always a fresh tmp key
+        out.key = make_tmp_key(tag, ttl_sec, inv.prefix);
+        card = er::BitmapIndex(r, inv.prefix).store(plan, ttl_sec, out.key);
+    } else if (inv.no_cache) {
+        out.key = make_tmp_key(tag, ttl_sec, inv.prefix);
+        card = er::query::store(r, plan, ttl_sec, out.key, inv.prefix);
+    } else {
+        out.key = make_tmp_key(tag, ttl_sec, inv.prefix);
+        card = er::query::store_cached(r, plan, ttl_sec, er::query::cache_key(node, inv.prefix), out.key, inv.prefix);
+    }
+    if (!card) return er::Result<StoredQuery>::err(card.error().code, card.error().msg);
+    out.count = card.value();
+    return er::Result<StoredQuery>::ok(std::move(out));
+}
+
+static int store_query(er::RedisClient& r, const Invocation& inv, const std::string& tag,
+                       const er::query::Node& node, int ttl_sec) {
+    auto stored = store_node(r, inv, tag, node, ttl_sec);
+    if (!stored) { std::cerr << "STORE+EXPIRE failed: " << stored.error().msg << "\n"; return 11; }
+    return print_stored(r, inv, stored.value().key, ttl_sec, stored.value().count);
+}
+
+// show <key> [--page [<count>]] [--cursor <c>]
+// --page streams the set with SSCAN (members print as pages arrive, count last);
+// --cursor reads a single page and prints the cursor to continue from (0 = done).
+static int cmd_show(er::RedisClient& r, int argc, char** argv) {
+    const std::string key = argv[1];
+    bool paged = false;
+    bool single = false;
+    std::uint64_t cursor = 0;
+    std::size_t count = er::RedisClient::kDefaultScanCount;
+    for (int i = 2; i < argc; ++i) {
+        const std::string_view a(argv[i]);
+        if (a == "--page") {
+            paged = true;
+            if (i + 1 < argc && argv[i + 1][0] >= '0' && argv[i + 1][0] <= '9') {
+                const std::string_view v(argv[++i]);
+                auto [ptr, ec] = std::from_chars(v.data(), v.data() + v.size(), count);
+                if (ec != std::errc() || ptr != v.data() + v.size() || count == 0) {
+                    std::cerr << "ERROR: invalid --page count: " << v << "\n";
+                    return 1;
+                }
+            }
+        } else if (a == "--cursor" && i + 1 < argc) {
+            paged = single = true;
+            const std::string_view v(argv[++i]);
+            auto [ptr, ec] = std::from_chars(v.data(), v.data() + v.size(), cursor);
+            if (ec != std::errc() || ptr != v.data() + v.size()) {
+                std::cerr << "ERROR: invalid --cursor: " << v << "\n";
+                return 1;
+            }
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (!paged) {
+        auto members = r.smembers(key);
+        if (!members) { std::cerr << "SMEMBERS failed: " << members.error().msg << "\n"; return 13; }
+        print_members("SHOW: " + key, members.value());
+        return 0;
+    }
+
+    std::cout << "SHOW: " << key << "\n";
+    std::size_t n = 0;
+    const auto print = [&](std::string_view m) {
+        std::cout << " - " << m << "\n";
+        ++n;
+    };
+    do {
+        auto next = r.sscan(key, cursor, count, print);
+        if (!next) { std::cerr << "SSCAN failed: " << next.error().msg << "\n"; return 13; }
+        cursor = next.value();
+        std::cout.flush();
+    } while (!single && cursor != 0);
+
+    if (single) std::cout << "Cursor: " << cursor << "\n";
+    std::cout << "Count: " << n << "\n";
+    return 0;
+}
+
+// Streams elements from a file/stdin into BulkWriter (batched upsert scripts).
+// BulkWriter only writes SET postings; with the bitmap backend each record is one upsert script.
+static int cmd_load(er::RedisClient& r, const Invocation& inv, int argc, char** argv) {
+    const er::IndexBackend backend = inv.backend;
+    std::string path = "-";
+    bool binary = false;
+    std::size_t batch = er::BulkWriter::kDefaultBatchSize;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view a(argv[i]);
+        if (a == "--binary") {
+            binary = true;
+        } else if (a == "--batch" && i + 1 < argc) {
+            const std::string_view v(argv[++i]);
+            auto [ptr, ec] = std::from_chars(v.data(), v.data() + v.size(), batch);
+            if (ec != std::errc() || ptr != v.data() + v.size() || batch == 0) {
+                std::cerr << "ERROR: invalid --batch: " << v << "\n";
+                return 1;
+            }
+        } else {
+            path = std::string(a);
+        }
+    }
+
+    std::ifstream file;
+    if (path != "-") {
+        file.open(path, binary ? std::ios::in | std::ios::binary : std::ios::in);
+        if (!file) {
+            std::cerr << "ERROR: cannot open " << path << "\n";
+            return 1;
+        }
+    }
+    std::istream& in = (path == "-") ? std::cin : file;
+
+    er::BulkWriter writer(r, batch, inv.prefix);
+    std::size_t upserts = 0;
+    const auto add = [&](std::string_view name, const er::Flags4096& f) -> er::Result<er::Unit> {
+        if (backend == er::IndexBackend::kSet) return writer.add(name, f);
+        auto ok = r.upsert_element(name, f, backend, inv.prefix);
+        if (!ok) return er::Result<er::Unit>::err(ok.error().code, ok.error().msg);
+        ++upserts;
+        return er::Result<er::Unit>::ok();
+    };
+    std::size_t record = 0;
+    er::Flags4096 flags;
+
+    if (binary) {
+        std::string name;
+        std::array<std::uint8_t, er::Flags4096::kBytes> blob{};
+        for (;;) {
+            std::uint8_t len_le[2];
+            if (!in.read(reinterpret_cast<char*>(len_le), 2)) break;
+            ++record;
+            const std::size_t name_len = static_cast<std::size_t>(len_le[0]) | (static_cast<std::size_t>(len_le[1]) << 8);
+            name.resize(name_len);
+            if (!in.read(name.data(), static_cast<std::streamsize>(name_len)) ||
+                !in.read(reinterpret_cast<char*>(blob.data()), static_cast<std::streamsize>(blob.size()))) {
+                std::cerr << "ERROR: record " << record << ": truncated input\n";
+                return 1;
+            }
+            auto f = er::Flags4096::from_bytes_be(blob.data(), blob.size());
+            if (!f) { std::cerr << "ERROR: record " << record << ": " << f.error().msg << "\n"; return 1; }
+            if (auto ok = add(name, f.value()); !ok) {
+                std::cerr << "LOAD failed at record " << record << ": " << ok.error().msg << "\n";
+                return 14;
+            }
+        }
+    } else {
+        std::string line;
+        while (std::getline(in, line)) {
+            ++record;
+            std::string_view rest(line);
+            auto next_token = [&rest]() {
+                const auto b = rest.find_first_not_of(" \t\r");
+                if (b == std::string_view::npos) { rest = {}; return std::string_view{}; }
+                rest.remove_prefix(b);
+                const auto e = rest.find_first_of(" \t\r");
+                const auto tok = rest.substr(0, e);
+                rest.remove_prefix(e == std::string_view::npos ? rest.size() : e);
+                return tok;
+            };
+
+            const std::string_view name = next_token();
+            if (name.empty() || name.front() == '#') continue;
+
+            flags.clear();
+            for (auto tok = next_token(); !tok.empty(); tok = next_token()) {
+                auto bit = parse_bit_arg(tok);
+                if (!bit) { std::cerr << "ERROR: line " << record << ": " << bit.error().msg << "\n"; return 1; }
+                (void)flags.set(bit.value());
+            }
+            if (auto ok = add(name, flags); !ok) {
+                std::cerr << "LOAD failed at line " << record << ": " << ok.error().msg << "\n";
+                return 14;
+            }
+        }
+    }
+
+    if (auto ok = writer.flush(); !ok) {
+        std::cerr << "LOAD flush failed: " << ok.error().msg << "\n";
+        return 14;
+    }
+    if (backend != er::IndexBackend::kSet) {
+        std::cout << "OK: loaded " << upserts << " elements (bitmap index, one upsert each)\n";
+        return 0;
+    }
+    const auto& st = writer.stats();
+    std::cout << "OK: loaded " << st.elements << " elements in " << st.batches << " batches ("
+              << st.commands << " commands)\n";
+    return 0;
+}
+
+// export <file>: Snapshot::load, then Snapshot::save (written atomically).
+static int cmd_export(er::RedisClient& r, const Invocation& inv, int argc, char** argv) {
+    if (argc != 2) { usage(); return 1; }
+    auto snap = er::Snapshot::load(r, er::RedisClient::kDefaultScanCount, inv.prefix);
+    if (!snap) { std::cerr << "SNAPSHOT load failed: " << snap.error().msg << "\n"; return 16; }
+    if (auto ok = snap.value().save(argv[1]); !ok) {
+        std::cerr << "EXPORT failed: " << ok.error().msg << "\n";
+        return 18;
+    }
+    std::cout << "OK: exported " << snap.value().size() << " elements to " << argv[1] << "\n";
+    return 0;
+}
+
+// import <file> [--batch <n>] [--no-verify]: maps the file and writes every row like
+// load does (BulkWriter batches for set postings, one upsert each for bitmaps).
+static int cmd_import(er::RedisClient& r, const Invocation& inv, int argc, char** argv) {
+    std::string path;
+    bool verify = true;
+    std::size_t batch = er::BulkWriter::kDefaultBatchSize;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view a(argv[i]);
+        if (a == "--no-verify") {
+            verify = false;
+        } else if (a == "--batch" && i + 1 < argc) {
+            const std::string_view v(argv[++i]);
+            auto [ptr, ec] = std::from_chars(v.data(), v.data() + v.size(), batch);
+            if (ec != std::errc() || ptr != v.data() + v.size() || batch == 0) {
+                std::cerr << "ERROR: invalid --batch: " << v << "\n";
+                return 1;
+            }
+        } else if (path.empty()) {
+            path = std::string(a);
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (path.empty()) { usage(); return 1; }
+
+    auto snap = er::Snapshot::open(path, verify);
+    if (!snap) { std::cerr << "IMPORT failed: " << snap.error().msg << "\n"; return 18; }
+    const er::Snapshot& rows = snap.value();
+
+    er::BulkWriter writer(r, batch, inv.prefix);
+    const auto add = [&](std::size_t i) -> er::Result<er::Unit> {
+        if (inv.backend == er::IndexBackend::kSet) return writer.add(rows.name(i), rows.flags(i));
+        auto ok = r.upsert_element(rows.name(i), rows.flags(i), inv.backend, inv.prefix);
+        if (!ok) return er::Result<er::Unit>::err(ok.error().code, ok.error().msg);
+        return er::Result<er::Unit>::ok();
+    };
+    for (std::size_t i = 0; i < rows.size(); ++i) {
+        if (auto ok = add(i); !ok) {
+            std::cerr << "IMPORT failed at row " << i << " (" << rows.name(i) << "): " << ok.error().msg << "\n";
+            return 14;
+        }
+    }
+    if (auto ok = writer.flush(); !ok) {
+        std::cerr << "IMPORT flush failed: " << ok.error().msg << "\n";
+        return 14;
+    }
+    std::cout << "OK: imported " << rows.size() << " elements from " << path << "\n";
+    return 0;
+}
+
+// bitstats [--rebuild] [bit ...]: the posting sizes from the stats hash, one
+// "<bit> <count>" line each (every non-empty bit unless bits are given), after "all".
+static int cmd_bitstats(er::RedisClient& r, const Invocation& inv, int argc, char** argv) {
+    bool rebuild = false;
+    std::vector<std::size_t> bits;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string_view(argv[i]) == "--rebuild") {
+            rebuild = true;
+            continue;
+        }
+        auto bit = parse_bit_arg(argv[i]);
+        if (!bit) { std::cerr << "ERROR: " << bit.error().msg << "\n"; return 1; }
+        bits.push_back(bit.value());
+    }
+    if (rebuild) {
+        if (auto n = r.rebuild_index_stats(inv.backend, inv.prefix); !n) {
+            std::cerr << "BITSTATS rebuild failed: " << n.error().msg << "\n";
+            return 19;
+        }
+    }
+    auto st = r.index_stats(inv.backend, inv.prefix);
+    if (!st) { std::cerr << "BITSTATS failed: " << st.error().msg << "\n"; return 19; }
+    std::cout << "all " << st.value().universe << "\n";
+    if (bits.empty()) {
+        for (std::size_t b = 0; b < st.value().bits.size(); ++b) {
+            if (st.value().bits[b] != 0) std::cout << b << " " << st.value().bits[b] << "\n";
+        }
+    } else {
+        for (auto b : bits) std::cout << b << " " << st.value().bits[b] << "\n";
+    }
+    return 0;
+}
+
+// snapshot [--file <f>] <find shape> <bits...>: same shapes as the find_* commands,
+// evaluated over an in-memory er::Snapshot instead of the index sets.
+static int cmd_snapshot(er::RedisClient& r, const Invocation& inv, int argc, char** argv) {
+    std::string file;
+    if (argc >= 3 && std::string_view(argv[1]) == "--file") {
+        file = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc < 2) { usage(); return 1; }
+    const std::string_view shape = argv[1];
+    if (shape != "find_all" && shape != "find_any" && shape != "find_not" && shape != "find_universe_not") {
+        std::cerr << "ERROR: unknown snapshot query: " << shape << "\n";
+        return 1;
+    }
+
+    er::Predicate pred;
+    for (int i = 2; i < argc; ++i) {
+        auto bit = parse_bit_arg(argv[i]);
+        if (!bit) { std::cerr << "ERROR: " << bit.error().msg << "\n"; return 1; }
+        // find_not: the first bit is the include, the rest are excluded
+        er::Flags4096* mask = &pred.all;
+        if (shape == "find_any") mask = &pred.any;
+        else if (shape == "find_universe_not" || (shape == "find_not" && i > 2)) mask = &pred.none;
+        (void)mask->set(bit.value());
+    }
+
+    using Clock = std::chrono::steady_clock;
+    const auto ms = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+
+    const auto t0 = Clock::now();
+    auto snap = file.empty() ? er::Snapshot::load(r, er::RedisClient::kDefaultScanCount, inv.prefix)
+                             : er::Snapshot::open(file);
+    if (!snap) { std::cerr << "SNAPSHOT load failed: " << snap.error().msg << "\n"; return 16; }
+    const auto t1 = Clock::now();
+    std::cerr << "snapshot: " << snap.value().size() << " rows " << (file.empty() ? "loaded" : "mapped") << " in "
+              << ms(t1 - t0) << " ms\n";
+
+    if (inv.count_only) {
+        std::size_t n = snap.value().count(pred);
+        if (inv.limit > 0 && n > inv.limit) n = inv.limit;
+        std::cerr << "snapshot: scan " << ms(Clock::now() - t1) << " ms\n";
+        std::cout << "Count: " << n << "\n";
+        return 0;
+    }
+    auto members = snap.value().find_names(pred, inv.limit);
+    std::cerr << "snapshot: scan " << ms(Clock::now() - t1) << " ms\n";
+    print_members("Snapshot " + std::string(shape), members);
+    return 0;
+}
+
+// similar <name> [--k <n>] [--metric jaccard|hamming] [--snapshot]
+static int cmd_similar(er::RedisClient& r, const Invocation& inv, int argc, char** argv) {
+    const std::string name = argv[1];
+    std::size_t k = 10;
+    er::Metric metric = er::Metric::kJaccard;
+    bool use_snapshot = false;
+    for (int i = 2; i < argc; ++i) {
+        const std::string_view a(argv[i]);
+        if (a == "--k" && i + 1 < argc) {
+            const std::string_view v(argv[++i]);
+            auto [ptr, ec] = std::from_chars(v.data(), v.data() + v.size(), k);
+            if (ec != std::errc() || ptr != v.data() + v.size() || k == 0) {
+                std::cerr << "ERROR: invalid --k: " << v << "\n";
+                return 1;
+            }
+        } else if (a == "--metric" && i + 1 < argc) {
+            auto m = er::parse_metric(argv[++i]);
+            if (!m) { std::cerr << "ERROR: " << m.error().msg << "\n"; return 1; }
+            metric = m.value();
+        } else if (a == "--snapshot") {
+            use_snapshot = true;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    auto flags = r.element_flags(name, inv.prefix);
+    if (!flags) {
+        if (flags.error().code == er::Errc::kNotFound) {
+            std::cerr << "Missing element (no flags_bin/flags_hex)\n";
+            return 4;
+        }
+        std::cerr << "HGET failed: " << flags.error().msg << "\n";
+        return 17;
+    }
+
+    std::vector<er::Match> matches;
+    if (use_snapshot) {
+        auto snap = er::Snapshot::load(r, er::RedisClient::kDefaultScanCount, inv.prefix);
+        if (!snap) { std::cerr << "SNAPSHOT load failed: " << snap.error().msg << "\n"; return 16; }
+        matches = er::similar(snap.value(), flags.value(), k, metric, name);
+    } else {
+        auto got = er::similar(r, flags.value(), k, metric, name, inv.backend, inv.prefix);
+        if (!got) { std::cerr << "SIMILAR failed: " << got.error().msg << "\n"; return 17; }
+        matches = std::move(got).value();
+    }
+
+    std::cout << "Similar to " << name << " (" << (metric == er::Metric::kJaccard ? "jaccard" : "hamming") << ")\n";
+    std::cout << "Count: " << matches.size() << "\n";
+    for (const auto& m : matches) std::cout << " - " << m.name << " " << m.score << "\n";
+    return 0;
+}
+
+// ---- --stats: the client's counters, printed to stderr when main returns ----
+
+class StatsReport {
+public:
+    // r == nullptr: --stats not given, nothing is recorded or printed.
+    explicit StatsReport(er::RedisClient* r) noexcept : r_(r) {
+        if (r_) r_->enable_stats();
+    }
+    ~StatsReport() {
+        if (r_) std::cerr << "stats: " << totals().json() << "\n";
+    }
+    StatsReport(const StatsReport&) = delete;
+    StatsReport& operator=(const StatsReport&) = delete;
+
+    bool enabled() const noexcept { return r_ != nullptr; }
+
+    // Before *r is replaced by a new connection: keep its counters.
+    void carry() {
+        if (r_ && r_->stats()) earlier_.merge(*r_->stats());
+    }
+    // After the new connection is in place.
+    void resume() noexcept {
+        if (r_) r_->enable_stats();
+    }
+
+    er::Stats totals() const {
+        er::Stats all = earlier_;
+        if (r_ && r_->stats()) all.merge(*r_->stats());
+        return all;
+    }
+
+private:
+    er::RedisClient* r_;
+    er::Stats earlier_{};   // of connections replaced by serve
+};
+
+// ---- serve: one JSON request per stdin line, one JSON response per stdout line ----
+
+static const char* errc_name(er::Errc c) noexcept {
+    switch (c) {
+    case er::Errc::kOk: return "ok";
+    case er::Errc::kInvalidArg: return "invalid_arg";
+    case er::Errc::kRedisIo: return "redis_io";
+    case er::Errc::kRedisProtocol: return "redis_protocol";
+    case er::Errc::kRedisReplyType: return "redis_reply_type";
+    case er::Errc::kNotFound: return "not_found";
+    case er::Errc::kTimeout: return "timeout";
+    case er::Errc::kInternal: return "internal";
+    }
+    return "internal";
+}
+
+using Fields = er::Result<std::string>;   // response members after "ok":true
+
+static Fields bad_request(std::string msg) {
+    return Fields::err(er::Errc::kInvalidArg, std::move(msg));
+}
+
+static const std::string* json_string(const er::json::Value& req, std::string_view field) {
+    const auto* v = req.find(field);
+    return (v && v->kind == er::json::Value::Kind::kString) ? &v->string : nullptr;
+}
+
+// Optional field: absent or null gives def, anything but a bool of the right type is an error.
+static er::Result<bool> json_flag(const er::json::Value& req, std::string_view field, bool def) {
+    const auto* v = req.find(field);
+    if (!v || v->is_null()) return er::Result<bool>::ok(def);
+    if (v->kind != er::json::Value::Kind::kBool)
+        return er::Result<bool>::err(er::Errc::kInvalidArg, std::string(field) + " must be a bool");
+    return er::Result<bool>::ok(v->boolean);
+}
+
+static er::Result<std::int64_t> json_int(const er::json::Value& req, std::string_view field, std::int64_t def,
+                                         std::int64_t lo, std::int64_t hi) {
+    const auto* v = req.find(field);
+    if (!v || v->is_null()) return er::Result<std::int64_t>::ok(def);
+    auto n = v->integer(lo, hi);
+    if (!n) {
+        return er::Result<std::int64_t>::err(er::Errc::kInvalidArg, std::string(field) + " must be an integer in " +
+                                                 std::to_string(lo) + ".." + std::to_string(hi));
+    }
+    return er::Result<std::int64_t>::ok(*n);
+}
+
+static er::Result<std::vector<std::size_t>> json_bits(const er::json::Value& req) {
+    using R = er::Result<std::vector<std::size_t>>;
+    const auto* v = req.find("bits");
+    if (!v || v->kind != er::json::Value::Kind::kArray || v->items.empty())
+        return R::err(er::Errc::kInvalidArg, "bits must be a non-empty array");
+    std::vector<std::size_t> bits;
+    bits.reserve(v->items.size());
+    for (const auto& item : v->items) {
+        auto b = item.integer(0, static_cast<std::int64_t>(er::Flags4096::kBits) - 1);
+        if (!b) return R::err(er::Errc::kInvalidArg, "bits must be integers in 0..4095");
+        bits.push_back(static_cast<std::size_t>(*b));
+    }
+    return R::ok(std::move(bits));
+}
+
+// {"expr": "<query expr>"} or {"shape": "find_all", "bits": [...]}
+static er::Result<er::query::Node> json_query(const er::json::Value& req) {
+    using R = er::Result<er::query::Node>;
+    if (const auto* expr = json_string(req, "expr")) return er::query::parse(*expr);
+    const auto* shape = json_string(req, "shape");
+    if (!shape || !is_find_no_store(*shape)) return R::err(er::Errc::kInvalidArg, "need expr, or shape (find_*) and bits");
+    auto bits = json_bits(req);
+    if (!bits) return R::err(bits.error().code, bits.error().msg);
+    if (*shape != "find" && *shape != "find_universe_not" && bits.value().size() < 2)
+        return R::err(er::Errc::kInvalidArg, *shape + " needs at least 2 bits");
+    return R::ok(er::query::normalize(find_node(*shape, bits.value())));
+}
+
+static void append_names(std::string& out, const std::vector<std::string>& names) {
+    out.push_back('[');
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        if (i) out.push_back(',');
+        er::json::append_string(out, names[i]);
+    }
+    out.push_back(']');
+}
+
+static Fields serve_request(er::RedisClient& r, const Invocation& inv, er::query::Hybrid* hybrid,
+                            const er::json::Value& req) {
+    const auto* op_field = json_string(req, "op");
+    if (!op_field) return bad_request("missing op");
+    const std::string_view op = *op_field;
+    std::string out;
+
+    if (op == "ping") {
+        if (auto ok = r.ping(); !ok) return Fields::err(ok.error().code, ok.error().msg);
+        return Fields::ok(std::move(out));
+    }
+
+    if (op == "put") {
+        const auto* name = json_string(req, "name");
+        if (!name) return bad_request("put needs name");
+        auto bits = json_bits(req);
+        if (!bits) return Fields::err(bits.error().code, bits.error().msg);
+        auto e = er::Element::create(*name);
+        if (!e) return Fields::err(e.error().code, e.error().msg);
+        er::Element el = std::move(e).value();
+        for (auto b : bits.value()) (void)el.flags().set(b);
+        if (auto ok = r.upsert_element(el.name(), el.flags(), inv.backend, inv.prefix); !ok)
+            return Fields::err(ok.error().code, ok.error().msg);
+        out.append("\"key\":");
+        er::json::append_string(out, key_for(*name, inv.prefix));
+        return Fields::ok(std::move(out));
+    }
+
+    if (op == "get") {
+        const auto* name = json_string(req, "name");
+        if (!name) return bad_request("get needs name");
+        auto flags = r.element_flags(*name, inv.prefix);
+        if (!flags) return Fields::err(flags.error().code, flags.error().msg);
+        out.append("\"bits\":[");
+        bool first = true;
+        for (auto b : flags.value().bits()) {
+            if (!first) out.push_back(',');
+            first = false;
+            out.append(std::to_string(b));
+        }
+        out.push_back(']');
+        return Fields::ok(std::move(out));
+    }
+
+    if (op == "del") {
+        const auto* name = json_string(req, "name");
+        if (!name) return bad_request("del needs name");
+        auto force = json_flag(req, "force", false);
+        if (!force) return Fields::err(force.error().code, force.error().msg);
+        auto found = delete_element(r, inv.backend, inv.prefix, *name, force.value());
+        if (!found) return Fields::err(found.error().code, found.error().msg);
+        out.append(found.value() ? "\"found\":true" : "\"found\":false");
+        return Fields::ok(std::move(out));
+    }
+
+    if (op == "query") {
+        auto node = json_query(req);
+        if (!node) return Fields::err(node.error().code, node.error().msg);
+        auto count_only = json_flag(req, "count", inv.count_only);
+        if (!count_only) return Fields::err(count_only.error().code, count_only.error().msg);
+        auto limit = json_int(req, "limit", static_cast<std::int64_t>(inv.limit), 0, INT64_MAX);
+        if (!limit) return Fields::err(limit.error().code, limit.error().msg);
+
+        const auto lim = static_cast<std::size_t>(limit.value());
+        if (hybrid) {
+            if (count_only.value()) {
+                auto n = hybrid->count(r, node.value(), lim);
+                if (!n) return Fields::err(n.error().code, n.error().msg);
+                out.append("\"count\":" + std::to_string(n.value()));
+                return Fields::ok(std::move(out));
+            }
+            auto members = hybrid->members(r, node.value(), lim);
+            if (!members) return Fields::err(members.error().code, members.error().msg);
+            out.append("\"count\":" + std::to_string(members.value().size()) + ",\"members\":");
+            append_names(out, members.value());
+            return Fields::ok(std::move(out));
+        }
+        const auto plan = er::query::compile(node.value(), inv.prefix);
+        const bool bitmap = (inv.backend == er::IndexBackend::kBitmap);
+        if (count_only.value()) {
+            auto n = bitmap ? er::BitmapIndex(r, inv.prefix).count(plan, lim) : er::query::count(r, plan, lim, inv.prefix);
+            if (!n) return Fields::err(n.error().code, n.error().msg);
+            out.append("\"count\":" + std::to_string(n.value()));
+            return Fields::ok(std::move(out));
+        }
+        auto members = bitmap ? er::BitmapIndex(r, inv.prefix).members(plan, lim)
+                              : er::query::members(r, plan, lim, inv.prefix);
+        if (!members) return Fields::err(members.error().code, members.error().msg);
+        out.append("\"count\":" + std::to_string(members.value().size()) + ",\"members\":");
+        append_names(out, members.value());
+        return Fields::ok(std::move(out));
+    }
+
+    if (op == "store") {
+        auto node = json_query(req);
+        if (!node) return Fields::err(node.error().code, node.error().msg);
+        auto ttl = json_int(req, "ttl", 0, 1, INT32_MAX);
+        if (!ttl || ttl.value() == 0) return bad_request("store needs ttl (seconds > 0)");
+        auto no_cache = json_flag(req, "no_cache", inv.no_cache);
+        if (!no_cache) return Fields::err(no_cache.error().code, no_cache.error().msg);
+
+        Invocation opts = inv;
+        opts.no_cache = no_cache.value();
+        if (const auto* into = json_string(req, "into")) opts.into = *into;
+        auto stored = store_node(r, opts, "serve", node.value(), static_cast<int>(ttl.value()));
+        if (!stored) return Fields::err(stored.error().code, stored.error().msg);
+        out.append("\"key\":");
+        er::json::append_string(out, stored.value().key);
+        out.append(",\"count\":" + std::to_string(stored.value().count));
+        return Fields::ok(std::move(out));
+    }
+
+    if (op == "release") {
+        const auto* key = json_string(req, "key");
+        if (!key) return bad_request("release needs key");
+        const std::string_view k(*key);
+        auto n = er::query::release(r, std::span<const std::string_view>(&k, 1), inv.prefix);
+        if (!n) return Fields::err(n.error().code, n.error().msg);
+        out.append("\"released\":" + std::to_string(n.value()));
+        return Fields::ok(std::move(out));
+    }
+
+    if (op == "similar") {
+        const auto* name = json_string(req, "name");
+        if (!name) return bad_request("similar needs name");
+        auto k = json_int(req, "k", 10, 1, INT32_MAX);
+        if (!k) return Fields::err(k.error().code, k.error().msg);
+        er::Metric metric = er::Metric::kJaccard;
+        if (const auto* m = json_string(req, "metric")) {
+            auto parsed = er::parse_metric(*m);
+            if (!parsed) return Fields::err(parsed.error().code, parsed.error().msg);
+            metric = parsed.value();
+        }
+        auto flags = r.element_flags(*name, inv.prefix);
+        if (!flags) return Fields::err(flags.error().code, flags.error().msg);
+        auto matches = er::similar(r, flags.value(), static_cast<std::size_t>(k.value()), metric, *name, inv.backend,
+                                    inv.prefix);
+        if (!matches) return Fields::err(matches.error().code, matches.error().msg);
+        out.append("\"matches\":[");
+        for (std::size_t i = 0; i < matches.value().size(); ++i) {
+            const auto& m = matches.value()[i];
+            if (i) out.push_back(',');
+            out.append("{\"name\":");
+            er::json::append_string(out, m.name);
+            out.append(",\"score\":");
+            er::json::append_number(out, m.score);
+            out.push_back('}');
+        }
+        out.push_back(']');
+        return Fields::ok(std::move(out));
+    }
+
+    if (op == "refresh") {
+        if (!hybrid) return bad_request("refresh needs serve --hybrid");
+        if (auto ok = hybrid->refresh(r); !ok) return Fields::err(ok.error().code, ok.error().msg);
+        out.append("\"rows\":" + std::to_string(hybrid->snapshot_size()));
+        return Fields::ok(std::move(out));
+    }
+
+    return bad_request("unknown op: " + std::string(op));
+}
+
+// serve: newline-delimited JSON on stdin/stdout over one warm connection.
+// Request:  {"id": <any>, "op": "ping|put|get|del|query|store|similar|stats|refresh", ...}
+// Response: {"id": <same>, "ok": true, ...} or {"id": ..., "ok": false, "error": {"code", "message"}}
+// A connection lost mid-request is re-established before the next one. Exits 0 on EOF.
+static int cmd_serve(er::RedisClient& r, const Invocation& inv, StatsReport& report) {
+    std::ios::sync_with_stdio(false);
+    std::unique_ptr<er::query::Hybrid> hybrid;
+    if (inv.hybrid > 0) {
+        if (inv.backend != er::IndexBackend::kSet) {
+            std::cerr << "ERROR: --hybrid supports only --backend set\n";
+            return 1;
+        }
+        er::query::HybridOptions opts;
+        opts.snapshot_rows = inv.hybrid;
+        hybrid = std::make_unique<er::query::Hybrid>(opts, inv.prefix);
+        if (auto ok = hybrid->refresh(r); !ok) {
+            std::cerr << "SNAPSHOT load failed: " << ok.error().msg << "\n";
+            return 16;
+        }
+    }
+    bool connected = true;
+    std::string line;
+    std::string resp;
+    while (std::getline(std::cin, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+
+        resp.assign("{\"id\":");
+        Fields fields = Fields::ok({});
+        auto req = er::json::parse(line);
+        if (!req) {
+            resp.append("null");
+            fields = Fields::err(req.error().code, req.error().msg);
+        } else {
+            const auto* id = req.value().find("id");
+            if (id) er::json::append(resp, *id);
+            else resp.append("null");
+
+            if (req.value().kind != er::json::Value::Kind::kObject) {
+                fields = bad_request("request must be an object");
+            } else {
+                const auto* op = json_string(req.value(), "op");
+                if (!connected && !(op && *op == "stats")) {
+                    auto rc = er::RedisClient::connect(inv.host, inv.port);
+                    if (rc) {
+                        report.carry();
+                        r = std::move(rc).value();
+                        report.resume();
+                        connected = true;
+                    } else {
+                        fields = Fields::err(rc.error().code, rc.error().msg);
+                    }
+                }
+                if (op && *op == "stats") {
+                    // {"stats": {...}} with --stats, {"stats": null} without
+                    std::string out("\"stats\":");
+                    if (report.enabled()) report.totals().append_json(out);
+                    else out.append("null");
+                    fields = Fields::ok(std::move(out));
+                } else if (connected) {
+                    fields = serve_request(r, inv, hybrid.get(), req.value());
+                }
+                if (!fields && fields.error().code == er::Errc::kRedisIo) connected = false;
+            }
+        }
+
+        if (fields) {
+            resp.append(",\"ok\":true");
+            if (!fields.value().empty()) {
+                resp.push_back(',');
+                resp.append(fields.value());
+            }
+        } else {
+            resp.append(",\"ok\":false,\"error\":{\"code\":");
+            er::json::append_string(resp, errc_name(fields.error().code));
+            resp.append(",\"message\":");
+            er::json::append_string(resp, fields.error().msg);
+            resp.push_back('}');
+        }
+        resp.append("}\n");
+        std::cout << resp << std::flush;
+    }
+    return 0;
+}
+
+// --shards: put / get / query / find_* on a ShardedIndex, same output as the
+// single-node commands.
+static int cmd_sharded(const Invocation& inv, std::string_view op, int argc, char** argv) {
+    if (inv.backend != er::IndexBackend::kSet) {
+        std::cerr << "ERROR: --shards supports only --backend set\n";
+        return 1;
+    }
+    if (op != "put" && op != "get" && op != "query" && !is_find_no_store(op)) {
+        std::cerr << "ERROR: " << op << " is not supported with --shards\n";
+        return 1;
+    }
+    if (argc < 2 || (op == "put" && argc < 3)) { usage(); return 1; }
+
+    auto idx_res = er::ShardedIndex::connect({inv.host, inv.port}, inv.shards, 2, inv.prefix);
+    if (!idx_res) {
+        std::cerr << "Redis connect failed: " << idx_res.error().msg << "\n";
+        return 2;
+    }
+    er::ShardedIndex idx = std::move(idx_res).value();
+    const std::string name = argv[1];
+
+    if (op == "put") {
+        er::Flags4096 f;
+        for (int i = 2; i < argc; ++i) {
+            auto bit = parse_bit_arg(argv[i]);
+            if (!bit) { std::cerr << "ERROR: " << bit.error().msg << "\n"; return 1; }
+            if (auto ok = f.set(bit.value()); !ok) { std::cerr << "ERROR: " << ok.error().msg << "\n"; return 1; }
+        }
+        if (auto ok = idx.put(name, f); !ok) {
+            std::cerr << "PUT failed: " << ok.error().msg << "\n";
+            return 3;
+        }
+        std::cout << "OK: stored " << er::keys::element(name, idx.shard_prefix(idx.shard_of(name)))
+                  << " and updated index\n";
+        return 0;
+    }
+
+    if (op == "get") {
+        auto f = idx.get(name);
+        if (!f) {
+            if (f.error().code == er::Errc::kNotFound) std::cerr << "Missing element (no flags_bin/flags_hex)\n";
+            else std::cerr << "GET failed: " << f.error().msg << "\n";
+            return 4;
+        }
+        std::cout << "Key: " << er::keys::element(name, idx.shard_prefix(idx.shard_of(name))) << "\n";
+        std::cout << "bit42: " << f.value().test(42).value() << "\n";
+        std::cout << "bit4095: " << f.value().test(4095).value() << "\n";
+        return 0;
+    }
+
+    er::Result<er::query::Node> node = er::Result<er::query::Node>::err(er::Errc::kInvalidArg, "");
+    if (op == "query") {
+        std::string expr;
+        for (int i = 1; i < argc; ++i) {
+            if (!expr.empty()) expr += ' ';
+            expr += argv[i];
+        }
+        node = er::query::parse(expr);
+    } else {
+        node = find_node(op, argc, argv);
+    }
+    if (!node) { std::cerr << "ERROR: " << node.error().msg << "\n"; return 1; }
+    const auto root = er::query::normalize(std::move(node).value());
+
+    if (inv.count_only) {
+        auto n = idx.count(root, inv.total ? 0 : inv.limit);
+        if (!n) { std::cerr << "QUERY failed: " << n.error().msg << "\n"; return 15; }
+        std::cout << "Count: " << n.value() << "\n";
+        return 0;
+    }
+    auto members = idx.members(root, inv.limit);
+    if (!members) { std::cerr << "QUERY failed: " << members.error().msg << "\n"; return 15; }
+    long long n = static_cast<long long>(members.value().size());
+    if (inv.total && inv.limit > 0 && members.value().size() >= inv.limit) {
+        auto total = idx.count(root);
+        if (!total) { std::cerr << "QUERY failed: " << total.error().msg << "\n"; return 15; }
+        n = total.value();
+    }
+    print_members("Query " + std::string(op) + " (" + std::to_string(idx.shards()) + " shards)", members.value(), n);
+    return 0;
+}
+
 static std::string env_string(const char* name, const std::string& def) {
     const char* v = std::getenv(name);
     if (!v || !*v) return def;
@@ -168,17 +1190,28 @@ static bool env_truthy(const char* name) {
     return s == "1" || s == "true" || s == "TRUE" || s == "yes" || s == "YES";
 }
 
-struct Invocation {
-    std::string host;
-    int port = 6379;
-    bool keys_only = false;
-    bool help = false;
-    int cmd_index = 1;
-};
+static bool parse_backend(std::string_view v, er::IndexBackend& out) noexcept {
+    if (v == "set") { out = er::IndexBackend::kSet; return true; }
+    if (v == "bitmap") { out = er::IndexBackend::kBitmap; return true; }
+    return false;
+}
+
+static bool parse_shards(std::string_view v, std::size_t& out) noexcept {
+    auto [ptr, ec] = std::from_chars(v.data(), v.data() + v.size(), out);
+    return !v.empty() && ec == std::errc() && ptr == v.data() + v.size() && out > 0 && out <= 16384;
+}
 
 static Invocation parse_invocation(int argc, char** argv) {
     Invocation inv;
     inv.keys_only = env_truthy("ER_KEYS_ONLY");
+    inv.no_cache = env_truthy("ER_NO_CACHE");
+    if (const char* b = std::getenv("ER_INDEX_BACKEND"); b && *b && !parse_backend(b, inv.backend)) {
+        inv.error = std::string("invalid ER_INDEX_BACKEND: ") + b + " (set|bitmap)";
+    }
+    if (const char* n = std::getenv("ER_SHARDS"); n && *n && !parse_shards(n, inv.shards)) {
+        inv.error = std::string("invalid ER_SHARDS: ") + n;
+    }
+    inv.prefix = env_string("ER_PREFIX", inv.prefix);
     inv.host = env_string("ER_REDIS_HOST", "localhost");
     inv.port = env_int("ER_REDIS_PORT", 6379);
 
@@ -189,6 +1222,78 @@ static Invocation parse_invocation(int argc, char** argv) {
             inv.keys_only = true;
             continue;
         }
+        if (arg == "--backend") {
+            const std::string_view v = (i + 1 < argc) ? std::string_view(argv[++i]) : std::string_view();
+            if (!parse_backend(v, inv.backend)) {
+                inv.error = "invalid --backend: " + std::string(v) + " (set|bitmap)";
+                inv.cmd_index = argc;
+                return inv;
+            }
+            continue;
+        }
+        if (arg == "--no-cache") {
+            inv.no_cache = true;
+            continue;
+        }
+        if (arg == "--count") {
+            inv.count_only = true;
+            continue;
+        }
+        if (arg == "--total") {
+            inv.total = true;
+            continue;
+        }
+        if (arg == "--into") {
+            if (i + 1 >= argc || argv[i + 1][0] == '\0') {
+                inv.error = "--into needs a key";
+                inv.cmd_index = argc;
+                return inv;
+            }
+            inv.into = argv[++i];
+            continue;
+        }
+        if (arg == "--stats") {
+            inv.stats = true;
+            continue;
+        }
+        if (arg == "--shards") {
+            const std::string_view v = (i + 1 < argc) ? std::string_view(argv[++i]) : std::string_view();
+            if (!parse_shards(v, inv.shards)) {
+                inv.error = "invalid --shards: " + std::string(v);
+                inv.cmd_index = argc;
+                return inv;
+            }
+            continue;
+        }
+        if (arg == "--prefix") {
+            if (i + 1 >= argc) {
+                inv.error = "--prefix needs a value";
+                inv.cmd_index = argc;
+                return inv;
+            }
+            inv.prefix = argv[++i];
+            continue;
+        }
+        if (arg == "--hybrid") {
+            const std::string_view v = (i + 1 < argc) ? std::string_view(argv[++i]) : std::string_view();
+            auto [ptr, ec] = std::from_chars(v.data(), v.data() + v.size(), inv.hybrid);
+            if (v.empty() || ec != std::errc() || ptr != v.data() + v.size() || inv.hybrid == 0) {
+                inv.error = "invalid --hybrid: " + std::string(v);
+                inv.cmd_index = argc;
+                return inv;
+            }
+            continue;
+        }
+        if (arg == "--limit") {
+            const std::string_view v = (i + 1 < argc) ? std::string_view(argv[++i]) : std::string_view();
+            auto [ptr, ec] = std::from_chars(v.data(), v.data() + v.size(), inv.limit);
+            if (v.empty() || ec != std::errc() || ptr != v.data() + v.size() || inv.limit == 0) {
+                inv.error = "invalid --limit: " + std::string(v);
+                inv.cmd_index = argc;
+                return inv;
+            }
+            continue;
+        }
         if (arg == "--help" || arg == "-h") {
             usage();
             inv.help = true;
@@ -208,6 +1313,8 @@ int main(int argc, char** argv) {
     Invocation inv = parse_invocation(argc, argv);
 
     if (inv.help) return 0;
+    if (!inv.error.empty()) { std::cerr << "ERROR: " << inv.error << "\n"; return 1; }
+    if (auto ns = er::Namespace::open(inv.prefix); !ns) { std::cerr << "ERROR: " << ns.error().msg << "\n"; return 1; }
     if (inv.cmd_index >= argc) { usage(); return 1; }
 
     const std::string op = argv[inv.cmd_index];
@@ -220,26 +1327,34 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    if (inv.shards > 0) return cmd_sharded(inv, op, cmd_argc, cmd_argv);
+
     auto rc = er::RedisClient::connect(inv.host, inv.port);
     if (!rc) {
         std::cerr << "Redis connect failed: " << rc.error().msg << "\n";
         return 2;
     }
     er::RedisClient r = std::move(rc).value();
+    StatsReport report(inv.stats ? &r : nullptr);
     if (auto ok = r.ping(); !ok) {
         std::cerr << "Redis PING failed: " << ok.error().msg << "\n";
         return 2;
     }
 
+    // ---- --count / --limit / bitmap backend for the no-store finds: one query script ----
+    if ((inv.count_only || inv.limit > 0 || inv.backend != er::IndexBackend::kSet) && is_find_no_store(op)) {
+            if (cmd_argc < 2) { usage(); return 1; }
+            auto node = find_node(op, cmd_argc, cmd_argv);
+            if (!node) { std::cerr << "ERROR: " << node.error().msg << "\n"; return 1; }
+            return print_query(r, inv, "Query " + op, er::query::compile(er::query::normalize(std::move(node).value()), inv.prefix));
+        }
+
     // ---- PUT ----
     if (op == "put") {
         if (cmd_argc < 3) { usage(); return 1; }
 
         const std::string name = cmd_argv[1];
-        const std::string key  = key_for(name);
-
-        er::Flags4096 oldf;
-        load_existing_flags(r, key, oldf);
+        const std::string key  = key_for(name, inv.prefix);
 
         auto e_res = er::Element::create(name);
         if (!e_res) {
@@ -260,22 +1375,9 @@ int main(int argc, char** argv) {
             }
         }
 
-        update_index_for_put(r, name, oldf, e.flags());
-
-        if (auto ok = r.hset(key, "name", std::string(e.name())); !ok) {
-            std::cerr << "HSET name failed: " << ok.error().msg << "\n";
-            return 3;
-        }
-
-        const auto bytes = e.flags().to_bytes_be();
-        if (auto ok = r.hset_bin(key, "flags_bin", bytes.data(), bytes.size()); !ok) {
-            std::cerr << "HSET flags_bin failed: " << ok.error().msg << "\n";
-            return 3;
-        }
-            
-        // maintain universe set for NOT queries
-        if (auto ok = r.sadd(er::keys::universe(), name); !ok) {
-            std::cerr << "SADD er:all failed: " << ok.error().msg << "\n";
+        // index delta + element hash + universe (er:all) in one atomic script
+        if (auto ok = r.upsert_element(e.name(), e.flags(), inv.backend, inv.prefix); !ok) {
+            std::cerr << "PUT failed: " << ok.error().msg << "\n";
             return 3;
         }
 
@@ -283,12 +1385,21 @@ int main(int argc, char** argv) {
         return 0;
     }
 
+    // ---- LOAD (bulk) ----
+    if (op == "load") {
+        std::ios::sync_with_stdio(false);
+        return cmd_load(r, inv, cmd_argc, cmd_argv);
+    }
+    if (op == "export") return cmd_export(r, inv, cmd_argc, cmd_argv);
+    if (op == "import") return cmd_import(r, inv, cmd_argc, cmd_argv);
+    if (op == "bitstats") return cmd_bitstats(r, inv, cmd_argc, cmd_argv);
+
     // ---- GET ----
     if (op == "get") {
             if (cmd_argc < 2) { usage(); return 1; }
 
             const std::string name = cmd_argv[1];
-            const std::string key  = key_for(name);
+            const std::string key  = key_for(name, inv.prefix);
 
             er::Flags4096 f;
             if (!load_existing_flags(r, key, f)) {
@@ -312,27 +1423,11 @@ int main(int argc, char** argv) {
     if (op == "del") {
             if (cmd_argc < 2) { usage(); return 1; }
             const std::string name = cmd_argv[1];
-            const std::string key  = key_for(name);
-
             const bool force = (cmd_argc >= 3 && std::string(cmd_argv[2]) == "--force");
 
-            er::Flags4096 f;
-            const bool have_flags = load_existing_flags(r, key, f);
-
-            if (have_flags) {
-                for (auto b : f.set_bits()) {
-                    (void)r.srem(idx_key_for_bit(b), name);
-                }
-            } else if (force) {
-                for (std::size_t b = 0; b < 4096; ++b) {
-                    (void)r.srem(idx_key_for_bit(b), name);
-                }
-            }
-
-            (void)r.srem(er::keys::universe(), name);
-            (void)r.del_key(key);
-
-            if (!have_flags && !force) {
+            auto found = delete_element(r, inv.backend, inv.prefix, name, force);
+            if (!found) { std::cerr << found.error().msg << "\n"; return 5; }
+            if (!found.value() && !force) {
                 std::cerr << "WARN: element missing; pass --force to scrub all 4096 indexes\n";
             }
             std::cout << "OK: deleted " << name << "\n";
@@ -346,7 +1441,7 @@ int main(int argc, char** argv) {
             if (!bit) { std::cerr << "ERROR: " << bit.error().msg << "\n"; return 1; }
             const std::size_t b = bit.value();
 
-            const std::string idx = idx_key_for_bit(b);
+            const std::string idx(idx_key_for_bit(b, inv.prefix));
             auto members = r.smembers(idx);
             if (!members) { std::cerr << "SMEMBERS failed: " << members.error().msg << "\n"; return 6; }
             print_members("Index: " + idx, members.value());
@@ -356,7 +1451,7 @@ int main(int argc, char** argv) {
     // ---- FIND_ALL (no store) ----
     if (op == "find_all") {
             if (cmd_argc < 3) { usage(); return 1; }
-            auto idx_keys = build_idx_keys_from_bits(cmd_argc, cmd_argv, 1);
+            auto idx_keys = build_idx_keys_from_bits(cmd_argc, cmd_argv, 1, inv.prefix);
             if (!idx_keys) { std::cerr << "ERROR: " << idx_keys.error().msg << "\n"; return 1; }
 
             auto members = r.sinter(idx_keys.value());
@@ -368,7 +1463,7 @@ int main(int argc, char** argv) {
     // ---- FIND_ANY (no store) ----
     if (op == "find_any") {
             if (cmd_argc < 3) { usage(); return 1; }
-            auto idx_keys = build_idx_keys_from_bits(cmd_argc, cmd_argv, 1);
+            auto idx_keys = build_idx_keys_from_bits(cmd_argc, cmd_argv, 1, inv.prefix);
             if (!idx_keys) { std::cerr << "ERROR: " << idx_keys.error().msg << "\n"; return 1; }
 
             auto members = r.sunion(idx_keys.value());
@@ -383,12 +1478,12 @@ int main(int argc, char** argv) {
             auto include_bit = parse_bit_arg(cmd_argv[1]);
             if (!include_bit) { std::cerr << "ERROR: " << include_bit.error().msg << "\n"; return 1; }
 
-            std::vector<std::string> idx_keys;
-            idx_keys.push_back(idx_key_for_bit(include_bit.value()));
+            std::vector<std::string_view> idx_keys;
+            idx_keys.push_back(idx_key_for_bit(include_bit.value(), inv.prefix));
             for (int i = 2; i < cmd_argc; ++i) {
                 auto bit = parse_bit_arg(cmd_argv[i]);
                 if (!bit) { std::cerr << "ERROR: " << bit.error().msg << "\n"; return 1; }
-                idx_keys.push_back(idx_key_for_bit(bit.value()));
+                idx_keys.push_back(idx_key_for_bit(bit.value(), inv.prefix));
             }
 
             auto members = r.sdiff(idx_keys);
@@ -401,12 +1496,12 @@ int main(int argc, char** argv) {
     if (op == "find_universe_not") {
             if (cmd_argc < 2) { usage(); return 1; }
 
-            std::vector<std::string> keys;
-            keys.push_back(er::keys::universe());
+            std::vector<std::string_view> keys;
+            keys.push_back(er::keys::KeyTable::of(inv.prefix).universe());
             for (int i = 1; i < cmd_argc; ++i) {
                 auto bit = parse_bit_arg(cmd_argv[i]);
                 if (!bit) { std::cerr << "ERROR: " << bit.error().msg << "\n"; return 1; }
-                keys.push_back(idx_key_for_bit(bit.value()));
+                keys.push_back(idx_key_for_bit(bit.value(), inv.prefix));
             }
 
             auto members = r.sdiff(keys);
@@ -422,32 +1517,18 @@ int main(int argc, char** argv) {
             auto include_bit = parse_bit_arg(cmd_argv[1]);
             if (!include_bit) { std::cerr << "ERROR: " << include_bit.error().msg << "\n"; return 1; }
 
-            // tmp = er:all \ excludes
-            std::vector<std::string> diff_keys;
-            diff_keys.push_back(er::keys::universe());
+            // include ∩ (er:all \ excludes) == include \ excludes: one server-side SDIFF
+            std::vector<std::string_view> diff_keys;
+            diff_keys.push_back(idx_key_for_bit(include_bit.value(), inv.prefix));
             for (int i = 2; i < cmd_argc; ++i) {
                 auto bit = parse_bit_arg(cmd_argv[i]);
                 if (!bit) { std::cerr << "ERROR: " << bit.error().msg << "\n"; return 1; }
-                diff_keys.push_back(idx_key_for_bit(bit.value()));
+                diff_keys.push_back(idx_key_for_bit(bit.value(), inv.prefix));
             }
 
-            auto universe_minus = r.sdiff(diff_keys);
-            if (!universe_minus) { std::cerr << "SDIFF failed: " << universe_minus.error().msg << "\n"; return 9; }
-
-            // intersect with include
-            // NOTE: hiredis/Redis nema SINTER između "virtual list" i seta bez store,
-            // pa radimo: members(include_set) ∩ (universe_minus) lokalno.
-            auto include_members = r.smembers(idx_key_for_bit(include_bit.value()));
-            if (!include_members) { std::cerr << "SMEMBERS failed: " << include_members.error().msg << "\n"; return 6; }
-
-            std::unordered_set<std::string> allow(universe_minus.value().begin(), universe_minus.value().end());
-            std::vector<std::string> out;
-            out.reserve(include_members.value().size());
-            for (auto& m : include_members.value()) {
-                if (allow.find(m) != allow.end()) out.push_back(m);
-            }
-
-            print_members("Query ALL NOT (include ∩ (er:all \\ excludes))", out);
+            auto members = r.sdiff(diff_keys);
+            if (!members) { std::cerr << "SDIFF failed: " << members.error().msg << "\n"; return 9; }
+            print_members("Query ALL NOT (include \\ excludes)", members.value());
             return 0;
         }
 
@@ -463,106 +1544,68 @@ int main(int argc, char** argv) {
                 return 1;
             }
 
-
             auto ttl = parse_ttl_arg(cmd_argv[1]);
             if (!ttl) { std::cerr << "ERROR: " << ttl.error().msg << "\n"; return 1; }
-            const int ttl_sec = ttl.value();
-
-            std::string tmp_key;
-
-            if (op == "find_all_store") {
-                // args: ttl bit1 bit2 ...
-                auto idx_keys = build_idx_keys_from_bits(cmd_argc, cmd_argv, 2);
-                if (!idx_keys) { std::cerr << "ERROR: " << idx_keys.error().msg << "\n"; return 1; }
-                if (idx_keys.value().size() < 2) { usage(); return 1; }
-                tmp_key = make_tmp_key("and", ttl_sec);
-                auto ok_store = r.store_all_expire_lua(ttl_sec, idx_keys.value(), tmp_key);
-                if (!ok_store) { std::cerr << "STORE+EXPIRE failed: " << ok_store.error().msg << "\n"; return 11; }
-            } else if (op == "find_any_store") {
-                auto idx_keys = build_idx_keys_from_bits(cmd_argc, cmd_argv, 2);
-                if (!idx_keys) { std::cerr << "ERROR: " << idx_keys.error().msg << "\n"; return 1; }
-                if (idx_keys.value().size() < 2) { usage(); return 1; }
-                tmp_key = make_tmp_key("or", ttl_sec);
-                auto ok_store = r.store_any_expire_lua(ttl_sec, idx_keys.value(), tmp_key);
-                if (!ok_store) { std::cerr << "STORE+EXPIRE failed: " << ok_store.error().msg << "\n"; return 11; }
-            } else if (op == "find_universe_not_store") {
-                // args: ttl exclude1 exclude2 ...
-                std::vector<std::string> set_keys;
-                set_keys.reserve(static_cast<std::size_t>(cmd_argc - 2));
-                for (int i = 2; i < cmd_argc; ++i) {
-                    auto bit = parse_bit_arg(cmd_argv[i]);
-                    if (!bit) { std::cerr << "ERROR: " << bit.error().msg << "\n"; return 1; }
-                    set_keys.push_back(idx_key_for_bit(bit.value()));
-                }
-                tmp_key = make_tmp_key("unot", ttl_sec);
-                // universe \ excludes
-                auto ok_store = r.store_not_expire_lua(ttl_sec, er::keys::universe(), set_keys, tmp_key);
-                if (!ok_store) { std::cerr << "STORE+EXPIRE failed: " << ok_store.error().msg << "\n"; return 11; }
-
-            } else if (op == "find_all_not_store") {
-                // args: ttl include exclude1 exclude2 ...
-                auto include_bit = parse_bit_arg(cmd_argv[2]);
-                if (!include_bit) { std::cerr << "ERROR: " << include_bit.error().msg << "\n"; return 1; }
-
-                std::vector<std::string> excludes;
-                excludes.reserve(static_cast<std::size_t>(cmd_argc - 3));
-                for (int i = 3; i < cmd_argc; ++i) {
-                    auto bit = parse_bit_arg(cmd_argv[i]);
-                    if (!bit) { std::cerr << "ERROR: " << bit.error().msg << "\n"; return 1; }
-                    excludes.push_back(idx_key_for_bit(bit.value()));
-                }
 
-                tmp_key = make_tmp_key("andnot", ttl_sec);
-                auto ok_store = r.store_all_not_expire_lua(
-                    ttl_sec,
-                    idx_key_for_bit(include_bit.value()),
-                    er::keys::universe(),
-                    excludes,
-                    tmp_key
-                );
-                if (!ok_store) { std::cerr << "STORE+EXPIRE failed: " << ok_store.error().msg << "\n"; return 11; }
-            } else { // find_not_store
-                // args: ttl include exclude1 ...
-                auto include_bit = parse_bit_arg(cmd_argv[2]);
-                if (!include_bit) { std::cerr << "ERROR: " << include_bit.error().msg << "\n"; return 1; }
-
-                std::vector<std::string> excludes;
-                excludes.reserve(static_cast<std::size_t>(cmd_argc - 3));
-                for (int i = 3; i < cmd_argc; ++i) {
-                    auto bit = parse_bit_arg(cmd_argv[i]);
-                    if (!bit) { std::cerr << "ERROR: " << bit.error().msg << "\n"; return 1; }
-                    excludes.push_back(idx_key_for_bit(bit.value()));
-                }
-                if (excludes.empty()) { usage(); return 1; }
-                tmp_key = make_tmp_key("not", ttl_sec);
-                auto ok_store = r.store_not_expire_lua(ttl_sec, idx_key_for_bit(include_bit.value()), excludes, tmp_key);
-                if (!ok_store) { std::cerr << "STORE+EXPIRE failed: " << ok_store.error().msg << "\n"; return 11; }
-            }
+            // same shapes as the no-store finds, args after the ttl
+            const std::string shape = op.substr(0, op.size() - std::string_view("_store").size());
+            auto node = find_node(shape, cmd_argc, cmd_argv, 2);
+            if (!node) { std::cerr << "ERROR: " << node.error().msg << "\n"; return 1; }
+            return store_query(r, inv, shape, er::query::normalize(std::move(node).value()), ttl.value());
+        }
 
-            if (inv.keys_only) {
-                std::cout << tmp_key << "\n";
-                return 0;
+    // ---- QUERY (boolean expression, one script call) ----
+    if (op == "query" || op == "query_store") {
+            const bool store = (op == "query_store");
+            const int first = store ? 2 : 1;
+            if (cmd_argc <= first) { usage(); return 1; }
+
+            // the expression may arrive as one quoted arg or split by the shell
+            std::string expr;
+            for (int i = first; i < cmd_argc; ++i) {
+                if (!expr.empty()) expr += ' ';
+                expr += cmd_argv[i];
             }
+            auto node = er::query::parse(expr);
+            if (!node) { std::cerr << "ERROR: " << node.error().msg << "\n"; return 1; }
+            if (!store) return print_query(r, inv, "Query: " + expr, er::query::compile(node.value(), inv.prefix));
 
-            // pokaži ključ + rezultate (možeš kasnije prebaciti da samo printa ključ)
-            auto members = r.smembers(tmp_key);
-            if (!members) { std::cerr << "SMEMBERS tmp_key failed: " << members.error().msg << "\n"; return 12; }
+            auto ttl = parse_ttl_arg(cmd_argv[1]);
+            if (!ttl) { std::cerr << "ERROR: " << ttl.error().msg << "\n"; return 1; }
+            return store_query(r, inv, "expr", node.value(), ttl.value());
+        }
 
-            std::cout << "TMP_KEY: " << tmp_key << " (ttl=" << ttl_sec << "s)\n";
-            print_members("Result:", members.value());
-            return 0;
+    // ---- SNAPSHOT (client-side scan) ----
+    if (op == "snapshot") {
+            if (cmd_argc < 3) { usage(); return 1; }
+            return cmd_snapshot(r, inv, cmd_argc, cmd_argv);
         }
 
+    // ---- SIMILAR (top-k by Jaccard / Hamming) ----
+    if (op == "similar") {
+            if (cmd_argc < 2) { usage(); return 1; }
+            return cmd_similar(r, inv, cmd_argc, cmd_argv);
+        }
+
+    // ---- SERVE (NDJSON requests on stdin) ----
+    if (op == "serve") return cmd_serve(r, inv, report);
+
         // ---- SHOW tmp set ----
         if (op == "show") {
             if (cmd_argc < 2) { usage(); return 1; }
-            const std::string k = cmd_argv[1];
-            auto members = r.smembers(k);
-            if (!members) { std::cerr << "SMEMBERS failed: " << members.error().msg << "\n"; return 13; }
-            print_members("SHOW: " + k, members.value());
-            return 0;
+            return cmd_show(r, cmd_argc, cmd_argv);
         }
 
+    // ---- RELEASE tmp keys ----
+    if (op == "release") {
+            if (cmd_argc < 2) { usage(); return 1; }
+            const std::vector<std::string_view> ks(cmd_argv + 1, cmd_argv + cmd_argc);
+            auto n = er::query::release(r, ks, inv.prefix);
+            if (!n) { std::cerr << "ERROR: " << n.error().msg << "\n"; return n.error().code == er::Errc::kInvalidArg ? 1 : 12; }
+            std::cout << "OK: released " << n.value() << "\n";
+        return 0;
+    }
+
     usage();
     return 1;
 }
@@ -660,16 +660,18 @@ async def query(req: QueryRequest, ns: str | None = None) -> dict[str, Any]:
     else:  # find_universe_not
         args = ["find_universe_not", *[str(b) for b in req.exclude_bits]]
 
-    count_from_cli, names = er_cli_query_with_count(
+    limit = int(req.limit)
+    # One er_cli run: only `limit` members, with the full cardinality as Count (--total).
+    count, names = er_cli_query_with_count(
         er_cli_path=settings.er_cli_path,
         redis_host=settings.redis_host,
         redis_port=settings.redis_port,
         redis_prefix=prefix,
-        args=args,
+        args=["--total", "--limit", str(limit), *args],
     )
-    limit = int(req.limit)
+    if count is None:
+        raise ApiError("ER_CLI_ERROR", "er_cli printed no Count", status_code=502)
     limited = names[:limit]
-    count = int(count_from_cli) if count_from_cli is not None else len(names)
     return ok({"ns": ns_id, "type": req.type, "count": count, "returned": len(limited), "limit": limit, "names": limited})
 
 
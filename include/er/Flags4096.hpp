@@ -1,26 +1,31 @@
 #pragma once
 
-#include <boost/multiprecision/cpp_int.hpp>
 #include <cstddef>
 #include <cstdint>
 #include <string>
 #include <string_view>
 #include <array>
+#include <bit>
+#include <iterator>
+#include <span>
 #include <vector>
 
 #include "er/result.hpp"
 
 namespace er {
 
-using uint4096 = boost::multiprecision::number<
-    boost::multiprecision::cpp_int_backend<
-        4096, 4096,
-        boost::multiprecision::unsigned_magnitude,
-        boost::multiprecision::unchecked,
-        void>>;
-
 class Flags4096 {
 public:
+    static constexpr std::size_t kBits = 4096;
+    static constexpr std::size_t kWords = kBits / 64;
+    static constexpr std::size_t kBytes = kBits / 8;
+
+    // Word 0 holds bits 0..63, word 63 holds bits 4032..4095.
+    using Words = std::array<std::uint64_t, kWords>;
+
+    class BitRange;
+    struct BitDelta;
+
     Flags4096();
 
     [[nodiscard]] Result<Unit> set(std::size_t bit) noexcept;
@@ -32,17 +37,107 @@ public:
     Flags4096 operator&(const Flags4096& other) const;
     Flags4096 operator^(const Flags4096& other) const;
 
+    // Set-bit counts with hardware popcount, without building the combined flags.
+    [[nodiscard]] std::size_t popcount() const noexcept;
+    [[nodiscard]] std::size_t and_count(const Flags4096& other) const noexcept;   // |a & b|
+    [[nodiscard]] std::size_t xor_count(const Flags4096& other) const noexcept;   // |a ^ b| (Hamming distance)
+
     std::string to_hex() const;
     static Result<Flags4096> from_hex(std::string_view hex) noexcept;
 
     std::array<std::uint8_t, 512> to_bytes_be() const;
+    // Serialize straight into a caller-provided 512-byte buffer (no temporary array).
+    void to_bytes_be(std::span<std::uint8_t, kBytes> out) const noexcept;
+
     static Result<Flags4096> from_bytes_be(const std::uint8_t* data, std::size_t len) noexcept;
+    static Result<Flags4096> from_bytes_be(std::span<const std::uint8_t> bytes) noexcept;
+    // Accepts any char buffer, e.g. a redisReply's str/len or an HGET result, without copying.
+    static Result<Flags4096> from_bytes_be(std::string_view bytes) noexcept;
 
     // index support
     [[nodiscard]] std::vector<std::size_t> set_bits() const;
+    // Ascending set-bit positions without allocating (countr_zero per set bit).
+    [[nodiscard]] BitRange bits() const noexcept;
+    // Word-wise delta: added = new & ~old, removed = old & ~new.
+    [[nodiscard]] static BitDelta diff(const Flags4096& old_flags, const Flags4096& new_flags) noexcept;
+
+    const Words& words() const noexcept { return words_; }
 
 private:
-    uint4096 value_;
+    // 64-byte aligned so the SIMD kernels can use aligned loads on every lane width.
+    alignas(64) Words words_{};
+};
+
+// Owns a copy of the words, so iterating `(a & b).bits()` or a BitDelta is always safe.
+class Flags4096::BitRange {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::size_t;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = std::size_t;
+
+        iterator() = default;
+
+        std::size_t operator*() const noexcept {
+            return word_index_ * 64 + static_cast<std::size_t>(std::countr_zero(word_));
+        }
+        iterator& operator++() noexcept {
+            word_ &= word_ - 1;
+            skip_empty();
+            return *this;
+        }
+        iterator operator++(int) noexcept {
+            iterator prev = *this;
+            ++*this;
+            return prev;
+        }
+        bool operator==(const iterator& other) const noexcept {
+            return word_index_ == other.word_index_ && word_ == other.word_;
+        }
+
+    private:
+        friend class BitRange;
+        iterator(const Words* words, std::size_t word_index) noexcept : words_(words), word_index_(word_index) {
+            if (word_index_ < kWords) {
+                word_ = (*words_)[word_index_];
+                skip_empty();
+            }
+        }
+        void skip_empty() noexcept {
+            while (word_ == 0 && ++word_index_ < kWords) word_ = (*words_)[word_index_];
+        }
+
+        const Words* words_{nullptr};
+        std::size_t word_index_{kWords};
+        std::uint64_t word_{0};
+    };
+
+    BitRange() = default;
+    explicit BitRange(const Words& words) noexcept : words_(words) {}
+
+    iterator begin() const noexcept { return iterator(&words_, 0); }
+    iterator end() const noexcept { return iterator(&words_, kWords); }
+
+    [[nodiscard]] bool empty() const noexcept {
+        for (auto w : words_) if (w != 0) return false;
+        return true;
+    }
+    [[nodiscard]] std::size_t count() const noexcept {
+        std::size_t n = 0;
+        for (auto w : words_) n += static_cast<std::size_t>(std::popcount(w));
+        return n;
+    }
+
+private:
+    alignas(64) Words words_{};
+};
+
+struct Flags4096::BitDelta {
+    BitRange added;
+    BitRange removed;
 };
 
 } // namespace er
@@ -2,17 +2,113 @@
 
 #include <memory>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <shared_mutex>
+#include <span>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <vector>
 #include <hiredis/hiredis.h>
 
+#include "er/Flags4096.hpp"
+#include "er/keys.hpp"
 #include "er/result.hpp"
+#include "er/stats.hpp"
 
 namespace er {
 
+namespace detail {
+
+struct ReplyDeleter {
+    void operator()(redisReply* r) const noexcept {
+        if (r) freeReplyObject(r);
+    }
+};
+
+using ReplyPtr = std::unique_ptr<redisReply, ReplyDeleter>;
+
+} // namespace detail
+
+// A Lua script with static storage. RedisClient loads it once (SCRIPT LOAD) and
+// runs it by SHA afterwards; `name` only shows up in error messages.
+struct LuaScript {
+    std::string_view name;
+    std::string_view source;
+};
+
+// Script SHAs shared by many connections (a pool, a Namespace): a connection that
+// finds a script here runs it by SHA straight away instead of sending SCRIPT LOAD
+// first. A SHA is the hash of the source, so a stale entry only costs the NOSCRIPT
+// reload a per-connection cache pays anyway. Thread-safe.
+class ScriptCache {
+public:
+    [[nodiscard]] std::optional<std::string> find(const LuaScript& script) const;
+    void put(const LuaScript& script, std::string sha);
+    void drop(const LuaScript& script) noexcept;
+    std::size_t size() const;
+
+private:
+    mutable std::shared_mutex mu_{};
+    std::unordered_map<const char*, std::string> shas_{};   // source address -> SHA1
+};
+
+// Where upsert_element keeps the per-bit postings (see er/bitmap_index.hpp).
+enum class IndexBackend {
+    kSet,      // er:idx:bit:N = SET of element names
+    kBitmap,   // er:bm:bit:N  = bitmap over dense element ids
+};
+
+struct UpsertResult {
+    long long bits_added{0};
+    long long bits_removed{0};
+    bool created{false};   // name was new to the universe set
+};
+
+struct DeleteResult {
+    bool found{false};           // stored flags decoded (the postings came from them)
+    long long bits_removed{0};   // postings the element was actually removed from
+    bool existed{false};         // the element hash was there
+};
+
+// Posting sizes from keys::idx_stats() / keys::bm_stats().
+struct IndexStats {
+    std::vector<long long> bits{};   // kBits entries, 0 for a field that is not there
+    long long universe{0};
+};
+
+// One CLUSTER SLOTS entry: hash slots [first, last] are served by host:port.
+struct SlotRange {
+    std::uint16_t first{0};
+    std::uint16_t last{0};
+    std::string host{};
+    int port{0};
+};
+
+// One CLIENT TRACKING invalidation: the keys written, or all when the server flushed
+// its data (FLUSHALL / FLUSHDB) or the message could not be kept.
+struct Invalidation {
+    bool all{false};
+    std::vector<std::string> keys{};
+};
+
+// One SSCAN page. cursor == 0 means the iteration is complete.
+struct ScanPage {
+    std::uint64_t cursor{0};
+    std::vector<std::string> members{};
+};
+
 class RedisClient {
 public:
+    static constexpr std::size_t kDefaultScanCount = 1000;
+
+    // Called once per member of a scan page; the view is only valid during the call.
+    using MemberFn = std::function<void(std::string_view)>;
+
+    class Pipeline;
+
     ~RedisClient();
 
     RedisClient(RedisClient&&) noexcept = default;
@@ -25,6 +121,9 @@ public:
 
     [[nodiscard]] Result<Unit> ping() noexcept;
 
+    // Batch commands into one write / one read pass (see Pipeline below).
+    [[nodiscard]] Pipeline pipeline() noexcept;
+
     // HASH
     [[nodiscard]] Result<long long> hset(std::string_view key, std::string_view field, std::string_view value) noexcept;
     [[nodiscard]] Result<std::string> hget(std::string_view key, std::string_view field) noexcept;
@@ -34,16 +133,31 @@ public:
                                              const void* data,
                                              std::size_t len) noexcept;
     [[nodiscard]] Result<std::string> hget_bin(std::string_view key, std::string_view field) noexcept;
+    // HGET of a 512-byte flags blob, decoded directly from the reply buffer.
+    [[nodiscard]] Result<Flags4096> hget_flags(std::string_view key, std::string_view field) noexcept;
 
     // SET basic
     [[nodiscard]] Result<long long> sadd(std::string_view key, std::string_view member) noexcept;
     [[nodiscard]] Result<long long> srem(std::string_view key, std::string_view member) noexcept;
     [[nodiscard]] Result<std::vector<std::string>> smembers(std::string_view key) noexcept;
 
+    // SET cursor iteration (SSCAN). Memory stays bounded by one page; `count` is a hint.
+    // Members added or removed during a full iteration may or may not be returned,
+    // and a member can be returned more than once (Redis SSCAN guarantees).
+    [[nodiscard]] Result<ScanPage> sscan(std::string_view key, std::uint64_t cursor,
+                                         std::size_t count = kDefaultScanCount) noexcept;
+    // Same page, delivered to fn straight from the reply buffer. Returns the next cursor.
+    [[nodiscard]] Result<std::uint64_t> sscan(std::string_view key, std::uint64_t cursor,
+                                              std::size_t count, const MemberFn& fn) noexcept;
+
     // SET composite (no-store)
     [[nodiscard]] Result<std::vector<std::string>> sinter(const std::vector<std::string>& keys) noexcept;
     [[nodiscard]] Result<std::vector<std::string>> sunion(const std::vector<std::string>& keys) noexcept;
     [[nodiscard]] Result<std::vector<std::string>> sdiff(const std::vector<std::string>& keys) noexcept;
+    // Same over borrowed keys, e.g. keys::KeyTable views: no key strings are built.
+    [[nodiscard]] Result<std::vector<std::string>> sinter(std::span<const std::string_view> keys) noexcept;
+    [[nodiscard]] Result<std::vector<std::string>> sunion(std::span<const std::string_view> keys) noexcept;
+    [[nodiscard]] Result<std::vector<std::string>> sdiff(std::span<const std::string_view> keys) noexcept;
 
     // STORE + EXPIRE
     [[nodiscard]] Result<Unit> expire_seconds(std::string_view key, int ttl_seconds) noexcept;
@@ -51,7 +165,10 @@ public:
     [[nodiscard]] Result<long long> sinterstore(std::string_view dst, const std::vector<std::string>& keys) noexcept;
     [[nodiscard]] Result<long long> sunionstore(std::string_view dst, const std::vector<std::string>& keys) noexcept;
     [[nodiscard]] Result<long long> sdiffstore(std::string_view dst, const std::vector<std::string>& keys) noexcept;
-    
+    [[nodiscard]] Result<long long> sinterstore(std::string_view dst, std::span<const std::string_view> keys) noexcept;
+    [[nodiscard]] Result<long long> sunionstore(std::string_view dst, std::span<const std::string_view> keys) noexcept;
+    [[nodiscard]] Result<long long> sdiffstore(std::string_view dst, std::span<const std::string_view> keys) noexcept;
+
     [[nodiscard]] Result<long long> store_expire_lua(std::string_view op,
                                                      std::string_view dst,
                                                      int ttl_seconds,
@@ -70,13 +187,135 @@ public:
                                                          const std::vector<std::string>& set_keys,
                                                          std::string_view out_key) noexcept;
 
+    // out = include \ excludes (same set as include ∩ (universe \ excludes), without the
+    // universe-sized intermediate).
     [[nodiscard]] Result<long long> store_all_not_expire_lua(int ttl_seconds,
                                                              std::string_view include_key,
-                                                             std::string_view universe_key,
                                                              const std::vector<std::string>& exclude_keys,
                                                              std::string_view out_key) noexcept;
 
+    // The store scripts over borrowed keys.
+    [[nodiscard]] Result<long long> store_expire_lua(std::string_view op,
+                                                     std::string_view dst,
+                                                     int ttl_seconds,
+                                                     std::span<const std::string_view> keys) noexcept;
+    [[nodiscard]] Result<long long> store_all_expire_lua(int ttl_seconds,
+                                                         std::span<const std::string_view> set_keys,
+                                                         std::string_view out_key) noexcept;
+    [[nodiscard]] Result<long long> store_any_expire_lua(int ttl_seconds,
+                                                         std::span<const std::string_view> set_keys,
+                                                         std::string_view out_key) noexcept;
+    [[nodiscard]] Result<long long> store_not_expire_lua(int ttl_seconds,
+                                                         std::string_view universe_key,
+                                                         std::span<const std::string_view> set_keys,
+                                                         std::string_view out_key) noexcept;
+    [[nodiscard]] Result<long long> store_all_not_expire_lua(int ttl_seconds,
+                                                             std::string_view include_key,
+                                                             std::span<const std::string_view> exclude_keys,
+                                                             std::string_view out_key) noexcept;
+
     [[nodiscard]] Result<long long> del_key(std::string_view key) noexcept;
+    // UNLINK of every key in one command: the server frees large values off its main
+    // thread. Returns how many existed.
+    [[nodiscard]] Result<long long> unlink_keys(std::span<const std::string_view> keys) noexcept;
+
+    // SCRIPTING (EVALSHA; SHA cached per connection)
+    [[nodiscard]] Result<long long> eval_integer(const LuaScript& script,
+                                                 const std::vector<std::string>& keys,
+                                                 const std::vector<std::string>& argv) noexcept;
+    [[nodiscard]] Result<std::vector<std::string>> eval_strings(const LuaScript& script,
+                                                                const std::vector<std::string>& keys,
+                                                                const std::vector<std::string>& argv) noexcept;
+    [[nodiscard]] Result<long long> eval_integer(const LuaScript& script,
+                                                 std::span<const std::string_view> keys,
+                                                 std::span<const std::string_view> argv) noexcept;
+    [[nodiscard]] Result<std::vector<std::string>> eval_strings(const LuaScript& script,
+                                                                std::span<const std::string_view> keys,
+                                                                std::span<const std::string_view> argv) noexcept;
+
+    // ELEMENT
+    // One atomic script: diff against the stored flags_bin, SADD/SREM the changed
+    // er:idx:bit:* postings, HSET name + flags_bin, SADD er:all, and bump the
+    // keys::idx_versions() fields it changed.
+    // With IndexBackend::kBitmap the postings are SETBITs on the element's id instead
+    // (allocated on first write).
+    // All keys are under prefix (see keys.hpp), e.g. a shard's "{er:s3}".
+    [[nodiscard]] Result<UpsertResult> upsert_element(std::string_view name,
+                                                      const Flags4096& flags,
+                                                      IndexBackend backend = IndexBackend::kSet,
+                                                      std::string_view prefix = keys::kPrefixDefault) noexcept;
+    // Same for many elements in one script call (one atomic batch): names[i] gets
+    // flags[i], results in input order. Keep batches to a few hundred elements: the
+    // server runs nothing else meanwhile.
+    [[nodiscard]] Result<std::vector<UpsertResult>> upsert_elements(std::span<const std::string_view> names,
+                                                                    std::span<const Flags4096> flags,
+                                                                    IndexBackend backend = IndexBackend::kSet,
+                                                                    std::string_view prefix = keys::kPrefixDefault) noexcept;
+    // One atomic script: removes the element from the postings of its stored flags
+    // (flags_bin, then legacy flags_hex), from the universe and drops its hash. With
+    // force, flags that are missing or corrupt mean every posting is scrubbed, in the
+    // same script. Bumps keys::idx_versions() for what changed.
+    [[nodiscard]] Result<DeleteResult> delete_element(std::string_view name, bool force = false,
+                                                      IndexBackend backend = IndexBackend::kSet,
+                                                      std::string_view prefix = keys::kPrefixDefault) noexcept;
+    // Same for many names in one script call (one atomic batch); results in input order.
+    // Keep batches to a few hundred names: the server runs nothing else meanwhile.
+    [[nodiscard]] Result<std::vector<DeleteResult>> delete_elements(std::span<const std::string_view> names,
+                                                                    bool force = false,
+                                                                    IndexBackend backend = IndexBackend::kSet,
+                                                                    std::string_view prefix = keys::kPrefixDefault) noexcept;
+    // Stored flags of an element: flags_bin, then legacy flags_hex. kNotFound when
+    // the element has neither.
+    [[nodiscard]] Result<Flags4096> element_flags(std::string_view name,
+                                                  std::string_view prefix = keys::kPrefixDefault) noexcept;
+
+    // STATS
+    // Posting sizes of every bit and the universe with one HMGET of keys::idx_stats()
+    // (keys::bm_stats() for kBitmap). kNotFound while the counts are not kept: data
+    // written before they existed needs one rebuild_index_stats().
+    [[nodiscard]] Result<IndexStats> index_stats(IndexBackend backend = IndexBackend::kSet,
+                                                 std::string_view prefix = keys::kPrefixDefault) noexcept;
+    // Recounts the stats hash from the postings (SCARD / BITCOUNT per bit) in one
+    // script, so writers see either the old or the new counts. Blocks the server for
+    // the 4097 counts. Returns the universe size.
+    [[nodiscard]] Result<long long> rebuild_index_stats(IndexBackend backend = IndexBackend::kSet,
+                                                        std::string_view prefix = keys::kPrefixDefault) noexcept;
+
+    // CLUSTER
+    // Slot ranges and their masters (CLUSTER SLOTS). kRedisProtocol when the server
+    // is not a cluster node. An empty host means the node that answered.
+    [[nodiscard]] Result<std::vector<SlotRange>> cluster_slots() noexcept;
+
+    // TRACKING (Redis 6+, RESP2 redirection)
+    [[nodiscard]] Result<long long> client_id() noexcept;
+    // CLIENT TRACKING ON REDIRECT redirect BCAST PREFIX p ...: every write to a key
+    // under one of the prefixes, by any client, is announced to connection redirect for
+    // as long as this connection stays open. kRedisProtocol when the server lacks it.
+    [[nodiscard]] Result<Unit> track_broadcast(long long redirect, std::span<const std::string_view> prefixes) noexcept;
+    // SUBSCRIBE __redis__:invalidate. The connection is then only good for
+    // next_invalidation().
+    [[nodiscard]] Result<Unit> subscribe_invalidations() noexcept;
+    // Blocks until the next invalidation arrives.
+    [[nodiscard]] Result<Invalidation> next_invalidation() noexcept;
+    // Shuts the socket down, so a next_invalidation() blocked on another thread
+    // returns kRedisIo. The one member that may be called concurrently.
+    void interrupt() noexcept;
+
+    // STATS (see er/stats.hpp): per-command counters, sizes and latency histograms.
+    // Off by default (one branch per command); on starts from empty counters, off
+    // drops them. A no-op when er_core is built with ER_STATS=OFF.
+    void enable_stats(bool on = true) noexcept;
+    // nullptr while disabled.
+    [[nodiscard]] const Stats* stats() const noexcept { return stats_.get(); }
+    void reset_stats() noexcept;
+    // Counts one call of a caller-timed step that is not a Redis command (e.g. which
+    // evaluator ran a query, see er/hybrid.hpp) under op; a no-op while disabled.
+    void record_op(std::string_view op, std::uint64_t ns) noexcept;
+
+    // SCRIPTS: consult and fill `cache` besides this connection's own SHAs (nullptr:
+    // per-connection only, the default).
+    void share_scripts(std::shared_ptr<ScriptCache> cache) noexcept { shared_shas_ = std::move(cache); }
+    [[nodiscard]] const std::shared_ptr<ScriptCache>& shared_scripts() const noexcept { return shared_shas_; }
 
 private:
     struct CtxDeleter {
@@ -87,7 +326,94 @@ private:
 
     explicit RedisClient(redisContext* c) : ctx_(c) {}
 
+    // EVALSHA with SCRIPT LOAD on first use and one reload on NOSCRIPT. Keys and argv
+    // are any ranges of string-like values (defined and instantiated in RedisClient.cpp).
+    template <class Keys, class Argv>
+    [[nodiscard]] Result<detail::ReplyPtr> eval_script(const LuaScript& script, const Keys& keys,
+                                                       const Argv& argv) noexcept;
+    // One of the store scripts: KEYS = [head] + keys, ARGV = ttl, out_key.
+    template <class Keys>
+    [[nodiscard]] Result<long long> store_script(const LuaScript& script, std::string_view head, const Keys& keys,
+                                                 int ttl_seconds, std::string_view out_key) noexcept;
+    [[nodiscard]] Result<std::string> load_script(const LuaScript& script) noexcept;
+
     std::unique_ptr<redisContext, CtxDeleter> ctx_;
+    // script source address -> SHA1 returned by SCRIPT LOAD on this connection
+    std::unordered_map<const char*, std::string> script_shas_{};
+    std::shared_ptr<ScriptCache> shared_shas_{};
+    std::unique_ptr<Stats> stats_{};
+};
+
+// Queues commands with redisAppendCommandArgv; exec() flushes them in one write and
+// reads one reply per command. Each queue call returns a slot used to read its typed
+// result after exec(). Arguments are copied into the hiredis output buffer on append,
+// so they do not need to outlive the call.
+//
+// Bound to the RedisClient it came from; do not issue other commands on that client
+// while commands are queued. Unread replies are drained on destruction.
+class RedisClient::Pipeline {
+public:
+    using Slot = std::size_t;
+
+    ~Pipeline();
+
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+    Pipeline(Pipeline&&) = delete;
+    Pipeline& operator=(Pipeline&&) = delete;
+
+    Slot hset(std::string_view key, std::string_view field, std::string_view value) noexcept;
+    Slot hset_bin(std::string_view key, std::string_view field, const void* data, std::size_t len) noexcept;
+    Slot hget(std::string_view key, std::string_view field) noexcept;
+    Slot hmget(std::string_view key, std::span<const std::string_view> fields) noexcept;
+    Slot sadd(std::string_view key, std::string_view member) noexcept;
+    Slot srem(std::string_view key, std::string_view member) noexcept;
+    // Variadic SADD/SREM: one command for many members of the same key.
+    Slot sadd(std::string_view key, std::span<const std::string_view> members) noexcept;
+    Slot srem(std::string_view key, std::span<const std::string_view> members) noexcept;
+    Slot hincrby(std::string_view key, std::string_view field, long long by = 1) noexcept;
+    Slot hdel(std::string_view key, std::string_view field) noexcept;
+    Slot setbit(std::string_view key, std::uint64_t offset, bool value) noexcept;
+    Slot del_key(std::string_view key) noexcept;
+    Slot scard(std::string_view key) noexcept;
+    // HMGET flags_bin flags_hex of an element hash; read with stored_flags().
+    Slot element_flags(std::string_view name, std::string_view prefix = keys::kPrefixDefault) noexcept;
+
+    [[nodiscard]] std::size_t size() const noexcept { return ops_.size(); }
+
+    // Sends all queued commands and reads their replies. Can be called again after
+    // queueing more commands; slots keep counting up.
+    [[nodiscard]] Result<Unit> exec() noexcept;
+
+    // Typed access to a reply after exec().
+    [[nodiscard]] Result<long long> integer(Slot slot) const noexcept;
+    [[nodiscard]] Result<std::string> string(Slot slot) const noexcept;
+    [[nodiscard]] Result<Flags4096> flags(Slot slot) const noexcept;
+    // Array of bulk strings (e.g. HMGET); nil entries become std::nullopt.
+    [[nodiscard]] Result<std::vector<std::optional<std::string>>> strings(Slot slot) const noexcept;
+    // Reply of element_flags(), decoded from the reply buffer: flags_bin, then legacy
+    // flags_hex (a field that does not decode counts as empty flags). kNotFound when
+    // the element has neither field.
+    [[nodiscard]] Result<Flags4096> stored_flags(Slot slot) const noexcept;
+
+    // First error reply (if any) among everything read so far.
+    [[nodiscard]] Result<Unit> first_error() const noexcept;
+
+private:
+    friend class RedisClient;
+    Pipeline(redisContext* c, Stats* stats) noexcept : ctx_(c), stats_(stats) {}
+
+    Slot append(const char* op, int argc, const char** argv, const std::size_t* argvlen) noexcept;
+    [[nodiscard]] Result<const redisReply*> reply_at(Slot slot) const noexcept;
+
+    redisContext* ctx_{nullptr};
+    std::vector<const char*> ops_{};
+    std::vector<detail::ReplyPtr> replies_{};
+    std::size_t appended_{0};   // commands actually handed to hiredis
+    Error error_{};             // sticky append / I/O failure
+    bool broken_{false};
+    Stats* stats_{nullptr};           // the client's, while enabled
+    std::uint64_t pending_bytes_{0};  // request bytes appended since the last exec
 };
 
 } // namespace er
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <hiredis/async.h>
+
+#include "er/Flags4096.hpp"
+#include "er/RedisClient.hpp"
+#include "er/result.hpp"
+#include "er/task.hpp"
+
+namespace er {
+
+class AsyncRedisClient;
+
+// Single-threaded epoll loop driving hiredis async contexts (the adapter hiredis
+// calls to add/remove read and write interest, plus its timeout timer).
+// Clients, their tasks and the loop must all be used from the loop's thread.
+class EventLoop {
+public:
+    [[nodiscard]] static Result<std::unique_ptr<EventLoop>> create() noexcept;
+
+    ~EventLoop();
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Waits up to timeout_ms (-1 = until something is ready) for socket readiness or
+    // the next client timeout, then runs the hiredis callbacks (and so the awaiting
+    // coroutines) that became ready.
+    [[nodiscard]] Result<Unit> poll(int timeout_ms = -1) noexcept;
+
+    // Polls until the task completes and returns its result.
+    template <class T>
+    [[nodiscard]] Result<T> run(Task<Result<T>>& task) noexcept;
+    template <class T>
+    [[nodiscard]] Result<T> run(Task<Result<T>>&& task) noexcept {
+        return run(task);
+    }
+
+private:
+    friend class AsyncRedisClient;
+
+    // One per client: its socket, the interest hiredis asked for and its timer.
+    struct Watch {
+        EventLoop* loop{nullptr};
+        redisAsyncContext* ac{nullptr};
+        int fd{-1};
+        std::uint32_t events{0};       // wanted (EPOLLIN / EPOLLOUT)
+        bool registered{false};        // fd is in the epoll set
+        std::optional<std::chrono::steady_clock::time_point> deadline{};
+    };
+
+    explicit EventLoop(int epfd) noexcept : epfd_(epfd) {}
+
+    // Installs the hiredis ev hooks of ac, which then report to w.
+    void attach(Watch& w, redisAsyncContext* ac) noexcept;
+    void update(Watch& w) noexcept;
+    void detach(Watch& w) noexcept;
+
+    int epfd_;
+    std::vector<Watch*> watches_{};
+};
+
+// Non-blocking counterpart of RedisClient on hiredis' async API: every command is a
+// Task<Result<T>> with the same result types as the sync client, so one thread can
+// keep thousands of requests in flight on one connection (replies arrive in order).
+//
+// Commands are sent when the call is made (see Task); string_view arguments only
+// need to live for the call itself. Once the connection fails (I/O error or
+// timeout) it is not re-established: pending and later commands fail with
+// kRedisIo / kTimeout and connected() turns false.
+//
+// Do not destroy the client from inside one of its own callbacks (i.e. from a
+// coroutine resumed by one of its replies); pending commands complete with
+// kRedisIo when it is destroyed.
+class AsyncRedisClient {
+public:
+    // timeout_ms bounds the connect and every command.
+    [[nodiscard]] static Result<std::unique_ptr<AsyncRedisClient>> connect(EventLoop& loop,
+                                                                           std::string host = "localhost",
+                                                                           int port = 6379,
+                                                                           int timeout_ms = 2000) noexcept;
+
+    ~AsyncRedisClient();
+    AsyncRedisClient(const AsyncRedisClient&) = delete;
+    AsyncRedisClient& operator=(const AsyncRedisClient&) = delete;
+
+    bool connected() const noexcept { return ac_ != nullptr; }
+
+    [[nodiscard]] Task<Result<Unit>> ping();
+
+    // HASH
+    [[nodiscard]] Task<Result<long long>> hset(std::string_view key, std::string_view field, std::string_view value);
+    [[nodiscard]] Task<Result<std::string>> hget(std::string_view key, std::string_view field);
+    [[nodiscard]] Task<Result<Flags4096>> hget_flags(std::string_view key, std::string_view field);
+
+    // SET
+    [[nodiscard]] Task<Result<long long>> sadd(std::string_view key, std::string_view member);
+    [[nodiscard]] Task<Result<long long>> srem(std::string_view key, std::string_view member);
+    [[nodiscard]] Task<Result<long long>> scard(std::string_view key);
+    [[nodiscard]] Task<Result<std::vector<std::string>>> smembers(std::string_view key);
+    [[nodiscard]] Task<Result<std::vector<std::string>>> sinter(const std::vector<std::string>& keys);
+    [[nodiscard]] Task<Result<std::vector<std::string>>> sunion(const std::vector<std::string>& keys);
+    [[nodiscard]] Task<Result<std::vector<std::string>>> sdiff(const std::vector<std::string>& keys);
+
+    [[nodiscard]] Task<Result<long long>> del_key(std::string_view key);
+
+    // SCRIPTING: EVALSHA, SCRIPT LOAD on first use and one reload on NOSCRIPT, like
+    // RedisClient. keys/argv are taken by value since a reload suspends the task.
+    [[nodiscard]] Task<Result<long long>> eval_integer(const LuaScript& script, std::vector<std::string> keys,
+                                                       std::vector<std::string> argv);
+    [[nodiscard]] Task<Result<std::vector<std::string>>> eval_strings(const LuaScript& script,
+                                                                      std::vector<std::string> keys,
+                                                                      std::vector<std::string> argv);
+
+private:
+    explicit AsyncRedisClient(EventLoop& loop) noexcept : loop_(&loop) {}
+
+    static void on_connect(const redisAsyncContext* ac, int status);
+    static void on_disconnect(const redisAsyncContext* ac, int status);
+
+    template <class T>
+    Task<Result<T>> eval_as(const LuaScript& script, std::vector<std::string> keys, std::vector<std::string> argv,
+                            Result<T> (*decode)(const redisReply&, std::string_view op));
+    Task<Result<std::string>> load_script(const LuaScript& script);
+
+    EventLoop* loop_;
+    redisAsyncContext* ac_{nullptr};
+    std::string lost_{"not connected"};   // why ac_ is null
+    EventLoop::Watch watch_{};
+    // script source address -> SHA1 returned by SCRIPT LOAD on this connection
+    std::unordered_map<const char*, std::string> script_shas_{};
+};
+
+template <class T>
+Result<T> EventLoop::run(Task<Result<T>>& task) noexcept {
+    while (!task.done()) {
+        if (watches_.empty()) return Result<T>::err(Errc::kInternal, "EventLoop::run: no connection to wait on");
+        if (auto ok = poll(); !ok) return Result<T>::err(ok.error().code, ok.error().msg);
+    }
+    return task.take();
+}
+
+} // namespace er
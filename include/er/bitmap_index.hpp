@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "er/Flags4096.hpp"
+#include "er/RedisClient.hpp"
+#include "er/keys.hpp"
+#include "er/query.hpp"
+#include "er/result.hpp"
+
+namespace er {
+
+// Bitmap index backend: each element gets a dense integer id (er:bm:ids / er:bm:names)
+// and every bit's posting list is a Redis bitmap over ids (er:bm:bit:N, er:bm:all).
+// A posting costs one bit per id instead of one SET entry per name, and wide
+// AND/OR/NOT become BITOP over byte strings.
+//
+// The element hash (flags_bin) and er:all stay the source of truth in both backends;
+// only the postings differ. A namespace uses one backend: the SET postings are not
+// maintained by writes through this class, and vice versa.
+//
+// Elements are deleted with RedisClient::delete_elements(..., IndexBackend::kBitmap),
+// which also releases the id. Ids are never reused; the bitmaps stay as long as the
+// highest id.
+class BitmapIndex {
+public:
+    // Keys under prefix (see keys.hpp); prefix must outlive the index.
+    explicit BitmapIndex(RedisClient& redis, std::string_view prefix = keys::kPrefixDefault) noexcept
+        : redis_(&redis), prefix_(prefix) {}
+
+    // Same atomic upsert as RedisClient::upsert_element, with bitmap postings.
+    [[nodiscard]] Result<UpsertResult> upsert(std::string_view name, const Flags4096& flags) noexcept;
+
+    // Evaluate a query::compile() plan with BITOP in one script. Limit semantics match
+    // query::members / query::count; store writes a SET of names (so `show`, SSCAN
+    // and the GUI read it like any other result).
+    [[nodiscard]] Result<std::vector<std::string>> members(const query::Plan& plan, std::size_t limit = 0) noexcept;
+    [[nodiscard]] Result<long long> count(const query::Plan& plan, std::size_t limit = 0) noexcept;
+    [[nodiscard]] Result<long long> store(const query::Plan& plan, int ttl_seconds, std::string_view out_key) noexcept;
+
+private:
+    RedisClient* redis_;
+    std::string_view prefix_;
+};
+
+} // namespace er
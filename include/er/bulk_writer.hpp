@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "er/Flags4096.hpp"
+#include "er/RedisClient.hpp"
+#include "er/keys.hpp"
+#include "er/result.hpp"
+
+namespace er {
+
+struct BulkStats {
+    std::size_t elements{0};   // records accepted by add()
+    std::size_t batches{0};    // flushes that reached Redis
+    std::size_t commands{0};   // commands sent across all batches
+};
+
+// Bulk ingest: buffers puts and writes them in batched script calls.
+//
+// Per batch: RedisClient::upsert_elements for every kScriptBatch elements, so each slice
+// is one round trip and one atomic script. The delta against the stored flags, the
+// er:idx:bit:* postings, the index versions and the keys::idx_stats() counts are all
+// worked out server-side, so concurrent writers (another loader, upsert_element,
+// delete_elements) cannot leave the index out of sync with the element hashes.
+// Repeated names inside one batch are coalesced (last write wins).
+class BulkWriter {
+public:
+    static constexpr std::size_t kDefaultBatchSize = 1000;
+
+    // Writes under prefix (see keys.hpp).
+    explicit BulkWriter(RedisClient& redis, std::size_t batch_size = kDefaultBatchSize,
+                        std::string_view prefix = keys::kPrefixDefault) noexcept;
+
+    // Queues one element; flushes automatically once the batch is full.
+    [[nodiscard]] Result<Unit> add(std::string_view name, const Flags4096& flags) noexcept;
+    // Writes whatever is buffered. Call once at the end of the input.
+    [[nodiscard]] Result<Unit> flush() noexcept;
+
+    const BulkStats& stats() const noexcept { return stats_; }
+
+private:
+    // elements per script call: the server runs nothing else meanwhile
+    static constexpr std::size_t kScriptBatch = 256;
+
+    RedisClient* redis_;
+    std::size_t batch_size_;
+    const keys::KeyTable* keys_;
+    std::vector<std::string> names_{};
+    std::vector<Flags4096> flags_{};                               // flags_[i] for names_[i]
+    std::unordered_map<std::string_view, std::size_t> index_{};   // name -> slot
+    BulkStats stats_{};
+};
+
+} // namespace er
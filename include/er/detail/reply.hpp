@@ -0,0 +1,154 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <hiredis/hiredis.h>
+
+#include "er/RedisClient.hpp"
+#include "er/result.hpp"
+
+// Reply checks and the argv builder shared by RedisClient and AsyncRedisClient.
+// Internal: only their translation units include this.
+namespace er::detail {
+
+inline Result<Unit> reply_no_error(const redisReply& r, std::string_view op) noexcept {
+    if (r.type != REDIS_REPLY_ERROR) return Result<Unit>::ok();
+    std::string full(op);
+    full.append(": ");
+    full.append(r.str ? std::string(r.str, static_cast<std::size_t>(r.len)) : "unknown redis error");
+    return Result<Unit>::err(Errc::kRedisProtocol, std::move(full));
+}
+
+inline Result<long long> reply_integer(const redisReply& r, std::string_view op) noexcept {
+    if (auto ok = reply_no_error(r, op); !ok) return Result<long long>::err(ok.error().code, ok.error().msg);
+    if (r.type != REDIS_REPLY_INTEGER) {
+        std::string msg(op);
+        msg.append(": expected integer reply");
+        return Result<long long>::err(Errc::kRedisReplyType, std::move(msg));
+    }
+    return Result<long long>::ok(r.integer);
+}
+
+// String elements of an array reply (others are skipped).
+inline Result<std::vector<std::string>> read_set_array(const redisReply& r) noexcept {
+    if (r.type != REDIS_REPLY_ARRAY) return Result<std::vector<std::string>>::err(Errc::kRedisReplyType, "expected array reply");
+    std::vector<std::string> out;
+    out.reserve(static_cast<std::size_t>(r.elements));
+    for (std::size_t i = 0; i < r.elements; ++i) {
+        const redisReply* e = r.element[i];
+        if (e && e->type == REDIS_REPLY_STRING && e->str) {
+            out.emplace_back(e->str, static_cast<std::size_t>(e->len));
+        }
+    }
+    return Result<std::vector<std::string>>::ok(std::move(out));
+}
+
+inline bool is_noscript(const redisReply& r) noexcept {
+    return r.type == REDIS_REPLY_ERROR && r.str &&
+           std::string_view(r.str, static_cast<std::size_t>(r.len)).starts_with("NOSCRIPT");
+}
+
+// "EVALSHA(<script name>)": error messages and the stats key of a script call.
+inline std::string script_op(const LuaScript& script) {
+    std::string op("EVALSHA(");
+    op.append(script.name);
+    op.push_back(')');
+    return op;
+}
+
+// argv for redisCommandArgv / redisAsyncCommandArgv. Up to kInline arguments live in
+// the builder itself (on the stack); larger commands borrow spill vectors from a
+// per-thread pool and hand them back, so steady-state commands of any width allocate
+// nothing. The arguments are borrowed: they must outlive the send.
+class ArgvBuilder {
+public:
+    static constexpr std::size_t kInline = 32;
+
+    explicit ArgvBuilder(std::size_t reserve_n = 0) {
+        if (reserve_n > kInline) spill(reserve_n);
+    }
+    ~ArgvBuilder() {
+        if (spill_) {
+            spill_->argv.clear();
+            spill_->argvlen.clear();
+            spill_pool().push_back(std::move(spill_));
+        }
+    }
+    // argv_ holds pointers to the arguments, not into the builder, so a move copies it
+    ArgvBuilder(ArgvBuilder&& o) noexcept
+        : argv_(o.argv_), argvlen_(o.argvlen_), n_(o.n_), spill_(std::move(o.spill_)) {
+        o.n_ = 0;
+    }
+    ArgvBuilder(const ArgvBuilder&) = delete;
+    ArgvBuilder& operator=(const ArgvBuilder&) = delete;
+    ArgvBuilder& operator=(ArgvBuilder&&) = delete;
+
+    // ArgvBuilder::of("SADD", key, member)
+    template <class... Args>
+    static ArgvBuilder of(const Args&... args) {
+        ArgvBuilder out(sizeof...(args));
+        (out.push(std::string_view(args)), ...);
+        return out;
+    }
+
+    void push(std::string_view s) { push_bytes(s.data(), s.size()); }
+
+    void push_bytes(const void* data, std::size_t len) {
+        const char* p = static_cast<const char*>(data);
+        if (!spill_ && n_ < kInline) {
+            argv_[n_] = p;
+            argvlen_[n_] = len;
+            ++n_;
+            return;
+        }
+        if (!spill_) spill(2 * kInline);
+        spill_->argv.push_back(p);
+        spill_->argvlen.push_back(len);
+    }
+
+    [[nodiscard]] int argc() const noexcept {
+        return static_cast<int>(spill_ ? spill_->argv.size() : n_);
+    }
+    // hiredis takes `const char**` (not `const char* const*`), even though it doesn't mutate argv.
+    [[nodiscard]] const char** argv() const noexcept {
+        return const_cast<const char**>(spill_ ? spill_->argv.data() : argv_.data());
+    }
+    [[nodiscard]] const size_t* argvlen() const noexcept { return spill_ ? spill_->argvlen.data() : argvlen_.data(); }
+
+private:
+    struct Spill {
+        std::vector<const char*> argv;
+        std::vector<size_t> argvlen;
+    };
+
+    static std::vector<std::unique_ptr<Spill>>& spill_pool() {
+        thread_local std::vector<std::unique_ptr<Spill>> pool;
+        return pool;
+    }
+
+    // moves the inline arguments into a pooled spill with room for n
+    void spill(std::size_t n) {
+        auto& pool = spill_pool();
+        if (pool.empty()) {
+            spill_ = std::make_unique<Spill>();
+        } else {
+            spill_ = std::move(pool.back());
+            pool.pop_back();
+        }
+        spill_->argv.reserve(n);
+        spill_->argvlen.reserve(n);
+        spill_->argv.assign(argv_.begin(), argv_.begin() + static_cast<std::ptrdiff_t>(n_));
+        spill_->argvlen.assign(argvlen_.begin(), argvlen_.begin() + static_cast<std::ptrdiff_t>(n_));
+    }
+
+    std::array<const char*, kInline> argv_{};
+    std::array<size_t, kInline> argvlen_{};
+    std::size_t n_{0};
+    std::unique_ptr<Spill> spill_{};
+};
+
+} // namespace er::detail
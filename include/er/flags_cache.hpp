@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "er/Flags4096.hpp"
+#include "er/RedisClient.hpp"
+#include "er/keys.hpp"
+#include "er/result.hpp"
+
+namespace er {
+
+struct FlagsCacheStats {
+    std::uint64_t hits{0};
+    std::uint64_t misses{0};
+    std::uint64_t evictions{0};       // dropped to stay under max_bytes
+    std::uint64_t invalidations{0};   // entries dropped by invalidate()
+    std::size_t entries{0};
+    std::size_t bytes{0};
+};
+
+// Bounded LRU of element name -> stored flags, safe to share between threads.
+//
+// A reader that misses takes a ticket() before reading Redis and hands it to put():
+// the entry is only kept if no invalidate() / clear() of that name happened since, so
+// a read racing a write can never park the old flags in the cache.
+//
+// The cache does not watch Redis itself: writers in this process call invalidate()
+// (or put() the flags they wrote), and a FlagsTracker covers writes from elsewhere.
+class FlagsCache {
+public:
+    // Approximate cost of one entry besides its name: the flags, list and map nodes.
+    static constexpr std::size_t kEntryBytes = sizeof(Flags4096) + 96;
+
+    explicit FlagsCache(std::size_t max_bytes) noexcept : max_bytes_(max_bytes) {}
+    FlagsCache(const FlagsCache&) = delete;
+    FlagsCache& operator=(const FlagsCache&) = delete;
+
+    // Cached flags of name (counted as a hit or a miss).
+    [[nodiscard]] std::optional<Flags4096> get(std::string_view name) noexcept;
+    [[nodiscard]] std::uint64_t ticket(std::string_view name) const noexcept;
+    void put(std::string_view name, const Flags4096& flags, std::uint64_t ticket) noexcept;
+    void invalidate(std::string_view name) noexcept;
+    // Drops everything; with stop, put() keeps nothing until resume().
+    void clear(bool stop = false) noexcept;
+    void resume() noexcept;
+
+    FlagsCacheStats stats() const noexcept;
+
+private:
+    struct Entry {
+        std::string name;
+        Flags4096 flags;
+    };
+
+    // invalidation generations, per hash bucket of the name
+    static constexpr std::size_t kBuckets = 256;
+    static std::size_t bucket(std::string_view name) noexcept;
+    void evict_locked() noexcept;
+
+    const std::size_t max_bytes_;
+    mutable std::mutex mu_{};
+    std::list<Entry> lru_{};   // most recently used first
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> index_{};   // keys point into lru_ names
+    std::array<std::uint64_t, kBuckets> gens_{};
+    bool stopped_{false};
+    FlagsCacheStats stats_{};
+};
+
+// Keeps a FlagsCache coherent with writes by any client (Redis 6+): CLIENT TRACKING
+// in broadcast mode on <prefix>:element:, redirected to a subscribed connection that a
+// background thread reads. Each invalidated element hash drops its name; a server
+// flush drops everything.
+//
+// If the invalidation connection is lost the cache is cleared and stopped (it then
+// only misses) and healthy() turns false: start a new tracker.
+class FlagsTracker {
+public:
+    // The cache must outlive the tracker.
+    [[nodiscard]] static Result<FlagsTracker> start(const std::string& host, int port, FlagsCache& cache,
+                                                    std::string_view prefix = keys::kPrefixDefault) noexcept;
+
+    ~FlagsTracker();
+    FlagsTracker(FlagsTracker&&) noexcept;
+    FlagsTracker& operator=(FlagsTracker&&) noexcept;
+    FlagsTracker(const FlagsTracker&) = delete;
+    FlagsTracker& operator=(const FlagsTracker&) = delete;
+
+    [[nodiscard]] bool healthy() const noexcept;
+
+private:
+    struct State;
+
+    explicit FlagsTracker(std::unique_ptr<State> state) noexcept;
+
+    std::unique_ptr<State> state_;
+};
+
+} // namespace er
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "er/RedisClient.hpp"
+#include "er/keys.hpp"
+#include "er/query.hpp"
+#include "er/result.hpp"
+#include "er/snapshot.hpp"
+
+namespace er::query {
+
+// Which evaluator ran a query.
+enum class Path { kRedis, kSnapshot };
+
+struct HybridOptions {
+    // Estimated result rows (capped by the query's limit) from which a query runs on
+    // the snapshot; below it the server-side script is cheaper than a full scan.
+    std::size_t snapshot_rows = 50000;
+    // How long a posting's cardinality is reused by estimates.
+    std::chrono::milliseconds cardinality_ttl{5000};
+};
+
+// Routes each query to the query script (members / count) or to a scan of a local
+// Snapshot, by its estimated result size: selective queries stay on Redis, while
+// queries that would materialize a large share of the universe (common bits, NOT)
+// are evaluated in memory without building sets on the server.
+//
+// The estimate treats bits as independent: each posting's share of er:all (read from
+// keys::idx_stats() with one HMGET, or SCARD while those counts are not kept; cached
+// for cardinality_ttl) is combined as a product for AND, 1 - prod(1 - p) for OR and
+// 1 - p for NOT.
+//
+// The snapshot is only used for a query while the keys::idx_versions() fields its
+// plan reads are those recorded before the snapshot was loaded (one HMGET per routed
+// query), so the result always matches what Redis would return; otherwise the query
+// runs on Redis. refresh() reloads the snapshot.
+//
+// Set postings only (IndexBackend::kSet). Safe to share between threads.
+//
+// With stats enabled on the client, each query is counted and timed under
+// QUERY:redis or QUERY:snapshot, and one vetoed by a stale snapshot under QUERY:stale.
+class Hybrid {
+public:
+    explicit Hybrid(HybridOptions opts = {}, std::string_view prefix = keys::kPrefixDefault);
+    Hybrid(const Hybrid&) = delete;
+    Hybrid& operator=(const Hybrid&) = delete;
+
+    // Records the index versions, then loads a new snapshot. Without a snapshot every
+    // query runs on Redis.
+    [[nodiscard]] Result<Unit> refresh(RedisClient& r) noexcept;
+    [[nodiscard]] std::size_t snapshot_size() const noexcept;
+
+    // Estimated result rows of node.
+    [[nodiscard]] Result<double> estimate(RedisClient& r, const Node& node) noexcept;
+
+    // Same results as query::count / query::members; *path (if given) says where it ran.
+    [[nodiscard]] Result<long long> count(RedisClient& r, const Node& node, std::size_t limit = 0,
+                                          Path* path = nullptr) noexcept;
+    [[nodiscard]] Result<std::vector<std::string>> members(RedisClient& r, const Node& node, std::size_t limit = 0,
+                                                           Path* path = nullptr) noexcept;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr std::size_t kBits = keys::KeyTable::kBits;
+
+    struct Loaded {
+        Snapshot snap;
+        std::vector<std::string> versions;   // bit fields, then "all"; "" when unset
+    };
+
+    // Posting sizes of bits (kBits = er:all), in order.
+    [[nodiscard]] Result<std::vector<long long>> cardinalities(RedisClient& r, const std::vector<std::size_t>& bits);
+    // The snapshot to run plan on, or nullptr for Redis.
+    [[nodiscard]] Result<std::shared_ptr<const Loaded>> route(RedisClient& r, const Node& node, const Plan& plan,
+                                                              std::size_t limit) noexcept;
+
+    const HybridOptions opts_;
+    const std::string prefix_;
+
+    mutable std::mutex mu_{};
+    std::shared_ptr<const Loaded> loaded_{};
+    // cached size of each bit posting, and of er:all at [kBits]
+    std::array<long long, kBits + 1> cards_{};
+    std::array<Clock::time_point, kBits + 1> card_at_{};
+};
+
+} // namespace er::query
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "er/result.hpp"
+
+// Minimal JSON for line-oriented tooling (`er_cli serve`): a parsed value tree and
+// an append-style writer. Not a general-purpose library: numbers are doubles, object
+// keys keep their order and duplicates are kept (find returns the first).
+namespace er::json {
+
+struct Value {
+    enum class Kind { kNull, kBool, kNumber, kString, kArray, kObject };
+
+    Kind kind{Kind::kNull};
+    bool boolean{false};
+    double number{0};
+    std::string string{};
+    std::vector<Value> items{};                               // kArray
+    std::vector<std::pair<std::string, Value>> members{};     // kObject
+
+    // Member of an object, nullptr if absent (or not an object).
+    const Value* find(std::string_view key) const noexcept;
+
+    bool is_null() const noexcept { return kind == Kind::kNull; }
+    // The number as an integer in [lo, hi], if it is one.
+    std::optional<std::int64_t> integer(std::int64_t lo, std::int64_t hi) const noexcept;
+};
+
+// Parses exactly one value (surrounding whitespace allowed); nesting is capped at 64.
+[[nodiscard]] Result<Value> parse(std::string_view text) noexcept;
+
+// Writers: append to out.
+void append_string(std::string& out, std::string_view s);   // quoted and escaped
+void append_number(std::string& out, double v);             // integral values print without exponent
+void append(std::string& out, const Value& v);
+
+} // namespace er::json
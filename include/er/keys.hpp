@@ -1,7 +1,8 @@
 #pragma once
 
-#include <chrono>
+#include <array>
 #include <cstddef>
+#include <cstdint>
 #include <string>
 #include <string_view>
 
@@ -22,21 +23,185 @@ inline std::string element(std::string_view name, std::string_view prefix = kPre
     return k;
 }
 
-inline std::string idx_bit(std::size_t bit, std::string_view prefix = kPrefixDefault) {
+// "<prefix>:idx:bit:" — Lua scripts append the bit number server-side.
+inline std::string idx_bit_prefix(std::string_view prefix = kPrefixDefault) {
     std::string k(prefix);
     k.append(":idx:bit:");
+    return k;
+}
+
+inline std::string idx_bit(std::size_t bit, std::string_view prefix = kPrefixDefault) {
+    std::string k = idx_bit_prefix(prefix);
+    k.append(std::to_string(bit));
+    return k;
+}
+
+// ---- interned keys ----
+// The index keys of one prefix, built once on first use and kept for the process
+// lifetime, so hot paths look keys up instead of formatting them. Thread-safe; the
+// views stay valid until exit. bit must be < kBits.
+class KeyTable {
+public:
+    static constexpr std::size_t kBits = 4096;
+
+    [[nodiscard]] static const KeyTable& of(std::string_view prefix = kPrefixDefault);
+    // "0".."4095": a bit's keys::idx_versions() field (same for every prefix).
+    [[nodiscard]] static std::string_view bit_field(std::size_t bit) noexcept;
+
+    std::string_view prefix() const noexcept { return prefix_; }
+    std::string_view idx_bit(std::size_t bit) const noexcept { return idx_.at(bit); }
+    std::string_view bm_bit(std::size_t bit) const noexcept { return bm_.at(bit); }
+    std::string_view universe() const noexcept { return universe_; }
+    std::string_view bm_universe() const noexcept { return bm_universe_; }
+    std::string_view idx_versions() const noexcept { return versions_; }
+    std::string_view idx_stats() const noexcept { return stats_; }
+    std::string_view bm_stats() const noexcept { return bm_stats_; }
+    std::string_view scratch() const noexcept { return scratch_; }
+
+    KeyTable(const KeyTable&) = delete;
+    KeyTable& operator=(const KeyTable&) = delete;
+
+    // "<head>0" .. "<head>4095" packed into one buffer.
+    class Strip {
+    public:
+        explicit Strip(std::string_view head);
+        std::string_view at(std::size_t i) const noexcept {
+            return std::string_view(buf_).substr(off_[i], off_[i + 1] - off_[i]);
+        }
+
+    private:
+        std::string buf_{};
+        std::array<std::uint32_t, kBits + 1> off_{};
+    };
+
+private:
+    explicit KeyTable(std::string_view prefix);
+
+    std::string prefix_;
+    Strip idx_;
+    Strip bm_;
+    std::string universe_;
+    std::string bm_universe_;
+    std::string versions_;
+    std::string stats_;
+    std::string bm_stats_;
+    std::string scratch_;
+};
+
+// ---- bitmap index backend (see er/bitmap_index.hpp) ----
+// Elements get dense integer ids; each bit's posting list is a Redis bitmap over ids.
+
+// name -> id and id -> name hashes, and the id allocator.
+inline std::string bm_ids(std::string_view prefix = kPrefixDefault) {
+    std::string k(prefix);
+    k.append(":bm:ids");
+    return k;
+}
+
+inline std::string bm_names(std::string_view prefix = kPrefixDefault) {
+    std::string k(prefix);
+    k.append(":bm:names");
+    return k;
+}
+
+inline std::string bm_next_id(std::string_view prefix = kPrefixDefault) {
+    std::string k(prefix);
+    k.append(":bm:next");
+    return k;
+}
+
+// Bitmap of every live id (the bitmap counterpart of universe()).
+inline std::string bm_universe(std::string_view prefix = kPrefixDefault) {
+    std::string k(prefix);
+    k.append(":bm:all");
+    return k;
+}
+
+inline std::string bm_bit_prefix(std::string_view prefix = kPrefixDefault) {
+    std::string k(prefix);
+    k.append(":bm:bit:");
+    return k;
+}
+
+inline std::string bm_bit(std::size_t bit, std::string_view prefix = kPrefixDefault) {
+    std::string k = bm_bit_prefix(prefix);
     k.append(std::to_string(bit));
     return k;
 }
 
-inline std::string tmp(std::string_view tag, std::string_view prefix = kPrefixDefault) {
-    using namespace std::chrono;
-    const auto ns = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+// Per-bit index version counters: one hash, field "<bit>" per er:idx:bit:<bit> and
+// kUniverseVersionField for the universe set. Every writer bumps the fields it touched
+// after changing the index; cached query results record the versions they were built from.
+inline constexpr std::string_view kUniverseVersionField{"all"};
+
+inline std::string idx_versions(std::string_view prefix = kPrefixDefault) {
+    std::string k(prefix);
+    k.append(":idx:ver");
+    return k;
+}
+
+// Per-bit posting sizes: one hash, field "<bit>" = SCARD er:idx:bit:<bit> and
+// kUniverseVersionField = SCARD er:all. Every writer adjusts it in the same script or
+// pipeline as the index delta, so a planner reads all cardinalities with one HMGET.
+// Absent until something is written (or RedisClient::rebuild_index_stats ran).
+inline std::string idx_stats(std::string_view prefix = kPrefixDefault) {
+    std::string k(prefix);
+    k.append(":stats");
+    return k;
+}
+
+// The same counts for the bitmap postings (BITCOUNT er:bm:bit:<bit>, er:bm:all).
+inline std::string bm_stats(std::string_view prefix = kPrefixDefault) {
+    std::string k(prefix);
+    k.append(":bm:stats");
+    return k;
+}
+
+// Cached query result for a canonical query id (see er::query::cache_key). Lives under
+// :tmp: like every other stored result, so it is bounded by the same TTL handling.
+inline std::string cache(std::string_view id, std::string_view prefix = kPrefixDefault) {
+    std::string k(prefix);
+    k.append(":tmp:cache:");
+    k.append(id);
+    return k;
+}
+
+// "<prefix>:tmp:" — every stored query result, cache entry and scratch key lives under it.
+inline std::string tmp_prefix(std::string_view prefix = kPrefixDefault) {
     std::string k(prefix);
     k.append(":tmp:");
-    k.append(tag);
-    k.push_back(':');
-    k.append(std::to_string(ns));
+    return k;
+}
+
+inline bool is_tmp(std::string_view key, std::string_view prefix = kPrefixDefault) {
+    return key.size() > prefix.size() + 5 && key.substr(0, prefix.size()) == prefix &&
+           key.substr(prefix.size(), 5) == ":tmp:";
+}
+
+// "<host>:<pid>": unique across the clients of one server.
+[[nodiscard]] std::string client_id();
+
+// "<prefix>:tmp:<tag>:<host>:<pid>:<n>" with a per-process counter n: unique across
+// hosts, processes and threads without a round trip or a shared server-side counter.
+[[nodiscard]] std::string tmp(std::string_view tag, std::string_view prefix = kPrefixDefault);
+
+// Base for in-script scratch keys ("<base>:<n>"). Scripts create and delete them
+// within one EVAL, so a fixed name cannot collide across callers.
+inline std::string scratch(std::string_view prefix = kPrefixDefault) {
+    std::string k(prefix);
+    k.append(":tmp:scratch");
+    return k;
+}
+
+// ---- sharded layout (see er/sharded_index.hpp) ----
+// Prefix of shard n: "{<prefix>:s<n>}". Passed as the prefix of every key above, so
+// all of a shard's keys share one hash tag and therefore one Redis Cluster slot.
+inline std::string shard_prefix(std::size_t shard, std::string_view prefix = kPrefixDefault) {
+    std::string k("{");
+    k.append(prefix);
+    k.append(":s");
+    k.append(std::to_string(shard));
+    k.push_back('}');
     return k;
 }
 
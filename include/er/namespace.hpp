@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "er/RedisClient.hpp"
+#include "er/keys.hpp"
+#include "er/result.hpp"
+
+namespace er {
+
+// A key namespace (one tenant): its prefix plus the state every request under it
+// reuses instead of re-deriving it, i.e. the interned keys::KeyTable (index keys,
+// universe, version hash) and the script SHAs learned by any connection serving it.
+//
+// open() returns the same shared state for the same prefix within a process, so a
+// server handling many tenants derives each one once. Copies are cheap and share it.
+class Namespace {
+public:
+    static constexpr std::size_t kMaxPrefix = 128;
+
+    // prefix: words of [A-Za-z0-9_-] joined by ':' ("er", "acme:prod"), at most
+    // kMaxPrefix bytes. Glob, hash-tag and whitespace characters would break SCAN
+    // patterns and Cluster slots, so anything else is kInvalidArg.
+    [[nodiscard]] static Result<Namespace> open(std::string_view prefix = keys::kPrefixDefault) noexcept;
+
+    const std::string& prefix() const noexcept { return state_->prefix; }
+    const keys::KeyTable& keys() const noexcept { return *state_->keys; }
+    std::string_view universe() const noexcept { return state_->keys->universe(); }
+    // For RedisPool::share_scripts / RedisClient::share_scripts.
+    const std::shared_ptr<ScriptCache>& scripts() const noexcept { return state_->scripts; }
+
+private:
+    struct State {
+        std::string prefix;
+        const keys::KeyTable* keys;
+        std::shared_ptr<ScriptCache> scripts;
+    };
+
+    explicit Namespace(std::shared_ptr<const State> state) noexcept : state_(std::move(state)) {}
+
+    std::shared_ptr<const State> state_;
+};
+
+} // namespace er
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "er/RedisClient.hpp"
+#include "er/keys.hpp"
+#include "er/result.hpp"
+
+namespace er::query {
+
+// Boolean expressions over bit postings, e.g. "(12 & 40) | (7 & !99)".
+//
+//   expr    := and ('|' and)*
+//   and     := unary ('&' unary)*
+//   unary   := '!' unary | primary
+//   primary := <bit 0..4095> | '(' expr ')'
+//
+// NOT is relative to the universe set (er:all), as in find_universe_not.
+struct Node {
+    enum class Kind { kBit, kAnd, kOr, kNot };
+
+    Kind kind{Kind::kBit};
+    std::size_t bit{0};
+    std::vector<Node> children{};
+};
+
+[[nodiscard]] Result<Node> parse(std::string_view expr) noexcept;
+
+// Flattens nested AND/OR and removes double negation.
+[[nodiscard]] Node normalize(Node node);
+
+// Deterministic text form of a normalized expression: AND/OR operands sorted and
+// deduplicated, so "42 & 7" and "7 & 42 & 7" give the same string.
+[[nodiscard]] std::string canonical(const Node& node);
+
+// Cache key (under keys::cache) for an expression; long expressions are hashed.
+[[nodiscard]] std::string cache_key(const Node& node, std::string_view prefix = keys::kPrefixDefault);
+
+// Stack program for the query script. `keys` are the Redis keys the program reads
+// (deduplicated); `program` is pairs of (op, arg):
+//   K i  push KEYS[i]
+//   I n  intersect the top n operands (smallest SCARD first, empty short-circuits)
+//   O n  union the top n operands
+//   D n  first of the top n minus the others
+//
+// `keys` and `version_fields` are views into keys::KeyTable, valid for the process
+// lifetime, so compiling and running a plan formats no key strings.
+struct Plan {
+    std::vector<std::string_view> keys{};
+    std::vector<std::string> program{};
+    // keys::idx_versions() field of each entry in `keys` (bit number or "all").
+    std::vector<std::string_view> version_fields{};
+};
+
+// Lowers an expression to a plan. AND negations become SDIFF against the
+// intersection of its positive operands; only a bare NOT falls back to the universe.
+[[nodiscard]] Plan compile(const Node& root, std::string_view prefix = keys::kPrefixDefault);
+
+// Evaluates a plan in one atomic script (one round trip). Intermediate results
+// live in scratch keys that are deleted before the script returns.
+//
+// With limit > 0 the final step scans its smallest input (SSCAN + SISMEMBER probes)
+// and stops after `limit` members instead of building the full result.
+[[nodiscard]] Result<std::vector<std::string>> members(RedisClient& r, const Plan& plan, std::size_t limit = 0,
+                                                       std::string_view prefix = keys::kPrefixDefault) noexcept;
+// Cardinality only; no members are transferred. A final intersection uses
+// SINTERCARD (with LIMIT) when the server has it, otherwise SINTERSTORE into
+// scratch. With limit > 0 the result is capped at limit.
+[[nodiscard]] Result<long long> count(RedisClient& r, const Plan& plan, std::size_t limit = 0,
+                                      std::string_view prefix = keys::kPrefixDefault) noexcept;
+// Same, but stores the result in out_key with a TTL and returns its cardinality.
+[[nodiscard]] Result<long long> store(RedisClient& r, const Plan& plan, int ttl_seconds, std::string_view out_key,
+                                      std::string_view prefix = keys::kPrefixDefault) noexcept;
+// Like store(), but the result is built in cache_key, an entry shared by every caller
+// of the same canonical query (see cache_key()): while the index versions recorded with
+// it still match, the script skips the evaluation. Writers bump keys::idx_versions(),
+// which invalidates it. out_key always receives a copy, so a rebuild never changes a
+// result another caller is still reading; the entry's TTL is only ever extended.
+[[nodiscard]] Result<long long> store_cached(RedisClient& r, const Plan& plan, int ttl_seconds,
+                                             std::string_view cache_key, std::string_view out_key,
+                                             std::string_view prefix = keys::kPrefixDefault) noexcept;
+
+// A caller-chosen store() destination, reused and overwritten in place by every store
+// into it instead of a new tmp key per query: it must be under keys::tmp_prefix(), not
+// a cache entry (shared by every caller of its query) and not under keys::scratch()
+// (deleted by the next query script). kInvalidArg otherwise.
+[[nodiscard]] Result<Unit> check_output_key(std::string_view key,
+                                            std::string_view prefix = keys::kPrefixDefault) noexcept;
+
+// Early release of stored results, ahead of their TTL: one UNLINK of every key. Only
+// keys a caller owns are accepted, the ones check_output_key() allows (store and
+// store_cached results, --into keys); anything else, cache entries included, is
+// kInvalidArg and nothing is removed. Returns how many keys existed.
+[[nodiscard]] Result<long long> release(RedisClient& r, std::span<const std::string_view> keys,
+                                        std::string_view prefix = keys::kPrefixDefault) noexcept;
+
+} // namespace er::query
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "er/RedisClient.hpp"
+#include "er/result.hpp"
+
+namespace er {
+
+// Fixed-size pool of RedisClient connections, safe to share between threads.
+//
+// acquire() hands out one connection exclusively until the Lease is destroyed, so
+// each RedisClient is still used by one thread at a time. A connection that failed
+// with Errc::kRedisIo is dropped (Lease::discard, or automatically by run()) and
+// reconnected on its next acquire.
+class RedisPool {
+public:
+    static constexpr std::size_t kDefaultSize = 4;
+
+    class Lease;
+
+    [[nodiscard]] static Result<RedisPool> create(std::string host, int port, std::size_t size = kDefaultSize,
+                                                  int timeout_ms = 2000) noexcept;
+
+    ~RedisPool();
+    RedisPool(RedisPool&&) noexcept;
+    RedisPool& operator=(RedisPool&&) noexcept;
+    RedisPool(const RedisPool&) = delete;
+    RedisPool& operator=(const RedisPool&) = delete;
+
+    std::size_t size() const noexcept;
+
+    // Blocks until a connection is free. Fails only when a dropped connection cannot
+    // be re-established (the slot stays free for the next attempt).
+    [[nodiscard]] Result<Lease> acquire() noexcept;
+
+    // PINGs every idle connection and reconnects the ones that fail or were dropped.
+    // Returns how many of the checked connections are healthy.
+    [[nodiscard]] Result<std::size_t> health_check() noexcept;
+
+    // Per-command stats (see RedisClient::enable_stats) for every connection. Each
+    // lease's counters are folded into the pool's when it is returned.
+    void enable_stats(bool on = true) noexcept;
+    // Copy of the counters of all returned leases.
+    Stats stats() const;
+
+    // Every connection's script SHAs go to (and come from) cache, so each script is
+    // loaded once per pool rather than once per connection (see ScriptCache).
+    void share_scripts(std::shared_ptr<ScriptCache> cache) noexcept;
+
+    // fn(RedisClient&) -> Result<T> on a leased connection, dropping it on kRedisIo.
+    template <class Fn>
+    auto run(Fn&& fn) -> std::invoke_result_t<Fn&, RedisClient&>;
+
+    // Executor: fn(RedisClient&, i) -> Result<T> for every i in [0, n), spread over up
+    // to size() threads that each hold one connection. Results are in index order.
+    // Tasks must be independent: their relative order across threads is unspecified.
+    // Do not call it (or acquire()) while this thread holds a Lease of a size-1 pool.
+    template <class Fn>
+    auto map(std::size_t n, Fn&& fn) -> std::vector<std::invoke_result_t<Fn&, RedisClient&, std::size_t>>;
+
+private:
+    struct State;
+
+    explicit RedisPool(std::unique_ptr<State> state) noexcept;
+
+    std::unique_ptr<State> state_;
+};
+
+class RedisPool::Lease {
+public:
+    ~Lease();
+    Lease(Lease&& other) noexcept;
+    Lease& operator=(Lease&&) = delete;
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+
+    RedisClient& operator*() const noexcept { return *client_; }
+    RedisClient* operator->() const noexcept { return client_; }
+    // False after discard().
+    bool valid() const noexcept { return client_ != nullptr; }
+
+    // Closes the connection instead of returning it; the slot reconnects on next use.
+    void discard() noexcept;
+    // discard() when err is a transport error (the connection state is unknown).
+    void check(const Error& err) noexcept {
+        if (err.code == Errc::kRedisIo) discard();
+    }
+
+private:
+    friend class RedisPool;
+    Lease(State* state, std::size_t slot, RedisClient* client) noexcept
+        : state_(state), slot_(slot), client_(client) {}
+
+    State* state_;
+    std::size_t slot_;
+    RedisClient* client_;
+};
+
+template <class Fn>
+auto RedisPool::run(Fn&& fn) -> std::invoke_result_t<Fn&, RedisClient&> {
+    using R = std::invoke_result_t<Fn&, RedisClient&>;
+    auto lease = acquire();
+    if (!lease) return R::err(lease.error().code, lease.error().msg);
+    Lease l = std::move(lease).value();
+    R r = fn(*l);
+    if (!r) l.check(r.error());
+    return r;
+}
+
+template <class Fn>
+auto RedisPool::map(std::size_t n, Fn&& fn) -> std::vector<std::invoke_result_t<Fn&, RedisClient&, std::size_t>> {
+    using R = std::invoke_result_t<Fn&, RedisClient&, std::size_t>;
+    std::vector<std::optional<R>> slots(n);
+    std::atomic<std::size_t> next{0};
+
+    // each worker leases one connection and pulls task indices until none are left;
+    // a connection dropped by a task is replaced before the next one
+    const auto worker = [&] {
+        std::optional<Lease> lease;
+        for (std::size_t i = next++; i < n; i = next++) {
+            if (!lease || !lease->valid()) {
+                lease.reset();
+                auto got = acquire();
+                if (!got) {
+                    slots[i].emplace(R::err(got.error().code, got.error().msg));
+                    continue;
+                }
+                lease.emplace(std::move(got).value());
+            }
+            slots[i].emplace(fn(**lease, i));
+            if (!*slots[i]) lease->check(slots[i]->error());
+        }
+    };
+
+    const std::size_t workers = std::min(n, size());
+    std::vector<std::thread> threads;
+    threads.reserve(workers > 0 ? workers - 1 : 0);
+    for (std::size_t t = 1; t < workers; ++t) {
+        try {
+            threads.emplace_back(worker);
+        } catch (const std::system_error&) {
+            break;   // the workers already running (and this thread) take the rest
+        }
+    }
+    if (n > 0) worker();
+    for (auto& t : threads) t.join();
+
+    std::vector<R> out;
+    out.reserve(n);
+    for (auto& s : slots) out.push_back(std::move(*s));
+    return out;
+}
+
+} // namespace er
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "er/Flags4096.hpp"
+#include "er/RedisClient.hpp"
+#include "er/keys.hpp"
+#include "er/query.hpp"
+#include "er/redis_pool.hpp"
+#include "er/result.hpp"
+
+namespace er {
+
+// Redis Cluster hash slot of a key (CRC16-XMODEM mod 16384), honouring {hash tags}.
+[[nodiscard]] std::uint16_t hash_slot(std::string_view key) noexcept;
+
+// Elements partitioned by name hash into S shards, each a complete index of its own
+// under keys::shard_prefix(s) ("{er:s3}:element:<name>", "{er:s3}:idx:bit:N",
+// "{er:s3}:all", ...). The hash tag keeps each shard in one cluster slot, so the
+// existing atomic scripts run unchanged per shard.
+//
+// Queries scatter the same per-shard script to every shard in parallel (one thread
+// per node, RedisPool::map within a node) and merge members or counts client-side.
+// Each shard is evaluated atomically, the whole query is not: a concurrent put can
+// be seen by one shard's result and not by another's.
+//
+// Set postings only (IndexBackend::kSet); no *_store queries, a result spans shards.
+class ShardedIndex {
+public:
+    static constexpr std::size_t kDefaultShards = 16;
+
+    struct Endpoint {
+        std::string host;
+        int port{6379};
+    };
+
+    // Independent (non-cluster) nodes: shard s lives on nodes[s % nodes.size()].
+    [[nodiscard]] static Result<ShardedIndex> create(const std::vector<Endpoint>& nodes,
+                                                     std::size_t shards = kDefaultShards,
+                                                     std::size_t connections_per_node = 2,
+                                                     std::string_view prefix = keys::kPrefixDefault) noexcept;
+    // Redis Cluster through one seed node: every shard goes to the master serving its
+    // hash slot (CLUSTER SLOTS). A seed that is not a cluster node holds all shards.
+    // The slot map is read once: after a resharding, create a new index.
+    [[nodiscard]] static Result<ShardedIndex> connect(const Endpoint& seed,
+                                                      std::size_t shards = kDefaultShards,
+                                                      std::size_t connections_per_node = 2,
+                                                      std::string_view prefix = keys::kPrefixDefault) noexcept;
+
+    std::size_t shards() const noexcept { return prefixes_.size(); }
+    std::size_t nodes() const noexcept { return nodes_.size(); }
+    // Stable across processes and releases (FNV-1a of the name).
+    [[nodiscard]] std::size_t shard_of(std::string_view name) const noexcept;
+    const std::string& shard_prefix(std::size_t shard) const noexcept { return prefixes_[shard]; }
+
+    // RedisClient::upsert_element / element_flags on the element's shard.
+    [[nodiscard]] Result<UpsertResult> put(std::string_view name, const Flags4096& flags) noexcept;
+    [[nodiscard]] Result<Flags4096> get(std::string_view name) noexcept;
+
+    // query::members / query::count on every shard. With limit > 0 each shard stops
+    // at limit and the merged result is capped at limit. Members are in shard order.
+    [[nodiscard]] Result<std::vector<std::string>> members(const query::Node& root, std::size_t limit = 0) noexcept;
+    [[nodiscard]] Result<long long> count(const query::Node& root, std::size_t limit = 0) noexcept;
+
+private:
+    ShardedIndex() = default;
+
+    [[nodiscard]] static Result<ShardedIndex> build(const std::vector<Endpoint>& nodes,
+                                                    std::vector<std::size_t> node_of, std::size_t connections_per_node,
+                                                    std::string_view prefix) noexcept;
+
+    // fn(RedisClient&, shard) for every shard; results in shard order.
+    template <class Fn>
+    auto scatter(Fn&& fn) -> std::vector<std::invoke_result_t<Fn&, RedisClient&, std::size_t>>;
+
+    std::vector<RedisPool> nodes_{};
+    std::vector<std::size_t> node_of_{};                   // shard -> node
+    std::vector<std::vector<std::size_t>> node_shards_{};  // node -> its shards
+    std::vector<std::string> prefixes_{};                  // shard -> keys::shard_prefix
+};
+
+} // namespace er
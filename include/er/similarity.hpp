@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "er/Flags4096.hpp"
+#include "er/RedisClient.hpp"
+#include "er/result.hpp"
+#include "er/snapshot.hpp"
+
+namespace er {
+
+// Jaccard: |a & b| / |a | b| (higher is closer). Hamming: |a ^ b| (lower is closer).
+enum class Metric { kJaccard, kHamming };
+
+[[nodiscard]] Result<Metric> parse_metric(std::string_view s) noexcept;
+
+[[nodiscard]] double similarity_score(Metric metric, const Flags4096& a, const Flags4096& b) noexcept;
+
+struct Match {
+    std::string name{};
+    double score{0};   // Jaccard similarity or Hamming distance, per the metric
+};
+
+// Top-k nearest elements to `query`, closest first (ties by name). `exclude` is
+// skipped, typically the element the query flags came from. Each scorer keeps a
+// bounded heap of k, so memory stays O(k) however many candidates are scored.
+//
+// Against Redis the candidates are the union of the query's bit postings in
+// `backend` (elements sharing at least one bit), scored from their flags in
+// pipelined pages. With Hamming an element sharing no bit is never a candidate,
+// however close its popcount is.
+[[nodiscard]] Result<std::vector<Match>> similar(RedisClient& redis, const Flags4096& query, std::size_t k,
+                                                 Metric metric, std::string_view exclude = {},
+                                                 IndexBackend backend = IndexBackend::kSet,
+                                                 std::string_view prefix = keys::kPrefixDefault) noexcept;
+// Same over every row of a snapshot (no candidate filter), on several threads.
+[[nodiscard]] std::vector<Match> similar(const Snapshot& snap, const Flags4096& query, std::size_t k,
+                                         Metric metric, std::string_view exclude = {}, unsigned threads = 0);
+
+} // namespace er
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "er/Flags4096.hpp"
+#include "er/RedisClient.hpp"
+#include "er/result.hpp"
+
+namespace er {
+
+// Row predicate over flags: every `all` bit set, at least one `any` bit set (when
+// `any` is non-empty) and no `none` bit set. find_all / find_any / find_not are
+// the single-mask cases.
+struct Predicate {
+    Flags4096 all{};
+    Flags4096 any{};
+    Flags4096 none{};
+
+    [[nodiscard]] static Result<Predicate> all_of(std::span<const std::size_t> bits) noexcept;
+    [[nodiscard]] static Result<Predicate> any_of(std::span<const std::size_t> bits) noexcept;
+    [[nodiscard]] static Result<Predicate> none_of(std::span<const std::size_t> bits) noexcept;
+};
+
+// Client-side, read-only copy of every element's flags for scan-style queries.
+//
+// load() walks er:all with SSCAN and pipelines one HMGET flags_bin/flags_hex per
+// page, so the whole table costs one round trip per page. Rows are stored as one
+// contiguous, 64-byte aligned array of Flags4096 (512 B per row) next to a packed
+// name table; queries then never touch Redis and run at memory bandwidth.
+//
+// The snapshot is not kept in sync with Redis: it reflects er:all at load time
+// (elements written during the load may or may not be included). Reload to refresh.
+//
+// save() / open() persist it as one file (format in snapshot.cpp): a header, the rows
+// in Flags4096's own little-endian word layout at a 64-byte aligned offset, and the
+// name table. open() maps the file read-only and scans it in place, so a cold start
+// costs the page-ins plus one checksum pass. Copies share the rows (read-only).
+class Snapshot {
+public:
+    // Rows scanned per thread before splitting the work further is not worth it.
+    static constexpr std::size_t kMinRowsPerThread = 16384;
+
+    Snapshot() = default;
+
+    [[nodiscard]] static Result<Snapshot> load(RedisClient& redis,
+                                               std::size_t page = RedisClient::kDefaultScanCount,
+                                               std::string_view prefix = keys::kPrefixDefault) noexcept;
+
+    // Writes path atomically (a temporary file next to it, then rename).
+    [[nodiscard]] Result<Unit> save(const std::string& path) const noexcept;
+    // Maps a save()d file. verify = false skips the checksum pass (pages then load lazily).
+    [[nodiscard]] static Result<Snapshot> open(const std::string& path, bool verify = true) noexcept;
+
+    std::size_t size() const noexcept { return rows_.size(); }
+    bool empty() const noexcept { return rows_.empty(); }
+    std::string_view name(std::size_t row) const noexcept;
+    const Flags4096& flags(std::size_t row) const noexcept { return rows_[row]; }
+
+    // Matching row indices in row order. threads == 0 uses the hardware concurrency;
+    // limit > 0 stops after that many matches (the first ones in row order).
+    [[nodiscard]] std::vector<std::size_t> find(const Predicate& pred, std::size_t limit = 0,
+                                                unsigned threads = 0) const;
+    // Same, resolved to names.
+    [[nodiscard]] std::vector<std::string> find_names(const Predicate& pred, std::size_t limit = 0,
+                                                      unsigned threads = 0) const;
+    [[nodiscard]] std::size_t count(const Predicate& pred, unsigned threads = 0) const;
+
+    // Building blocks of the scans above, for other row-wise passes (e.g. similar()).
+    // partitions(): range count for a thread request (0 = hardware concurrency),
+    // capped so each range has at least kMinRowsPerThread rows.
+    // for_each_range(): fn(begin, end, part) per range, one thread each; the calling
+    // thread takes part 0, and a range whose thread cannot start runs inline.
+    [[nodiscard]] unsigned partitions(unsigned threads) const noexcept;
+    template <class Fn>
+    void for_each_range(unsigned parts, Fn&& fn) const;
+
+private:
+    struct Storage;   // owns the arrays below: vectors from load(), or a file mapping
+
+    std::shared_ptr<const Storage> store_{};
+    std::span<const Flags4096> rows_{};            // Flags4096 is alignas(64): rows are cache-line aligned
+    std::string_view names_{};                     // all names back to back
+    std::span<const std::uint32_t> name_offsets_{};  // size() + 1 offsets into names_
+};
+
+template <class Fn>
+void Snapshot::for_each_range(unsigned parts, Fn&& fn) const {
+    const std::size_t rows = rows_.size();
+    const std::size_t step = (rows + parts - 1) / parts;
+    std::vector<std::thread> workers;
+    workers.reserve(parts - 1);
+    for (unsigned t = 1; t < parts; ++t) {
+        const std::size_t begin = std::min(rows, t * step);
+        const std::size_t end = std::min(rows, begin + step);
+        try {
+            workers.emplace_back([&fn, begin, end, t] { fn(begin, end, t); });
+        } catch (const std::system_error&) {
+            fn(begin, end, t);
+        }
+    }
+    fn(std::size_t{0}, std::min(rows, step), 0u);
+    for (auto& w : workers) w.join();
+}
+
+} // namespace er
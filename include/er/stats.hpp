@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace er {
+
+// Log-linear latency histogram (HDR style): 16 sub-buckets per power of two, so a
+// percentile is within ~6% of the true value. Values are nanoseconds; anything
+// above ~18 minutes lands in the last bucket.
+class LatencyHistogram {
+public:
+    void record(std::uint64_t ns) noexcept;
+    void merge(const LatencyHistogram& other) noexcept;
+
+    std::uint64_t count() const noexcept { return count_; }
+    std::uint64_t max() const noexcept { return max_; }
+    // Upper bound of the bucket holding the p-th percentile (p in [0, 100]); 0 if empty.
+    std::uint64_t percentile(double p) const noexcept;
+
+private:
+    static constexpr unsigned kSubBits = 4;
+    static constexpr unsigned kMaxExponent = 40;   // 2^40 ns
+    static constexpr std::size_t kBuckets = (kMaxExponent - kSubBits + 2) << kSubBits;
+
+    static std::size_t bucket_of(std::uint64_t ns) noexcept;
+    static std::uint64_t bucket_upper(std::size_t bucket) noexcept;
+
+    std::array<std::uint64_t, kBuckets> buckets_{};
+    std::uint64_t count_{0};
+    std::uint64_t max_{0};
+};
+
+struct CommandStats {
+    std::uint64_t calls{0};
+    std::uint64_t errors{0};           // I/O failures and error replies
+    std::uint64_t bytes_sent{0};       // RESP request size
+    std::uint64_t bytes_received{0};   // RESP size of the replies (RESP2 framing)
+    std::uint64_t reply_elements{0};   // top-level elements of array replies
+    LatencyHistogram latency{};        // write + wait + hiredis parse
+    LatencyHistogram decode{};         // reply -> std types, where a command has that step
+};
+
+// Per-command-type counters of one RedisClient (see RedisClient::enable_stats).
+// Commands are keyed by name ("HGET", "EVALSHA", ...); pipelines count as one
+// "PIPELINE" call per exec with one reply element per command.
+class Stats {
+public:
+    using Entry = std::pair<std::string, CommandStats>;
+
+    // Entry for op, created on first use.
+    CommandStats& at(std::string_view op);
+    const std::vector<Entry>& commands() const noexcept { return commands_; }
+    bool empty() const noexcept { return commands_.empty(); }
+
+    void merge(const Stats& other);
+    void reset() noexcept { commands_.clear(); }
+
+    // {"HGET":{"calls":..,"errors":..,"bytes_sent":..,"bytes_received":..,
+    //  "reply_elements":..,"latency_us":{"p50":..,"p90":..,"p99":..,"p999":..,"max":..},
+    //  "decode_us":{...}}, ...} -- decode_us only for commands that recorded it.
+    void append_json(std::string& out) const;
+    std::string json() const;
+
+private:
+    std::vector<Entry> commands_{};   // few command types: linear lookup
+};
+
+} // namespace er
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+namespace er {
+
+// Eager coroutine task: the body runs as soon as the task is created, up to its first
+// suspension, so a command is already on the wire when the call returns. Start many
+// tasks, then co_await them, to keep many requests in flight on one thread.
+//
+// co_await a task (once) from another coroutine, or drive it with EventLoop::run.
+// A task dropped before it completes finishes on its own and frees itself.
+// T is normally an er::Result<...>; the core does not throw, so an escaping
+// exception terminates.
+template <class T>
+class [[nodiscard]] Task {
+public:
+    struct promise_type;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+        std::coroutine_handle<> await_suspend(Handle h) noexcept {
+            auto& p = h.promise();
+            if (p.detached) {
+                h.destroy();
+                return std::noop_coroutine();
+            }
+            return p.waiter ? p.waiter : std::noop_coroutine();
+        }
+        void await_resume() const noexcept {}
+    };
+
+    struct promise_type {
+        std::optional<T> value{};
+        std::coroutine_handle<> waiter{};
+        bool detached{false};
+
+        Task get_return_object() noexcept { return Task(Handle::from_promise(*this)); }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        FinalAwaiter final_suspend() const noexcept { return {}; }
+        template <class U>
+        void return_value(U&& v) {
+            value.emplace(std::forward<U>(v));
+        }
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+
+    Task(Task&& other) noexcept : h_(std::exchange(other.h_, {})) {}
+    Task& operator=(Task&&) = delete;
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        if (!h_) return;
+        if (h_.done()) h_.destroy();
+        else h_.promise().detached = true;
+    }
+
+    bool done() const noexcept { return !h_ || h_.done(); }
+
+    bool await_ready() const noexcept { return h_.done(); }
+    void await_suspend(std::coroutine_handle<> waiter) noexcept { h_.promise().waiter = waiter; }
+    T await_resume() { return std::move(*h_.promise().value); }
+
+    // Result of a completed task (done() must be true); moves it out.
+    T take() { return std::move(*h_.promise().value); }
+
+private:
+    explicit Task(Handle h) noexcept : h_(h) {}
+
+    Handle h_;
+};
+
+} // namespace er
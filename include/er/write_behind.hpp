@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#include "er/Flags4096.hpp"
+#include "er/bulk_writer.hpp"
+#include "er/keys.hpp"
+#include "er/redis_pool.hpp"
+#include "er/result.hpp"
+
+namespace er {
+
+struct WriteBehindOptions {
+    std::size_t max_pending = 100000;   // distinct queued names; put() blocks beyond it
+    std::chrono::milliseconds max_latency{50};   // oldest queued put waits at most this long
+    std::size_t batch_size = BulkWriter::kDefaultBatchSize;   // names per drained batch
+};
+
+struct WriteBehindStats {
+    std::uint64_t puts{0};        // accepted by put()
+    std::uint64_t coalesced{0};   // puts that replaced a still-queued put of the same name
+    std::uint64_t written{0};     // elements written to Redis
+    std::uint64_t batches{0};     // drains that reached Redis
+    std::uint64_t failures{0};    // drains that failed (their puts are queued again)
+};
+
+// Write-behind ingest: put() only queues the element's final flags and returns. One
+// background thread drains the queue through a BulkWriter on a leased connection, so
+// each name costs its share of one batched upsert script, once per drain however often
+// it was put meanwhile (last put wins).
+//
+// A drain starts when batch_size names are queued, the oldest put is max_latency old,
+// or flush() waits. A failed drain is retried after max_latency: writes are deltas
+// against the stored flags, so replaying a partly written batch is harmless.
+//
+// Reads see a put only once it is drained: flush() is the barrier. A put from another
+// writer that lands while the name is queued is overwritten by the drain.
+class WriteBehind {
+public:
+    // Writes through pool under prefix (set postings, IndexBackend::kSet). pool must
+    // outlive the queue.
+    [[nodiscard]] static Result<WriteBehind> start(RedisPool& pool, WriteBehindOptions opts = {},
+                                                   std::string_view prefix = keys::kPrefixDefault) noexcept;
+
+    // Drains what is queued (errors are dropped: flush() first to see them) and stops.
+    ~WriteBehind();
+    WriteBehind(WriteBehind&&) noexcept;
+    WriteBehind& operator=(WriteBehind&&) noexcept;
+    WriteBehind(const WriteBehind&) = delete;
+    WriteBehind& operator=(const WriteBehind&) = delete;
+
+    // Queues name's new flags. Blocks while max_pending other names are queued.
+    [[nodiscard]] Result<Unit> put(std::string_view name, const Flags4096& flags) noexcept;
+    // Returns once every put queued before the call is in Redis, or with the error of
+    // a drain that failed meanwhile (its puts stay queued for the retry).
+    [[nodiscard]] Result<Unit> flush() noexcept;
+
+    std::size_t pending() const noexcept;
+    WriteBehindStats stats() const noexcept;
+
+private:
+    struct State;
+
+    explicit WriteBehind(std::unique_ptr<State> state) noexcept;
+
+    std::unique_ptr<State> state_;
+};
+
+} // namespace er
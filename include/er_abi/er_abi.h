@@ -28,27 +28,209 @@ typedef enum er_status {
   ER_NOMEM = 5
 } er_status_t;
 
-/* lifecycle */
+/* lifecycle
+ * A handle owns a pool of Redis connections and may be used from many threads at
+ * once: each call leases one connection for its duration (calls beyond the pool
+ * size wait for a free one). er_create is er_create_pool with one connection.
+ * Connections that hit an I/O error are reconnected on their next use.
+ * er_destroy must not race with other calls on the same handle.
+ * er_create_ns puts every key of the handle under `prefix` instead of "er" (one
+ * tenant: "acme:prod" -> acme:prod:element:<name>, acme:prod:idx:bit:N, ...);
+ * words of [A-Za-z0-9_-] joined by ':', at most 128 bytes, NULL otherwise. Handles
+ * on the same prefix share its key table and script SHAs. */
 ER_ABI_API er_handle_t* er_create(const char* host, int port);
+ER_ABI_API er_handle_t* er_create_pool(const char* host, int port, size_t n_connections);
+ER_ABI_API er_handle_t* er_create_ns(const char* host, int port, size_t n_connections, const char* prefix);
 ER_ABI_API void         er_destroy(er_handle_t* h);
 ER_ABI_API int          er_ping(er_handle_t* h);
 
-/* error */
+/* error: message of the calling thread's last failed call on h ("" if none);
+ * valid until that thread's next failing call on h. Messages live in the
+ * calling thread's storage and go with the thread (or er_destroy on it). */
 ER_ABI_API const char*  er_last_error(er_handle_t* h);
 
+/* per-command stats: call counts, bytes, reply sizes and latency percentiles
+ * of every connection of h, off by default. er_stats_enable(h, 0) also clears
+ * them. er_stats_json writes one JSON object keyed by command (see er/stats.hpp)
+ * with a NUL; ER_RANGE if it does not fit in cap. Calls still in flight are
+ * counted once they finish. */
+ER_ABI_API int er_stats_enable(er_handle_t* h, int on);
+ER_ABI_API int er_stats_json(er_handle_t* h, char* buf, size_t cap);
+
 /* element ops */
 ER_ABI_API int er_put_bits(er_handle_t* h, const char* name,
                            const uint16_t* bits, size_t n_bits);
 
+/* bulk put (batched upsert scripts, each element written atomically)
+ * element i is names[i] with bits bits_flat[offsets[i] .. offsets[i+1]);
+ * offsets has n + 1 entries and offsets[n] is the length of bits_flat.
+ * Large calls are split by name across the pool's connections. */
+ER_ABI_API int er_put_many(er_handle_t* h, const char* const* names,
+                           const uint16_t* bits_flat, const size_t* offsets,
+                           size_t n);
+
+/* bulk delete: each element is removed from the postings of its stored flags,
+ * from the universe, and its hash is dropped, by one server-side script per batch
+ * of names (atomic per batch, batches run in parallel over the pool). With force,
+ * an element whose flags are missing or corrupt is scrubbed from every posting.
+ * *out_deleted (may be NULL) is the number of element hashes that existed; on
+ * error some batches may already be applied. */
+ER_ABI_API int er_del_many(er_handle_t* h, const char* const* names, size_t n,
+                           int force, uint64_t* out_deleted);
+
+/* write-behind ingest (see er/write_behind.hpp)
+ * After er_write_behind, er_put_bits / er_put_many only queue each element's final
+ * flags and return; a background thread writes them in pipelined batches, one delta
+ * per name however often it was put meanwhile (last put wins). The oldest queued put
+ * waits at most max_latency_ms; puts block while max_pending names are queued.
+ * Queries see a put once it is written: er_flush returns when every put queued before
+ * it is in Redis, or ER_ERR with the error of a failed write (those puts stay queued
+ * and are retried). er_del_many flushes first. max_pending = 0 flushes and turns the
+ * mode off. er_destroy drains the queue but cannot report errors: er_flush first. */
+ER_ABI_API int er_write_behind(er_handle_t* h, size_t max_pending, unsigned max_latency_ms);
+ER_ABI_API int er_flush(er_handle_t* h);
+
+/* element flags cache (see er/flags_cache.hpp)
+ * er_flags_cache keeps up to max_bytes of name -> flags in the handle (about 600 bytes
+ * per element, least recently used first out) for er_get_bits and er_similar; the
+ * handle's own puts and deletes keep it current. With track, writes by any client
+ * invalidate it through Redis 6+ CLIENT TRACKING (two more connections; ER_ERR when
+ * the server cannot track); without, the handle must be the only writer.
+ * max_bytes = 0 turns the cache off (calling it again also restarts tracking).
+ * er_get_bits writes the element's set bits, ascending, to out_bits and their count
+ * to *out_n (ER_RANGE when more than cap). er_flags_cache_stats counts since the
+ * cache was turned on (any pointer may be NULL); ER_REDIS once the tracking
+ * connection was lost: the cache then only misses until er_flags_cache is called. */
+ER_ABI_API int er_flags_cache(er_handle_t* h, size_t max_bytes, int track);
+ER_ABI_API int er_get_bits(er_handle_t* h, const char* name, uint16_t* out_bits, size_t cap, size_t* out_n);
+ER_ABI_API int er_flags_cache_stats(er_handle_t* h, uint64_t* out_hits, uint64_t* out_misses,
+                                    uint64_t* out_entries);
+
+/* bit statistics (see keys::idx_stats): out_counts[b] (4096 entries, may be NULL)
+ * elements with bit b, *out_universe (may be NULL) all elements, with one HMGET.
+ * With rebuild the counts are recomputed first (one script; needed once for data
+ * written before they were kept). ER_ERR while they are not built. */
+ER_ABI_API int er_bit_counts(er_handle_t* h, int rebuild, uint64_t* out_counts, uint64_t* out_universe);
+
 /* composite store (Lua, atomic) */
 ER_ABI_API int er_find_all_store(er_handle_t* h, int ttl_sec,
                                  const uint16_t* bits, size_t n_bits,
                                  char* out_tmp_key, size_t key_cap);
 
-/* read members of a set key */
+/* read members of a set key, newline-separated
+ * returns ER_RANGE as soon as the set does not fit in out_cap (out is then
+ * unspecified); use er_scan_set for sets of unknown size. Read with SSCAN, so
+ * a member may be listed twice if the set is modified during the call.
+ * Members containing '\n' are ambiguous here: er_show_set_result has no separator. */
 ER_ABI_API int er_show_set(er_handle_t* h, const char* set_key,
                            char* out, size_t out_cap);
 
+/* cursor iteration over a set key (SSCAN)
+ * reads one page: cb is called once per member (member is not NUL-terminated
+ * and only valid during the call). *cursor is 0 to start, and is updated to the
+ * cursor of the next page; 0 again means done. count is a page-size hint (0 = default). */
+typedef void (*er_member_cb)(const char* member, size_t len, void* user);
+
+ER_ABI_API int er_scan_set(er_handle_t* h, const char* set_key,
+                           uint64_t* cursor, size_t count,
+                           er_member_cb cb, void* user);
+
+/* boolean expression queries, e.g. "(12 & 40) | (7 & !99)" (see er/query.hpp);
+ * the find_all / find_any / find_not shapes are "a & b", "a | b", "a & !b".
+ * er_query_count: cardinality only, capped at limit when limit > 0.
+ * er_query_limit: at most limit members (0 = all) through cb, without the
+ * server materializing the full result when limit > 0.
+ * er_hybrid (see er/hybrid.hpp) loads a snapshot and from then on runs each
+ * query (also er_query_result and the er_find_*_result calls) in memory when
+ * its estimated result (from cached bit counts) has at least snapshot_rows members
+ * and the snapshot is current for its bits; otherwise on Redis as before.
+ * Results are the same either way. Call again to reload the snapshot; 0 turns
+ * it off. With stats on, each query counts under QUERY:redis or QUERY:snapshot. */
+ER_ABI_API int er_query_count(er_handle_t* h, const char* expr,
+                              size_t limit, uint64_t* out_count);
+
+ER_ABI_API int er_hybrid(er_handle_t* h, size_t snapshot_rows);
+
+ER_ABI_API int er_query_limit(er_handle_t* h, const char* expr,
+                              size_t limit, er_member_cb cb, void* user);
+
+/* client-side snapshot of every element's flags (see er/snapshot.hpp)
+ * er_snapshot_load reads er:all and all flags once (NULL on error, see
+ * er_last_error(h)); queries then run in memory on several threads and never
+ * touch Redis. The snapshot is independent of h and not refreshed: reload it.
+ * A row matches when it has every all_bits bit, at least one any_bits bit
+ * (when n_any > 0) and no none_bits bit. er_snapshot_find calls cb for at
+ * most limit matches (0 = all), in snapshot order.
+ * er_snapshot_save writes s to path (atomically, checksummed; er_cli export
+ * writes the same format) and er_snapshot_open maps such a file read-only
+ * without Redis: h only receives the error and may be NULL. verify = 0 skips
+ * the checksum pass. */
+typedef struct er_snapshot er_snapshot_t;
+
+ER_ABI_API er_snapshot_t* er_snapshot_load(er_handle_t* h);
+ER_ABI_API er_snapshot_t* er_snapshot_open(er_handle_t* h, const char* path, int verify);
+ER_ABI_API int            er_snapshot_save(er_handle_t* h, const er_snapshot_t* s, const char* path);
+ER_ABI_API void           er_snapshot_destroy(er_snapshot_t* s);
+ER_ABI_API size_t         er_snapshot_size(const er_snapshot_t* s);
+
+ER_ABI_API int er_snapshot_count(const er_snapshot_t* s,
+                                 const uint16_t* all_bits, size_t n_all,
+                                 const uint16_t* any_bits, size_t n_any,
+                                 const uint16_t* none_bits, size_t n_none,
+                                 uint64_t* out_count);
+
+ER_ABI_API int er_snapshot_find(const er_snapshot_t* s,
+                                const uint16_t* all_bits, size_t n_all,
+                                const uint16_t* any_bits, size_t n_any,
+                                const uint16_t* none_bits, size_t n_none,
+                                size_t limit, er_member_cb cb, void* user);
+
+/* top-k most similar elements to an existing element (see er/similarity.hpp)
+ * metric: ER_METRIC_JACCARD (score = similarity, closest first) or
+ * ER_METRIC_HAMMING (score = distance, closest first). The element itself is
+ * excluded. With snap == NULL the candidates are the elements sharing a bit
+ * with name; otherwise every snapshot row is scored in memory. cb gets at most
+ * k matches in rank order. */
+typedef enum er_metric {
+  ER_METRIC_JACCARD = 0,
+  ER_METRIC_HAMMING = 1
+} er_metric_t;
+
+typedef void (*er_scored_cb)(const char* member, size_t len, double score, void* user);
+
+ER_ABI_API int er_similar(er_handle_t* h, const er_snapshot_t* snap,
+                          const char* name, size_t k, int metric,
+                          er_scored_cb cb, void* user);
+
+/* arena-backed results: members as one byte buffer plus offsets, no callback
+ * and no separator, so members may contain any byte (newlines included).
+ * Member i is data[offsets[i] .. offsets[i+1]) (not NUL-terminated); offsets
+ * has count + 1 entries, offsets[0] == 0 and offsets[count] == the data size.
+ * The buffers are owned by the result and valid until er_result_free, which
+ * hands the arena back to h for reuse by later calls (any thread). Free every
+ * result before er_destroy(h). *out is set only on ER_OK. */
+typedef struct er_result er_result_t;
+
+ER_ABI_API void            er_result_free(er_result_t* res);
+ER_ABI_API size_t          er_result_count(const er_result_t* res);
+ER_ABI_API const char*     er_result_data(const er_result_t* res, size_t* out_bytes);
+ER_ABI_API const uint64_t* er_result_offsets(const er_result_t* res);
+
+/* all members of a set key (SSCAN; see er_show_set about concurrent changes) */
+ER_ABI_API int er_show_set_result(er_handle_t* h, const char* set_key, er_result_t** out);
+
+/* er_query_limit into a result: at most limit members (0 = all) */
+ER_ABI_API int er_query_result(er_handle_t* h, const char* expr, size_t limit, er_result_t** out);
+
+/* members of the er_find_*_store shapes in one call, without storing a tmp key:
+ * all / any of the bits, or not (universe \ bits). At most limit members (0 = all). */
+ER_ABI_API int er_find_all_result(er_handle_t* h, const uint16_t* bits, size_t n_bits,
+                                  size_t limit, er_result_t** out);
+ER_ABI_API int er_find_any_result(er_handle_t* h, const uint16_t* bits, size_t n_bits,
+                                  size_t limit, er_result_t** out);
+ER_ABI_API int er_find_not_result(er_handle_t* h, const uint16_t* bits, size_t n_bits,
+                                  size_t limit, er_result_t** out);
+
 int er_find_any_store(er_handle_t* h, int ttl_seconds,
                       const uint16_t* bits, size_t n_bits,
                       char* out_tmp_key, size_t key_cap);
@@ -57,6 +239,28 @@ int er_find_not_store(er_handle_t* h, int ttl_seconds,
                       const uint16_t* bits, size_t n_bits,
                       char* out_tmp_key, size_t key_cap);
 
+/* the er_find_*_store shapes into a caller-chosen key, overwritten in place on
+ * every call, so repeated queries reuse one key instead of creating their own.
+ * out_key must be under "er:tmp:", not a cache entry ("er:tmp:cache:*") and not
+ * a script scratch key ("er:tmp:scratch:*"), else ER_BADARG. An empty result deletes out_key. *out_count (may be NULL) is
+ * the stored cardinality. */
+ER_ABI_API int er_find_all_store_into(er_handle_t* h, int ttl_sec,
+                                      const uint16_t* bits, size_t n_bits,
+                                      const char* out_key, uint64_t* out_count);
+ER_ABI_API int er_find_any_store_into(er_handle_t* h, int ttl_sec,
+                                      const uint16_t* bits, size_t n_bits,
+                                      const char* out_key, uint64_t* out_count);
+ER_ABI_API int er_find_not_store_into(er_handle_t* h, int ttl_sec,
+                                      const uint16_t* bits, size_t n_bits,
+                                      const char* out_key, uint64_t* out_count);
+
+/* early release of stored results (er_find_*_store keys, store_into keys) ahead
+ * of their TTL: one UNLINK of all n keys. Every key must be one a store_into call
+ * accepts (shared cache entries are refused), else ER_BADARG and nothing is
+ * removed. *out_released (may be NULL) is how many keys existed. */
+ER_ABI_API int er_release_tmp(er_handle_t* h, const char* const* keys, size_t n,
+                              uint64_t* out_released);
+
 
 #ifdef __cplusplus
 }
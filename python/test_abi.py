@@ -1,11 +1,32 @@
 import ctypes as C
-from ctypes import c_char_p, c_int, c_size_t, c_uint16, POINTER
+from ctypes import c_char_p, c_int, c_size_t, c_uint16, c_uint64, c_void_p, POINTER
 
 lib = C.CDLL("./build/liber_abi.so")
 
 lib.er_create.restype = C.c_void_p
 lib.er_create.argtypes = [c_char_p, c_int]
 
+lib.er_create_pool.restype = C.c_void_p
+lib.er_create_pool.argtypes = [c_char_p, c_int, c_size_t]
+
+lib.er_create_ns.restype = C.c_void_p
+lib.er_create_ns.argtypes = [c_char_p, c_int, c_size_t, c_char_p]
+
+lib.er_write_behind.argtypes = [C.c_void_p, c_size_t, C.c_uint]
+lib.er_write_behind.restype = c_int
+lib.er_flush.argtypes = [C.c_void_p]
+lib.er_flush.restype = c_int
+
+lib.er_flags_cache.argtypes = [C.c_void_p, c_size_t, c_int]
+lib.er_flags_cache.restype = c_int
+lib.er_get_bits.argtypes = [C.c_void_p, c_char_p, POINTER(c_uint16), c_size_t, POINTER(c_size_t)]
+lib.er_get_bits.restype = c_int
+lib.er_flags_cache_stats.argtypes = [C.c_void_p, POINTER(c_uint64), POINTER(c_uint64), POINTER(c_uint64)]
+lib.er_flags_cache_stats.restype = c_int
+lib.er_hybrid.argtypes = [C.c_void_p, c_size_t]
+lib.er_hybrid.restype = c_int
+lib.er_bit_counts.argtypes = [C.c_void_p, c_int, POINTER(c_uint64), POINTER(c_uint64)]
+lib.er_bit_counts.restype = c_int
 lib.er_destroy.argtypes = [C.c_void_p]
 lib.er_ping.argtypes = [C.c_void_p]
 lib.er_ping.restype = c_int
@@ -13,14 +34,89 @@ lib.er_ping.restype = c_int
 lib.er_put_bits.argtypes = [C.c_void_p, c_char_p, POINTER(c_uint16), c_size_t]
 lib.er_put_bits.restype = c_int
 
+lib.er_put_many.argtypes = [
+    C.c_void_p, POINTER(c_char_p), POINTER(c_uint16), POINTER(c_size_t), c_size_t
+]
+lib.er_put_many.restype = c_int
+
 lib.er_find_all_store.argtypes = [
     C.c_void_p, c_int, POINTER(c_uint16), c_size_t, c_char_p, c_size_t
 ]
 lib.er_find_all_store.restype = c_int
+lib.er_find_all_store_into.argtypes = [
+    C.c_void_p, c_int, POINTER(c_uint16), c_size_t, c_char_p, POINTER(c_uint64)
+]
+lib.er_find_all_store_into.restype = c_int
+lib.er_release_tmp.argtypes = [C.c_void_p, POINTER(c_char_p), c_size_t, POINTER(c_uint64)]
+lib.er_release_tmp.restype = c_int
 
 lib.er_show_set.argtypes = [C.c_void_p, c_char_p, c_char_p, c_size_t]
 lib.er_show_set.restype = c_int
 
+MEMBER_CB = C.CFUNCTYPE(None, C.POINTER(C.c_char), c_size_t, c_void_p)
+lib.er_scan_set.argtypes = [C.c_void_p, c_char_p, POINTER(c_uint64), c_size_t, MEMBER_CB, c_void_p]
+lib.er_scan_set.restype = c_int
+
+lib.er_query_count.argtypes = [C.c_void_p, c_char_p, c_size_t, POINTER(c_uint64)]
+lib.er_query_count.restype = c_int
+lib.er_query_limit.argtypes = [C.c_void_p, c_char_p, c_size_t, MEMBER_CB, c_void_p]
+lib.er_query_limit.restype = c_int
+
+lib.er_snapshot_load.restype = C.c_void_p
+lib.er_snapshot_load.argtypes = [C.c_void_p]
+lib.er_snapshot_destroy.argtypes = [C.c_void_p]
+lib.er_snapshot_open.restype = C.c_void_p
+lib.er_snapshot_open.argtypes = [C.c_void_p, c_char_p, c_int]
+lib.er_snapshot_save.argtypes = [C.c_void_p, C.c_void_p, c_char_p]
+lib.er_snapshot_save.restype = c_int
+lib.er_snapshot_size.restype = c_size_t
+lib.er_snapshot_size.argtypes = [C.c_void_p]
+lib.er_snapshot_count.argtypes = [
+    C.c_void_p, POINTER(c_uint16), c_size_t, POINTER(c_uint16), c_size_t,
+    POINTER(c_uint16), c_size_t, POINTER(c_uint64)
+]
+lib.er_snapshot_count.restype = c_int
+lib.er_snapshot_find.argtypes = [
+    C.c_void_p, POINTER(c_uint16), c_size_t, POINTER(c_uint16), c_size_t,
+    POINTER(c_uint16), c_size_t, c_size_t, MEMBER_CB, c_void_p
+]
+lib.er_snapshot_find.restype = c_int
+
+SCORED_CB = C.CFUNCTYPE(None, C.POINTER(C.c_char), c_size_t, C.c_double, c_void_p)
+lib.er_similar.argtypes = [C.c_void_p, C.c_void_p, c_char_p, c_size_t, c_int, SCORED_CB, c_void_p]
+lib.er_similar.restype = c_int
+
+lib.er_result_free.argtypes = [C.c_void_p]
+lib.er_result_count.restype = c_size_t
+lib.er_result_count.argtypes = [C.c_void_p]
+lib.er_result_data.restype = C.c_void_p
+lib.er_result_data.argtypes = [C.c_void_p, POINTER(c_size_t)]
+lib.er_result_offsets.restype = POINTER(c_uint64)
+lib.er_result_offsets.argtypes = [C.c_void_p]
+lib.er_show_set_result.argtypes = [C.c_void_p, c_char_p, POINTER(C.c_void_p)]
+lib.er_show_set_result.restype = c_int
+lib.er_query_result.argtypes = [C.c_void_p, c_char_p, c_size_t, POINTER(C.c_void_p)]
+lib.er_query_result.restype = c_int
+lib.er_find_all_result.argtypes = [C.c_void_p, POINTER(c_uint16), c_size_t, c_size_t, POINTER(C.c_void_p)]
+lib.er_find_all_result.restype = c_int
+lib.er_del_many.argtypes = [C.c_void_p, POINTER(c_char_p), c_size_t, c_int, POINTER(c_uint64)]
+lib.er_del_many.restype = c_int
+lib.er_stats_enable.argtypes = [C.c_void_p, c_int]
+lib.er_stats_enable.restype = c_int
+lib.er_stats_json.argtypes = [C.c_void_p, c_char_p, c_size_t]
+lib.er_stats_json.restype = c_int
+
+
+def result_members(res):
+    """Members of an er_result_t as bytes, through zero-copy views of its arena."""
+    count = lib.er_result_count(res)
+    size = c_size_t(0)
+    base = lib.er_result_data(res, C.byref(size))
+    view = memoryview((C.c_ubyte * size.value).from_address(base)) if size.value else memoryview(b"")
+    offs = lib.er_result_offsets(res)
+    return [bytes(view[offs[i]:offs[i + 1]]) for i in range(count)]
+
+
 h = lib.er_create(b"redis", 6379)
 assert h
 assert lib.er_ping(h) == 0
@@ -28,6 +124,13 @@ assert lib.er_ping(h) == 0
 bits = (c_uint16 * 2)(42, 7)
 assert lib.er_put_bits(h, b"a", bits, 2) == 0
 
+names = (c_char_p * 2)(b"b", b"c")
+flat = (c_uint16 * 3)(42, 7, 7)
+offsets = (c_size_t * 3)(0, 2, 3)
+assert lib.er_put_many(h, names, flat, offsets, 2) == 0
+bad = (c_char_p * 2)(b"d", b"")
+assert lib.er_put_many(h, bad, flat, offsets, 2) == 2   # ER_BADARG, nothing written
+
 bits2 = (c_uint16 * 2)(42, 7)
 tmp = C.create_string_buffer(256)
 assert lib.er_find_all_store(h, 10, bits2, 2, tmp, len(tmp)) == 0
@@ -36,5 +139,221 @@ out = C.create_string_buffer(1024)
 assert lib.er_show_set(h, tmp.value, out, len(out)) == 0
 print("RESULTS:\n", out.value.decode())
 
+scanned = []
+on_member = MEMBER_CB(lambda p, n, _user: scanned.append(C.string_at(p, n).decode()))
+cursor = c_uint64(0)
+while True:
+    assert lib.er_scan_set(h, tmp.value, C.byref(cursor), 100, on_member, None) == 0
+    if cursor.value == 0:
+        break
+print("SCANNED:", sorted(set(scanned)))
+
+res = C.c_void_p()
+assert lib.er_show_set_result(h, tmp.value, C.byref(res)) == 0
+assert sorted(set(m.decode() for m in result_members(res))) == sorted(set(scanned))
+lib.er_result_free(res)
+assert lib.er_find_all_result(h, bits2, 2, 0, C.byref(res)) == 0
+assert sorted(m.decode() for m in result_members(res)) == sorted(set(scanned))
+lib.er_result_free(res)
+
+n = c_uint64(0)
+assert lib.er_query_count(h, b"42 & 7", 0, C.byref(n)) == 0
+assert n.value == len(set(scanned))
+
+into = b"er:tmp:test_abi:into"
+stored = c_uint64(0)
+for _ in range(2):   # the second store overwrites the same key
+    assert lib.er_find_all_store_into(h, 10, bits2, 2, into, C.byref(stored)) == 0
+    assert stored.value == n.value
+assert lib.er_find_all_store_into(h, 10, bits2, 2, b"er:all", None) == 2   # ER_BADARG
+released = c_uint64(0)
+assert lib.er_release_tmp(h, (c_char_p * 2)(into, tmp.value), 2, C.byref(released)) == 0
+assert released.value == 2
+assert lib.er_release_tmp(h, (c_char_p * 1)(b"er:all"), 1, None) == 2
+assert lib.er_release_tmp(h, (c_char_p * 1)(b"er:tmp:cache:&(42,7)"), 1, None) == 2   # shared
+assert lib.er_find_all_store_into(h, 10, bits2, 2, b"er:tmp:scratch:1", None) == 2
+first = []
+on_first = MEMBER_CB(lambda p, n, _user: first.append(C.string_at(p, n).decode()))
+assert lib.er_query_limit(h, b"42 & 7", 1, on_first, None) == 0
+assert len(first) == 1
+assert lib.er_query_result(h, b"42 & 7", 1, C.byref(res)) == 0
+assert lib.er_result_count(res) == 1
+lib.er_result_free(res)
+
+snap = lib.er_snapshot_load(h)
+assert snap
+assert lib.er_snapshot_size(snap) >= 3
+snap_count = c_uint64(0)
+assert lib.er_snapshot_count(snap, bits2, 2, None, 0, None, 0, C.byref(snap_count)) == 0
+assert snap_count.value == n.value
+snapped = []
+on_snap = MEMBER_CB(lambda p, n, _user: snapped.append(C.string_at(p, n).decode()))
+assert lib.er_snapshot_find(snap, bits2, 2, None, 0, None, 0, 0, on_snap, None) == 0
+assert sorted(snapped) == sorted(set(scanned))
+
+import os
+import tempfile
+
+# a saved snapshot maps back with the same rows, also without a handle
+snap_path = os.path.join(tempfile.mkdtemp(), "er.snap")
+assert lib.er_snapshot_save(h, snap, snap_path.encode()) == 0
+mapped = lib.er_snapshot_open(None, snap_path.encode(), 1)
+assert mapped
+assert lib.er_snapshot_size(mapped) == lib.er_snapshot_size(snap)
+mapped_count = c_uint64(0)
+assert lib.er_snapshot_count(mapped, bits2, 2, None, 0, None, 0, C.byref(mapped_count)) == 0
+assert mapped_count.value == snap_count.value
+lib.er_snapshot_destroy(mapped)
+assert not lib.er_snapshot_open(h, (snap_path + ".missing").encode(), 1)
+
+# "b" has the same bits as "a" (42, 7): Jaccard 1.0, Hamming 0, from Redis and the snapshot
+for use_snap in (None, snap):
+    for metric, best in ((0, 1.0), (1, 0.0)):
+        near = []
+        on_near = SCORED_CB(lambda p, n, score, _user: near.append((C.string_at(p, n).decode(), score)))
+        assert lib.er_similar(h, use_snap, b"a", 2, metric, on_near, None) == 0
+        assert 0 < len(near) <= 2
+        assert near[0][1] == best
+        assert all(name != "a" for name, _ in near)
+lib.er_snapshot_destroy(snap)
+
+# hybrid: every query estimated at >= 1 row runs on the snapshot, with the same results
+hybrid_before = c_uint64(0)
+assert lib.er_query_count(h, b"42 & 7", 0, C.byref(hybrid_before)) == 0
+assert lib.er_hybrid(h, 1) == 0
+hybrid_after = c_uint64(0)
+assert lib.er_query_count(h, b"42 & 7", 0, C.byref(hybrid_after)) == 0
+assert hybrid_after.value == hybrid_before.value
+hybrid_members = []
+on_hybrid = MEMBER_CB(lambda p, n, _user: hybrid_members.append(C.string_at(p, n).decode()))
+assert lib.er_query_limit(h, b"42 & 7", 0, on_hybrid, None) == 0
+assert len(hybrid_members) == hybrid_before.value
+assert lib.er_hybrid(h, 0) == 0
+
+# bit counts: rebuilt once, then kept by every put and delete
+counts = (c_uint64 * 4096)()
+universe = c_uint64(0)
+assert lib.er_bit_counts(h, 1, counts, C.byref(universe)) == 0
+posting_42 = c_uint64(0)
+assert lib.er_query_count(h, b"42", 0, C.byref(posting_42)) == 0
+assert counts[42] == posting_42.value and universe.value >= posting_42.value
+assert lib.er_put_bits(h, b"counted", (c_uint16 * 1)(42), 1) == 0
+assert lib.er_bit_counts(h, 0, counts, C.byref(universe)) == 0
+assert counts[42] == posting_42.value + 1
+counted = (c_char_p * 1)(b"counted")
+assert lib.er_del_many(h, counted, 1, 0, None) == 0
+assert lib.er_bit_counts(h, 0, counts, None) == 0
+assert counts[42] == posting_42.value
+
+# batched delete: postings, universe and hash in one script per batch
+gone_bits = (c_uint16 * 2)(42, 7)
+assert lib.er_put_bits(h, b"gone1", gone_bits, 2) == 0
+assert lib.er_put_bits(h, b"gone2", gone_bits, 2) == 0
+before = c_uint64(0)
+assert lib.er_query_count(h, b"42 & 7", 0, C.byref(before)) == 0
+gone = (c_char_p * 3)(b"gone1", b"gone2", b"never-existed")
+deleted = c_uint64(0)
+assert lib.er_del_many(h, gone, 3, 0, C.byref(deleted)) == 0
+assert deleted.value == 2
+after = c_uint64(0)
+assert lib.er_query_count(h, b"42 & 7", 0, C.byref(after)) == 0
+assert after.value == before.value - 2
+
 lib.er_destroy(h)
 
+# one pooled handle shared by several threads
+import threading
+
+pool = lib.er_create_pool(b"redis", 6379, 4)
+assert pool
+assert lib.er_stats_enable(pool, 1) == 0
+counts = []
+
+def count_worker():
+    c = c_uint64(0)
+    for _ in range(20):
+        assert lib.er_query_count(pool, b"42 & 7", 0, C.byref(c)) == 0
+    counts.append(c.value)
+
+workers = [threading.Thread(target=count_worker) for _ in range(8)]
+for w in workers:
+    w.start()
+for w in workers:
+    w.join()
+assert counts == [n.value] * 8
+
+# every leased connection's counters end up in the handle's
+import json
+
+stats_buf = C.create_string_buffer(1 << 16)
+assert lib.er_stats_json(pool, stats_buf, 2) == 3   # ER_RANGE
+assert lib.er_stats_json(pool, stats_buf, len(stats_buf)) == 0
+stats = json.loads(stats_buf.value)
+assert sum(s["calls"] for s in stats.values()) >= 8 * 20
+assert all(s["latency_us"]["p50"] <= s["latency_us"]["max"] for s in stats.values())
+assert lib.er_stats_enable(pool, 0) == 0
+assert lib.er_stats_json(pool, stats_buf, len(stats_buf)) == 0
+assert stats_buf.value == b"{}"
+lib.er_destroy(pool)
+
+# namespaced handles see only their own prefix
+assert not lib.er_create_ns(b"redis", 6379, 1, b"bad prefix")
+assert not lib.er_create_ns(b"redis", 6379, 1, b"a:{b}")
+tenant = lib.er_create_ns(b"redis", 6379, 2, b"er_test:tenant")
+assert tenant
+tb = (c_uint16 * 2)(42, 7)
+assert lib.er_put_bits(tenant, b"t1", tb, 2) == 0
+tc = c_uint64(0)
+assert lib.er_query_count(tenant, b"42 & 7", 0, C.byref(tc)) == 0
+assert tc.value == 1
+lib.er_destroy(tenant)
+
+# write-behind: repeated puts of one name coalesce, er_flush is the barrier
+wb = lib.er_create_ns(b"redis", 6379, 2, b"er_test:wb")
+assert wb
+assert lib.er_write_behind(wb, 1000, 50) == 0
+for i in range(100):
+    wbits = (c_uint16 * 1)(i % 3)
+    assert lib.er_put_bits(wb, b"w1", wbits, 1) == 0
+assert lib.er_flush(wb) == 0
+wc = c_uint64(0)
+assert lib.er_query_count(wb, b"0", 0, C.byref(wc)) == 0   # last put was bit 0
+assert wc.value == 1
+assert lib.er_write_behind(wb, 0, 0) == 0
+assert lib.er_flush(wb) == 0
+lib.er_destroy(wb)
+
+# flags cache: the second read is a hit, a put through the handle replaces the entry
+fc = lib.er_create_ns(b"redis", 6379, 2, b"er_test:fc")
+assert fc
+assert lib.er_flags_cache(fc, 1 << 20, 1) == 0
+fbits = (c_uint16 * 2)(3, 9)
+assert lib.er_put_bits(fc, b"c1", fbits, 2) == 0
+got = (c_uint16 * 4)()
+gn = c_size_t(0)
+for _ in range(2):
+    assert lib.er_get_bits(fc, b"c1", got, 4, C.byref(gn)) == 0
+    assert gn.value == 2 and list(got)[:2] == [3, 9]
+assert lib.er_get_bits(fc, b"c1", got, 1, C.byref(gn)) == 3   # ER_RANGE
+fh, fm, fe = c_uint64(0), c_uint64(0), c_uint64(0)
+assert lib.er_flags_cache_stats(fc, C.byref(fh), C.byref(fm), C.byref(fe)) == 0
+assert fh.value >= 2 and fe.value == 1
+fbits = (c_uint16 * 1)(5)
+assert lib.er_put_bits(fc, b"c1", fbits, 1) == 0
+assert lib.er_get_bits(fc, b"c1", got, 4, C.byref(gn)) == 0
+assert gn.value == 1 and got[0] == 5
+assert lib.er_flags_cache(fc, 0, 0) == 0
+lib.er_destroy(fc)
+
+# stats rebuild with exactly 999 non-empty postings (none at 4095): the 'all' pair
+# plus 999 bit pairs fill the first HSET chunk, so nothing is left for the last one
+rb = lib.er_create_ns(b"redis", 6379, 1, b"er_test:rebuild999")
+assert rb
+rbits = (c_uint16 * 999)(*range(999))
+assert lib.er_put_bits(rb, b"wide", rbits, 999) == 0
+rcounts = (c_uint64 * 4096)()
+runiverse = c_uint64(0)
+assert lib.er_bit_counts(rb, 1, rcounts, C.byref(runiverse)) == 0
+assert runiverse.value == 1
+assert all(rcounts[b] == 1 for b in range(999)) and rcounts[999] == 0 and rcounts[4095] == 0
+lib.er_destroy(rb)
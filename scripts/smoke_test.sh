@@ -6,7 +6,7 @@ ROOT="$(cd -- "$(dirname -- "${BASH_SOURCE[0]}")/.." && pwd)"
 ER_CLI="${ER_CLI:-$ROOT/build/cli/er_cli}"
 ER_REDIS_HOST="${ER_REDIS_HOST:-localhost}"
 ER_REDIS_PORT="${ER_REDIS_PORT:-6379}"
-ER_PREFIX="${ER_PREFIX:-er}"
+export ER_PREFIX="${ER_PREFIX:-er}"   # er_cli reads it too
 
 need() { command -v "$1" >/dev/null 2>&1 || { echo "ERROR: missing required command: $1" >&2; exit 2; }; }
 need redis-cli
@@ -38,12 +38,14 @@ echo "er_cli: $ER_CLI"
 echo "Prefix: $ER_PREFIX:"
 echo
 
-echo "Resetting keys: $ER_PREFIX:*"
+echo "Resetting keys: $ER_PREFIX:* and shards {$ER_PREFIX:s*}:*"
 if redis-cli -h "$ER_REDIS_HOST" -p "$ER_REDIS_PORT" --scan --pattern "$ER_PREFIX:*" >/dev/null 2>&1; then
-  while IFS= read -r k; do
-    [[ -z "$k" ]] && continue
-    redis DEL "$k" >/dev/null
-  done < <(redis-cli -h "$ER_REDIS_HOST" -p "$ER_REDIS_PORT" --scan --pattern "$ER_PREFIX:*")
+  for pattern in "$ER_PREFIX:*" "{$ER_PREFIX:s*}:*"; do
+    while IFS= read -r k; do
+      [[ -z "$k" ]] && continue
+      redis DEL "$k" >/dev/null
+    done < <(redis-cli -h "$ER_REDIS_HOST" -p "$ER_REDIS_PORT" --scan --pattern "$pattern")
+  done
 else
   echo "WARN: redis-cli --scan not available; skipping reset" >&2
 fi
@@ -80,6 +82,32 @@ echo "Query: find_not 42 7 (expect alice)"
 OUT="$("$ER_CLI" find_not 42 7)"
 assert_count "$OUT" "1" "find_not 42 7"
 
+echo "Sharded: the same elements over --shards 4 (expect the unsharded counts and members)"
+"$ER_CLI" --shards 4 put alice 1 42 >/dev/null
+"$ER_CLI" --shards 4 put bob 1 7 >/dev/null
+"$ER_CLI" --shards 4 put carol 7 42 >/dev/null
+if ! "$ER_CLI" --shards 4 get carol | grep -q '^bit42: 1$'; then
+  echo "ERROR: expected bit42 set on carol from --shards 4 get" >&2
+  exit 1
+fi
+members_of() { printf '%s\n' "$1" | sed -n 's/^ - //p' | sort; }
+assert_sharded_same() {
+  local single sharded want
+  single="$("$ER_CLI" "$@")"
+  sharded="$("$ER_CLI" --shards 4 "$@")"
+  want="$(printf '%s\n' "$single" | awk -F': ' '/^Count: /{print $2; exit}')"
+  assert_count "$sharded" "$want" "--shards 4 $*"
+  if [[ "$(members_of "$single")" != "$(members_of "$sharded")" ]]; then
+    echo "ERROR: --shards 4 $* returned other members than the unsharded command" >&2
+    exit 1
+  fi
+}
+assert_sharded_same find_all 1 42
+assert_sharded_same find_any 7 42
+assert_sharded_same find_not 42 7
+assert_sharded_same query "(1 & 42) | (7 & !1)"
+assert_sharded_same --count find_any 1 7
+
 echo "Store+TTL: find_all_store 30 1 42"
 TMP="$("$ER_CLI" --keys-only find_all_store 30 1 42)"
 if [[ -z "$TMP" ]]; then
@@ -110,4 +138,116 @@ if [[ "$(redis SCARD "$TMP2")" -le 0 ]]; then
 fi
 "$ER_CLI" show "$TMP2" >/dev/null
 
+echo "Bulk load: dave, erin (expect find 99 -> 2)"
+printf '# name bits...\ndave 1 99\nerin 99\n' | "$ER_CLI" load - >/dev/null
+OUT="$("$ER_CLI" find 99)"
+assert_count "$OUT" "2" "find 99 after load"
+
+echo "Query: 99 & !1 (expect erin)"
+OUT="$("$ER_CLI" query "99 & !1")"
+assert_count "$OUT" "1" "query 99 & !1"
+
+echo "Paged show: $ER_PREFIX:all --page 1 (expect 5)"
+OUT="$("$ER_CLI" show "$ER_PREFIX:all" --page 1)"
+assert_count "$OUT" "5" "show er:all --page"
+
+echo "Count/limit: find 99 (expect count 2, limit 1, total 2 with one member)"
+OUT="$("$ER_CLI" --count find 99)"
+assert_count "$OUT" "2" "--count find 99"
+OUT="$("$ER_CLI" --limit 1 find_any 1 99)"
+assert_count "$OUT" "1" "--limit 1 find_any 1 99"
+OUT="$("$ER_CLI" --total --limit 1 find 99)"
+assert_count "$OUT" "2" "--total --limit 1 find 99"
+if [[ "$(grep -c '^ - ' <<<"$OUT")" -ne 1 ]]; then
+  echo "ERROR: expected one member from --total --limit 1, got: $OUT" >&2
+  exit 1
+fi
+
+echo "Result cache: find_all_store 30 1 42 twice (expect two copies, refreshed after put, old copy kept)"
+C1="$("$ER_CLI" --keys-only find_all_store 30 1 42)"
+C2="$("$ER_CLI" --keys-only find_all_store 30 42 1)"
+if [[ "$C1" == "$C2" || "$(redis SCARD "$C1")" -ne "$(redis SCARD "$C2")" ]]; then
+  echo "ERROR: expected one key per caller with the same members, got $C1 vs $C2" >&2
+  exit 1
+fi
+BEFORE="$(redis SCARD "$C1")"
+"$ER_CLI" put frank 1 42 >/dev/null
+C3="$("$ER_CLI" --keys-only find_all_store 30 1 42)"
+AFTER="$(redis SCARD "$C3")"
+if [[ "$AFTER" -ne $((BEFORE + 1)) || "$(redis SCARD "$C1")" -ne "$BEFORE" ]]; then
+  echo "ERROR: expected cache invalidation after put ($BEFORE -> $AFTER) without touching $C1" >&2
+  exit 1
+fi
+
+echo "Caller key: find_all_store --into twice, then release (expect one key, gone after)"
+INTO="$ER_PREFIX:tmp:smoke:into"
+"$ER_CLI" --keys-only --into "$INTO" find_all_store 30 1 42 >/dev/null
+OUT="$("$ER_CLI" --keys-only --into "$INTO" find_all_store 30 42 1)"
+if [[ "$OUT" != "$INTO" || "$(redis SCARD "$INTO")" -ne "$AFTER" ]]; then
+  echo "ERROR: expected $INTO overwritten in place, got $OUT" >&2
+  exit 1
+fi
+"$ER_CLI" release "$INTO" "$TMP2" >/dev/null
+if [[ "$(redis EXISTS "$INTO" "$TMP2")" -ne 0 ]]; then
+  echo "ERROR: expected $INTO and $TMP2 released" >&2
+  exit 1
+fi
+
+echo "Snapshot: find_all 99 and find_not 99 1 in memory (expect 2, 1)"
+OUT="$("$ER_CLI" --count snapshot find_all 99 2>/dev/null)"
+assert_count "$OUT" "2" "snapshot find_all 99"
+OUT="$("$ER_CLI" snapshot find_not 99 1 2>/dev/null)"
+assert_count "$OUT" "1" "snapshot find_not 99 1"
+
+echo "Snapshot file: export, find_all 99 from the file, import under $ER_PREFIX:copy (expect 2, 2)"
+SNAP_FILE="$(mktemp)"
+"$ER_CLI" export "$SNAP_FILE" >/dev/null
+OUT="$("$ER_CLI" --count snapshot --file "$SNAP_FILE" find_all 99 2>/dev/null)"
+assert_count "$OUT" "2" "snapshot --file find_all 99"
+"$ER_CLI" --prefix "$ER_PREFIX:copy" import "$SNAP_FILE" >/dev/null
+OUT="$("$ER_CLI" --prefix "$ER_PREFIX:copy" find 99)"
+assert_count "$OUT" "2" "find 99 after import"
+rm -f "$SNAP_FILE"
+
+echo "Bitstats: bit 99 counted by the writes, by the import and by a rebuild (expect 2 each)"
+assert_bitstat() {
+  local out="$1" label="$2"
+  if ! grep -q '^99 2$' <<<"$out"; then
+    echo "ERROR: unexpected $label output: $out" >&2
+    exit 1
+  fi
+}
+assert_bitstat "$("$ER_CLI" bitstats 99)" "bitstats 99"
+assert_bitstat "$("$ER_CLI" --prefix "$ER_PREFIX:copy" bitstats 99)" "bitstats 99 after import"
+assert_bitstat "$("$ER_CLI" bitstats --rebuild 99)" "bitstats --rebuild 99"
+
+echo "Similar: dave --k 1, from postings and from a snapshot (expect 1 each)"
+OUT="$("$ER_CLI" similar dave --k 1)"
+assert_count "$OUT" "1" "similar dave"
+OUT="$("$ER_CLI" similar dave --k 1 --metric hamming --snapshot)"
+assert_count "$OUT" "1" "similar dave --snapshot"
+
+echo "Serve: query count and a bad request over one process (expect count 2, ok false)"
+OUT="$(printf '%s\n' '{"id":1,"op":"query","shape":"find","bits":[99],"count":true}' '{"id":2,"op":"nope"}' \
+  | "$ER_CLI" serve)"
+if ! grep -q '^{"id":1,"ok":true,"count":2}$' <<<"$OUT" || ! grep -q '^{"id":2,"ok":false,' <<<"$OUT"; then
+  echo "ERROR: unexpected serve output: $OUT" >&2
+  exit 1
+fi
+
+echo "Serve --hybrid 1: the same count from the snapshot, counted as QUERY:snapshot (expect count 2)"
+OUT="$(printf '%s\n' '{"id":1,"op":"query","shape":"find","bits":[99],"count":true}' '{"id":2,"op":"stats"}' \
+  | "$ER_CLI" --stats --hybrid 1 serve 2>/dev/null)"
+if ! grep -q '^{"id":1,"ok":true,"count":2}$' <<<"$OUT" || ! grep -q '"QUERY:snapshot"' <<<"$OUT"; then
+  echo "ERROR: unexpected serve --hybrid output: $OUT" >&2
+  exit 1
+fi
+
+echo "Stats: --stats prints per-command counters on stderr (expect an HGET entry for get)"
+ERR="$("$ER_CLI" --stats get dave 2>&1 >/dev/null)"
+if ! grep -q '^stats: {.*"HGET":{"calls":[1-9]' <<<"$ERR"; then
+  echo "ERROR: unexpected --stats output: $ERR" >&2
+  exit 1
+fi
+
 echo "OK: smoke test passed"
@@ -1,11 +1,98 @@
 #include "er/Flags4096.hpp"
 
-#include <sstream>
-#include <cctype>
+#include <bit>
+#include <cstring>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 namespace er {
 
-Flags4096::Flags4096() : value_(0) {}
+namespace {
+
+enum class BitOp { kOr, kAnd, kXor };
+
+// out = a <op> b over all 64 words. All pointers are 64-byte aligned (see Flags4096::words_).
+template <BitOp Op>
+void combine_words(const std::uint64_t* a, const std::uint64_t* b, std::uint64_t* out) noexcept {
+#if defined(__AVX512F__)
+    for (std::size_t i = 0; i < Flags4096::kWords; i += 8) {
+        const __m512i va = _mm512_load_si512(a + i);
+        const __m512i vb = _mm512_load_si512(b + i);
+        __m512i vr;
+        if constexpr (Op == BitOp::kOr) vr = _mm512_or_si512(va, vb);
+        else if constexpr (Op == BitOp::kAnd) vr = _mm512_and_si512(va, vb);
+        else vr = _mm512_xor_si512(va, vb);
+        _mm512_store_si512(out + i, vr);
+    }
+#elif defined(__AVX2__)
+    for (std::size_t i = 0; i < Flags4096::kWords; i += 4) {
+        const __m256i va = _mm256_load_si256(reinterpret_cast<const __m256i*>(a + i));
+        const __m256i vb = _mm256_load_si256(reinterpret_cast<const __m256i*>(b + i));
+        __m256i vr;
+        if constexpr (Op == BitOp::kOr) vr = _mm256_or_si256(va, vb);
+        else if constexpr (Op == BitOp::kAnd) vr = _mm256_and_si256(va, vb);
+        else vr = _mm256_xor_si256(va, vb);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(out + i), vr);
+    }
+#elif defined(__ARM_NEON)
+    for (std::size_t i = 0; i < Flags4096::kWords; i += 2) {
+        const uint64x2_t va = vld1q_u64(a + i);
+        const uint64x2_t vb = vld1q_u64(b + i);
+        uint64x2_t vr;
+        if constexpr (Op == BitOp::kOr) vr = vorrq_u64(va, vb);
+        else if constexpr (Op == BitOp::kAnd) vr = vandq_u64(va, vb);
+        else vr = veorq_u64(va, vb);
+        vst1q_u64(out + i, vr);
+    }
+#else
+    for (std::size_t i = 0; i < Flags4096::kWords; ++i) {
+        if constexpr (Op == BitOp::kOr) out[i] = a[i] | b[i];
+        else if constexpr (Op == BitOp::kAnd) out[i] = a[i] & b[i];
+        else out[i] = a[i] ^ b[i];
+    }
+#endif
+}
+
+// popcount(a <op> b) over all 64 words. AVX-512 VPOPCNTDQ counts 8 words per
+// instruction; otherwise std::popcount lowers to POPCNT where the target has it.
+template <BitOp Op>
+std::size_t count_words(const std::uint64_t* a, const std::uint64_t* b) noexcept {
+#if defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__)
+    __m512i acc = _mm512_setzero_si512();
+    for (std::size_t i = 0; i < Flags4096::kWords; i += 8) {
+        const __m512i va = _mm512_load_si512(a + i);
+        const __m512i vb = _mm512_load_si512(b + i);
+        __m512i vr;
+        if constexpr (Op == BitOp::kOr) vr = _mm512_or_si512(va, vb);
+        else if constexpr (Op == BitOp::kAnd) vr = _mm512_and_si512(va, vb);
+        else vr = _mm512_xor_si512(va, vb);
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(vr));
+    }
+    return static_cast<std::size_t>(_mm512_reduce_add_epi64(acc));
+#else
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < Flags4096::kWords; ++i) {
+        std::uint64_t w;
+        if constexpr (Op == BitOp::kOr) w = a[i] | b[i];
+        else if constexpr (Op == BitOp::kAnd) w = a[i] & b[i];
+        else w = a[i] ^ b[i];
+        n += static_cast<std::size_t>(std::popcount(w));
+    }
+    return n;
+#endif
+}
+
+constexpr std::uint64_t bit_mask(std::size_t bit) noexcept {
+    return std::uint64_t{1} << (bit % 64);
+}
+
+} // namespace
+
+Flags4096::Flags4096() = default;
 
 static Result<Unit> check_bit(std::size_t bit) noexcept {
     if (bit >= 4096) return Result<Unit>::err(Errc::kInvalidArg, "Flags4096: bit out of range (0..4095)");
@@ -14,74 +101,146 @@ static Result<Unit> check_bit(std::size_t bit) noexcept {
 
 Result<Unit> Flags4096::set(std::size_t bit) noexcept {
     if (auto ok = check_bit(bit); !ok) return ok;
-    value_ |= (uint4096(1) << bit);
+    words_[bit / 64] |= bit_mask(bit);
     return Result<Unit>::ok();
 }
 
 Result<Unit> Flags4096::reset(std::size_t bit) noexcept {
     if (auto ok = check_bit(bit); !ok) return ok;
-    value_ &= ~(uint4096(1) << bit);
+    words_[bit / 64] &= ~bit_mask(bit);
     return Result<Unit>::ok();
 }
 
 Result<bool> Flags4096::test(std::size_t bit) const noexcept {
     if (auto ok = check_bit(bit); !ok) return Result<bool>::err(ok.error().code, ok.error().msg);
-    return Result<bool>::ok((value_ & (uint4096(1) << bit)) != 0);
+    return Result<bool>::ok((words_[bit / 64] & bit_mask(bit)) != 0);
 }
 
 void Flags4096::clear() noexcept {
-    value_ = 0;
+    words_.fill(0);
 }
 
 Flags4096 Flags4096::operator|(const Flags4096& other) const {
     Flags4096 r;
-    r.value_ = value_ | other.value_;
+    combine_words<BitOp::kOr>(words_.data(), other.words_.data(), r.words_.data());
     return r;
 }
 
 Flags4096 Flags4096::operator&(const Flags4096& other) const {
     Flags4096 r;
-    r.value_ = value_ & other.value_;
+    combine_words<BitOp::kAnd>(words_.data(), other.words_.data(), r.words_.data());
     return r;
 }
 
 Flags4096 Flags4096::operator^(const Flags4096& other) const {
     Flags4096 r;
-    r.value_ = value_ ^ other.value_;
+    combine_words<BitOp::kXor>(words_.data(), other.words_.data(), r.words_.data());
     return r;
 }
 
+std::size_t Flags4096::popcount() const noexcept {
+    // a & a == a: reuses the two-operand kernel
+    return count_words<BitOp::kAnd>(words_.data(), words_.data());
+}
+
+std::size_t Flags4096::and_count(const Flags4096& other) const noexcept {
+    return count_words<BitOp::kAnd>(words_.data(), other.words_.data());
+}
+
+std::size_t Flags4096::xor_count(const Flags4096& other) const noexcept {
+    return count_words<BitOp::kXor>(words_.data(), other.words_.data());
+}
+
 // ---- hex ----
 
-std::string Flags4096::to_hex() const {
-    std::stringstream ss;
-    ss << std::hex << value_;
-    return ss.str();
+namespace {
+
+// Two lowercase hex digits per byte value.
+constexpr std::array<char, 512> make_hex_pairs() {
+    constexpr char kDigits[] = "0123456789abcdef";
+    std::array<char, 512> t{};
+    for (std::size_t i = 0; i < 256; ++i) {
+        t[2 * i] = kDigits[i >> 4];
+        t[2 * i + 1] = kDigits[i & 0xF];
+    }
+    return t;
 }
 
-static int hex_val(char c) {
-    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
-    if (c >= '0' && c <= '9') return c - '0';
-    if (c >= 'a' && c <= 'f') return 10 + (c - 'a');
-    return -1;
+constexpr std::int8_t kHexInvalid = -1;
+constexpr std::int8_t kHexSpace = -2;
+
+// Nibble value per input char; whitespace (as std::isspace in the "C" locale) is skipped.
+constexpr std::array<std::int8_t, 256> make_hex_values() {
+    std::array<std::int8_t, 256> t{};
+    for (auto& v : t) v = kHexInvalid;
+    for (int c = '0'; c <= '9'; ++c) t[static_cast<std::size_t>(c)] = static_cast<std::int8_t>(c - '0');
+    for (int c = 'a'; c <= 'f'; ++c) t[static_cast<std::size_t>(c)] = static_cast<std::int8_t>(10 + c - 'a');
+    for (int c = 'A'; c <= 'F'; ++c) t[static_cast<std::size_t>(c)] = static_cast<std::int8_t>(10 + c - 'A');
+    for (char c : {' ', '\t', '\n', '\v', '\f', '\r'}) t[static_cast<unsigned char>(c)] = kHexSpace;
+    return t;
+}
+
+constexpr auto kHexPairs = make_hex_pairs();
+constexpr auto kHexValues = make_hex_values();
+
+inline std::uint64_t to_be64(std::uint64_t v) noexcept {
+    if constexpr (std::endian::native == std::endian::big) return v;
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap64(v);
+#else
+    std::uint64_t r = 0;
+    for (int i = 0; i < 8; ++i) {
+        r = (r << 8) | (v & 0xFF);
+        v >>= 8;
+    }
+    return r;
+#endif
+}
+
+} // namespace
+
+// Lowercase, no prefix, no leading zeros ("0" for the empty set).
+std::string Flags4096::to_hex() const {
+    std::size_t top = kWords;
+    while (top > 0 && words_[top - 1] == 0) --top;
+    if (top == 0) return "0";
+
+    std::array<std::uint8_t, kBytes> be;
+    to_bytes_be(be);
+
+    // Emit only the significant bytes, then drop a single leading zero nibble.
+    const std::size_t first = kBytes - top * 8 + static_cast<std::size_t>(std::countl_zero(words_[top - 1]) / 8);
+    std::string out((kBytes - first) * 2, '\0');
+    char* p = out.data();
+    for (std::size_t i = first; i < kBytes; ++i) {
+        const char* pair = &kHexPairs[static_cast<std::size_t>(be[i]) * 2];
+        *p++ = pair[0];
+        *p++ = pair[1];
+    }
+    if (out[0] == '0') out.erase(0, 1);
+    return out;
 }
 
 Result<Flags4096> Flags4096::from_hex(std::string_view hex) noexcept {
     Flags4096 out{};
-    out.value_ = 0;
 
-    std::size_t i = 0;
+    std::size_t begin = 0;
     if (hex.size() >= 2 && hex[0] == '0' &&
         (hex[1] == 'x' || hex[1] == 'X')) {
-        i = 2;
+        begin = 2;
     }
 
-    for (; i < hex.size(); ++i) {
-        if (std::isspace(static_cast<unsigned char>(hex[i]))) continue;
-        int v = hex_val(hex[i]);
+    // Walk from the least-significant digit; digits beyond 4096 bits are validated
+    // but dropped (same truncation as the previous shift-and-add parser).
+    std::size_t nibble = 0;
+    for (std::size_t i = hex.size(); i-- > begin;) {
+        const std::int8_t v = kHexValues[static_cast<unsigned char>(hex[i])];
+        if (v == kHexSpace) continue;
         if (v < 0) return Result<Flags4096>::err(Errc::kInvalidArg, "Flags4096::from_hex: invalid hex");
-        out.value_ <<= 4;
-        out.value_ += uint4096(v);
+        if (nibble < kBits / 4) {
+            out.words_[nibble / 16] |= static_cast<std::uint64_t>(v) << ((nibble % 16) * 4);
+        }
+        ++nibble;
     }
     return Result<Flags4096>::ok(std::move(out));
 }
@@ -89,15 +248,17 @@ Result<Flags4096> Flags4096::from_hex(std::string_view hex) noexcept {
 // ---- binary 512B BE ----
 
 std::array<std::uint8_t, 512> Flags4096::to_bytes_be() const {
-    std::array<std::uint8_t, 512> out{};
-    uint4096 tmp = value_;
+    std::array<std::uint8_t, 512> out;
+    to_bytes_be(out);
+    return out;
+}
 
-    for (int i = 511; i >= 0; --i) {
-        out[static_cast<std::size_t>(i)] =
-            static_cast<std::uint8_t>(tmp & 0xFF);
-        tmp >>= 8;
+void Flags4096::to_bytes_be(std::span<std::uint8_t, kBytes> out) const noexcept {
+    // out[511] is the least-significant byte (bits 0..7): word 0 goes last, byte-swapped.
+    for (std::size_t w = 0; w < kWords; ++w) {
+        const std::uint64_t be = to_be64(words_[w]);
+        std::memcpy(out.data() + (kWords - 1 - w) * 8, &be, sizeof(be));
     }
-    return out;
 }
 
 Result<Flags4096> Flags4096::from_bytes_be(const std::uint8_t* data, std::size_t len) noexcept {
@@ -105,31 +266,44 @@ Result<Flags4096> Flags4096::from_bytes_be(const std::uint8_t* data, std::size_t
     if (len != 512) return Result<Flags4096>::err(Errc::kInvalidArg, "Flags4096::from_bytes_be: len must be 512");
 
     Flags4096 out{};
-    out.value_ = 0;
-    for (std::size_t i = 0; i < 512; ++i) {
-        out.value_ <<= 8;
-        out.value_ += uint4096(data[i]);
+    for (std::size_t w = 0; w < kWords; ++w) {
+        std::uint64_t be;
+        std::memcpy(&be, data + (kWords - 1 - w) * 8, sizeof(be));
+        out.words_[w] = to_be64(be);
     }
     return Result<Flags4096>::ok(std::move(out));
 }
 
+Result<Flags4096> Flags4096::from_bytes_be(std::span<const std::uint8_t> bytes) noexcept {
+    return from_bytes_be(bytes.data(), bytes.size());
+}
+
+Result<Flags4096> Flags4096::from_bytes_be(std::string_view bytes) noexcept {
+    return from_bytes_be(reinterpret_cast<const std::uint8_t*>(bytes.data()), bytes.size());
+}
+
 // ---- index helper ----
 
 std::vector<std::size_t> Flags4096::set_bits() const {
-    std::vector<std::size_t> bits;
-    bits.reserve(64);
-
-    // Faster than 4096 big-int tests: scan bytes and extract bit positions.
-    const auto bytes = to_bytes_be(); // 512 bytes, BE; out[511] is least-significant byte.
-    for (int i = 511; i >= 0; --i) {
-        const std::uint8_t byte = bytes[static_cast<std::size_t>(i)];
-        if (byte == 0) continue;
-        const std::size_t base = static_cast<std::size_t>((511 - i) * 8);
-        for (std::size_t b = 0; b < 8; ++b) {
-            if (byte & (static_cast<std::uint8_t>(1u) << b)) bits.push_back(base + b);
-        }
+    const BitRange range = bits();
+    std::vector<std::size_t> out;
+    out.reserve(range.count());
+    for (auto b : range) out.push_back(b);
+    return out;
+}
+
+Flags4096::BitRange Flags4096::bits() const noexcept {
+    return BitRange(words_);
+}
+
+Flags4096::BitDelta Flags4096::diff(const Flags4096& old_flags, const Flags4096& new_flags) noexcept {
+    Words added{};
+    Words removed{};
+    for (std::size_t w = 0; w < kWords; ++w) {
+        added[w] = new_flags.words_[w] & ~old_flags.words_[w];
+        removed[w] = old_flags.words_[w] & ~new_flags.words_[w];
     }
-    return bits;
+    return BitDelta{BitRange(added), BitRange(removed)};
 }
 
 } // namespace er
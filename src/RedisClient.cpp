@@ -1,62 +1,121 @@
 #include "er/RedisClient.hpp"
 
+#include "er/detail/reply.hpp"
+#include "er/keys.hpp"
+
+#include <charconv>
 #include <cstring>
 #include <memory>
+#include <mutex>
+#include <new>
 #include <vector>
+#include <array>
 #include <chrono>
 #include <sstream>
 
+#include <sys/socket.h>
+
+// ER_STATS=0 compiles the command instrumentation out (see er/stats.hpp).
+#ifndef ER_STATS
+#define ER_STATS 1
+#endif
+
 namespace er {
 
 namespace {
 
-struct ReplyDeleter {
-    void operator()(redisReply* r) const noexcept {
-        if (r) freeReplyObject(r);
-    }
-};
+using ReplyPtr = detail::ReplyPtr;
+using detail::ArgvBuilder;
+using detail::is_noscript;
+using detail::read_set_array;
+using detail::reply_integer;
+using detail::reply_no_error;
+using detail::script_op;
 
-using ReplyPtr = std::unique_ptr<redisReply, ReplyDeleter>;
+constexpr bool kStatsCompiled = ER_STATS != 0;
+using StatsClock = std::chrono::steady_clock;
 
-static Result<Unit> reply_no_error(const redisReply& r, std::string_view op) noexcept {
-    if (r.type != REDIS_REPLY_ERROR) return Result<Unit>::ok();
-    std::string msg = r.str ? std::string(r.str, static_cast<std::size_t>(r.len)) : "unknown redis error";
-    std::string full(op);
-    full.append(": ");
-    full.append(msg);
-    return Result<Unit>::err(Errc::kRedisProtocol, std::move(full));
+std::uint64_t elapsed_ns(StatsClock::time_point t0) noexcept {
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(StatsClock::now() - t0).count());
 }
 
-class ArgvBuilder {
-public:
-    explicit ArgvBuilder(std::size_t reserve_n = 0) {
-        argv_.reserve(reserve_n);
-        argvlen_.reserve(reserve_n);
-    }
+std::uint64_t decimal_digits(std::uint64_t v) noexcept {
+    std::uint64_t n = 1;
+    while (v >= 10) { v /= 10; ++n; }
+    return n;
+}
 
-    void push(std::string_view s) {
-        argv_.push_back(s.data());
-        argvlen_.push_back(s.size());
-    }
+// RESP encoding size of a command: *<argc>\r\n then $<len>\r\n<arg>\r\n per argument.
+std::uint64_t request_bytes(int argc, const std::size_t* argvlen) noexcept {
+    std::uint64_t n = 3 + decimal_digits(static_cast<std::uint64_t>(argc));
+    for (int i = 0; i < argc; ++i) n += 5 + decimal_digits(argvlen[i]) + argvlen[i];
+    return n;
+}
 
-    void push_bytes(const void* data, std::size_t len) {
-        argv_.push_back(static_cast<const char*>(data));
-        argvlen_.push_back(len);
+// RESP2 encoding size of a parsed reply (RESP3-only types are counted like their
+// closest RESP2 form).
+std::uint64_t reply_bytes(const redisReply& r) noexcept {
+    switch (r.type) {
+    case REDIS_REPLY_STRING:
+        return 5 + decimal_digits(static_cast<std::uint64_t>(r.len)) + static_cast<std::uint64_t>(r.len);
+    case REDIS_REPLY_ARRAY: {
+        std::uint64_t n = 3 + decimal_digits(r.elements);
+        for (std::size_t i = 0; i < r.elements; ++i) {
+            if (r.element[i]) n += reply_bytes(*r.element[i]);
+        }
+        return n;
     }
+    case REDIS_REPLY_INTEGER: {
+        const auto u = static_cast<std::uint64_t>(r.integer);
+        return r.integer < 0 ? 4 + decimal_digits(0 - u) : 3 + decimal_digits(u);
+    }
+    case REDIS_REPLY_NIL:
+        return 5;
+    default:   // status, error
+        return 3 + static_cast<std::uint64_t>(r.len);
+    }
+}
 
-    [[nodiscard]] int argc() const noexcept { return static_cast<int>(argv_.size()); }
-    // hiredis takes `const char**` (not `const char* const*`), even though it doesn't mutate argv.
-    [[nodiscard]] const char** argv() const noexcept { return const_cast<const char**>(argv_.data()); }
-    [[nodiscard]] const size_t* argvlen() const noexcept { return argvlen_.data(); }
+void record_reply(CommandStats& s, const redisReply* r, std::uint64_t ns) noexcept {
+    s.latency.record(ns);
+    if (!r || r->type == REDIS_REPLY_ERROR) ++s.errors;
+    if (!r) return;
+    s.bytes_received += reply_bytes(*r);
+    if (r->type == REDIS_REPLY_ARRAY) s.reply_elements += r->elements;
+}
+
+// Times the conversion of a reply into std types; records into stats->at(op).decode
+// on destruction, so `return decode(...)` is measured.
+class DecodeTimer {
+public:
+    DecodeTimer(Stats* stats, std::string_view op) noexcept
+        : stats_(kStatsCompiled ? stats : nullptr), op_(op), t0_(stats_ ? StatsClock::now() : StatsClock::time_point{}) {}
+    ~DecodeTimer() {
+        if (stats_) stats_->at(op_).decode.record(elapsed_ns(t0_));
+    }
+    DecodeTimer(const DecodeTimer&) = delete;
+    DecodeTimer& operator=(const DecodeTimer&) = delete;
 
 private:
-    std::vector<const char*> argv_{};
-    std::vector<size_t> argvlen_{};
+    Stats* stats_;
+    std::string_view op_;
+    StatsClock::time_point t0_;
 };
 
-static Result<ReplyPtr> command_argv(redisContext* c, const ArgvBuilder& args) noexcept {
+// The single blocking round trip. With stats, records it under op (default: the
+// command name, argv[0]).
+static Result<ReplyPtr> command_argv(redisContext* c, const ArgvBuilder& args, Stats* stats,
+                                     std::string_view op = {}) noexcept {
     if (!c) return Result<ReplyPtr>::err(Errc::kInternal, "redis context is null");
+    const bool timed = kStatsCompiled && stats;
+    const auto t0 = timed ? StatsClock::now() : StatsClock::time_point{};
     void* r = redisCommandArgv(c, args.argc(), args.argv(), args.argvlen());
+    if (timed) {
+        CommandStats& s = stats->at(op.empty() ? std::string_view(args.argv()[0], args.argvlen()[0]) : op);
+        ++s.calls;
+        s.bytes_sent += request_bytes(args.argc(), args.argvlen());
+        record_reply(s, static_cast<const redisReply*>(r), elapsed_ns(t0));
+    }
     if (!r) {
         if (c->err) return Result<ReplyPtr>::err(Errc::kRedisIo, c->errstr ? c->errstr : "redis I/O error");
         return Result<ReplyPtr>::err(Errc::kRedisIo, "redis command failed (null reply)");
@@ -64,19 +123,6 @@ static Result<ReplyPtr> command_argv(redisContext* c, const ArgvBuilder& args) n
     return Result<ReplyPtr>::ok(ReplyPtr(static_cast<redisReply*>(r)));
 }
 
-static Result<std::vector<std::string>> read_set_array(const redisReply& r) noexcept {
-    if (r.type != REDIS_REPLY_ARRAY) return Result<std::vector<std::string>>::err(Errc::kRedisReplyType, "expected array reply");
-    std::vector<std::string> out;
-    out.reserve(static_cast<std::size_t>(r.elements));
-    for (std::size_t i = 0; i < r.elements; ++i) {
-        const redisReply* e = r.element[i];
-        if (e && e->type == REDIS_REPLY_STRING && e->str) {
-            out.emplace_back(e->str, static_cast<std::size_t>(e->len));
-        }
-    }
-    return Result<std::vector<std::string>>::ok(std::move(out));
-}
-
 } // namespace
 
 Result<RedisClient> RedisClient::connect(std::string host, int port, int timeout_ms) noexcept {
@@ -104,7 +150,7 @@ RedisClient::~RedisClient() = default;
 Result<Unit> RedisClient::ping() noexcept {
     ArgvBuilder args(1);
     args.push("PING");
-    auto r = command_argv(ctx_.get(), args);
+    auto r = command_argv(ctx_.get(), args, stats_.get());
     if (!r) return Result<Unit>::err(r.error().code, r.error().msg);
     if (auto ok = reply_no_error(*r.value(), "PING"); !ok) return ok;
     if (r.value()->type == REDIS_REPLY_STATUS && r.value()->str &&
@@ -122,7 +168,7 @@ Result<long long> RedisClient::hset(std::string_view key, std::string_view field
     args.push(key);
     args.push(field);
     args.push(value);
-    auto r = command_argv(ctx_.get(), args);
+    auto r = command_argv(ctx_.get(), args, stats_.get());
     if (!r) return Result<long long>::err(r.error().code, r.error().msg);
     if (auto ok = reply_no_error(*r.value(), "HSET"); !ok) return Result<long long>::err(ok.error().code, ok.error().msg);
     if (r.value()->type != REDIS_REPLY_INTEGER) return Result<long long>::err(Errc::kRedisReplyType, "HSET: expected integer reply");
@@ -134,7 +180,7 @@ Result<std::string> RedisClient::hget(std::string_view key, std::string_view fie
     args.push("HGET");
     args.push(key);
     args.push(field);
-    auto r = command_argv(ctx_.get(), args);
+    auto r = command_argv(ctx_.get(), args, stats_.get());
     if (!r) return Result<std::string>::err(r.error().code, r.error().msg);
     if (auto ok = reply_no_error(*r.value(), "HGET"); !ok) return Result<std::string>::err(ok.error().code, ok.error().msg);
     if (r.value()->type == REDIS_REPLY_NIL) return Result<std::string>::err(Errc::kNotFound, "HGET: not found");
@@ -152,7 +198,7 @@ Result<long long> RedisClient::hset_bin(std::string_view key,
     args.push(key);
     args.push(field);
     args.push_bytes(data, len);
-    auto r = command_argv(ctx_.get(), args);
+    auto r = command_argv(ctx_.get(), args, stats_.get());
     if (!r) return Result<long long>::err(r.error().code, r.error().msg);
     if (auto ok = reply_no_error(*r.value(), "HSET(bin)"); !ok) return Result<long long>::err(ok.error().code, ok.error().msg);
     if (r.value()->type != REDIS_REPLY_INTEGER) return Result<long long>::err(Errc::kRedisReplyType, "HSET(bin): expected integer reply");
@@ -164,6 +210,20 @@ Result<std::string> RedisClient::hget_bin(std::string_view key, std::string_view
     return hget(key, field);
 }
 
+Result<Flags4096> RedisClient::hget_flags(std::string_view key, std::string_view field) noexcept {
+    ArgvBuilder args(3);
+    args.push("HGET");
+    args.push(key);
+    args.push(field);
+    auto r = command_argv(ctx_.get(), args, stats_.get());
+    if (!r) return Result<Flags4096>::err(r.error().code, r.error().msg);
+    if (auto ok = reply_no_error(*r.value(), "HGET(flags)"); !ok) return Result<Flags4096>::err(ok.error().code, ok.error().msg);
+    if (r.value()->type == REDIS_REPLY_NIL) return Result<Flags4096>::err(Errc::kNotFound, "HGET(flags): not found");
+    if (r.value()->type != REDIS_REPLY_STRING || !r.value()->str)
+        return Result<Flags4096>::err(Errc::kRedisReplyType, "HGET(flags): expected string reply");
+    return Flags4096::from_bytes_be(std::string_view(r.value()->str, static_cast<std::size_t>(r.value()->len)));
+}
+
 // ---- SET basic ----
 
 Result<long long> RedisClient::sadd(std::string_view key, std::string_view member) noexcept {
@@ -171,7 +231,7 @@ Result<long long> RedisClient::sadd(std::string_view key, std::string_view membe
     args.push("SADD");
     args.push(key);
     args.push(member);
-    auto r = command_argv(ctx_.get(), args);
+    auto r = command_argv(ctx_.get(), args, stats_.get());
     if (!r) return Result<long long>::err(r.error().code, r.error().msg);
     if (auto ok = reply_no_error(*r.value(), "SADD"); !ok) return Result<long long>::err(ok.error().code, ok.error().msg);
     if (r.value()->type != REDIS_REPLY_INTEGER) return Result<long long>::err(Errc::kRedisReplyType, "SADD: expected integer reply");
@@ -183,7 +243,7 @@ Result<long long> RedisClient::srem(std::string_view key, std::string_view membe
     args.push("SREM");
     args.push(key);
     args.push(member);
-    auto r = command_argv(ctx_.get(), args);
+    auto r = command_argv(ctx_.get(), args, stats_.get());
     if (!r) return Result<long long>::err(r.error().code, r.error().msg);
     if (auto ok = reply_no_error(*r.value(), "SREM"); !ok) return Result<long long>::err(ok.error().code, ok.error().msg);
     if (r.value()->type != REDIS_REPLY_INTEGER) return Result<long long>::err(Errc::kRedisReplyType, "SREM: expected integer reply");
@@ -194,47 +254,98 @@ Result<std::vector<std::string>> RedisClient::smembers(std::string_view key) noe
     ArgvBuilder args(2);
     args.push("SMEMBERS");
     args.push(key);
-    auto r = command_argv(ctx_.get(), args);
+    auto r = command_argv(ctx_.get(), args, stats_.get());
     if (!r) return Result<std::vector<std::string>>::err(r.error().code, r.error().msg);
     if (auto ok = reply_no_error(*r.value(), "SMEMBERS"); !ok)
         return Result<std::vector<std::string>>::err(ok.error().code, ok.error().msg);
+    DecodeTimer decode(stats_.get(), "SMEMBERS");
     return read_set_array(*r.value());
 }
 
-Result<std::vector<std::string>> RedisClient::sinter(const std::vector<std::string>& keys) noexcept {
-    if (keys.empty()) return Result<std::vector<std::string>>::ok({});
-    ArgvBuilder args(keys.size() + 1);
-    args.push("SINTER");
+Result<std::uint64_t> RedisClient::sscan(std::string_view key,
+                                         std::uint64_t cursor,
+                                         std::size_t count,
+                                         const MemberFn& fn) noexcept {
+    const std::string cursor_str = std::to_string(cursor);
+    const std::string count_str = std::to_string(count == 0 ? kDefaultScanCount : count);
+    ArgvBuilder args(5);
+    args.push("SSCAN");
+    args.push(key);
+    args.push(cursor_str);
+    args.push("COUNT");
+    args.push(count_str);
+    auto r = command_argv(ctx_.get(), args, stats_.get());
+    if (!r) return Result<std::uint64_t>::err(r.error().code, r.error().msg);
+    const redisReply& rep = *r.value();
+    if (auto ok = reply_no_error(rep, "SSCAN"); !ok) return Result<std::uint64_t>::err(ok.error().code, ok.error().msg);
+
+    // reply: [cursor (bulk string), [member, ...]]
+    if (rep.type != REDIS_REPLY_ARRAY || rep.elements != 2 ||
+        !rep.element[0] || rep.element[0]->type != REDIS_REPLY_STRING ||
+        !rep.element[1] || rep.element[1]->type != REDIS_REPLY_ARRAY) {
+        return Result<std::uint64_t>::err(Errc::kRedisReplyType, "SSCAN: unexpected reply shape");
+    }
+    std::uint64_t next = 0;
+    const redisReply& c = *rep.element[0];
+    auto [ptr, ec] = std::from_chars(c.str, c.str + c.len, next);
+    if (ec != std::errc() || ptr != c.str + c.len) {
+        return Result<std::uint64_t>::err(Errc::kRedisReplyType, "SSCAN: invalid cursor");
+    }
+
+    const redisReply& page = *rep.element[1];
+    DecodeTimer decode(stats_.get(), "SSCAN");
+    for (std::size_t i = 0; i < page.elements; ++i) {
+        const redisReply* e = page.element[i];
+        if (e && e->type == REDIS_REPLY_STRING && e->str) fn(std::string_view(e->str, static_cast<std::size_t>(e->len)));
+    }
+    return Result<std::uint64_t>::ok(next);
+}
+
+Result<ScanPage> RedisClient::sscan(std::string_view key, std::uint64_t cursor, std::size_t count) noexcept {
+    ScanPage page;
+    page.members.reserve(count == 0 ? kDefaultScanCount : count);
+    auto next = sscan(key, cursor, count, [&](std::string_view m) { page.members.emplace_back(m); });
+    if (!next) return Result<ScanPage>::err(next.error().code, next.error().msg);
+    page.cursor = next.value();
+    return Result<ScanPage>::ok(std::move(page));
+}
+
+template <class Keys>
+static Result<std::vector<std::string>> set_op(redisContext* c, Stats* stats, const char* op, const Keys& keys) noexcept {
+    if (std::empty(keys)) return Result<std::vector<std::string>>::ok({});
+    ArgvBuilder args(std::size(keys) + 1);
+    args.push(op);
     for (const auto& k : keys) args.push(k);
-    auto r = command_argv(ctx_.get(), args);
+    auto r = command_argv(c, args, stats);
     if (!r) return Result<std::vector<std::string>>::err(r.error().code, r.error().msg);
-    if (auto ok = reply_no_error(*r.value(), "SINTER"); !ok)
+    if (auto ok = reply_no_error(*r.value(), op); !ok)
         return Result<std::vector<std::string>>::err(ok.error().code, ok.error().msg);
+    DecodeTimer decode(stats, op);
     return read_set_array(*r.value());
 }
 
+Result<std::vector<std::string>> RedisClient::sinter(const std::vector<std::string>& keys) noexcept {
+    return set_op(ctx_.get(), stats_.get(), "SINTER", keys);
+}
+
 Result<std::vector<std::string>> RedisClient::sunion(const std::vector<std::string>& keys) noexcept {
-    if (keys.empty()) return Result<std::vector<std::string>>::ok({});
-    ArgvBuilder args(keys.size() + 1);
-    args.push("SUNION");
-    for (const auto& k : keys) args.push(k);
-    auto r = command_argv(ctx_.get(), args);
-    if (!r) return Result<std::vector<std::string>>::err(r.error().code, r.error().msg);
-    if (auto ok = reply_no_error(*r.value(), "SUNION"); !ok)
-        return Result<std::vector<std::string>>::err(ok.error().code, ok.error().msg);
-    return read_set_array(*r.value());
+    return set_op(ctx_.get(), stats_.get(), "SUNION", keys);
 }
 
 Result<std::vector<std::string>> RedisClient::sdiff(const std::vector<std::string>& keys) noexcept {
-    if (keys.empty()) return Result<std::vector<std::string>>::ok({});
-    ArgvBuilder args(keys.size() + 1);
-    args.push("SDIFF");
-    for (const auto& k : keys) args.push(k);
-    auto r = command_argv(ctx_.get(), args);
-    if (!r) return Result<std::vector<std::string>>::err(r.error().code, r.error().msg);
-    if (auto ok = reply_no_error(*r.value(), "SDIFF"); !ok)
-        return Result<std::vector<std::string>>::err(ok.error().code, ok.error().msg);
-    return read_set_array(*r.value());
+    return set_op(ctx_.get(), stats_.get(), "SDIFF", keys);
+}
+
+Result<std::vector<std::string>> RedisClient::sinter(std::span<const std::string_view> keys) noexcept {
+    return set_op(ctx_.get(), stats_.get(), "SINTER", keys);
+}
+
+Result<std::vector<std::string>> RedisClient::sunion(std::span<const std::string_view> keys) noexcept {
+    return set_op(ctx_.get(), stats_.get(), "SUNION", keys);
+}
+
+Result<std::vector<std::string>> RedisClient::sdiff(std::span<const std::string_view> keys) noexcept {
+    return set_op(ctx_.get(), stats_.get(), "SDIFF", keys);
 }
 
 // ---- EXPIRE ----
@@ -246,7 +357,7 @@ Result<Unit> RedisClient::expire_seconds(std::string_view key, int ttl_seconds)
     args.push("EXPIRE");
     args.push(key);
     args.push(ttl_str);
-    auto r = command_argv(ctx_.get(), args);
+    auto r = command_argv(ctx_.get(), args, stats_.get());
     if (!r) return Result<Unit>::err(r.error().code, r.error().msg);
     if (auto ok = reply_no_error(*r.value(), "EXPIRE"); !ok) return ok;
     if (r.value()->type != REDIS_REPLY_INTEGER) return Result<Unit>::err(Errc::kRedisReplyType, "EXPIRE: expected integer reply");
@@ -256,16 +367,18 @@ Result<Unit> RedisClient::expire_seconds(std::string_view key, int ttl_seconds)
 
 // ---- STORE ----
 
+template <class Keys>
 static Result<long long> store_op(redisContext* c,
+                                 Stats* stats,
                                  const char* op,
                                  std::string_view dst,
-                                 const std::vector<std::string>& keys) noexcept {
-    if (keys.empty()) return Result<long long>::err(Errc::kInvalidArg, "store op requires at least one key");
-    ArgvBuilder args(keys.size() + 2);
+                                 const Keys& keys) noexcept {
+    if (std::empty(keys)) return Result<long long>::err(Errc::kInvalidArg, "store op requires at least one key");
+    ArgvBuilder args(std::size(keys) + 2);
     args.push(op);
     args.push(dst);
     for (const auto& k : keys) args.push(k);
-    auto r = command_argv(c, args);
+    auto r = command_argv(c, args, stats);
     if (!r) return Result<long long>::err(r.error().code, r.error().msg);
     if (auto ok = reply_no_error(*r.value(), op); !ok) return Result<long long>::err(ok.error().code, ok.error().msg);
     if (r.value()->type != REDIS_REPLY_INTEGER) return Result<long long>::err(Errc::kRedisReplyType, "store op: expected integer reply");
@@ -273,115 +386,64 @@ static Result<long long> store_op(redisContext* c,
 }
 
 Result<long long> RedisClient::sinterstore(std::string_view dst, const std::vector<std::string>& keys) noexcept {
-    return store_op(ctx_.get(), "SINTERSTORE", dst, keys);
+    return store_op(ctx_.get(), stats_.get(), "SINTERSTORE", dst, keys);
 }
 
 Result<long long> RedisClient::sunionstore(std::string_view dst, const std::vector<std::string>& keys) noexcept {
-    return store_op(ctx_.get(), "SUNIONSTORE", dst, keys);
+    return store_op(ctx_.get(), stats_.get(), "SUNIONSTORE", dst, keys);
 }
 
 Result<long long> RedisClient::sdiffstore(std::string_view dst, const std::vector<std::string>& keys) noexcept {
-    return store_op(ctx_.get(), "SDIFFSTORE", dst, keys);
+    return store_op(ctx_.get(), stats_.get(), "SDIFFSTORE", dst, keys);
 }
 
-Result<long long> RedisClient::store_expire_lua(std::string_view op,
-                                               std::string_view dst,
-                                               int ttl_seconds,
-                                               const std::vector<std::string>& keys) noexcept {
-    if (ttl_seconds <= 0) return Result<long long>::err(Errc::kInvalidArg, "ttl_seconds must be > 0");
-    if (keys.empty()) return Result<long long>::err(Errc::kInvalidArg, "store_expire_lua requires at least one key");
+Result<long long> RedisClient::sinterstore(std::string_view dst, std::span<const std::string_view> keys) noexcept {
+    return store_op(ctx_.get(), stats_.get(), "SINTERSTORE", dst, keys);
+}
 
-    // Redis Lua script (atomic store + expire)
-    static const char* kLua = R"(
-        local op  = ARGV[1]
-        local dst = ARGV[2]
-        local ttl = tonumber(ARGV[3])
+Result<long long> RedisClient::sunionstore(std::string_view dst, std::span<const std::string_view> keys) noexcept {
+    return store_op(ctx_.get(), stats_.get(), "SUNIONSTORE", dst, keys);
+}
 
-        local card = redis.call(op, dst, unpack(KEYS))
+Result<long long> RedisClient::sdiffstore(std::string_view dst, std::span<const std::string_view> keys) noexcept {
+    return store_op(ctx_.get(), stats_.get(), "SDIFFSTORE", dst, keys);
+}
 
-        if ttl and ttl > 0 then
-          redis.call("EXPIRE", dst, ttl)
-        end
+// ---- LUA ----
+//
+// Every script is sent once per connection with SCRIPT LOAD and then run with
+// EVALSHA. NOSCRIPT (server restart / SCRIPT FLUSH) triggers one reload + retry.
 
-        return card
-    )";
+namespace {
 
-    // EVAL <script> <numkeys> key1 key2 ... op dst ttl
-    const std::string numkeys_str = std::to_string(keys.size());
-    const std::string ttl_str = std::to_string(ttl_seconds);
+// KEYS: sources...   ARGV: op, dst, ttl
+constexpr LuaScript kStoreExpireLua{"store_expire_lua", R"lua(
+local op  = ARGV[1]
+local dst = ARGV[2]
+local ttl = tonumber(ARGV[3])
 
-    ArgvBuilder args(keys.size() + 6);
-    args.push("EVAL");
-    args.push(std::string_view(kLua, std::strlen(kLua)));
-    args.push(numkeys_str);
-    for (const auto& k : keys) args.push(k);
-    args.push(op);
-    args.push(dst);
-    args.push(ttl_str);
-
-    auto r = command_argv(ctx_.get(), args);
-    if (!r) return Result<long long>::err(r.error().code, r.error().msg);
-    if (auto ok = reply_no_error(*r.value(), "EVAL(store_expire_lua)"); !ok)
-        return Result<long long>::err(ok.error().code, ok.error().msg);
-    if (r.value()->type != REDIS_REPLY_INTEGER)
-        return Result<long long>::err(Errc::kRedisReplyType, "store_expire_lua: expected integer reply");
-    return Result<long long>::ok(r.value()->integer);
-}
+local card = redis.call(op, dst, unpack(KEYS))
 
-static Result<long long> eval_lua(redisContext* c,
-                                 std::string_view script,
-                                 const std::vector<std::string>& keys,
-                                 const std::vector<std::string>& argv) noexcept {
-    if (!c || script.empty()) return Result<long long>::err(Errc::kInternal, "eval_lua: null context/script");
-    const std::string numkeys_str = std::to_string(static_cast<int>(keys.size()));
-    ArgvBuilder cmd(3 + keys.size() + argv.size());
-    cmd.push("EVAL");
-    cmd.push(script);
-    cmd.push(numkeys_str);
-    for (const auto& k : keys) cmd.push(k);
-    for (const auto& a : argv) cmd.push(a);
-
-    auto r = command_argv(c, cmd);
-    if (!r) return Result<long long>::err(r.error().code, r.error().msg);
-    if (auto ok = reply_no_error(*r.value(), "EVAL"); !ok) return Result<long long>::err(ok.error().code, ok.error().msg);
-    if (r.value()->type != REDIS_REPLY_INTEGER) return Result<long long>::err(Errc::kRedisReplyType, "EVAL: expected integer reply");
-    return Result<long long>::ok(r.value()->integer);
-}
+if ttl and ttl > 0 then
+  redis.call("EXPIRE", dst, ttl)
+end
 
-Result<long long> er::RedisClient::store_all_expire_lua(int ttl_seconds,
-                                                       const std::vector<std::string>& set_keys,
-                                                       std::string_view out_key) noexcept {
-    if (!ctx_) return Result<long long>::err(Errc::kInternal, "redis context is null");
-    if (ttl_seconds <= 0) return Result<long long>::err(Errc::kInvalidArg, "ttl_seconds must be > 0");
-    if (set_keys.empty()) return Result<long long>::err(Errc::kInvalidArg, "store_all_expire_lua requires at least one key");
+return card
+)lua"};
 
-    // KEYS: set_keys...
-    // ARGV: ttl, out_key
-    const char* script = R"lua(
+// KEYS: set_keys...   ARGV: ttl, out_key
+constexpr LuaScript kStoreAllExpireLua{"store_all_expire_lua", R"lua(
 local ttl = tonumber(ARGV[1])
 local out = ARGV[2]
 redis.call('SINTERSTORE', out, unpack(KEYS))
 if ttl and ttl > 0 then
   redis.call('EXPIRE', out, ttl)
 end
-	return redis.call('SCARD', out)
-	)lua";
-
-    const std::vector<std::string> argv{
-        std::to_string(ttl_seconds),
-        std::string(out_key),
-    };
-    return eval_lua(ctx_.get(), std::string_view(script, std::strlen(script)), set_keys, argv);
-}
-
-Result<long long> er::RedisClient::store_any_expire_lua(int ttl_seconds,
-                                                       const std::vector<std::string>& set_keys,
-                                                       std::string_view out_key) noexcept {
-    if (!ctx_) return Result<long long>::err(Errc::kInternal, "redis context is null");
-    if (ttl_seconds <= 0) return Result<long long>::err(Errc::kInvalidArg, "ttl_seconds must be > 0");
-    if (set_keys.empty()) return Result<long long>::err(Errc::kInvalidArg, "store_any_expire_lua requires at least one key");
+return redis.call('SCARD', out)
+)lua"};
 
-    const char* script = R"lua(
+// KEYS: set_keys...   ARGV: ttl, out_key
+constexpr LuaScript kStoreAnyExpireLua{"store_any_expire_lua", R"lua(
 local ttl = tonumber(ARGV[1])
 local out = ARGV[2]
 redis.call('SUNIONSTORE', out, unpack(KEYS))
@@ -389,24 +451,10 @@ if ttl and ttl > 0 then
   redis.call('EXPIRE', out, ttl)
 end
 return redis.call('SCARD', out)
-	)lua";
-
-    const std::vector<std::string> argv{
-        std::to_string(ttl_seconds),
-        std::string(out_key),
-    };
-    return eval_lua(ctx_.get(), std::string_view(script, std::strlen(script)), set_keys, argv);
-}
-
-Result<long long> er::RedisClient::store_not_expire_lua(int ttl_seconds,
-                                                       std::string_view universe_key,
-                                                       const std::vector<std::string>& set_keys,
-                                                       std::string_view out_key) noexcept {
-    if (!ctx_) return Result<long long>::err(Errc::kInternal, "redis context is null");
-    if (ttl_seconds <= 0) return Result<long long>::err(Errc::kInvalidArg, "ttl_seconds must be > 0");
+)lua"};
 
-    // KEYS: universe_key + set_keys...
-    const char* script = R"lua(
+// KEYS: universe_key + set_keys...   ARGV: ttl, out_key
+constexpr LuaScript kStoreNotExpireLua{"store_not_expire_lua", R"lua(
 local ttl = tonumber(ARGV[1])
 local out = ARGV[2]
 -- SDIFFSTORE out universe s1 s2 ...
@@ -415,77 +463,1150 @@ if ttl and ttl > 0 then
   redis.call('EXPIRE', out, ttl)
 end
 return redis.call('SCARD', out)
-	)lua";
-
-    std::vector<std::string> keys;
-    keys.reserve(1 + set_keys.size());
-    keys.push_back(std::string(universe_key));
-    for (auto& k : set_keys) keys.push_back(k);
-    const std::vector<std::string> argv{
-        std::to_string(ttl_seconds),
-        std::string(out_key),
-    };
-    return eval_lua(ctx_.get(), std::string_view(script, std::strlen(script)), keys, argv);
+)lua"};
+
+// KEYS: include_key, exclude1, exclude2, ...   ARGV: ttl, out_key
+// include ∩ (universe \ excludes) == include \ excludes (every indexed element is in
+// the universe), so no universe-sized intermediate set is built.
+constexpr LuaScript kStoreAllNotExpireLua{"store_all_not_expire_lua", R"lua(
+local ttl = tonumber(ARGV[1])
+local out = ARGV[2]
+local n = redis.call('SDIFFSTORE', out, unpack(KEYS))
+if ttl and ttl > 0 then
+  redis.call('EXPIRE', out, ttl)
+end
+return n
+)lua"};
+
+// Lua helpers shared by the element scripts: the set bits of an element's stored
+// flags, from flags_bin or the legacy flags_hex (prepended with lua_with_helpers).
+constexpr char kStoredBitsLua[] = R"lua(
+-- set bits of a 512-byte big-endian blob; byte 512 holds bits 0..7
+local function blob_bits(b, out)
+  for i = 1, 512 do
+    local v = string.byte(b, i)
+    if v ~= 0 then
+      local base = (512 - i) * 8
+      for j = 0, 7 do
+        if v % 2 == 1 then out[base + j] = true end
+        v = math.floor(v / 2)
+      end
+    end
+  end
+end
+
+-- same semantics as Flags4096::from_hex (low 4096 bits kept)
+local function hex_bits(h, out)
+  h = string.gsub(h, '^0[xX]', '')
+  h = string.gsub(h, '%s', '')
+  if #h > 1024 then h = string.sub(h, -1024) end
+  local n = #h
+  for i = n, 1, -1 do
+    local v = tonumber(string.sub(h, i, i), 16)
+    if not v then return false end
+    local base = (n - i) * 4
+    for j = 0, 3 do
+      if v % 2 == 1 then out[base + j] = true end
+      v = math.floor(v / 2)
+    end
+  end
+  return true
+end
+
+-- stored flags of ekey into out; false (and out empty) when neither field decodes
+local function stored_bits(ekey, out)
+  local cur = redis.call('HGET', ekey, 'flags_bin')
+  if cur and #cur == 512 then
+    blob_bits(cur, out)
+    return true
+  end
+  local hex = redis.call('HGET', ekey, 'flags_hex')
+  if hex and #hex > 0 then
+    if hex_bits(hex, out) then return true end
+    for k in pairs(out) do out[k] = nil end
+  end
+  return false
+end
+)lua";
+
+// helpers + body as one NUL-terminated array, built at compile time
+template <std::size_t H, std::size_t B>
+constexpr std::array<char, H + B - 1> lua_with_helpers(const char (&helpers)[H], const char (&body)[B]) {
+    std::array<char, H + B - 1> out{};
+    for (std::size_t i = 0; i + 1 < H; ++i) out[i] = helpers[i];
+    for (std::size_t i = 0; i < B; ++i) out[H - 1 + i] = body[i];
+    return out;
+}
+
+constexpr std::string_view lua_source(const auto& src) {
+    return std::string_view(src.data(), src.size() - 1);
+}
+
+// Atomic element upsert, for a batch of elements in one call. The index delta is
+// computed server-side against the stored flags_bin (or legacy flags_hex), so
+// concurrent writers cannot leave er:idx:bit:* out of sync with the element hash.
+//
+// KEYS: universe_key, idx_versions_key, stats_key (idx_stats / bm_stats)
+//       [, bm_ids, bm_names, bm_next_id, bm_universe]   (bitmap backend only)
+//       , then one element hash per element
+// ARGV: posting_prefix, backend ('set' | 'bitmap'),
+//       then per element: name, flags_bin (512 bytes BE), n_bits, bit1 .. bitN
+//   set:    postings are SETs of names under posting_prefix (er:idx:bit:N)
+//   bitmap: postings are bitmaps over the element's dense id (er:bm:bit:N)
+// Returns: {bits_added, bits_removed, created} per element, in input order
+constexpr auto kUpsertElementsSrc = lua_with_helpers(kStoredBitsLua, R"lua(
+local ukey, vkey, skey = KEYS[1], KEYS[2], KEYS[3]
+local prefix, bitmap = ARGV[1], ARGV[2] == 'bitmap'
+local base = bitmap and 7 or 3
+
+-- Counts are only kept once they are complete: the stats hash was built (has 'all')
+-- or this batch starts an empty universe. Otherwise they wait for a rebuild.
+local tracked = redis.call('HEXISTS', skey, 'all') == 1 or
+                redis.call('EXISTS', bitmap and KEYS[7] or ukey) == 0
+
+local bumped = {}   -- version fields, bumped once per batch
+local delta = {}    -- stats field -> net change of its posting
+
+-- the stats count follows the posting's actual change, not the stored flags
+local function posting(b, on, name, id)
+  local changed
+  if id then
+    changed = redis.call('SETBIT', prefix .. b, id, on and 1 or 0) ~= (on and 1 or 0)
+  elseif on then
+    changed = redis.call('SADD', prefix .. b, name) == 1
+  else
+    changed = redis.call('SREM', prefix .. b, name) == 1
+  end
+  if changed then delta[b] = (delta[b] or 0) + (on and 1 or -1) end
+  bumped[b] = true
+end
+
+local out = {}
+local a, e = 3, 0
+while a <= #ARGV do
+  e = e + 1
+  local ekey, name, blob = KEYS[base + e], ARGV[a], ARGV[a + 1]
+  local last = a + 2 + tonumber(ARGV[a + 2])
+  local id = nil
+  if bitmap then
+    id = redis.call('HGET', KEYS[4], name)
+    if not id then
+      id = redis.call('INCR', KEYS[6]) - 1
+      redis.call('HSET', KEYS[4], name, id)
+      redis.call('HSET', KEYS[5], id, name)
+    end
+    id = tonumber(id)
+  end
+
+  local old = {}
+  stored_bits(ekey, old)
+
+  local new = {}
+  for i = a + 3, last do new[tonumber(ARGV[i])] = true end
+  a = last + 1
+
+  local added, removed = 0, 0
+  for b in pairs(old) do
+    if not new[b] then
+      posting(b, false, name, id)
+      removed = removed + 1
+    end
+  end
+  for b in pairs(new) do
+    if not old[b] then
+      posting(b, true, name, id)
+      added = added + 1
+    end
+  end
+
+  redis.call('HSET', ekey, 'name', name, 'flags_bin', blob)
+  local created = redis.call('SADD', ukey, name)
+  local joined = created == 1
+  if id then joined = redis.call('SETBIT', KEYS[7], id, 1) == 0 end
+  if joined then delta['all'] = (delta['all'] or 0) + 1 end
+  if created == 1 then bumped['all'] = true end
+
+  out[#out + 1] = added
+  out[#out + 1] = removed
+  out[#out + 1] = created
+end
+
+if tracked then
+  for f, by in pairs(delta) do
+    if by ~= 0 then redis.call('HINCRBY', skey, f, by) end
+  end
+end
+-- after the postings, so a cached result built in between is never stamped fresh
+for f in pairs(bumped) do redis.call('HINCRBY', vkey, f, 1) end
+return out
+)lua");
+constexpr LuaScript kUpsertElementsLua{"upsert_elements", lua_source(kUpsertElementsSrc)};
+
+// KEYS: universe, versions, stats, [bm ids, bm names, bm universe,] one element hash per name
+// ARGV: posting prefix, 'set'|'bitmap', force '1'|'0', names...
+constexpr auto kDeleteElementsSrc = lua_with_helpers(kStoredBitsLua, R"lua(
+local ukey, vkey, skey = KEYS[1], KEYS[2], KEYS[3]
+local prefix, bitmap, force = ARGV[1], ARGV[2] == 'bitmap', ARGV[3] == '1'
+local n = #ARGV - 3
+local base = #KEYS - n
+
+local bumped = {}   -- version fields, bumped once per batch
+local left = {}     -- stats field -> members that left it
+local out = {}
+for i = 1, n do
+  local name, ekey = ARGV[3 + i], KEYS[base + i]
+  local id = nil
+  if bitmap then
+    id = redis.call('HGET', KEYS[4], name)
+    if id then id = tonumber(id) end
+  end
+
+  local bits = {}
+  local found = stored_bits(ekey, bits)
+  if not found and force then
+    for b = 0, 4095 do bits[b] = true end
+  end
+
+  local removed = 0
+  for b in pairs(bits) do
+    local changed = 0
+    if not bitmap then
+      changed = redis.call('SREM', prefix .. b, name)
+    elseif id then
+      changed = redis.call('SETBIT', prefix .. b, id, 0)
+    end
+    if changed == 1 then
+      removed = removed + 1
+      bumped[b] = true
+      left[b] = (left[b] or 0) + 1
+    end
+  end
+
+  local gone = redis.call('SREM', ukey, name)
+  local counted = bitmap and 0 or gone   -- bitmap stats count er:bm:all
+  if id then
+    counted = redis.call('SETBIT', KEYS[6], id, 0)
+    gone = gone + counted
+    redis.call('HDEL', KEYS[4], name)
+    redis.call('HDEL', KEYS[5], id)
+  end
+  if gone > 0 then bumped['all'] = true end
+  if counted > 0 then left['all'] = (left['all'] or 0) + 1 end
+
+  out[#out + 1] = found and 1 or 0
+  out[#out + 1] = removed
+  out[#out + 1] = redis.call('DEL', ekey)
+end
+
+if redis.call('HEXISTS', skey, 'all') == 1 then
+  for f, k in pairs(left) do redis.call('HINCRBY', skey, f, -k) end
+end
+for f in pairs(bumped) do redis.call('HINCRBY', vkey, f, 1) end
+return out
+)lua");
+constexpr LuaScript kDeleteElementsLua{"delete_elements", lua_source(kDeleteElementsSrc)};
+
+// KEYS: stats key, universe (er:all or er:bm:all)
+// ARGV: posting prefix, 'set'|'bitmap'
+// Returns: universe size
+constexpr LuaScript kRebuildStatsLua{"rebuild_stats", R"lua(
+local skey, ukey = KEYS[1], KEYS[2]
+local prefix, bitmap = ARGV[1], ARGV[2] == 'bitmap'
+local function size(k)
+  if bitmap then return redis.call('BITCOUNT', k) end
+  return redis.call('SCARD', k)
+end
+
+redis.call('DEL', skey)
+local total = size(ukey)
+local args = {'all', total}
+for b = 0, 4095 do
+  local n = size(prefix .. b)
+  if n > 0 then
+    args[#args + 1] = b
+    args[#args + 1] = n
+  end
+  -- bounded unpack() (Lua stack); an earlier flush may have left nothing for the last one
+  if #args > 0 and (#args >= 2000 or b == 4095) then
+    redis.call('HSET', skey, unpack(args))
+    args = {}
+  end
+end
+return total
+)lua"};
+
+} // namespace
+
+Result<std::string> RedisClient::load_script(const LuaScript& script) noexcept {
+    ArgvBuilder args(3);
+    args.push("SCRIPT");
+    args.push("LOAD");
+    args.push(script.source);
+    auto r = command_argv(ctx_.get(), args, stats_.get());
+    if (!r) return Result<std::string>::err(r.error().code, r.error().msg);
+    if (auto ok = reply_no_error(*r.value(), "SCRIPT LOAD"); !ok) return Result<std::string>::err(ok.error().code, ok.error().msg);
+    if (r.value()->type != REDIS_REPLY_STRING || !r.value()->str)
+        return Result<std::string>::err(Errc::kRedisReplyType, "SCRIPT LOAD: expected string reply");
+    std::string sha(r.value()->str, static_cast<std::size_t>(r.value()->len));
+    script_shas_[script.source.data()] = sha;
+    if (shared_shas_) {
+        try {
+            shared_shas_->put(script, sha);
+        } catch (const std::bad_alloc&) {
+            // the shared cache is an optimisation: this connection still has the SHA
+        }
+    }
+    return Result<std::string>::ok(std::move(sha));
+}
+
+std::optional<std::string> ScriptCache::find(const LuaScript& script) const {
+    std::shared_lock<std::shared_mutex> lock(mu_);
+    const auto it = shas_.find(script.source.data());
+    if (it == shas_.end()) return std::nullopt;
+    return it->second;
+}
+
+void ScriptCache::put(const LuaScript& script, std::string sha) {
+    std::unique_lock<std::shared_mutex> lock(mu_);
+    shas_[script.source.data()] = std::move(sha);
+}
+
+void ScriptCache::drop(const LuaScript& script) noexcept {
+    std::unique_lock<std::shared_mutex> lock(mu_);
+    shas_.erase(script.source.data());
+}
+
+std::size_t ScriptCache::size() const {
+    std::shared_lock<std::shared_mutex> lock(mu_);
+    return shas_.size();
+}
+
+template <class Keys, class Argv>
+Result<detail::ReplyPtr> RedisClient::eval_script(const LuaScript& script, const Keys& keys, const Argv& argv) noexcept {
+    if (!ctx_ || script.source.empty()) return Result<detail::ReplyPtr>::err(Errc::kInternal, "eval_script: null context/script");
+
+    char numkeys[24];
+    const auto nk = std::to_chars(numkeys, numkeys + sizeof(numkeys), std::size(keys)).ptr - numkeys;
+    // the "EVALSHA(<name>)" label is only built when stats or an error need it
+    const std::string op = stats_ ? script_op(script) : std::string();
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        auto it = script_shas_.find(script.source.data());
+        if (it == script_shas_.end() && shared_shas_ && attempt == 0) {
+            // another connection already loaded it: try its SHA before SCRIPT LOAD
+            try {
+                if (auto sha = shared_shas_->find(script)) it = script_shas_.emplace(script.source.data(), std::move(*sha)).first;
+            } catch (const std::bad_alloc&) {
+                // fall back to SCRIPT LOAD below
+            }
+        }
+        if (it == script_shas_.end()) {
+            auto loaded = load_script(script);
+            if (!loaded) return Result<detail::ReplyPtr>::err(loaded.error().code, loaded.error().msg);
+            it = script_shas_.find(script.source.data());
+        }
+
+        ArgvBuilder cmd(3 + std::size(keys) + std::size(argv));
+        cmd.push("EVALSHA");
+        cmd.push(it->second);
+        cmd.push(std::string_view(numkeys, static_cast<std::size_t>(nk)));
+        for (const auto& k : keys) cmd.push(k);
+        for (const auto& a : argv) cmd.push(a);
+
+        auto r = command_argv(ctx_.get(), cmd, stats_.get(), op);
+        if (!r) return r;
+        if (is_noscript(*r.value()) && attempt == 0) {
+            script_shas_.erase(script.source.data());
+            if (shared_shas_) shared_shas_->drop(script);
+            continue;
+        }
+        if (r.value()->type == REDIS_REPLY_ERROR) {
+            auto ok = reply_no_error(*r.value(), op.empty() ? script_op(script) : op);
+            return Result<detail::ReplyPtr>::err(ok.error().code, ok.error().msg);
+        }
+        return r;
+    }
+    return Result<detail::ReplyPtr>::err(Errc::kRedisProtocol, "EVALSHA: NOSCRIPT after reload");
+}
+
+Result<long long> RedisClient::eval_integer(const LuaScript& script,
+                                           const std::vector<std::string>& keys,
+                                           const std::vector<std::string>& argv) noexcept {
+    auto r = eval_script(script, keys, argv);
+    if (!r) return Result<long long>::err(r.error().code, r.error().msg);
+    return reply_integer(*r.value(), script.name);
+}
+
+Result<long long> RedisClient::eval_integer(const LuaScript& script,
+                                           std::span<const std::string_view> keys,
+                                           std::span<const std::string_view> argv) noexcept {
+    auto r = eval_script(script, keys, argv);
+    if (!r) return Result<long long>::err(r.error().code, r.error().msg);
+    return reply_integer(*r.value(), script.name);
+}
+
+Result<std::vector<std::string>> RedisClient::eval_strings(const LuaScript& script,
+                                                          const std::vector<std::string>& keys,
+                                                          const std::vector<std::string>& argv) noexcept {
+    auto r = eval_script(script, keys, argv);
+    if (!r) return Result<std::vector<std::string>>::err(r.error().code, r.error().msg);
+    const std::string op = stats_ ? script_op(script) : std::string();
+    DecodeTimer decode(stats_.get(), op);
+    return read_set_array(*r.value());
+}
+
+Result<std::vector<std::string>> RedisClient::eval_strings(const LuaScript& script,
+                                                          std::span<const std::string_view> keys,
+                                                          std::span<const std::string_view> argv) noexcept {
+    auto r = eval_script(script, keys, argv);
+    if (!r) return Result<std::vector<std::string>>::err(r.error().code, r.error().msg);
+    const std::string op = stats_ ? script_op(script) : std::string();
+    DecodeTimer decode(stats_.get(), op);
+    return read_set_array(*r.value());
+}
+
+template <class Keys>
+Result<long long> RedisClient::store_script(const LuaScript& script, std::string_view head, const Keys& keys,
+                                           int ttl_seconds, std::string_view out_key) noexcept {
+    if (!ctx_) return Result<long long>::err(Errc::kInternal, "redis context is null");
+    if (ttl_seconds <= 0) return Result<long long>::err(Errc::kInvalidArg, "ttl_seconds must be > 0");
+    if (head.empty() && std::empty(keys)) {
+        std::string msg(script.name);
+        msg.append(" requires at least one key");
+        return Result<long long>::err(Errc::kInvalidArg, std::move(msg));
+    }
+
+    // KEYS = [head] + keys without copying either: views over both (inline for narrow calls)
+    constexpr std::size_t kInline = 64;
+    const std::size_t n = (head.empty() ? 0 : 1) + std::size(keys);
+    std::array<std::string_view, kInline> inline_keys{};
+    std::vector<std::string_view> wide;
+    std::string_view* all = inline_keys.data();
+    if (n > kInline) {
+        wide.resize(n);
+        all = wide.data();
+    }
+    std::size_t i = 0;
+    if (!head.empty()) all[i++] = head;
+    for (const auto& k : keys) all[i++] = k;
+
+    char ttl[16];
+    const auto tn = std::to_chars(ttl, ttl + sizeof(ttl), ttl_seconds).ptr - ttl;
+    const std::array<std::string_view, 2> argv{std::string_view(ttl, static_cast<std::size_t>(tn)), out_key};
+    return eval_integer(script, std::span<const std::string_view>(all, n), argv);
+}
+
+Result<long long> RedisClient::store_expire_lua(std::string_view op,
+                                               std::string_view dst,
+                                               int ttl_seconds,
+                                               std::span<const std::string_view> keys) noexcept {
+    if (ttl_seconds <= 0) return Result<long long>::err(Errc::kInvalidArg, "ttl_seconds must be > 0");
+    if (keys.empty()) return Result<long long>::err(Errc::kInvalidArg, "store_expire_lua requires at least one key");
+
+    char ttl[16];
+    const auto tn = std::to_chars(ttl, ttl + sizeof(ttl), ttl_seconds).ptr - ttl;
+    const std::array<std::string_view, 3> argv{op, dst, std::string_view(ttl, static_cast<std::size_t>(tn))};
+    return eval_integer(kStoreExpireLua, keys, argv);
+}
+
+Result<long long> RedisClient::store_expire_lua(std::string_view op,
+                                               std::string_view dst,
+                                               int ttl_seconds,
+                                               const std::vector<std::string>& keys) noexcept {
+    const std::vector<std::string_view> views(keys.begin(), keys.end());
+    return store_expire_lua(op, dst, ttl_seconds, views);
+}
+
+Result<long long> er::RedisClient::store_all_expire_lua(int ttl_seconds,
+                                                       const std::vector<std::string>& set_keys,
+                                                       std::string_view out_key) noexcept {
+    return store_script(kStoreAllExpireLua, {}, set_keys, ttl_seconds, out_key);
+}
+
+Result<long long> er::RedisClient::store_all_expire_lua(int ttl_seconds,
+                                                       std::span<const std::string_view> set_keys,
+                                                       std::string_view out_key) noexcept {
+    return store_script(kStoreAllExpireLua, {}, set_keys, ttl_seconds, out_key);
+}
+
+Result<long long> er::RedisClient::store_any_expire_lua(int ttl_seconds,
+                                                       const std::vector<std::string>& set_keys,
+                                                       std::string_view out_key) noexcept {
+    return store_script(kStoreAnyExpireLua, {}, set_keys, ttl_seconds, out_key);
+}
+
+Result<long long> er::RedisClient::store_any_expire_lua(int ttl_seconds,
+                                                       std::span<const std::string_view> set_keys,
+                                                       std::string_view out_key) noexcept {
+    return store_script(kStoreAnyExpireLua, {}, set_keys, ttl_seconds, out_key);
+}
+
+Result<long long> er::RedisClient::store_not_expire_lua(int ttl_seconds,
+                                                       std::string_view universe_key,
+                                                       const std::vector<std::string>& set_keys,
+                                                       std::string_view out_key) noexcept {
+    return store_script(kStoreNotExpireLua, universe_key, set_keys, ttl_seconds, out_key);
+}
+
+Result<long long> er::RedisClient::store_not_expire_lua(int ttl_seconds,
+                                                       std::string_view universe_key,
+                                                       std::span<const std::string_view> set_keys,
+                                                       std::string_view out_key) noexcept {
+    return store_script(kStoreNotExpireLua, universe_key, set_keys, ttl_seconds, out_key);
 }
 
 Result<long long> er::RedisClient::store_all_not_expire_lua(int ttl_seconds,
                                                            std::string_view include_key,
-                                                           std::string_view universe_key,
                                                            const std::vector<std::string>& exclude_keys,
                                                            std::string_view out_key) noexcept {
-    if (!ctx_) return Result<long long>::err(Errc::kInternal, "redis context is null");
-    if (ttl_seconds <= 0) return Result<long long>::err(Errc::kInvalidArg, "ttl_seconds must be > 0");
+    return store_script(kStoreAllNotExpireLua, include_key, exclude_keys, ttl_seconds, out_key);
+}
 
-    // KEYS: universe_key, exclude1, exclude2, ..., include_key
-    // ARGV: ttl, out_key
-    const char* script = R"lua(
-	local ttl = tonumber(ARGV[1])
-	local out = ARGV[2]
-	-- Avoid tmp-key collisions across concurrent calls for the same out key.
-	-- Use server TIME + a monotonic counter key.
-	local t = redis.call('TIME')
-	local nonce = redis.call('INCR', 'er:tmp:nonce')
-	if redis.call('TTL', 'er:tmp:nonce') < 0 then
-	  redis.call('EXPIRE', 'er:tmp:nonce', 86400)
-	end
-	local tmp = out .. ':tmp:' .. t[1] .. ':' .. t[2] .. ':' .. nonce
-	local tmp_ttl = (ttl and ttl > 0) and ttl or 60
-
-	-- tmp = universe \ excludes
-	redis.call('SDIFFSTORE', tmp, unpack(KEYS, 1, (#KEYS - 1)))
-	redis.call('EXPIRE', tmp, tmp_ttl)
-	-- out = include ∩ tmp
-	redis.call('SINTERSTORE', out, KEYS[#KEYS], tmp)
+Result<long long> er::RedisClient::store_all_not_expire_lua(int ttl_seconds,
+                                                           std::string_view include_key,
+                                                           std::span<const std::string_view> exclude_keys,
+                                                           std::string_view out_key) noexcept {
+    return store_script(kStoreAllNotExpireLua, include_key, exclude_keys, ttl_seconds, out_key);
+}
 
-if ttl and ttl > 0 then
-  redis.call('EXPIRE', out, ttl)
-end
-redis.call('DEL', tmp)
-return redis.call('SCARD', out)
-	)lua";
-
-    std::vector<std::string> keys;
-    keys.reserve(2 + exclude_keys.size());
-    keys.push_back(std::string(universe_key));
-    for (const auto& k : exclude_keys) keys.push_back(k);
-    keys.push_back(std::string(include_key));
-    const std::vector<std::string> argv{
-        std::to_string(ttl_seconds),
-        std::string(out_key),
-    };
-    return eval_lua(ctx_.get(), std::string_view(script, std::strlen(script)), keys, argv);
+// ---- ELEMENT ----
+
+Result<UpsertResult> RedisClient::upsert_element(std::string_view name,
+                                                 const Flags4096& flags,
+                                                 IndexBackend backend,
+                                                 std::string_view prefix) noexcept {
+    auto r = upsert_elements(std::span<const std::string_view>(&name, 1), std::span<const Flags4096>(&flags, 1),
+                             backend, prefix);
+    if (!r) return Result<UpsertResult>::err(r.error().code, r.error().msg);
+    return Result<UpsertResult>::ok(r.value().front());
+}
+
+Result<std::vector<UpsertResult>> RedisClient::upsert_elements(std::span<const std::string_view> names,
+                                                               std::span<const Flags4096> flags,
+                                                               IndexBackend backend,
+                                                               std::string_view prefix) noexcept {
+    using R = Result<std::vector<UpsertResult>>;
+    if (names.size() != flags.size()) return R::err(Errc::kInvalidArg, "upsert_element: one flags per name");
+    if (names.empty()) return R::ok({});
+    for (auto name : names) {
+        if (name.empty()) return R::err(Errc::kInvalidArg, "upsert_element: empty name");
+    }
+
+    const bool bitmap = (backend == IndexBackend::kBitmap);
+    std::vector<std::string> keys{keys::universe(prefix), keys::idx_versions(prefix),
+                                  bitmap ? keys::bm_stats(prefix) : keys::idx_stats(prefix)};
+    if (bitmap) {
+        keys.push_back(keys::bm_ids(prefix));
+        keys.push_back(keys::bm_names(prefix));
+        keys.push_back(keys::bm_next_id(prefix));
+        keys.push_back(keys::bm_universe(prefix));
+    }
+    std::vector<std::string> argv;
+    argv.reserve(2 + 3 * names.size());
+    argv.push_back(bitmap ? keys::bm_bit_prefix(prefix) : keys::idx_bit_prefix(prefix));
+    argv.emplace_back(bitmap ? "bitmap" : "set");
+    keys.reserve(keys.size() + names.size());
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        keys.push_back(keys::element(names[i], prefix));
+        argv.emplace_back(names[i]);
+        std::string blob(Flags4096::kBytes, '\0');
+        flags[i].to_bytes_be(std::span<std::uint8_t, Flags4096::kBytes>(reinterpret_cast<std::uint8_t*>(blob.data()),
+                                                                       Flags4096::kBytes));
+        argv.push_back(std::move(blob));
+        const auto range = flags[i].bits();
+        argv.push_back(std::to_string(range.count()));
+        for (auto b : range) argv.push_back(std::to_string(b));
+    }
+
+    auto r = eval_script(kUpsertElementsLua, keys, argv);
+    if (!r) return R::err(r.error().code, r.error().msg);
+    const redisReply& rep = *r.value();
+    if (rep.type != REDIS_REPLY_ARRAY || rep.elements != 3 * names.size())
+        return R::err(Errc::kRedisReplyType, "upsert_element: expected 3 integers per element");
+    for (std::size_t i = 0; i < rep.elements; ++i) {
+        if (!rep.element[i] || rep.element[i]->type != REDIS_REPLY_INTEGER)
+            return R::err(Errc::kRedisReplyType, "upsert_element: expected integer elements");
+    }
+
+    std::vector<UpsertResult> out(names.size());
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        out[i].bits_added = rep.element[3 * i]->integer;
+        out[i].bits_removed = rep.element[3 * i + 1]->integer;
+        out[i].created = rep.element[3 * i + 2]->integer != 0;
+    }
+    return R::ok(std::move(out));
+}
+
+Result<DeleteResult> RedisClient::delete_element(std::string_view name, bool force, IndexBackend backend,
+                                                 std::string_view prefix) noexcept {
+    auto r = delete_elements(std::span<const std::string_view>(&name, 1), force, backend, prefix);
+    if (!r) return Result<DeleteResult>::err(r.error().code, r.error().msg);
+    return Result<DeleteResult>::ok(r.value().front());
+}
+
+Result<std::vector<DeleteResult>> RedisClient::delete_elements(std::span<const std::string_view> names, bool force,
+                                                               IndexBackend backend, std::string_view prefix) noexcept {
+    using R = Result<std::vector<DeleteResult>>;
+    if (names.empty()) return R::ok({});
+    for (auto name : names) {
+        if (name.empty()) return R::err(Errc::kInvalidArg, "delete_element: empty name");
+    }
+
+    const bool bitmap = (backend == IndexBackend::kBitmap);
+    std::vector<std::string> keys{keys::universe(prefix), keys::idx_versions(prefix),
+                                  bitmap ? keys::bm_stats(prefix) : keys::idx_stats(prefix)};
+    if (bitmap) {
+        keys.push_back(keys::bm_ids(prefix));
+        keys.push_back(keys::bm_names(prefix));
+        keys.push_back(keys::bm_universe(prefix));
+    }
+    std::vector<std::string> argv;
+    argv.reserve(3 + names.size());
+    argv.push_back(bitmap ? keys::bm_bit_prefix(prefix) : keys::idx_bit_prefix(prefix));
+    argv.emplace_back(bitmap ? "bitmap" : "set");
+    argv.emplace_back(force ? "1" : "0");
+    keys.reserve(keys.size() + names.size());
+    for (auto name : names) {
+        keys.push_back(keys::element(name, prefix));
+        argv.emplace_back(name);
+    }
+
+    auto r = eval_script(kDeleteElementsLua, keys, argv);
+    if (!r) return R::err(r.error().code, r.error().msg);
+    const redisReply& rep = *r.value();
+    if (rep.type != REDIS_REPLY_ARRAY || rep.elements != 3 * names.size())
+        return R::err(Errc::kRedisReplyType, "delete_element: expected 3 integers per name");
+
+    std::vector<DeleteResult> out(names.size());
+    for (std::size_t i = 0; i < rep.elements; ++i) {
+        if (!rep.element[i] || rep.element[i]->type != REDIS_REPLY_INTEGER)
+            return R::err(Errc::kRedisReplyType, "delete_element: expected integer elements");
+    }
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        out[i].found = rep.element[3 * i]->integer != 0;
+        out[i].bits_removed = rep.element[3 * i + 1]->integer;
+        out[i].existed = rep.element[3 * i + 2]->integer != 0;
+    }
+    return R::ok(std::move(out));
+}
+
+Result<Flags4096> RedisClient::element_flags(std::string_view name, std::string_view prefix) noexcept {
+    const std::string key = keys::element(name, prefix);
+    auto bin = hget_flags(key, "flags_bin");
+    if (bin || bin.error().code != Errc::kNotFound) return bin;
+
+    auto hex = hget(key, "flags_hex");
+    if (!hex) {
+        if (hex.error().code == Errc::kNotFound)
+            return Result<Flags4096>::err(Errc::kNotFound, "element not found: " + std::string(name));
+        return Result<Flags4096>::err(hex.error().code, hex.error().msg);
+    }
+    return Flags4096::from_hex(hex.value());
+}
+
+// ---- STATS ----
+
+Result<IndexStats> RedisClient::index_stats(IndexBackend backend, std::string_view prefix) noexcept {
+    using R = Result<IndexStats>;
+    const auto& table = keys::KeyTable::of(prefix);
+    std::vector<std::string_view> fields;
+    fields.reserve(keys::KeyTable::kBits + 1);
+    fields.push_back(keys::kUniverseVersionField);
+    for (std::size_t b = 0; b < keys::KeyTable::kBits; ++b) fields.push_back(keys::KeyTable::bit_field(b));
+
+    auto p = pipeline();
+    const auto slot = p.hmget(backend == IndexBackend::kBitmap ? table.bm_stats() : table.idx_stats(), fields);
+    if (auto ok = p.exec(); !ok) return R::err(ok.error().code, ok.error().msg);
+    auto got = p.strings(slot);
+    if (!got) return R::err(got.error().code, got.error().msg);
+    const auto& v = got.value();
+    if (v.size() != fields.size()) return R::err(Errc::kRedisReplyType, "index_stats: short HMGET reply");
+    if (!v[0]) return R::err(Errc::kNotFound, "index_stats: no counts under " + std::string(prefix) + " (rebuild them)");
+
+    IndexStats out;
+    out.bits.assign(keys::KeyTable::kBits, 0);
+    for (std::size_t i = 0; i < v.size(); ++i) {
+        if (!v[i]) continue;
+        long long n = 0;
+        const auto [ptr, ec] = std::from_chars(v[i]->data(), v[i]->data() + v[i]->size(), n);
+        if (ec != std::errc() || ptr != v[i]->data() + v[i]->size())
+            return R::err(Errc::kRedisReplyType, "index_stats: non-integer count for field " + std::string(fields[i]));
+        (i == 0 ? out.universe : out.bits[i - 1]) = n;
+    }
+    return R::ok(std::move(out));
+}
+
+Result<long long> RedisClient::rebuild_index_stats(IndexBackend backend, std::string_view prefix) noexcept {
+    const bool bitmap = (backend == IndexBackend::kBitmap);
+    const auto& table = keys::KeyTable::of(prefix);
+    const std::array<std::string_view, 2> keys{bitmap ? table.bm_stats() : table.idx_stats(),
+                                               bitmap ? table.bm_universe() : table.universe()};
+    const std::string head = bitmap ? keys::bm_bit_prefix(prefix) : keys::idx_bit_prefix(prefix);
+    const std::array<std::string_view, 2> argv{head, bitmap ? "bitmap" : "set"};
+    return eval_integer(kRebuildStatsLua, keys, argv);
 }
 
 Result<long long> er::RedisClient::del_key(std::string_view key) noexcept {
     ArgvBuilder args(2);
     args.push("DEL");
     args.push(key);
-    auto r = command_argv(ctx_.get(), args);
+    auto r = command_argv(ctx_.get(), args, stats_.get());
     if (!r) return Result<long long>::err(r.error().code, r.error().msg);
     if (auto ok = reply_no_error(*r.value(), "DEL"); !ok) return Result<long long>::err(ok.error().code, ok.error().msg);
     if (r.value()->type != REDIS_REPLY_INTEGER) return Result<long long>::err(Errc::kRedisReplyType, "DEL: expected integer reply");
     return Result<long long>::ok(r.value()->integer);
 }
 
+Result<long long> er::RedisClient::unlink_keys(std::span<const std::string_view> keys) noexcept {
+    if (keys.empty()) return Result<long long>::ok(0);
+    ArgvBuilder args(keys.size() + 1);
+    args.push("UNLINK");
+    for (const auto k : keys) args.push(k);
+    auto r = command_argv(ctx_.get(), args, stats_.get());
+    if (!r) return Result<long long>::err(r.error().code, r.error().msg);
+    if (auto ok = reply_no_error(*r.value(), "UNLINK"); !ok) return Result<long long>::err(ok.error().code, ok.error().msg);
+    if (r.value()->type != REDIS_REPLY_INTEGER) return Result<long long>::err(Errc::kRedisReplyType, "UNLINK: expected integer reply");
+    return Result<long long>::ok(r.value()->integer);
+}
+
+// ---- CLUSTER ----
+
+Result<std::vector<SlotRange>> RedisClient::cluster_slots() noexcept {
+    using R = Result<std::vector<SlotRange>>;
+    ArgvBuilder args(2);
+    args.push("CLUSTER");
+    args.push("SLOTS");
+    auto r = command_argv(ctx_.get(), args, stats_.get());
+    if (!r) return R::err(r.error().code, r.error().msg);
+    const redisReply& rep = *r.value();
+    if (auto ok = reply_no_error(rep, "CLUSTER SLOTS"); !ok) return R::err(ok.error().code, ok.error().msg);
+    if (rep.type != REDIS_REPLY_ARRAY) return R::err(Errc::kRedisReplyType, "CLUSTER SLOTS: expected array reply");
+
+    // [first, last, [host, port, id, ...], replicas ...] per range
+    std::vector<SlotRange> out;
+    out.reserve(rep.elements);
+    for (std::size_t i = 0; i < rep.elements; ++i) {
+        const redisReply* e = rep.element[i];
+        if (!e || e->type != REDIS_REPLY_ARRAY || e->elements < 3 || e->element[0]->type != REDIS_REPLY_INTEGER ||
+            e->element[1]->type != REDIS_REPLY_INTEGER || e->element[2]->type != REDIS_REPLY_ARRAY) {
+            return R::err(Errc::kRedisReplyType, "CLUSTER SLOTS: malformed slot range");
+        }
+        const redisReply& master = *e->element[2];
+        if (master.elements < 2 || master.element[0]->type != REDIS_REPLY_STRING ||
+            master.element[1]->type != REDIS_REPLY_INTEGER) {
+            return R::err(Errc::kRedisReplyType, "CLUSTER SLOTS: malformed master entry");
+        }
+        const long long first = e->element[0]->integer, last = e->element[1]->integer;
+        if (first < 0 || last < first || last >= 16384)
+            return R::err(Errc::kRedisProtocol, "CLUSTER SLOTS: slot out of range");
+        SlotRange range;
+        range.first = static_cast<std::uint16_t>(first);
+        range.last = static_cast<std::uint16_t>(last);
+        range.host.assign(master.element[0]->str, static_cast<std::size_t>(master.element[0]->len));
+        range.port = static_cast<int>(master.element[1]->integer);
+        out.push_back(std::move(range));
+    }
+    return R::ok(std::move(out));
+}
+
+// ---- TRACKING ----
+
+Result<long long> RedisClient::client_id() noexcept {
+    ArgvBuilder args(2);
+    args.push("CLIENT");
+    args.push("ID");
+    auto r = command_argv(ctx_.get(), args, stats_.get());
+    if (!r) return Result<long long>::err(r.error().code, r.error().msg);
+    if (auto ok = reply_no_error(*r.value(), "CLIENT ID"); !ok) return Result<long long>::err(ok.error().code, ok.error().msg);
+    if (r.value()->type != REDIS_REPLY_INTEGER)
+        return Result<long long>::err(Errc::kRedisReplyType, "CLIENT ID: expected integer reply");
+    return Result<long long>::ok(r.value()->integer);
+}
+
+Result<Unit> RedisClient::track_broadcast(long long redirect, std::span<const std::string_view> prefixes) noexcept {
+    const std::string id = std::to_string(redirect);
+    ArgvBuilder args(6 + 2 * prefixes.size());
+    args.push("CLIENT");
+    args.push("TRACKING");
+    args.push("ON");
+    args.push("REDIRECT");
+    args.push(id);
+    args.push("BCAST");
+    for (const auto p : prefixes) {
+        args.push("PREFIX");
+        args.push(p);
+    }
+    auto r = command_argv(ctx_.get(), args, stats_.get());
+    if (!r) return Result<Unit>::err(r.error().code, r.error().msg);
+    return reply_no_error(*r.value(), "CLIENT TRACKING");
+}
+
+Result<Unit> RedisClient::subscribe_invalidations() noexcept {
+    ArgvBuilder args(2);
+    args.push("SUBSCRIBE");
+    args.push("__redis__:invalidate");
+    auto r = command_argv(ctx_.get(), args, stats_.get());
+    if (!r) return Result<Unit>::err(r.error().code, r.error().msg);
+    return reply_no_error(*r.value(), "SUBSCRIBE");
+}
+
+Result<Invalidation> RedisClient::next_invalidation() noexcept {
+    using R = Result<Invalidation>;
+    if (!ctx_) return R::err(Errc::kInternal, "next_invalidation: null context");
+    const auto is = [](const redisReply* e, std::string_view s) {
+        return e && e->type == REDIS_REPLY_STRING && std::string_view(e->str, static_cast<std::size_t>(e->len)) == s;
+    };
+    for (;;) {
+        void* raw = nullptr;
+        if (redisGetReply(ctx_.get(), &raw) != REDIS_OK || !raw)
+            return R::err(Errc::kRedisIo, ctx_->err ? ctx_->errstr : "invalidation read failed");
+        const ReplyPtr r(static_cast<redisReply*>(raw));
+        // ["message", "__redis__:invalidate", [key ...] | nil]; confirmations are skipped
+        if (r->type != REDIS_REPLY_ARRAY || r->elements != 3 || !is(r->element[0], "message")) continue;
+
+        Invalidation inv;
+        const redisReply* ks = r->element[2];
+        if (!ks || ks->type == REDIS_REPLY_NIL) {
+            inv.all = true;
+            return R::ok(std::move(inv));
+        }
+        if (ks->type != REDIS_REPLY_ARRAY) return R::err(Errc::kRedisReplyType, "invalidation: expected key array");
+        try {
+            inv.keys.reserve(ks->elements);
+            for (std::size_t i = 0; i < ks->elements; ++i) {
+                const redisReply* k = ks->element[i];
+                if (k && k->type == REDIS_REPLY_STRING) inv.keys.emplace_back(k->str, static_cast<std::size_t>(k->len));
+            }
+        } catch (const std::bad_alloc&) {
+            // cannot keep the keys: dropping everything is the safe reading
+            inv.keys.clear();
+            inv.all = true;
+        }
+        return R::ok(std::move(inv));
+    }
+}
+
+void RedisClient::interrupt() noexcept {
+    if (ctx_ && ctx_->fd >= 0) ::shutdown(ctx_->fd, SHUT_RDWR);
+}
+
+// ---- STATS ----
+
+void RedisClient::enable_stats(bool on) noexcept {
+    if (!kStatsCompiled) return;
+    if (on) stats_ = std::make_unique<Stats>();
+    else stats_.reset();
+}
+
+void RedisClient::reset_stats() noexcept {
+    if (stats_) stats_->reset();
+}
+
+void RedisClient::record_op(std::string_view op, std::uint64_t ns) noexcept {
+    if (!stats_) return;
+    CommandStats& s = stats_->at(op);
+    ++s.calls;
+    s.latency.record(ns);
+}
+
+// ---- PIPELINE ----
+
+RedisClient::Pipeline RedisClient::pipeline() noexcept {
+    return Pipeline(ctx_.get(), stats_.get());
+}
+
+RedisClient::Pipeline::~Pipeline() {
+    // Keep the connection in sync: replies we never read would otherwise be
+    // returned to the next command issued on this client.
+    if (broken_ || !ctx_) return;
+    while (replies_.size() < appended_) {
+        void* raw = nullptr;
+        if (redisGetReply(ctx_, &raw) != REDIS_OK) return;
+        replies_.emplace_back(static_cast<redisReply*>(raw));
+    }
+}
+
+RedisClient::Pipeline::Slot RedisClient::Pipeline::append(const char* op,
+                                                         int argc,
+                                                         const char** argv,
+                                                         const std::size_t* argvlen) noexcept {
+    const Slot slot = ops_.size();
+    ops_.push_back(op);
+    if (broken_) return slot;
+    if (!ctx_) {
+        broken_ = true;
+        error_ = Error{Errc::kInternal, "redis context is null"};
+        return slot;
+    }
+    if (redisAppendCommandArgv(ctx_, argc, argv, argvlen) != REDIS_OK) {
+        broken_ = true;
+        std::string msg(op);
+        msg.append(": append failed: ");
+        msg.append(ctx_->err ? ctx_->errstr : "out of memory");
+        error_ = Error{Errc::kRedisIo, std::move(msg)};
+        return slot;
+    }
+    ++appended_;
+    if (kStatsCompiled && stats_) pending_bytes_ += request_bytes(argc, argvlen);
+    return slot;
+}
+
+RedisClient::Pipeline::Slot RedisClient::Pipeline::hset(std::string_view key,
+                                                       std::string_view field,
+                                                       std::string_view value) noexcept {
+    ArgvBuilder args(4);
+    args.push("HSET");
+    args.push(key);
+    args.push(field);
+    args.push(value);
+    return append("HSET", args.argc(), args.argv(), args.argvlen());
+}
+
+RedisClient::Pipeline::Slot RedisClient::Pipeline::hset_bin(std::string_view key,
+                                                           std::string_view field,
+                                                           const void* data,
+                                                           std::size_t len) noexcept {
+    ArgvBuilder args(4);
+    args.push("HSET");
+    args.push(key);
+    args.push(field);
+    args.push_bytes(data, len);
+    return append("HSET(bin)", args.argc(), args.argv(), args.argvlen());
+}
+
+RedisClient::Pipeline::Slot RedisClient::Pipeline::hget(std::string_view key, std::string_view field) noexcept {
+    ArgvBuilder args(3);
+    args.push("HGET");
+    args.push(key);
+    args.push(field);
+    return append("HGET", args.argc(), args.argv(), args.argvlen());
+}
+
+RedisClient::Pipeline::Slot RedisClient::Pipeline::hmget(std::string_view key,
+                                                        std::span<const std::string_view> fields) noexcept {
+    ArgvBuilder args(2 + fields.size());
+    args.push("HMGET");
+    args.push(key);
+    for (auto f : fields) args.push(f);
+    return append("HMGET", args.argc(), args.argv(), args.argvlen());
+}
+
+RedisClient::Pipeline::Slot RedisClient::Pipeline::element_flags(std::string_view name, std::string_view prefix) noexcept {
+    const std::string key = keys::element(name, prefix);
+    ArgvBuilder args(4);
+    args.push("HMGET");
+    args.push(key);
+    args.push("flags_bin");
+    args.push("flags_hex");
+    return append("HMGET(flags)", args.argc(), args.argv(), args.argvlen());
+}
+
+RedisClient::Pipeline::Slot RedisClient::Pipeline::sadd(std::string_view key, std::string_view member) noexcept {
+    ArgvBuilder args(3);
+    args.push("SADD");
+    args.push(key);
+    args.push(member);
+    return append("SADD", args.argc(), args.argv(), args.argvlen());
+}
+
+RedisClient::Pipeline::Slot RedisClient::Pipeline::srem(std::string_view key, std::string_view member) noexcept {
+    ArgvBuilder args(3);
+    args.push("SREM");
+    args.push(key);
+    args.push(member);
+    return append("SREM", args.argc(), args.argv(), args.argvlen());
+}
+
+RedisClient::Pipeline::Slot RedisClient::Pipeline::sadd(std::string_view key,
+                                                       std::span<const std::string_view> members) noexcept {
+    ArgvBuilder args(2 + members.size());
+    args.push("SADD");
+    args.push(key);
+    for (auto m : members) args.push(m);
+    return append("SADD", args.argc(), args.argv(), args.argvlen());
+}
+
+RedisClient::Pipeline::Slot RedisClient::Pipeline::srem(std::string_view key,
+                                                       std::span<const std::string_view> members) noexcept {
+    ArgvBuilder args(2 + members.size());
+    args.push("SREM");
+    args.push(key);
+    for (auto m : members) args.push(m);
+    return append("SREM", args.argc(), args.argv(), args.argvlen());
+}
+
+RedisClient::Pipeline::Slot RedisClient::Pipeline::hincrby(std::string_view key,
+                                                          std::string_view field,
+                                                          long long by) noexcept {
+    const std::string by_str = std::to_string(by);
+    ArgvBuilder args(4);
+    args.push("HINCRBY");
+    args.push(key);
+    args.push(field);
+    args.push(by_str);
+    return append("HINCRBY", args.argc(), args.argv(), args.argvlen());
+}
+
+RedisClient::Pipeline::Slot RedisClient::Pipeline::hdel(std::string_view key, std::string_view field) noexcept {
+    ArgvBuilder args(3);
+    args.push("HDEL");
+    args.push(key);
+    args.push(field);
+    return append("HDEL", args.argc(), args.argv(), args.argvlen());
+}
+
+RedisClient::Pipeline::Slot RedisClient::Pipeline::setbit(std::string_view key,
+                                                         std::uint64_t offset,
+                                                         bool value) noexcept {
+    const std::string offset_str = std::to_string(offset);
+    ArgvBuilder args(4);
+    args.push("SETBIT");
+    args.push(key);
+    args.push(offset_str);
+    args.push(value ? "1" : "0");
+    return append("SETBIT", args.argc(), args.argv(), args.argvlen());
+}
+
+RedisClient::Pipeline::Slot RedisClient::Pipeline::del_key(std::string_view key) noexcept {
+    ArgvBuilder args(2);
+    args.push("DEL");
+    args.push(key);
+    return append("DEL", args.argc(), args.argv(), args.argvlen());
+}
+
+RedisClient::Pipeline::Slot RedisClient::Pipeline::scard(std::string_view key) noexcept {
+    ArgvBuilder args(2);
+    args.push("SCARD");
+    args.push(key);
+    return append("SCARD", args.argc(), args.argv(), args.argvlen());
+}
+
+Result<Unit> RedisClient::Pipeline::exec() noexcept {
+    if (broken_) return Result<Unit>::err(error_.code, error_.msg);
+    const bool timed = kStatsCompiled && stats_;
+    const auto t0 = timed ? StatsClock::now() : StatsClock::time_point{};
+    const std::size_t first = replies_.size();
+    replies_.reserve(appended_);
+    bool failed = false;
+    while (replies_.size() < appended_) {
+        void* raw = nullptr;
+        // The first redisGetReply flushes the whole output buffer in one write.
+        if (redisGetReply(ctx_, &raw) != REDIS_OK || !raw) {
+            broken_ = true;
+            error_ = Error{Errc::kRedisIo, ctx_->err ? ctx_->errstr : "redis pipeline read failed"};
+            failed = true;
+            break;
+        }
+        replies_.emplace_back(static_cast<redisReply*>(raw));
+    }
+
+    if (timed && (failed || replies_.size() > first)) {
+        // one call per exec; each command is one reply element
+        CommandStats& s = stats_->at("PIPELINE");
+        ++s.calls;
+        s.latency.record(elapsed_ns(t0));
+        s.bytes_sent += std::exchange(pending_bytes_, 0);
+        s.reply_elements += replies_.size() - first;
+        if (failed) ++s.errors;
+        for (std::size_t i = first; i < replies_.size(); ++i) {
+            s.bytes_received += reply_bytes(*replies_[i]);
+            if (replies_[i]->type == REDIS_REPLY_ERROR) ++s.errors;
+        }
+    }
+    if (failed) return Result<Unit>::err(error_.code, error_.msg);
+    return Result<Unit>::ok();
+}
+
+Result<const redisReply*> RedisClient::Pipeline::reply_at(Slot slot) const noexcept {
+    if (slot >= ops_.size()) return Result<const redisReply*>::err(Errc::kInvalidArg, "pipeline: slot out of range");
+    if (slot >= replies_.size()) {
+        if (broken_) return Result<const redisReply*>::err(error_.code, error_.msg);
+        return Result<const redisReply*>::err(Errc::kInvalidArg, "pipeline: reply not read yet (call exec)");
+    }
+    const redisReply* r = replies_[slot].get();
+    if (auto ok = reply_no_error(*r, ops_[slot]); !ok) return Result<const redisReply*>::err(ok.error().code, ok.error().msg);
+    return Result<const redisReply*>::ok(r);
+}
+
+Result<long long> RedisClient::Pipeline::integer(Slot slot) const noexcept {
+    auto r = reply_at(slot);
+    if (!r) return Result<long long>::err(r.error().code, r.error().msg);
+    if (r.value()->type != REDIS_REPLY_INTEGER) {
+        return Result<long long>::err(Errc::kRedisReplyType, std::string(ops_[slot]) + ": expected integer reply");
+    }
+    return Result<long long>::ok(r.value()->integer);
+}
+
+Result<std::string> RedisClient::Pipeline::string(Slot slot) const noexcept {
+    auto r = reply_at(slot);
+    if (!r) return Result<std::string>::err(r.error().code, r.error().msg);
+    if (r.value()->type == REDIS_REPLY_NIL) return Result<std::string>::err(Errc::kNotFound, std::string(ops_[slot]) + ": not found");
+    if (r.value()->type != REDIS_REPLY_STRING || !r.value()->str) {
+        return Result<std::string>::err(Errc::kRedisReplyType, std::string(ops_[slot]) + ": expected string reply");
+    }
+    return Result<std::string>::ok(std::string(r.value()->str, static_cast<std::size_t>(r.value()->len)));
+}
+
+Result<Flags4096> RedisClient::Pipeline::flags(Slot slot) const noexcept {
+    auto r = reply_at(slot);
+    if (!r) return Result<Flags4096>::err(r.error().code, r.error().msg);
+    if (r.value()->type == REDIS_REPLY_NIL) return Result<Flags4096>::err(Errc::kNotFound, std::string(ops_[slot]) + ": not found");
+    if (r.value()->type != REDIS_REPLY_STRING || !r.value()->str) {
+        return Result<Flags4096>::err(Errc::kRedisReplyType, std::string(ops_[slot]) + ": expected string reply");
+    }
+    return Flags4096::from_bytes_be(std::string_view(r.value()->str, static_cast<std::size_t>(r.value()->len)));
+}
+
+Result<std::vector<std::optional<std::string>>> RedisClient::Pipeline::strings(Slot slot) const noexcept {
+    using Out = std::vector<std::optional<std::string>>;
+    auto r = reply_at(slot);
+    if (!r) return Result<Out>::err(r.error().code, r.error().msg);
+    if (r.value()->type != REDIS_REPLY_ARRAY) {
+        return Result<Out>::err(Errc::kRedisReplyType, std::string(ops_[slot]) + ": expected array reply");
+    }
+    Out out;
+    out.reserve(r.value()->elements);
+    for (std::size_t i = 0; i < r.value()->elements; ++i) {
+        const redisReply* e = r.value()->element[i];
+        if (e && e->type == REDIS_REPLY_STRING && e->str) {
+            out.emplace_back(std::string(e->str, static_cast<std::size_t>(e->len)));
+        } else {
+            out.emplace_back(std::nullopt);
+        }
+    }
+    return Result<Out>::ok(std::move(out));
+}
+
+Result<Flags4096> RedisClient::Pipeline::stored_flags(Slot slot) const noexcept {
+    auto r = reply_at(slot);
+    if (!r) return Result<Flags4096>::err(r.error().code, r.error().msg);
+    const redisReply* rep = r.value();
+    if (rep->type != REDIS_REPLY_ARRAY || rep->elements != 2) {
+        return Result<Flags4096>::err(Errc::kRedisReplyType, std::string(ops_[slot]) + ": expected array reply");
+    }
+    const auto field = [&](std::size_t i) -> const redisReply* {
+        const redisReply* e = rep->element[i];
+        return (e && e->type == REDIS_REPLY_STRING && e->str) ? e : nullptr;
+    };
+    const redisReply* bin = field(0);
+    const redisReply* hex = field(1);
+    if (bin) {
+        auto f = Flags4096::from_bytes_be(std::string_view(bin->str, static_cast<std::size_t>(bin->len)));
+        if (f) return f;
+    }
+    if (hex) {
+        auto f = Flags4096::from_hex(std::string_view(hex->str, static_cast<std::size_t>(hex->len)));
+        if (f) return f;
+    }
+    if (bin || hex) return Result<Flags4096>::ok(Flags4096{});
+    return Result<Flags4096>::err(Errc::kNotFound, std::string(ops_[slot]) + ": not found");
+}
+
+Result<Unit> RedisClient::Pipeline::first_error() const noexcept {
+    for (Slot i = 0; i < replies_.size(); ++i) {
+        if (auto ok = reply_no_error(*replies_[i], ops_[i]); !ok) return ok;
+    }
+    if (broken_) return Result<Unit>::err(error_.code, error_.msg);
+    return Result<Unit>::ok();
+}
 
 } // namespace er
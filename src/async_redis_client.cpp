@@ -0,0 +1,420 @@
+#include "er/async_redis_client.hpp"
+
+#include "er/detail/reply.hpp"
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <coroutine>
+#include <cstring>
+
+namespace er {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+template <class T>
+using Decode = Result<T> (*)(const redisReply&, std::string_view op);
+
+using detail::ArgvBuilder;
+using detail::is_noscript;
+using detail::read_set_array;
+using detail::reply_integer;
+using detail::reply_no_error;
+using detail::script_op;
+
+template <class T>
+Result<T> type_error(std::string_view op, const char* expected) {
+    std::string msg(op);
+    msg.append(": expected ");
+    msg.append(expected);
+    msg.append(" reply");
+    return Result<T>::err(Errc::kRedisReplyType, std::move(msg));
+}
+
+Result<Unit> decode_pong(const redisReply& r, std::string_view op) noexcept {
+    if (auto ok = reply_no_error(r, op); !ok) return ok;
+    if (r.type == REDIS_REPLY_STATUS && r.str && std::string_view(r.str, static_cast<std::size_t>(r.len)) == "PONG")
+        return Result<Unit>::ok();
+    return Result<Unit>::err(Errc::kRedisReplyType, "PING: expected PONG");
+}
+
+Result<std::string> decode_string(const redisReply& r, std::string_view op) noexcept {
+    if (auto ok = reply_no_error(r, op); !ok) return Result<std::string>::err(ok.error().code, ok.error().msg);
+    if (r.type == REDIS_REPLY_NIL) return Result<std::string>::err(Errc::kNotFound, std::string(op) + ": not found");
+    if (r.type != REDIS_REPLY_STRING || !r.str) return type_error<std::string>(op, "string");
+    return Result<std::string>::ok(std::string(r.str, static_cast<std::size_t>(r.len)));
+}
+
+Result<Flags4096> decode_flags(const redisReply& r, std::string_view op) noexcept {
+    if (auto ok = reply_no_error(r, op); !ok) return Result<Flags4096>::err(ok.error().code, ok.error().msg);
+    if (r.type == REDIS_REPLY_NIL) return Result<Flags4096>::err(Errc::kNotFound, std::string(op) + ": not found");
+    if (r.type != REDIS_REPLY_STRING || !r.str) return type_error<Flags4096>(op, "string");
+    return Flags4096::from_bytes_be(std::string_view(r.str, static_cast<std::size_t>(r.len)));
+}
+
+Result<std::vector<std::string>> decode_strings(const redisReply& r, std::string_view op) noexcept {
+    using Out = std::vector<std::string>;
+    if (auto ok = reply_no_error(r, op); !ok) return Result<Out>::err(ok.error().code, ok.error().msg);
+    if (r.type != REDIS_REPLY_ARRAY) return type_error<Out>(op, "array");
+    return read_set_array(r);
+}
+
+// Awaitable for one command: sent in await_suspend, its reply decoded in the hiredis
+// callback, which then resumes the awaiting coroutine. Lives in that coroutine's frame
+// until it is resumed. hiredis formats argv into its output buffer when the command
+// is issued, so the arguments need not outlive the send.
+template <class T>
+class Command {
+public:
+    Command(redisAsyncContext* ac, const std::string& lost, std::string op, Decode<T> decode, ArgvBuilder args,
+            bool* noscript = nullptr)
+        : ac_(ac), lost_(lost), op_(std::move(op)), decode_(decode), args_(std::move(args)), noscript_(noscript) {}
+
+    bool await_ready() noexcept {
+        if (ac_) return false;
+        fail(Errc::kRedisIo, lost_);
+        return true;
+    }
+
+    bool await_suspend(std::coroutine_handle<> waiter) noexcept {
+        waiter_ = waiter;
+        if (redisAsyncCommandArgv(ac_, &Command::on_reply, this, args_.argc(), args_.argv(), args_.argvlen()) ==
+            REDIS_OK)
+            return true;
+        // closing, or out of memory: no callback will come
+        fail(Errc::kRedisIo, ac_->err && ac_->errstr ? ac_->errstr : "connection is closing");
+        return false;
+    }
+
+    Result<T> await_resume() { return std::move(*result_); }
+
+private:
+    static void on_reply(redisAsyncContext* ac, void* reply, void* privdata) {
+        auto* self = static_cast<Command*>(privdata);
+        if (!reply) {
+            // connection failed, timed out or is being freed
+            const Errc code = ac->err == REDIS_ERR_TIMEOUT ? Errc::kTimeout : Errc::kRedisIo;
+            self->fail(code, ac->err && ac->errstr ? ac->errstr : "connection closed");
+        } else {
+            const auto& r = *static_cast<const redisReply*>(reply);
+            if (self->noscript_) *self->noscript_ = is_noscript(r);
+            self->result_.emplace(self->decode_(r, self->op_));
+        }
+        self->waiter_.resume();   // may free the frame holding *self
+    }
+
+    void fail(Errc code, std::string_view why) {
+        std::string msg(op_);
+        msg.append(": ");
+        msg.append(why);
+        result_.emplace(Result<T>::err(code, std::move(msg)));
+    }
+
+    redisAsyncContext* ac_;
+    const std::string& lost_;
+    std::string op_;
+    Decode<T> decode_;
+    ArgvBuilder args_;
+    bool* noscript_;
+    std::coroutine_handle<> waiter_{};
+    std::optional<Result<T>> result_{};
+};
+
+timeval to_timeval(int ms) noexcept {
+    timeval tv{};
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    return tv;
+}
+
+} // namespace
+
+// ---- EventLoop ----
+
+Result<std::unique_ptr<EventLoop>> EventLoop::create() noexcept {
+    const int fd = epoll_create1(EPOLL_CLOEXEC);
+    if (fd < 0) return Result<std::unique_ptr<EventLoop>>::err(Errc::kInternal, std::string("epoll_create1: ") + std::strerror(errno));
+    return Result<std::unique_ptr<EventLoop>>::ok(std::unique_ptr<EventLoop>(new EventLoop(fd)));
+}
+
+EventLoop::~EventLoop() {
+    close(epfd_);
+}
+
+void EventLoop::attach(Watch& w, redisAsyncContext* ac) noexcept {
+    w.loop = this;
+    w.ac = ac;
+    w.fd = ac->c.fd;
+    watches_.push_back(&w);
+
+    ac->ev.data = &w;
+    ac->ev.addRead = [](void* p) {
+        auto& w = *static_cast<Watch*>(p);
+        w.events |= EPOLLIN;
+        w.loop->update(w);
+    };
+    ac->ev.delRead = [](void* p) {
+        auto& w = *static_cast<Watch*>(p);
+        w.events &= ~static_cast<std::uint32_t>(EPOLLIN);
+        w.loop->update(w);
+    };
+    ac->ev.addWrite = [](void* p) {
+        auto& w = *static_cast<Watch*>(p);
+        w.events |= EPOLLOUT;
+        w.loop->update(w);
+    };
+    ac->ev.delWrite = [](void* p) {
+        auto& w = *static_cast<Watch*>(p);
+        w.events &= ~static_cast<std::uint32_t>(EPOLLOUT);
+        w.loop->update(w);
+    };
+    ac->ev.cleanup = [](void* p) {
+        auto& w = *static_cast<Watch*>(p);
+        w.loop->detach(w);
+    };
+    ac->ev.scheduleTimer = [](void* p, timeval tv) {
+        auto& w = *static_cast<Watch*>(p);
+        w.deadline = Clock::now() + std::chrono::seconds(tv.tv_sec) + std::chrono::microseconds(tv.tv_usec);
+    };
+}
+
+void EventLoop::update(Watch& w) noexcept {
+    epoll_event ev{};
+    ev.events = w.events;
+    ev.data.ptr = &w;
+    if (w.events == 0) {
+        if (w.registered) epoll_ctl(epfd_, EPOLL_CTL_DEL, w.fd, nullptr);
+        w.registered = false;
+        return;
+    }
+    epoll_ctl(epfd_, w.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, w.fd, &ev);
+    w.registered = true;
+}
+
+void EventLoop::detach(Watch& w) noexcept {
+    w.events = 0;
+    update(w);
+    w.ac = nullptr;
+    w.deadline.reset();
+    watches_.erase(std::remove(watches_.begin(), watches_.end(), &w), watches_.end());
+}
+
+Result<Unit> EventLoop::poll(int timeout_ms) noexcept {
+    // wake up for the earliest command/connect timeout
+    const auto now = Clock::now();
+    for (const Watch* w : watches_) {
+        if (!w->deadline) continue;
+        const auto left = std::chrono::ceil<std::chrono::milliseconds>(*w->deadline - now).count();
+        const int ms = static_cast<int>(std::max<decltype(left)>(left, 0));
+        if (timeout_ms < 0 || ms < timeout_ms) timeout_ms = ms;
+    }
+
+    epoll_event events[64];
+    const int n = epoll_wait(epfd_, events, 64, timeout_ms);
+    if (n < 0 && errno != EINTR)
+        return Result<Unit>::err(Errc::kInternal, std::string("epoll_wait: ") + std::strerror(errno));
+
+    for (int i = 0; i < n; ++i) {
+        auto* w = static_cast<Watch*>(events[i].data.ptr);
+        const auto ev = events[i].events;
+        // a callback may have freed this context (w->ac is then null)
+        if (w->ac && (ev & (EPOLLIN | EPOLLERR | EPOLLHUP))) redisAsyncHandleRead(w->ac);
+        if (w->ac && (ev & EPOLLOUT)) redisAsyncHandleWrite(w->ac);
+    }
+
+    // a timeout frees the context and so edits watches_: walk a copy
+    const auto fired = Clock::now();
+    const std::vector<Watch*> watches = watches_;
+    for (Watch* w : watches) {
+        if (!w->ac || !w->deadline || *w->deadline > fired) continue;
+        w->deadline.reset();
+        redisAsyncHandleTimeout(w->ac);   // no-op while idle
+    }
+    return Result<Unit>::ok();
+}
+
+// ---- AsyncRedisClient ----
+
+Result<std::unique_ptr<AsyncRedisClient>> AsyncRedisClient::connect(EventLoop& loop, std::string host, int port,
+                                                                     int timeout_ms) noexcept {
+    using R = Result<std::unique_ptr<AsyncRedisClient>>;
+    if (host.empty()) return R::err(Errc::kInvalidArg, "redis host is empty");
+    if (port <= 0) return R::err(Errc::kInvalidArg, "redis port must be > 0");
+    if (timeout_ms <= 0) return R::err(Errc::kInvalidArg, "timeout_ms must be > 0");
+
+    const timeval tv = to_timeval(timeout_ms);
+    redisOptions opts{};
+    REDIS_OPTIONS_SET_TCP(&opts, host.c_str(), port);
+    opts.connect_timeout = &tv;
+    opts.command_timeout = &tv;
+
+    redisAsyncContext* ac = redisAsyncConnectWithOptions(&opts);
+    if (!ac) return R::err(Errc::kRedisIo, "redisAsyncConnectWithOptions returned null");
+    if (ac->err) {
+        std::string msg = ac->errstr ? ac->errstr : "redis connect error";
+        redisAsyncFree(ac);
+        return R::err(Errc::kRedisIo, std::move(msg));
+    }
+
+    std::unique_ptr<AsyncRedisClient> client(new AsyncRedisClient(loop));
+    client->ac_ = ac;
+    ac->data = client.get();
+    loop.attach(client->watch_, ac);
+    redisAsyncSetConnectCallback(ac, &AsyncRedisClient::on_connect);
+    redisAsyncSetDisconnectCallback(ac, &AsyncRedisClient::on_disconnect);
+    return R::ok(std::move(client));
+}
+
+AsyncRedisClient::~AsyncRedisClient() {
+    // pending commands are failed from inside redisAsyncFree; commands they issue in
+    // turn see a closed client
+    if (auto* ac = std::exchange(ac_, nullptr)) {
+        lost_ = "client destroyed";
+        redisAsyncFree(ac);
+    }
+}
+
+void AsyncRedisClient::on_connect(const redisAsyncContext* ac, int status) {
+    if (status == REDIS_OK) return;
+    // hiredis frees the context after this callback
+    auto* self = static_cast<AsyncRedisClient*>(ac->data);
+    self->lost_ = ac->errstr ? ac->errstr : "redis connect error";
+    self->ac_ = nullptr;
+}
+
+void AsyncRedisClient::on_disconnect(const redisAsyncContext* ac, int status) {
+    auto* self = static_cast<AsyncRedisClient*>(ac->data);
+    if (!self->ac_) return;
+    self->lost_ = (status != REDIS_OK && ac->errstr) ? ac->errstr : "disconnected";
+    self->ac_ = nullptr;
+}
+
+Task<Result<Unit>> AsyncRedisClient::ping() {
+    co_return co_await Command<Unit>(ac_, lost_, "PING", &decode_pong, ArgvBuilder::of("PING"));
+}
+
+// ---- HASH ----
+
+Task<Result<long long>> AsyncRedisClient::hset(std::string_view key, std::string_view field, std::string_view value) {
+    co_return co_await Command<long long>(ac_, lost_, "HSET", &reply_integer, ArgvBuilder::of("HSET", key, field, value));
+}
+
+Task<Result<std::string>> AsyncRedisClient::hget(std::string_view key, std::string_view field) {
+    co_return co_await Command<std::string>(ac_, lost_, "HGET", &decode_string, ArgvBuilder::of("HGET", key, field));
+}
+
+Task<Result<Flags4096>> AsyncRedisClient::hget_flags(std::string_view key, std::string_view field) {
+    co_return co_await Command<Flags4096>(ac_, lost_, "HGET(flags)", &decode_flags, ArgvBuilder::of("HGET", key, field));
+}
+
+// ---- SET ----
+
+Task<Result<long long>> AsyncRedisClient::sadd(std::string_view key, std::string_view member) {
+    co_return co_await Command<long long>(ac_, lost_, "SADD", &reply_integer, ArgvBuilder::of("SADD", key, member));
+}
+
+Task<Result<long long>> AsyncRedisClient::srem(std::string_view key, std::string_view member) {
+    co_return co_await Command<long long>(ac_, lost_, "SREM", &reply_integer, ArgvBuilder::of("SREM", key, member));
+}
+
+Task<Result<long long>> AsyncRedisClient::scard(std::string_view key) {
+    co_return co_await Command<long long>(ac_, lost_, "SCARD", &reply_integer, ArgvBuilder::of("SCARD", key));
+}
+
+Task<Result<std::vector<std::string>>> AsyncRedisClient::smembers(std::string_view key) {
+    co_return co_await Command<std::vector<std::string>>(ac_, lost_, "SMEMBERS", &decode_strings, ArgvBuilder::of("SMEMBERS", key));
+}
+
+namespace {
+
+ArgvBuilder with_keys(std::string_view cmd, const std::vector<std::string>& keys) {
+    ArgvBuilder args(1 + keys.size());
+    args.push(cmd);
+    for (const auto& k : keys) args.push(k);
+    return args;
+}
+
+} // namespace
+
+Task<Result<std::vector<std::string>>> AsyncRedisClient::sinter(const std::vector<std::string>& keys) {
+    if (keys.empty()) co_return Result<std::vector<std::string>>::ok({});
+    co_return co_await Command<std::vector<std::string>>(ac_, lost_, "SINTER", &decode_strings,
+                                                         with_keys("SINTER", keys));
+}
+
+Task<Result<std::vector<std::string>>> AsyncRedisClient::sunion(const std::vector<std::string>& keys) {
+    if (keys.empty()) co_return Result<std::vector<std::string>>::ok({});
+    co_return co_await Command<std::vector<std::string>>(ac_, lost_, "SUNION", &decode_strings,
+                                                         with_keys("SUNION", keys));
+}
+
+Task<Result<std::vector<std::string>>> AsyncRedisClient::sdiff(const std::vector<std::string>& keys) {
+    if (keys.empty()) co_return Result<std::vector<std::string>>::ok({});
+    co_return co_await Command<std::vector<std::string>>(ac_, lost_, "SDIFF", &decode_strings,
+                                                         with_keys("SDIFF", keys));
+}
+
+Task<Result<long long>> AsyncRedisClient::del_key(std::string_view key) {
+    co_return co_await Command<long long>(ac_, lost_, "DEL", &reply_integer, ArgvBuilder::of("DEL", key));
+}
+
+// ---- SCRIPTING ----
+
+Task<Result<std::string>> AsyncRedisClient::load_script(const LuaScript& script) {
+    auto sha = co_await Command<std::string>(ac_, lost_, "SCRIPT LOAD", &decode_string,
+                                             ArgvBuilder::of("SCRIPT", "LOAD", script.source));
+    if (sha) script_shas_[script.source.data()] = sha.value();
+    co_return sha;
+}
+
+template <class T>
+Task<Result<T>> AsyncRedisClient::eval_as(const LuaScript& script, std::vector<std::string> keys,
+                                          std::vector<std::string> argv,
+                                          Result<T> (*decode)(const redisReply&, std::string_view op)) {
+    if (script.source.empty()) co_return Result<T>::err(Errc::kInternal, "eval_script: empty script");
+
+    const std::string op = script_op(script);
+    const std::string numkeys = std::to_string(keys.size());
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        std::string sha;
+        if (auto it = script_shas_.find(script.source.data()); it != script_shas_.end()) {
+            sha = it->second;
+        } else {
+            auto loaded = co_await load_script(script);
+            if (!loaded) co_return Result<T>::err(loaded.error().code, loaded.error().msg);
+            sha = std::move(loaded).value();
+        }
+
+        ArgvBuilder cmd(3 + keys.size() + argv.size());
+        cmd.push("EVALSHA");
+        cmd.push(sha);
+        cmd.push(numkeys);
+        for (const auto& k : keys) cmd.push(k);
+        for (const auto& a : argv) cmd.push(a);
+        bool noscript = false;
+        auto r = co_await Command<T>(ac_, lost_, op, decode, std::move(cmd), &noscript);
+        if (noscript && attempt == 0) {
+            script_shas_.erase(script.source.data());
+            continue;
+        }
+        co_return r;
+    }
+    co_return Result<T>::err(Errc::kRedisProtocol, "EVALSHA: NOSCRIPT after reload");
+}
+
+Task<Result<long long>> AsyncRedisClient::eval_integer(const LuaScript& script, std::vector<std::string> keys,
+                                                       std::vector<std::string> argv) {
+    return eval_as<long long>(script, std::move(keys), std::move(argv), &reply_integer);
+}
+
+Task<Result<std::vector<std::string>>> AsyncRedisClient::eval_strings(const LuaScript& script,
+                                                                      std::vector<std::string> keys,
+                                                                      std::vector<std::string> argv) {
+    return eval_as<std::vector<std::string>>(script, std::move(keys), std::move(argv), &decode_strings);
+}
+
+} // namespace er
@@ -0,0 +1,196 @@
+#include "er/bitmap_index.hpp"
+
+#include <charconv>
+
+namespace er {
+
+namespace {
+
+// KEYS: bitmaps the program reads (same K/I/O/D program as the SET query script)
+// ARGV: mode ('members' | 'count' | 'store'), scratch_base, out_key, n, names_key, program...
+//   n is the TTL in store mode and the result limit otherwise (0 = no limit).
+// Returns the members, the cardinality (capped at the limit) or the stored cardinality.
+constexpr LuaScript kBitmapQueryLua{"bitmap_query", R"lua(
+local mode      = ARGV[1]
+local scratch   = ARGV[2]
+local out       = ARGV[3]
+local n4        = tonumber(ARGV[4])
+local ttl       = (mode == 'store') and n4 or nil
+local limit     = (mode ~= 'store' and n4 and n4 > 0) and n4 or nil
+local names_key = ARGV[5]
+
+local tmps = {}
+local function new_tmp()
+  local k = scratch .. ':' .. (#tmps + 1)
+  tmps[#tmps + 1] = k
+  return k
+end
+local function cleanup()
+  if #tmps > 0 then redis.call('DEL', unpack(tmps)) end
+end
+
+-- operands are bitmap keys, or false for a known-empty bitmap
+local stack = {}
+local last = #ARGV
+local pc = 6
+while pc <= last do
+  local op, n = ARGV[pc], tonumber(ARGV[pc + 1])
+  pc = pc + 2
+  local res
+  if op == 'K' then
+    local k = KEYS[n]
+    res = (redis.call('EXISTS', k) == 1) and k or false
+  else
+    local args = {}
+    for i = #stack - n + 1, #stack do args[#args + 1] = stack[i] end
+    for _ = 1, n do stack[#stack] = nil end
+
+    if op == 'I' then
+      res = true
+      for i = 1, #args do if not args[i] then res = false end end
+      if res and #args == 1 then res = args[1]
+      elseif res then
+        res = new_tmp()
+        redis.call('BITOP', 'AND', res, unpack(args))
+      end
+    elseif op == 'O' then
+      local live = {}
+      for i = 1, #args do if args[i] then live[#live + 1] = args[i] end end
+      if #live == 0 then res = false
+      elseif #live == 1 then res = live[1]
+      else
+        res = new_tmp()
+        redis.call('BITOP', 'OR', res, unpack(live))
+      end
+    elseif op == 'D' then
+      local base, subs = args[1], {}
+      for i = 2, #args do if args[i] then subs[#subs + 1] = args[i] end end
+      if not base then res = false
+      elseif #subs == 0 then res = base
+      else
+        -- base AND NOT (s1 OR s2 ...); the mask is padded to the base length first,
+        -- since BITOP NOT only inverts the bytes its input has
+        local mask = new_tmp()
+        redis.call('BITOP', 'OR', mask, unpack(subs))
+        local blen = redis.call('STRLEN', base)
+        if redis.call('STRLEN', mask) < blen then redis.call('SETBIT', mask, blen * 8 - 1, 0) end
+        redis.call('BITOP', 'NOT', mask, mask)
+        res = new_tmp()
+        redis.call('BITOP', 'AND', res, base, mask)
+      end
+    else
+      cleanup()
+      return redis.error_reply('bitmap_query: bad opcode ' .. tostring(op))
+    end
+  end
+  stack[#stack + 1] = res
+end
+
+local top = stack[#stack]
+if mode == 'count' then
+  local c = top and redis.call('BITCOUNT', top) or 0
+  cleanup()
+  if limit and c > limit then c = limit end
+  return c
+end
+
+-- set bit offsets of the result (offset 0 is the high bit of byte 1), up to the limit
+local ids = {}
+if top then
+  local s = redis.call('GET', top)
+  local pow = { 128, 64, 32, 16, 8, 4, 2, 1 }
+  for i = 1, #s do
+    local v = string.byte(s, i)
+    if v ~= 0 then
+      for j = 1, 8 do
+        if math.floor(v / pow[j]) % 2 == 1 then
+          ids[#ids + 1] = (i - 1) * 8 + (j - 1)
+        end
+      end
+      if limit and #ids >= limit then break end
+    end
+  end
+  if limit then for i = #ids, limit + 1, -1 do ids[i] = nil end end
+end
+
+-- ids -> names, in chunks to stay within unpack limits
+local names = {}
+for i = 1, #ids, 1000 do
+  local got = redis.call('HMGET', names_key, unpack(ids, i, math.min(i + 999, #ids)))
+  for _, nm in ipairs(got) do if nm then names[#names + 1] = nm end end
+end
+cleanup()
+
+if mode == 'members' then return names end
+
+-- store: a SET of names, like the SET backend's results
+redis.call('DEL', out)
+for i = 1, #names, 1000 do
+  redis.call('SADD', out, unpack(names, i, math.min(i + 999, #names)))
+end
+if #names > 0 and ttl and ttl > 0 then redis.call('EXPIRE', out, ttl) end
+return #names
+)lua"};
+
+// The SET plan's keys, mapped to the matching bitmaps (version_fields name the bit).
+std::vector<std::string_view> bitmap_keys(const query::Plan& plan, std::string_view prefix) {
+    const auto& table = keys::KeyTable::of(prefix);
+    std::vector<std::string_view> out;
+    out.reserve(plan.version_fields.size());
+    for (const auto f : plan.version_fields) {
+        std::size_t bit = 0;
+        if (f == keys::kUniverseVersionField) out.push_back(table.bm_universe());
+        else if (std::from_chars(f.data(), f.data() + f.size(), bit).ec == std::errc() && bit < keys::KeyTable::kBits)
+            out.push_back(table.bm_bit(bit));
+    }
+    return out;
+}
+
+// ARGV of kBitmapQueryLua, as views (n formatted in place).
+struct BitmapArgv {
+    BitmapArgv(const query::Plan& plan, std::string_view prefix, const char* mode, std::string_view out_key,
+               std::size_t n)
+        : names(keys::bm_names(prefix)) {
+        const auto& table = keys::KeyTable::of(prefix);
+        const auto n_len = static_cast<std::size_t>(std::to_chars(n_buf, n_buf + sizeof(n_buf), n).ptr - n_buf);
+        argv.reserve(5 + plan.program.size());
+        argv.emplace_back(mode);
+        argv.push_back(table.scratch());
+        argv.push_back(out_key);
+        argv.emplace_back(n_buf, n_len);
+        argv.push_back(names);
+        argv.insert(argv.end(), plan.program.begin(), plan.program.end());
+    }
+    BitmapArgv(const BitmapArgv&) = delete;
+    BitmapArgv& operator=(const BitmapArgv&) = delete;
+
+    std::string names;
+    char n_buf[24]{};
+    std::vector<std::string_view> argv{};
+};
+
+} // namespace
+
+Result<UpsertResult> BitmapIndex::upsert(std::string_view name, const Flags4096& flags) noexcept {
+    return redis_->upsert_element(name, flags, IndexBackend::kBitmap, prefix_);
+}
+
+Result<std::vector<std::string>> BitmapIndex::members(const query::Plan& plan, std::size_t limit) noexcept {
+    if (plan.program.empty()) return Result<std::vector<std::string>>::err(Errc::kInvalidArg, "query: empty plan");
+    return redis_->eval_strings(kBitmapQueryLua, bitmap_keys(plan, prefix_), BitmapArgv(plan, prefix_, "members", "", limit).argv);
+}
+
+Result<long long> BitmapIndex::count(const query::Plan& plan, std::size_t limit) noexcept {
+    if (plan.program.empty()) return Result<long long>::err(Errc::kInvalidArg, "query: empty plan");
+    return redis_->eval_integer(kBitmapQueryLua, bitmap_keys(plan, prefix_), BitmapArgv(plan, prefix_, "count", "", limit).argv);
+}
+
+Result<long long> BitmapIndex::store(const query::Plan& plan, int ttl_seconds, std::string_view out_key) noexcept {
+    if (plan.program.empty()) return Result<long long>::err(Errc::kInvalidArg, "query: empty plan");
+    if (ttl_seconds <= 0) return Result<long long>::err(Errc::kInvalidArg, "ttl_seconds must be > 0");
+    if (out_key.empty()) return Result<long long>::err(Errc::kInvalidArg, "query: empty out_key");
+    return redis_->eval_integer(kBitmapQueryLua, bitmap_keys(plan, prefix_),
+                                BitmapArgv(plan, prefix_, "store", out_key, static_cast<std::size_t>(ttl_seconds)).argv);
+}
+
+} // namespace er
@@ -0,0 +1,57 @@
+#include "er/bulk_writer.hpp"
+
+#include <algorithm>
+
+#include "er/Element.hpp"
+
+namespace er {
+
+BulkWriter::BulkWriter(RedisClient& redis, std::size_t batch_size, std::string_view prefix) noexcept
+    : redis_(&redis),
+      batch_size_(batch_size == 0 ? kDefaultBatchSize : batch_size),
+      keys_(&keys::KeyTable::of(prefix)) {
+    // index_ keys point into names_, so names_ must never reallocate.
+    names_.reserve(batch_size_);
+    flags_.reserve(batch_size_);
+    index_.reserve(batch_size_);
+}
+
+Result<Unit> BulkWriter::add(std::string_view name, const Flags4096& flags) noexcept {
+    if (name.empty()) return Result<Unit>::err(Errc::kInvalidArg, "BulkWriter: empty element name");
+    if (auto e = Element::create(std::string(name)); !e) return Result<Unit>::err(e.error().code, e.error().msg);
+
+    if (auto it = index_.find(name); it != index_.end()) {
+        flags_[it->second] = flags;
+    } else {
+        names_.emplace_back(name);
+        flags_.push_back(flags);
+        index_.emplace(names_.back(), names_.size() - 1);
+    }
+    ++stats_.elements;
+
+    if (names_.size() >= batch_size_) return flush();
+    return Result<Unit>::ok();
+}
+
+Result<Unit> BulkWriter::flush() noexcept {
+    if (names_.empty()) return Result<Unit>::ok();
+
+    std::vector<std::string_view> names(names_.begin(), names_.end());
+    // One upsert script per slice. A slice that failed may have been applied (the reply
+    // was lost): rerunning it is harmless, the deltas are against the stored flags.
+    for (std::size_t at = 0; at < names.size(); at += kScriptBatch) {
+        const std::size_t n = std::min(kScriptBatch, names.size() - at);
+        auto ok = redis_->upsert_elements(std::span<const std::string_view>(names).subspan(at, n),
+                                          std::span<const Flags4096>(flags_).subspan(at, n), IndexBackend::kSet, keys_->prefix());
+        ++stats_.commands;
+        if (!ok) return Result<Unit>::err(ok.error().code, ok.error().msg);
+    }
+
+    ++stats_.batches;
+    index_.clear();
+    flags_.clear();
+    names_.clear();
+    return Result<Unit>::ok();
+}
+
+} // namespace er
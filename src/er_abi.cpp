@@ -2,23 +2,98 @@
 
 #include <string>
 #include <vector>
-#include <sstream>
 #include <memory>
 #include <cstring>
 #include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
 
 #include "er/RedisClient.hpp"
+#include "er/Element.hpp"
 #include "er/Flags4096.hpp"
+#include "er/bulk_writer.hpp"
+#include "er/flags_cache.hpp"
+#include "er/hybrid.hpp"
 #include "er/keys.hpp"
+#include "er/namespace.hpp"
+#include "er/query.hpp"
+#include "er/redis_pool.hpp"
+#include "er/similarity.hpp"
+#include "er/snapshot.hpp"
+#include "er/write_behind.hpp"
+
+// One result arena: members back to back in bytes, member i is
+// bytes[offsets[i] .. offsets[i + 1]). Freed results go back to their handle and
+// are reused with their capacity.
+struct er_result {
+    er_handle_t* owner;
+    std::string bytes{};
+    std::vector<uint64_t> offsets{0};
+
+    void clear() {
+        bytes.clear();
+        offsets.assign(1, 0);
+    }
+    void push(std::string_view m) {
+        bytes.append(m);
+        offsets.push_back(bytes.size());
+    }
+};
 
+static std::uint64_t next_handle_serial() {
+    static std::atomic<std::uint64_t> next{1};
+    return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Every call leases a connection from the pool for its duration, so a handle can be
+// shared between threads. Errors are kept per calling thread (see t_last_error).
 struct er_handle {
-    std::unique_ptr<er::RedisClient> redis;
-    std::string last_error;
+    er::RedisPool pool;
+    er::Namespace ns;   // every key the handle touches lives under ns.prefix()
+    std::string host{};
+    int port{0};
+    // never reused, unlike the address, so a new handle cannot see a stale message
+    const std::uint64_t serial{next_handle_serial()};
+
+    // er_write_behind: puts go through the queue while it is set. Declared after pool,
+    // so it drains before the pool closes.
+    std::shared_mutex wb_mu{};
+    std::optional<er::WriteBehind> wb{};
+
+    // er_flags_cache: element flags for er_get_bits / er_similar, kept coherent by the
+    // handle's own writes and, when tracking, by tracker (declared after cache, so it
+    // stops first).
+    std::shared_mutex cache_mu{};
+    std::unique_ptr<er::FlagsCache> cache{};
+    std::optional<er::FlagsTracker> tracker{};
+
+    // er_hybrid: queries are routed by hybrid while it is set
+    std::shared_mutex hybrid_mu{};
+    std::unique_ptr<er::query::Hybrid> hybrid{};
+
+    // freed result arenas kept for reuse (at most kSpareResults)
+    static constexpr size_t kSpareResults = 8;
+    std::mutex results_mu{};
+    std::vector<std::unique_ptr<er_result>> spare_results{};
+};
+
+struct er_snapshot {
+    er::Snapshot snap;
 };
 
+// handle serial -> last error of this thread on it; freed with the thread, so threads
+// that come and go do not pile up messages on a long-lived handle
+static thread_local std::unordered_map<std::uint64_t, std::string> t_last_error;
+
 /* helpers */
 static int set_err(er_handle_t* h, const std::string& e) {
-    if (h) h->last_error = e;
+    if (!h) return ER_ERR;
+    t_last_error[h->serial] = e;
     return ER_ERR;
 }
 
@@ -26,76 +101,26 @@ static int set_err(er_handle_t* h, const er::Error& e) {
     return set_err(h, e.msg);
 }
 
-static bool load_existing_flags(er::RedisClient& r, const std::string& elem_key, er::Flags4096& out) {
-    auto blob = r.hget_bin(elem_key, "flags_bin");
-    if (blob && blob.value().size() == 512) {
-        auto f = er::Flags4096::from_bytes_be(reinterpret_cast<const std::uint8_t*>(blob.value().data()), blob.value().size());
-        if (f) {
-            out = std::move(f).value();
-            return true;
-        }
-    }
-
-    auto hex = r.hget(elem_key, "flags_hex");
-    if (hex && !hex.value().empty()) {
-        auto f = er::Flags4096::from_hex(hex.value());
-        if (f) {
-            out = std::move(f).value();
-            return true;
-        }
-    }
-
-    out.clear();
-    return false;
-}
-
-/* update index sets based on delta old->new */
-static er::Result<er::Unit> update_index(er::RedisClient& r,
-                                        const std::string& name,
-                                        const er::Flags4096& oldf,
-                                        const er::Flags4096& newf) {
-    const auto old_bits = oldf.set_bits();
-    const auto new_bits = newf.set_bits();
-
-    // brute-force delta with two-pointer would be faster, but this is fine for now
-    // (bit count is usually small)
-    for (auto b : old_bits) {
-        auto t = newf.test(b);
-        if (!t) return er::Result<er::Unit>::err(t.error().code, t.error().msg);
-        if (!t.value()) {
-            auto ok = r.srem(er::keys::idx_bit(b), name);
-            if (!ok) return er::Result<er::Unit>::err(ok.error().code, ok.error().msg);
-        }
-    }
-    for (auto b : new_bits) {
-        auto t = oldf.test(b);
-        if (!t) return er::Result<er::Unit>::err(t.error().code, t.error().msg);
-        if (!t.value()) {
-            auto ok = r.sadd(er::keys::idx_bit(b), name);
-            if (!ok) return er::Result<er::Unit>::err(ok.error().code, ok.error().msg);
-        }
-    }
-    return er::Result<er::Unit>::ok();
+/* lifecycle */
+er_handle_t* er_create(const char* host, int port) {
+    return er_create_pool(host, port, 1);
 }
 
-static std::string make_tmp_key(const char* op, int ttl_sec) {
-    std::string tag(op);
-    tag.append(":ttl");
-    tag.append(std::to_string(ttl_sec));
-    return er::keys::tmp(tag);
+er_handle_t* er_create_pool(const char* host, int port, size_t n_connections) {
+    return er_create_ns(host, port, n_connections, er::keys::kPrefixDefault.data());
 }
 
-/* lifecycle */
-er_handle_t* er_create(const char* host, int port) {
-    if (!host || port <= 0) return nullptr;
-    auto client = er::RedisClient::connect(host, port);
-    if (!client) return nullptr;
-
-    auto* h = new er_handle();
-    h->redis = std::make_unique<er::RedisClient>(std::move(client).value());
-    auto ok = h->redis->ping();
-    if (!ok) {
-        h->last_error = ok.error().msg;
+er_handle_t* er_create_ns(const char* host, int port, size_t n_connections, const char* prefix) {
+    if (!host || port <= 0 || n_connections == 0 || !prefix) return nullptr;
+    auto ns = er::Namespace::open(prefix);
+    if (!ns) return nullptr;
+    auto pool = er::RedisPool::create(host, port, n_connections);
+    if (!pool) return nullptr;
+
+    auto* h = new er_handle{std::move(pool).value(), std::move(ns).value(), host, port};
+    h->pool.share_scripts(h->ns.scripts());
+    auto ok = h->pool.health_check();
+    if (!ok || ok.value() != h->pool.size()) {
         delete h;
         return nullptr;
     }
@@ -104,24 +129,75 @@ er_handle_t* er_create(const char* host, int port) {
 
 void er_destroy(er_handle_t* h) {
     if (!h) return;
+    t_last_error.erase(h->serial);
     delete h;
 }
 
 int er_ping(er_handle_t* h) {
-    if (!h || !h->redis) return ER_BADARG;
-    auto ok = h->redis->ping();
+    if (!h) return ER_BADARG;
+    auto ok = h->pool.run([](er::RedisClient& r) { return r.ping(); });
     return ok ? ER_OK : set_err(h, ok.error());
 }
 
 const char* er_last_error(er_handle_t* h) {
     if (!h) return "null handle";
-    return h->last_error.c_str();
+    // node-based map: the string stays put until this thread's next error on h
+    auto it = t_last_error.find(h->serial);
+    return it == t_last_error.end() ? "" : it->second.c_str();
+}
+
+/* stats */
+int er_stats_enable(er_handle_t* h, int on) {
+    if (!h) return ER_BADARG;
+    h->pool.enable_stats(on != 0);
+    return ER_OK;
+}
+
+int er_stats_json(er_handle_t* h, char* buf, size_t cap) {
+    if (!h || !buf || cap == 0) return ER_BADARG;
+    const std::string json = h->pool.stats().json();
+    if (json.size() + 1 > cap) return ER_RANGE;
+    std::memcpy(buf, json.c_str(), json.size() + 1);
+    return ER_OK;
+}
+
+// The er_flush barrier; ER_OK without write-behind.
+static int flush_write_behind(er_handle_t* h) {
+    std::shared_lock<std::shared_mutex> lock(h->wb_mu);
+    if (!h->wb) return ER_OK;
+    auto ok = h->wb->flush();
+    return ok ? ER_OK : set_err(h, ok.error());
+}
+
+/* write-behind */
+int er_write_behind(er_handle_t* h, size_t max_pending, unsigned max_latency_ms) {
+    if (!h) return ER_BADARG;
+    std::unique_lock<std::shared_mutex> lock(h->wb_mu);
+    if (h->wb) {
+        // keep the queue (and its puts) when they cannot be written
+        if (auto ok = h->wb->flush(); !ok) return set_err(h, ok.error());
+        h->wb.reset();
+    }
+    if (max_pending == 0) return ER_OK;
+
+    er::WriteBehindOptions opts;
+    opts.max_pending = max_pending;
+    opts.max_latency = std::chrono::milliseconds(max_latency_ms);
+    auto wb = er::WriteBehind::start(h->pool, opts, h->ns.prefix());
+    if (!wb) return set_err(h, wb.error());
+    h->wb.emplace(std::move(wb).value());
+    return ER_OK;
+}
+
+int er_flush(er_handle_t* h) {
+    if (!h) return ER_BADARG;
+    return flush_write_behind(h);
 }
 
 /* element ops */
 int er_put_bits(er_handle_t* h, const char* name,
                 const uint16_t* bits, size_t n_bits) {
-    if (!h || !h->redis || !name || (!bits && n_bits > 0))
+    if (!h || !name || (!bits && n_bits > 0))
         return ER_BADARG;
 
     // build new flags
@@ -132,106 +208,630 @@ int er_put_bits(er_handle_t* h, const char* name,
         if (!ok) return set_err(h, ok.error());
     }
 
-    const std::string sname(name);
-    const std::string elem_key = er::keys::element(sname);
+    // the cache takes the flags this handle wrote (queued ones included: read-your-writes)
+    std::shared_lock<std::shared_mutex> cache_lock(h->cache_mu);
+    const uint64_t ticket = h->cache ? h->cache->ticket(name) : 0;
+    {
+        std::shared_lock<std::shared_mutex> lock(h->wb_mu);
+        if (h->wb) {
+            auto queued = h->wb->put(name, newf);
+            if (!queued) return set_err(h, queued.error());
+            if (h->cache) h->cache->put(name, newf, ticket);
+            return ER_OK;
+        }
+    }
 
-    // load old flags for index delta
-    er::Flags4096 oldf;
-    load_existing_flags(*h->redis, elem_key, oldf);
+    // atomic: server-side index delta + element hash + universe
+    auto ok = h->pool.run([&](er::RedisClient& r) { return r.upsert_element(name, newf, er::IndexBackend::kSet, h->ns.prefix()); });
+    if (!ok) {
+        if (h->cache) h->cache->invalidate(name);   // the write may still have happened
+        return set_err(h, ok.error());
+    }
+    if (h->cache) h->cache->put(name, newf, ticket);
+    return ER_OK;
+}
 
-    // update index sets
-    if (auto ok = update_index(*h->redis, sname, oldf, newf); !ok) return set_err(h, ok.error());
+int er_put_many(er_handle_t* h, const char* const* names,
+                const uint16_t* bits_flat, const size_t* offsets,
+                size_t n) {
+    if (!h) return ER_BADARG;
+    if (n > 0 && (!names || !offsets)) {
+        set_err(h, "er_put_many: names and offsets are required");
+        return ER_BADARG;
+    }
+    if (n == 0) return ER_OK;
+    if (!bits_flat && offsets[n] > 0) {
+        set_err(h, "er_put_many: bits_flat is NULL");
+        return ER_BADARG;
+    }
 
-    // store element hash
-    if (auto ok = h->redis->hset(elem_key, "name", sname); !ok) return set_err(h, ok.error());
+    // validate everything up front: batches are written (and split across the pool) as
+    // they fill, so a bad record found later would leave the load partial
+    for (size_t i = 0; i < n; ++i) {
+        auto at = [i] { return "er_put_many: record " + std::to_string(i); };
+        if (!names[i] || !*names[i]) {
+            set_err(h, at() + ": empty name");
+            return ER_BADARG;
+        }
+        if (auto e = er::Element::create(names[i]); !e) {
+            set_err(h, at() + ": " + e.error().msg);
+            return ER_BADARG;
+        }
+        if (offsets[i + 1] < offsets[i]) {
+            set_err(h, at() + ": offsets go backwards");
+            return ER_BADARG;
+        }
+        for (size_t j = offsets[i]; j < offsets[i + 1]; ++j) {
+            if (bits_flat[j] >= 4096) {
+                set_err(h, at() + ": bit " + std::to_string(bits_flat[j]) + " out of range");
+                return ER_RANGE;
+            }
+        }
+    }
 
-    const auto bytes = newf.to_bytes_be(); // 512 bytes
-    if (auto ok = h->redis->hset_bin(elem_key, "flags_bin", bytes.data(), bytes.size()); !ok) return set_err(h, ok.error());
+    // A direct bulk load drops its names instead of caching them (it would evict the hot
+    // entries); queued puts are cached, or a read before the drain could cache old flags.
+    std::shared_lock<std::shared_mutex> cache_lock(h->cache_mu);
+    const auto drop_cached = [&] {
+        if (!h->cache) return;
+        for (size_t i = 0; i < n; ++i) h->cache->invalidate(names[i]);
+    };
+    {
+        std::shared_lock<std::shared_mutex> lock(h->wb_mu);
+        if (h->wb) {
+            er::Flags4096 flags;
+            for (size_t i = 0; i < n; ++i) {
+                flags.clear();
+                for (size_t j = offsets[i]; j < offsets[i + 1]; ++j) (void)flags.set(bits_flat[j]);
+                if (auto ok = h->wb->put(names[i], flags); !ok) { drop_cached(); return set_err(h, ok.error()); }
+                if (h->cache) h->cache->put(names[i], flags, h->cache->ticket(names[i]));
+            }
+            return ER_OK;
+        }
+    }
+
+    // Large loads are split across the pool by name hash: a name always lands in the
+    // same shard, so each BulkWriter still sees every write to its elements, in order.
+    const size_t shards = (n >= 2 * er::BulkWriter::kDefaultBatchSize) ? h->pool.size() : 1;
+    std::vector<std::vector<size_t>> parts(shards);
+    for (size_t i = 0; i < n; ++i) {
+        parts[shards == 1 ? 0 : std::hash<std::string_view>{}(names[i]) % shards].push_back(i);
+    }
 
+    auto done = h->pool.map(shards, [&](er::RedisClient& r, size_t shard) -> er::Result<er::Unit> {
+        er::BulkWriter writer(r, er::BulkWriter::kDefaultBatchSize, h->ns.prefix());
+        er::Flags4096 flags;
+        for (size_t i : parts[shard]) {
+            flags.clear();
+            for (size_t j = offsets[i]; j < offsets[i + 1]; ++j) (void)flags.set(bits_flat[j]);
+            if (auto ok = writer.add(names[i], flags); !ok) return ok;
+        }
+        return writer.flush();
+    });
+    drop_cached();
+    for (const auto& ok : done) {
+        if (!ok) return set_err(h, ok.error());
+    }
     return ER_OK;
 }
 
-/* composite store: find_all + TTL (Lua, atomic) */
-int er_find_all_store(er_handle_t* h, int ttl_sec,
-                      const uint16_t* bits, size_t n_bits,
-                      char* out_tmp_key, size_t key_cap) {
-    if (!h || !h->redis || !bits || n_bits == 0 || !out_tmp_key || key_cap == 0)
-        return ER_BADARG;
-    if (ttl_sec <= 0) return ER_BADARG;
+int er_del_many(er_handle_t* h, const char* const* names, size_t n, int force, uint64_t* out_deleted) {
+    if (!h || (n > 0 && !names)) return ER_BADARG;
+    for (size_t i = 0; i < n; ++i) {
+        if (!names[i] || !*names[i]) return ER_BADARG;
+    }
+    if (out_deleted) *out_deleted = 0;
+    if (n == 0) return ER_OK;
+    // a queued put must not land after the delete
+    if (int rc = flush_write_behind(h); rc != ER_OK) return rc;
+
+    // one delete script per batch; batches are independent, so the pool runs them in parallel
+    constexpr size_t kBatch = 256;
+    const size_t batches = (n + kBatch - 1) / kBatch;
+    auto done = h->pool.map(batches, [&](er::RedisClient& r, size_t b) -> er::Result<uint64_t> {
+        std::vector<std::string_view> batch(names + b * kBatch, names + std::min(n, (b + 1) * kBatch));
+        auto del = r.delete_elements(batch, force != 0, er::IndexBackend::kSet, h->ns.prefix());
+        if (!del) return er::Result<uint64_t>::err(del.error().code, del.error().msg);
+        uint64_t existed = 0;
+        for (const auto& d : del.value()) existed += d.existed ? 1 : 0;
+        return er::Result<uint64_t>::ok(existed);
+    });
+    {
+        std::shared_lock<std::shared_mutex> cache_lock(h->cache_mu);
+        if (h->cache) {
+            for (size_t i = 0; i < n; ++i) h->cache->invalidate(names[i]);
+        }
+    }
+    uint64_t deleted = 0;
+    for (const auto& d : done) {
+        if (!d) return set_err(h, d.error());
+        deleted += d.value();
+    }
+    if (out_deleted) *out_deleted = deleted;
+    return ER_OK;
+}
 
-    std::vector<std::string> idx_keys;
-    idx_keys.reserve(n_bits);
+/* the find_* shapes: kind over the bits, each negated with negate (universe \ bits) */
+static int bits_node(er::query::Node& root, er::query::Node::Kind kind, bool negate,
+                     const uint16_t* bits, size_t n_bits) {
+    using er::query::Node;
+    root = Node{kind, 0, {}};
+    root.children.reserve(n_bits);
     for (size_t i = 0; i < n_bits; ++i) {
         if (bits[i] >= 4096) return ER_RANGE;
-        idx_keys.push_back(er::keys::idx_bit(bits[i]));
+        Node leaf{Node::Kind::kBit, bits[i], {}};
+        if (negate) root.children.push_back(Node{Node::Kind::kNot, 0, {std::move(leaf)}});
+        else root.children.push_back(std::move(leaf));
     }
+    return ER_OK;
+}
 
-    std::string tmp_key = make_tmp_key("all", ttl_sec);
+/* composite store: cached per canonical query (Lua, atomic) */
+static int store_bits_query(er_handle_t* h, er::query::Node::Kind kind, bool negate, int ttl_sec,
+                            const uint16_t* bits, size_t n_bits,
+                            char* out_tmp_key, size_t key_cap) {
+    if (!h || !bits || n_bits == 0 || !out_tmp_key || key_cap == 0)
+        return ER_BADARG;
+    if (ttl_sec <= 0) return ER_BADARG;
 
-    auto ok = h->redis->store_expire_lua("SINTERSTORE", tmp_key, ttl_sec, idx_keys);
+    er::query::Node root;
+    if (int rc = bits_node(root, kind, negate, bits, n_bits); rc != ER_OK) return rc;
+
+    // evaluated once while none of the indexes it reads changed, then copied into a
+    // key of the caller's own (see er::query::store_cached)
+    const std::string cache_key = er::query::cache_key(root, h->ns.prefix());
+    const std::string tmp_key = er::keys::tmp("store", h->ns.prefix());
+    if (tmp_key.size() + 1 > key_cap) return ER_RANGE;
+    const auto plan = er::query::compile(root, h->ns.prefix());
+    auto ok = h->pool.run([&](er::RedisClient& r) {
+        return er::query::store_cached(r, plan, ttl_sec, cache_key, tmp_key, h->ns.prefix());
+    });
     if (!ok) return set_err(h, ok.error());
 
-    std::snprintf(out_tmp_key, key_cap, "%s", tmp_key.c_str());
+    std::memcpy(out_tmp_key, tmp_key.c_str(), tmp_key.size() + 1);
     return ER_OK;
 }
 
+int er_find_all_store(er_handle_t* h, int ttl_sec,
+                      const uint16_t* bits, size_t n_bits,
+                      char* out_tmp_key, size_t key_cap) {
+    return store_bits_query(h, er::query::Node::Kind::kAnd, false, ttl_sec, bits, n_bits, out_tmp_key, key_cap);
+}
+
 /* read set members */
 int er_show_set(er_handle_t* h, const char* set_key,
                 char* out, size_t out_cap) {
-    if (!h || !h->redis || !set_key || !out || out_cap == 0)
+    if (!h || !set_key || !out || out_cap == 0)
         return ER_BADARG;
 
-    auto members = h->redis->smembers(set_key);
-    if (!members) return set_err(h, members.error());
+    // Page through the set and write straight into the caller's buffer, so an
+    // oversized set fails on the first page that overflows instead of after a full read.
+    size_t used = 0;
+    bool overflow = false;
+    auto ok = h->pool.run([&](er::RedisClient& r) -> er::Result<er::Unit> {
+        std::uint64_t cursor = 0;
+        do {
+            auto next = r.sscan(set_key, cursor, er::RedisClient::kDefaultScanCount, [&](std::string_view m) {
+                if (overflow) return;
+                if (used + m.size() + 2 > out_cap) { overflow = true; return; }
+                std::memcpy(out + used, m.data(), m.size());
+                used += m.size();
+                out[used++] = '\n';
+            });
+            if (!next) return er::Result<er::Unit>::err(next.error().code, next.error().msg);
+            cursor = next.value();
+        } while (cursor != 0 && !overflow);
+        return er::Result<er::Unit>::ok();
+    });
+    if (!ok) return set_err(h, ok.error());
+    if (overflow) return ER_RANGE;
 
-    std::ostringstream oss;
-    for (auto& m : members.value()) oss << m << "\n";
+    out[used] = '\0';
+    return ER_OK;
+}
 
-    const std::string s = oss.str();
-    if (s.size() + 1 > out_cap) return ER_RANGE;
+int er_scan_set(er_handle_t* h, const char* set_key,
+                uint64_t* cursor, size_t count,
+                er_member_cb cb, void* user) {
+    if (!h || !set_key || !cursor || !cb)
+        return ER_BADARG;
 
-    std::memcpy(out, s.c_str(), s.size() + 1);
+    auto next = h->pool.run([&](er::RedisClient& r) {
+        return r.sscan(set_key, *cursor, count, [&](std::string_view m) { cb(m.data(), m.size(), user); });
+    });
+    if (!next) return set_err(h, next.error());
+    *cursor = next.value();
     return ER_OK;
 }
-    
-int er_find_any_store(er_handle_t* h, int ttl_seconds,
-                      const uint16_t* bits, size_t n_bits,
-                      char* out_tmp_key, size_t key_cap) {
-    if (!h || !h->redis || !bits || n_bits == 0 || !out_tmp_key || key_cap == 0)
+
+int er_query_count(er_handle_t* h, const char* expr,
+                   size_t limit, uint64_t* out_count) {
+    if (!h || !expr || !out_count)
         return ER_BADARG;
 
-    std::vector<std::string> keys;
-    keys.reserve(n_bits);
-    for (size_t i = 0; i < n_bits; ++i) {
-        if (bits[i] >= 4096) return ER_RANGE;
-        keys.push_back(er::keys::idx_bit(bits[i]));
+    auto node = er::query::parse(expr);
+    if (!node) { set_err(h, node.error()); return ER_BADARG; }
+    std::shared_lock<std::shared_mutex> lock(h->hybrid_mu);
+    auto n = h->pool.run([&](er::RedisClient& r) {
+        if (h->hybrid) return h->hybrid->count(r, node.value(), limit);
+        return er::query::count(r, er::query::compile(node.value(), h->ns.prefix()), limit, h->ns.prefix());
+    });
+    lock.unlock();
+    if (!n) return set_err(h, n.error());
+
+    *out_count = static_cast<uint64_t>(n.value());
+    return ER_OK;
+}
+
+int er_hybrid(er_handle_t* h, size_t snapshot_rows) {
+    if (!h) return ER_BADARG;
+    std::unique_ptr<er::query::Hybrid> hybrid;
+    if (snapshot_rows > 0) {
+        // loaded before taking the lock: queries keep running meanwhile
+        er::query::HybridOptions opts;
+        opts.snapshot_rows = snapshot_rows;
+        hybrid = std::make_unique<er::query::Hybrid>(opts, h->ns.prefix());
+        auto ok = h->pool.run([&](er::RedisClient& r) { return hybrid->refresh(r); });
+        if (!ok) return set_err(h, ok.error());
     }
+    std::unique_lock<std::shared_mutex> lock(h->hybrid_mu);
+    h->hybrid = std::move(hybrid);
+    return ER_OK;
+}
 
-    std::string tmp_key = er::keys::tmp(std::string("any:ttl") + std::to_string(ttl_seconds));
-    auto ok = h->redis->store_any_expire_lua(ttl_seconds, keys, tmp_key);
-    if (!ok) return set_err(h, ok.error());
+int er_query_limit(er_handle_t* h, const char* expr,
+                   size_t limit, er_member_cb cb, void* user) {
+    if (!h || !expr || !cb)
+        return ER_BADARG;
 
-    std::snprintf(out_tmp_key, key_cap, "%s", tmp_key.c_str());
+    auto node = er::query::parse(expr);
+    if (!node) { set_err(h, node.error()); return ER_BADARG; }
+    std::shared_lock<std::shared_mutex> lock(h->hybrid_mu);
+    auto members = h->pool.run([&](er::RedisClient& r) {
+        if (h->hybrid) return h->hybrid->members(r, node.value(), limit);
+        return er::query::members(r, er::query::compile(node.value(), h->ns.prefix()), limit, h->ns.prefix());
+    });
+    lock.unlock();
+    if (!members) return set_err(h, members.error());
+
+    for (const auto& m : members.value()) cb(m.data(), m.size(), user);
     return ER_OK;
 }
 
+int er_find_any_store(er_handle_t* h, int ttl_seconds,
+                      const uint16_t* bits, size_t n_bits,
+                      char* out_tmp_key, size_t key_cap) {
+    return store_bits_query(h, er::query::Node::Kind::kOr, false, ttl_seconds, bits, n_bits, out_tmp_key, key_cap);
+}
+
+/* universe \ bits */
 int er_find_not_store(er_handle_t* h, int ttl_seconds,
                       const uint16_t* bits, size_t n_bits,
                       char* out_tmp_key, size_t key_cap) {
-    if (!h || !h->redis || !bits || n_bits == 0 || !out_tmp_key || key_cap == 0)
-        return ER_BADARG;
+    return store_bits_query(h, er::query::Node::Kind::kAnd, true, ttl_seconds, bits, n_bits, out_tmp_key, key_cap);
+}
 
-    std::vector<std::string> keys;
-    keys.reserve(n_bits);
-    for (size_t i = 0; i < n_bits; ++i) {
+/* store into the caller's key: overwritten in place, no new key per call */
+static int store_bits_into(er_handle_t* h, er::query::Node::Kind kind, bool negate, int ttl_sec,
+                           const uint16_t* bits, size_t n_bits, const char* out_key, uint64_t* out_count) {
+    if (!h || !bits || n_bits == 0 || !out_key || ttl_sec <= 0) return ER_BADARG;
+    if (auto ok = er::query::check_output_key(out_key, h->ns.prefix()); !ok) { set_err(h, ok.error()); return ER_BADARG; }
+
+    er::query::Node root;
+    if (int rc = bits_node(root, kind, negate, bits, n_bits); rc != ER_OK) return rc;
+    const auto plan = er::query::compile(root, h->ns.prefix());
+    auto card = h->pool.run([&](er::RedisClient& r) { return er::query::store(r, plan, ttl_sec, out_key, h->ns.prefix()); });
+    if (!card) return set_err(h, card.error());
+    if (out_count) *out_count = static_cast<uint64_t>(card.value());
+    return ER_OK;
+}
+
+int er_find_all_store_into(er_handle_t* h, int ttl_sec, const uint16_t* bits, size_t n_bits,
+                           const char* out_key, uint64_t* out_count) {
+    return store_bits_into(h, er::query::Node::Kind::kAnd, false, ttl_sec, bits, n_bits, out_key, out_count);
+}
+
+int er_find_any_store_into(er_handle_t* h, int ttl_sec, const uint16_t* bits, size_t n_bits,
+                           const char* out_key, uint64_t* out_count) {
+    return store_bits_into(h, er::query::Node::Kind::kOr, false, ttl_sec, bits, n_bits, out_key, out_count);
+}
+
+int er_find_not_store_into(er_handle_t* h, int ttl_sec, const uint16_t* bits, size_t n_bits,
+                           const char* out_key, uint64_t* out_count) {
+    return store_bits_into(h, er::query::Node::Kind::kAnd, true, ttl_sec, bits, n_bits, out_key, out_count);
+}
+
+int er_release_tmp(er_handle_t* h, const char* const* keys, size_t n, uint64_t* out_released) {
+    if (!h || (n > 0 && !keys)) return ER_BADARG;
+    std::vector<std::string_view> ks;
+    ks.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        if (!keys[i]) return ER_BADARG;
+        ks.emplace_back(keys[i]);
+    }
+    auto released = h->pool.run([&](er::RedisClient& r) { return er::query::release(r, ks, h->ns.prefix()); });
+    if (!released) {
+        set_err(h, released.error());
+        return released.error().code == er::Errc::kInvalidArg ? ER_BADARG : ER_ERR;
+    }
+    if (out_released) *out_released = static_cast<uint64_t>(released.value());
+    return ER_OK;
+}
+
+/* in-memory snapshot */
+er_snapshot_t* er_snapshot_load(er_handle_t* h) {
+    if (!h) return nullptr;
+    auto snap = h->pool.run([&](er::RedisClient& r) {
+        return er::Snapshot::load(r, er::RedisClient::kDefaultScanCount, h->ns.prefix());
+    });
+    if (!snap) { set_err(h, snap.error()); return nullptr; }
+    return new er_snapshot{std::move(snap).value()};
+}
+
+er_snapshot_t* er_snapshot_open(er_handle_t* h, const char* path, int verify) {
+    if (!path) return nullptr;
+    auto snap = er::Snapshot::open(path, verify != 0);
+    if (!snap) { set_err(h, snap.error()); return nullptr; }
+    return new er_snapshot{std::move(snap).value()};
+}
+
+int er_snapshot_save(er_handle_t* h, const er_snapshot_t* s, const char* path) {
+    if (!s || !path) return ER_BADARG;
+    auto ok = s->snap.save(path);
+    return ok ? ER_OK : set_err(h, ok.error());
+}
+
+void er_snapshot_destroy(er_snapshot_t* s) {
+    delete s;
+}
+
+size_t er_snapshot_size(const er_snapshot_t* s) {
+    return s ? s->snap.size() : 0;
+}
+
+static int set_mask(er::Flags4096& mask, const uint16_t* bits, size_t n) {
+    if (!bits && n > 0) return ER_BADARG;
+    for (size_t i = 0; i < n; ++i) {
         if (bits[i] >= 4096) return ER_RANGE;
-        keys.push_back(er::keys::idx_bit(bits[i]));
+        (void)mask.set(bits[i]);
     }
+    return ER_OK;
+}
 
-    std::string tmp_key = er::keys::tmp(std::string("not:ttl") + std::to_string(ttl_seconds));
-    auto ok = h->redis->store_not_expire_lua(ttl_seconds, er::keys::universe(), keys, tmp_key);
-    if (!ok) return set_err(h, ok.error());
+static int make_predicate(er::Predicate& pred,
+                          const uint16_t* all_bits, size_t n_all,
+                          const uint16_t* any_bits, size_t n_any,
+                          const uint16_t* none_bits, size_t n_none) {
+    if (int rc = set_mask(pred.all, all_bits, n_all); rc != ER_OK) return rc;
+    if (int rc = set_mask(pred.any, any_bits, n_any); rc != ER_OK) return rc;
+    return set_mask(pred.none, none_bits, n_none);
+}
+
+int er_snapshot_count(const er_snapshot_t* s,
+                      const uint16_t* all_bits, size_t n_all,
+                      const uint16_t* any_bits, size_t n_any,
+                      const uint16_t* none_bits, size_t n_none,
+                      uint64_t* out_count) {
+    if (!s || !out_count) return ER_BADARG;
+    er::Predicate pred;
+    if (int rc = make_predicate(pred, all_bits, n_all, any_bits, n_any, none_bits, n_none); rc != ER_OK)
+        return rc;
+    *out_count = static_cast<uint64_t>(s->snap.count(pred));
+    return ER_OK;
+}
 
-    std::snprintf(out_tmp_key, key_cap, "%s", tmp_key.c_str());
+int er_snapshot_find(const er_snapshot_t* s,
+                     const uint16_t* all_bits, size_t n_all,
+                     const uint16_t* any_bits, size_t n_any,
+                     const uint16_t* none_bits, size_t n_none,
+                     size_t limit, er_member_cb cb, void* user) {
+    if (!s || !cb) return ER_BADARG;
+    er::Predicate pred;
+    if (int rc = make_predicate(pred, all_bits, n_all, any_bits, n_any, none_bits, n_none); rc != ER_OK)
+        return rc;
+    for (auto row : s->snap.find(pred, limit)) {
+        const auto name = s->snap.name(row);
+        cb(name.data(), name.size(), user);
+    }
     return ER_OK;
 }
+
+/* flags cache */
+// element_flags, through the cache when it is on (caller holds no cache_mu).
+static er::Result<er::Flags4096> cached_flags(er_handle_t* h, er::RedisClient& r, std::string_view name) {
+    std::shared_lock<std::shared_mutex> lock(h->cache_mu);
+    if (!h->cache) return r.element_flags(name, h->ns.prefix());
+    if (auto hit = h->cache->get(name)) return er::Result<er::Flags4096>::ok(*hit);
+    const uint64_t ticket = h->cache->ticket(name);
+    auto flags = r.element_flags(name, h->ns.prefix());
+    if (flags) h->cache->put(name, flags.value(), ticket);
+    return flags;
+}
+
+int er_flags_cache(er_handle_t* h, size_t max_bytes, int track) {
+    if (!h) return ER_BADARG;
+    std::unique_lock<std::shared_mutex> lock(h->cache_mu);
+    h->tracker.reset();
+    h->cache.reset();
+    if (max_bytes == 0) return ER_OK;
+
+    auto cache = std::make_unique<er::FlagsCache>(max_bytes);
+    if (track) {
+        auto tracker = er::FlagsTracker::start(h->host, h->port, *cache, h->ns.prefix());
+        if (!tracker) return set_err(h, tracker.error());
+        h->tracker.emplace(std::move(tracker).value());
+    }
+    h->cache = std::move(cache);
+    return ER_OK;
+}
+
+int er_flags_cache_stats(er_handle_t* h, uint64_t* out_hits, uint64_t* out_misses, uint64_t* out_entries) {
+    if (!h) return ER_BADARG;
+    std::shared_lock<std::shared_mutex> lock(h->cache_mu);
+    const er::FlagsCacheStats st = h->cache ? h->cache->stats() : er::FlagsCacheStats{};
+    if (out_hits) *out_hits = st.hits;
+    if (out_misses) *out_misses = st.misses;
+    if (out_entries) *out_entries = st.entries;
+    // a tracker that lost its connection leaves the cache stopped: say so once asked
+    if (h->tracker && !h->tracker->healthy()) {
+        set_err(h, "flags cache: invalidation connection lost, call er_flags_cache again");
+        return ER_REDIS;
+    }
+    return ER_OK;
+}
+
+int er_bit_counts(er_handle_t* h, int rebuild, uint64_t* out_counts, uint64_t* out_universe) {
+    if (!h) return ER_BADARG;
+    auto st = h->pool.run([&](er::RedisClient& r) -> er::Result<er::IndexStats> {
+        if (rebuild) {
+            if (auto n = r.rebuild_index_stats(er::IndexBackend::kSet, h->ns.prefix()); !n)
+                return er::Result<er::IndexStats>::err(n.error().code, n.error().msg);
+        }
+        return r.index_stats(er::IndexBackend::kSet, h->ns.prefix());
+    });
+    if (!st) return set_err(h, st.error());
+    if (out_counts) {
+        for (std::size_t b = 0; b < st.value().bits.size(); ++b)
+            out_counts[b] = static_cast<uint64_t>(std::max(0LL, st.value().bits[b]));
+    }
+    if (out_universe) *out_universe = static_cast<uint64_t>(std::max(0LL, st.value().universe));
+    return ER_OK;
+}
+
+int er_get_bits(er_handle_t* h, const char* name, uint16_t* out_bits, size_t cap, size_t* out_n) {
+    if (!h || !name || !out_n || (!out_bits && cap > 0)) return ER_BADARG;
+    auto flags = h->pool.run([&](er::RedisClient& r) { return cached_flags(h, r, name); });
+    if (!flags) return set_err(h, flags.error());
+    *out_n = flags.value().popcount();
+    if (*out_n > cap) return ER_RANGE;
+    size_t i = 0;
+    for (auto b : flags.value().bits()) out_bits[i++] = static_cast<uint16_t>(b);
+    return ER_OK;
+}
+
+/* similarity */
+int er_similar(er_handle_t* h, const er_snapshot_t* snap,
+               const char* name, size_t k, int metric,
+               er_scored_cb cb, void* user) {
+    if (!h || !name || !cb) return ER_BADARG;
+    if (metric != ER_METRIC_JACCARD && metric != ER_METRIC_HAMMING) return ER_BADARG;
+    const auto m = (metric == ER_METRIC_HAMMING) ? er::Metric::kHamming : er::Metric::kJaccard;
+
+    auto matches = h->pool.run([&](er::RedisClient& r) -> er::Result<std::vector<er::Match>> {
+        auto flags = cached_flags(h, r, name);
+        if (!flags) return er::Result<std::vector<er::Match>>::err(flags.error().code, flags.error().msg);
+        if (snap) return er::Result<std::vector<er::Match>>::ok(er::similar(snap->snap, flags.value(), k, m, name));
+        return er::similar(r, flags.value(), k, m, name, er::IndexBackend::kSet, h->ns.prefix());
+    });
+    if (!matches) return set_err(h, matches.error());
+    for (const auto& match : matches.value()) cb(match.name.data(), match.name.size(), match.score, user);
+    return ER_OK;
+}
+
+/* arena-backed results */
+static er_result* take_result(er_handle_t* h) {
+    std::unique_ptr<er_result> res;
+    {
+        std::lock_guard<std::mutex> lock(h->results_mu);
+        if (!h->spare_results.empty()) {
+            res = std::move(h->spare_results.back());
+            h->spare_results.pop_back();
+        }
+    }
+    if (!res) res.reset(new er_result{h});
+    res->clear();
+    return res.release();
+}
+
+void er_result_free(er_result_t* res) {
+    if (!res) return;
+    std::unique_ptr<er_result> owned(res);
+    er_handle_t* h = res->owner;
+    std::lock_guard<std::mutex> lock(h->results_mu);
+    if (h->spare_results.size() < er_handle::kSpareResults) h->spare_results.push_back(std::move(owned));
+}
+
+size_t er_result_count(const er_result_t* res) {
+    return res ? res->offsets.size() - 1 : 0;
+}
+
+const char* er_result_data(const er_result_t* res, size_t* out_bytes) {
+    if (!res) return nullptr;
+    if (out_bytes) *out_bytes = res->bytes.size();
+    return res->bytes.data();
+}
+
+const uint64_t* er_result_offsets(const er_result_t* res) {
+    return res ? res->offsets.data() : nullptr;
+}
+
+// fill(RedisClient&, er_result&) -> Result<Unit> on a leased connection; *out is only
+// set on success.
+template <class Fill>
+static int fill_result(er_handle_t* h, er_result_t** out, Fill&& fill) {
+    er_result* res = take_result(h);
+    auto ok = h->pool.run([&](er::RedisClient& r) { return fill(r, *res); });
+    if (!ok) {
+        er_result_free(res);
+        return set_err(h, ok.error());
+    }
+    *out = res;
+    return ER_OK;
+}
+
+static int plan_result(er_handle_t* h, const er::query::Node& node, size_t limit, er_result_t** out) {
+    std::shared_lock<std::shared_mutex> lock(h->hybrid_mu);
+    return fill_result(h, out, [&](er::RedisClient& r, er_result& res) -> er::Result<er::Unit> {
+        auto members = h->hybrid ? h->hybrid->members(r, node, limit)
+                                 : er::query::members(r, er::query::compile(node, h->ns.prefix()), limit,
+                                                      h->ns.prefix());
+        if (!members) return er::Result<er::Unit>::err(members.error().code, members.error().msg);
+        size_t bytes = 0;
+        for (const auto& m : members.value()) bytes += m.size();
+        res.bytes.reserve(bytes);
+        res.offsets.reserve(members.value().size() + 1);
+        for (const auto& m : members.value()) res.push(m);
+        return er::Result<er::Unit>::ok();
+    });
+}
+
+int er_show_set_result(er_handle_t* h, const char* set_key, er_result_t** out) {
+    if (!h || !set_key || !out) return ER_BADARG;
+    return fill_result(h, out, [&](er::RedisClient& r, er_result& res) -> er::Result<er::Unit> {
+        std::uint64_t cursor = 0;
+        do {
+            auto next = r.sscan(set_key, cursor, er::RedisClient::kDefaultScanCount,
+                                [&](std::string_view m) { res.push(m); });
+            if (!next) return er::Result<er::Unit>::err(next.error().code, next.error().msg);
+            cursor = next.value();
+        } while (cursor != 0);
+        return er::Result<er::Unit>::ok();
+    });
+}
+
+int er_query_result(er_handle_t* h, const char* expr, size_t limit, er_result_t** out) {
+    if (!h || !expr || !out) return ER_BADARG;
+    auto node = er::query::parse(expr);
+    if (!node) { set_err(h, node.error()); return ER_BADARG; }
+    return plan_result(h, node.value(), limit, out);
+}
+
+static int find_bits_result(er_handle_t* h, er::query::Node::Kind kind, bool negate,
+                            const uint16_t* bits, size_t n_bits, size_t limit, er_result_t** out) {
+    if (!h || !bits || n_bits == 0 || !out) return ER_BADARG;
+    er::query::Node root;
+    if (int rc = bits_node(root, kind, negate, bits, n_bits); rc != ER_OK) return rc;
+    return plan_result(h, er::query::normalize(std::move(root)), limit, out);
+}
+
+int er_find_all_result(er_handle_t* h, const uint16_t* bits, size_t n_bits, size_t limit, er_result_t** out) {
+    return find_bits_result(h, er::query::Node::Kind::kAnd, false, bits, n_bits, limit, out);
+}
+
+int er_find_any_result(er_handle_t* h, const uint16_t* bits, size_t n_bits, size_t limit, er_result_t** out) {
+    return find_bits_result(h, er::query::Node::Kind::kOr, false, bits, n_bits, limit, out);
+}
+
+int er_find_not_result(er_handle_t* h, const uint16_t* bits, size_t n_bits, size_t limit, er_result_t** out) {
+    return find_bits_result(h, er::query::Node::Kind::kAnd, true, bits, n_bits, limit, out);
+}
@@ -0,0 +1,177 @@
+#include "er/flags_cache.hpp"
+
+#include <atomic>
+#include <functional>
+#include <new>
+#include <system_error>
+#include <thread>
+
+namespace er {
+
+std::size_t FlagsCache::bucket(std::string_view name) noexcept {
+    return std::hash<std::string_view>{}(name) % kBuckets;
+}
+
+std::optional<Flags4096> FlagsCache::get(std::string_view name) noexcept {
+    std::lock_guard<std::mutex> lock(mu_);
+    const auto it = index_.find(name);
+    if (it == index_.end()) {
+        ++stats_.misses;
+        return std::nullopt;
+    }
+    ++stats_.hits;
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->flags;
+}
+
+std::uint64_t FlagsCache::ticket(std::string_view name) const noexcept {
+    std::lock_guard<std::mutex> lock(mu_);
+    return gens_[bucket(name)];
+}
+
+void FlagsCache::put(std::string_view name, const Flags4096& flags, std::uint64_t ticket) noexcept {
+    const std::size_t cost = kEntryBytes + name.size();
+    std::lock_guard<std::mutex> lock(mu_);
+    if (stopped_ || gens_[bucket(name)] != ticket || cost > max_bytes_) return;
+    if (const auto it = index_.find(name); it != index_.end()) {
+        it->second->flags = flags;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return;
+    }
+    try {
+        lru_.push_front(Entry{std::string(name), flags});
+        try {
+            index_.emplace(lru_.front().name, lru_.begin());
+        } catch (const std::bad_alloc&) {
+            lru_.pop_front();
+            return;
+        }
+    } catch (const std::bad_alloc&) {
+        return;   // a cache may always decline
+    }
+    stats_.bytes += cost;
+    evict_locked();
+}
+
+void FlagsCache::evict_locked() noexcept {
+    while (stats_.bytes > max_bytes_ && !lru_.empty()) {
+        const Entry& last = lru_.back();
+        stats_.bytes -= kEntryBytes + last.name.size();
+        index_.erase(last.name);
+        lru_.pop_back();
+        ++stats_.evictions;
+    }
+}
+
+void FlagsCache::invalidate(std::string_view name) noexcept {
+    std::lock_guard<std::mutex> lock(mu_);
+    ++gens_[bucket(name)];
+    const auto it = index_.find(name);
+    if (it == index_.end()) return;
+    stats_.bytes -= kEntryBytes + it->second->name.size();
+    const auto node = it->second;
+    index_.erase(it);
+    lru_.erase(node);
+    ++stats_.invalidations;
+}
+
+void FlagsCache::clear(bool stop) noexcept {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (auto& g : gens_) ++g;
+    stats_.invalidations += index_.size();
+    index_.clear();
+    lru_.clear();
+    stats_.bytes = 0;
+    if (stop) stopped_ = true;
+}
+
+void FlagsCache::resume() noexcept {
+    std::lock_guard<std::mutex> lock(mu_);
+    stopped_ = false;
+}
+
+FlagsCacheStats FlagsCache::stats() const noexcept {
+    std::lock_guard<std::mutex> lock(mu_);
+    FlagsCacheStats s = stats_;
+    s.entries = index_.size();
+    return s;
+}
+
+struct FlagsTracker::State {
+    FlagsCache* cache;
+    std::string element_head;   // keys::element("", prefix)
+    std::optional<RedisClient> registered;   // holds the tracking registration
+    std::optional<RedisClient> subscriber;   // read by reader
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> healthy{true};
+    std::thread reader;
+
+    ~State() {
+        stopping.store(true);
+        if (subscriber) subscriber->interrupt();
+        if (reader.joinable()) reader.join();
+    }
+
+    void run() noexcept {
+        for (;;) {
+            auto inv = subscriber->next_invalidation();
+            if (!inv) break;
+            if (inv.value().all) {
+                cache->clear();
+                continue;
+            }
+            for (const std::string_view key : inv.value().keys) {
+                if (key.starts_with(element_head)) cache->invalidate(key.substr(element_head.size()));
+            }
+        }
+        // interrupted or lost: with no invalidations the cache cannot be trusted
+        healthy.store(false);
+        if (!stopping.load()) cache->clear(true);
+    }
+};
+
+Result<FlagsTracker> FlagsTracker::start(const std::string& host, int port, FlagsCache& cache,
+                                         std::string_view prefix) noexcept {
+    using R = Result<FlagsTracker>;
+    try {
+        auto state = std::make_unique<State>();
+        state->cache = &cache;
+        state->element_head = keys::element("", prefix);
+
+        auto sub = RedisClient::connect(host, port);
+        if (!sub) return R::err(sub.error().code, sub.error().msg);
+        RedisClient& subscriber = state->subscriber.emplace(std::move(sub).value());
+        auto id = subscriber.client_id();
+        if (!id) return R::err(id.error().code, "flags tracker: " + id.error().msg);
+        if (auto ok = subscriber.subscribe_invalidations(); !ok) return R::err(ok.error().code, "flags tracker: " + ok.error().msg);
+
+        auto reg = RedisClient::connect(host, port);
+        if (!reg) return R::err(reg.error().code, reg.error().msg);
+        RedisClient& registered = state->registered.emplace(std::move(reg).value());
+        const std::string_view head = state->element_head;
+        if (auto ok = registered.track_broadcast(id.value(), std::span<const std::string_view>(&head, 1)); !ok)
+            return R::err(ok.error().code, "flags tracker: " + ok.error().msg);
+
+        // whatever was cached before tracking began may already be stale
+        cache.clear();
+        cache.resume();
+        State* st = state.get();
+        state->reader = std::thread([st] { st->run(); });
+        return R::ok(FlagsTracker(std::move(state)));
+    } catch (const std::bad_alloc&) {
+        return R::err(Errc::kInternal, "flags tracker: out of memory");
+    } catch (const std::system_error& e) {
+        return R::err(Errc::kInternal, std::string("flags tracker: cannot start reader thread: ") + e.what());
+    }
+}
+
+FlagsTracker::FlagsTracker(std::unique_ptr<State> state) noexcept : state_(std::move(state)) {}
+FlagsTracker::~FlagsTracker() = default;
+FlagsTracker::FlagsTracker(FlagsTracker&&) noexcept = default;
+FlagsTracker& FlagsTracker::operator=(FlagsTracker&&) noexcept = default;
+
+bool FlagsTracker::healthy() const noexcept {
+    return state_ && state_->healthy.load();
+}
+
+} // namespace er
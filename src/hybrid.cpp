@@ -0,0 +1,362 @@
+#include "er/hybrid.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <new>
+
+namespace er::query {
+
+namespace {
+
+// A query expression evaluated on one row. Bit operands of each AND / OR / NOT are
+// folded into per-word masks, so "1 & 2 & 70" is two word tests, not a tree walk.
+class RowExpr {
+public:
+    explicit RowExpr(const Node& root) { root_ = add(root); }
+
+    bool operator()(const Flags4096& row) const noexcept { return eval(root_, row.words()); }
+
+private:
+    struct Term {
+        std::size_t word;
+        std::uint64_t mask;
+    };
+    struct Op {
+        Node::Kind kind{Node::Kind::kAnd};   // kBit is lowered to a one-term kAnd
+        std::vector<Term> terms{};
+        std::vector<std::size_t> children{};
+    };
+
+    static void add_term(Op& op, std::size_t bit) {
+        const std::size_t word = bit / 64;
+        const std::uint64_t mask = std::uint64_t{1} << (bit % 64);
+        for (auto& t : op.terms) {
+            if (t.word == word) {
+                t.mask |= mask;
+                return;
+            }
+        }
+        op.terms.push_back(Term{word, mask});
+    }
+
+    std::size_t add(const Node& n) {
+        Op op;
+        if (n.kind == Node::Kind::kBit) {
+            add_term(op, n.bit);
+        } else {
+            op.kind = n.kind;
+            for (const auto& c : n.children) {
+                if (c.kind == Node::Kind::kBit) add_term(op, c.bit);
+                else op.children.push_back(add(c));
+            }
+        }
+        ops_.push_back(std::move(op));
+        return ops_.size() - 1;
+    }
+
+    bool all(const Op& op, const Flags4096::Words& r) const noexcept {
+        for (const auto& t : op.terms) {
+            if ((r[t.word] & t.mask) != t.mask) return false;
+        }
+        for (auto c : op.children) {
+            if (!eval(c, r)) return false;
+        }
+        return true;
+    }
+
+    bool eval(std::size_t i, const Flags4096::Words& r) const noexcept {
+        const Op& op = ops_[i];
+        switch (op.kind) {
+        case Node::Kind::kOr:
+            for (const auto& t : op.terms) {
+                if ((r[t.word] & t.mask) != 0) return true;
+            }
+            for (auto c : op.children) {
+                if (eval(c, r)) return true;
+            }
+            return false;
+        case Node::Kind::kNot:
+            return !all(op, r);   // a NOT has one operand
+        default:
+            return all(op, r);
+        }
+    }
+
+    std::vector<Op> ops_{};
+    std::size_t root_{0};
+};
+
+void collect_bits(const Node& n, std::vector<std::size_t>& out) {
+    if (n.kind == Node::Kind::kBit) {
+        out.push_back(n.bit);
+        return;
+    }
+    for (const auto& c : n.children) collect_bits(c, out);
+}
+
+// Share of the universe matching n, assuming independent bits.
+double share(const Node& n, const std::array<long long, keys::KeyTable::kBits + 1>& cards, double universe) noexcept {
+    switch (n.kind) {
+    case Node::Kind::kBit:
+        return std::min(1.0, static_cast<double>(cards[n.bit]) / universe);
+    case Node::Kind::kAnd: {
+        double p = 1.0;
+        for (const auto& c : n.children) p *= share(c, cards, universe);
+        return p;
+    }
+    case Node::Kind::kOr: {
+        double q = 1.0;
+        for (const auto& c : n.children) q *= 1.0 - share(c, cards, universe);
+        return 1.0 - q;
+    }
+    case Node::Kind::kNot:
+        return n.children.empty() ? 1.0 : 1.0 - share(n.children.front(), cards, universe);
+    }
+    return 1.0;
+}
+
+// Index of a keys::idx_versions() field in Loaded::versions.
+std::size_t version_slot(std::string_view field) noexcept {
+    std::size_t bit = keys::KeyTable::kBits;
+    const auto [ptr, ec] = std::from_chars(field.data(), field.data() + field.size(), bit);
+    return (ec == std::errc() && ptr == field.data() + field.size() && bit < keys::KeyTable::kBits)
+               ? bit
+               : keys::KeyTable::kBits;   // "all"
+}
+
+std::uint64_t elapsed_ns(std::chrono::steady_clock::time_point t0) noexcept {
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+}
+
+std::size_t scan_count(const Snapshot& snap, const RowExpr& match, std::size_t limit) {
+    const unsigned parts = snap.partitions(0);
+    std::vector<std::size_t> counts(parts, 0);
+    snap.for_each_range(parts, [&](std::size_t begin, std::size_t end, unsigned part) {
+        std::size_t n = 0;
+        for (std::size_t i = begin; i < end; ++i) n += match(snap.flags(i)) ? 1 : 0;
+        counts[part] = n;
+    });
+    std::size_t total = 0;
+    for (auto n : counts) total += n;
+    return (limit > 0 && total > limit) ? limit : total;
+}
+
+std::vector<std::string> scan_members(const Snapshot& snap, const RowExpr& match, std::size_t limit) {
+    const unsigned parts = snap.partitions(0);
+    std::vector<std::vector<std::size_t>> found(parts);
+    snap.for_each_range(parts, [&](std::size_t begin, std::size_t end, unsigned part) {
+        auto& out = found[part];
+        for (std::size_t i = begin; i < end; ++i) {
+            if (!match(snap.flags(i))) continue;
+            out.push_back(i);
+            if (limit > 0 && out.size() >= limit) break;
+        }
+    });
+    std::vector<std::string> names;
+    for (const auto& rows : found) {
+        for (auto i : rows) {
+            if (limit > 0 && names.size() >= limit) return names;
+            names.emplace_back(snap.name(i));
+        }
+    }
+    return names;
+}
+
+} // namespace
+
+Hybrid::Hybrid(HybridOptions opts, std::string_view prefix) : opts_(opts), prefix_(prefix) {
+    card_at_.fill(Clock::time_point::min());
+}
+
+Result<Unit> Hybrid::refresh(RedisClient& r) noexcept {
+    using R = Result<Unit>;
+    try {
+        auto loaded = std::make_shared<Loaded>();
+        // versions first: a write during the load bumps past them and vetoes its bits
+        std::vector<std::string_view> fields;
+        fields.reserve(kBits + 1);
+        for (std::size_t b = 0; b < kBits; ++b) fields.push_back(keys::KeyTable::bit_field(b));
+        fields.push_back("all");
+        auto p = r.pipeline();
+        const auto slot = p.hmget(keys::KeyTable::of(prefix_).idx_versions(), fields);
+        if (auto ok = p.exec(); !ok) return R::err(ok.error().code, ok.error().msg);
+        auto versions = p.strings(slot);
+        if (!versions) return R::err(versions.error().code, versions.error().msg);
+        if (versions.value().size() != fields.size()) return R::err(Errc::kRedisReplyType, "Hybrid::refresh: short HMGET reply");
+        loaded->versions.reserve(fields.size());
+        for (auto& v : versions.value()) loaded->versions.push_back(v ? std::move(*v) : std::string());
+
+        auto snap = Snapshot::load(r, RedisClient::kDefaultScanCount, prefix_);
+        if (!snap) return R::err(snap.error().code, snap.error().msg);
+        loaded->snap = std::move(snap).value();
+
+        std::lock_guard<std::mutex> lock(mu_);
+        loaded_ = std::move(loaded);
+        return R::ok();
+    } catch (const std::bad_alloc&) {
+        return R::err(Errc::kInternal, "Hybrid::refresh: out of memory");
+    }
+}
+
+std::size_t Hybrid::snapshot_size() const noexcept {
+    std::lock_guard<std::mutex> lock(mu_);
+    return loaded_ ? loaded_->snap.size() : 0;
+}
+
+Result<double> Hybrid::estimate(RedisClient& r, const Node& node) noexcept {
+    using R = Result<double>;
+    try {
+        std::vector<std::size_t> bits;
+        collect_bits(node, bits);
+        bits.push_back(kBits);   // er:all
+        std::sort(bits.begin(), bits.end());
+        bits.erase(std::unique(bits.begin(), bits.end()), bits.end());
+
+        std::vector<std::size_t> stale;
+        const auto now = Clock::now();
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            for (auto b : bits) {
+                if (now >= card_at_[b] + opts_.cardinality_ttl) stale.push_back(b);
+            }
+        }
+        if (!stale.empty()) {
+            auto got = cardinalities(r, stale);
+            if (!got) return R::err(got.error().code, got.error().msg);
+            std::lock_guard<std::mutex> lock(mu_);
+            for (std::size_t i = 0; i < stale.size(); ++i) {
+                cards_[stale[i]] = got.value()[i];
+                card_at_[stale[i]] = now;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mu_);
+        const auto universe = static_cast<double>(cards_[kBits]);
+        if (universe <= 0) return R::ok(0.0);
+        return R::ok(universe * share(node, cards_, universe));
+    } catch (const std::bad_alloc&) {
+        return R::err(Errc::kInternal, "Hybrid::estimate: out of memory");
+    }
+}
+
+Result<std::vector<long long>> Hybrid::cardinalities(RedisClient& r, const std::vector<std::size_t>& bits) {
+    using R = Result<std::vector<long long>>;
+    const auto& table = keys::KeyTable::of(prefix_);
+    std::vector<long long> got(bits.size(), 0);
+
+    // one HMGET of the stats hash; "all" first, it is only there while the counts are kept
+    std::vector<std::string_view> fields{keys::kUniverseVersionField};
+    for (auto b : bits) fields.push_back(b == kBits ? keys::kUniverseVersionField : keys::KeyTable::bit_field(b));
+    {
+        auto p = r.pipeline();
+        const auto slot = p.hmget(table.idx_stats(), fields);
+        if (auto ok = p.exec(); !ok) return R::err(ok.error().code, ok.error().msg);
+        auto v = p.strings(slot);
+        if (!v) return R::err(v.error().code, v.error().msg);
+        if (v.value().size() != fields.size()) return R::err(Errc::kRedisReplyType, "Hybrid::estimate: short HMGET reply");
+        if (v.value().front()) {
+            for (std::size_t i = 0; i < bits.size(); ++i) {
+                const auto& f = v.value()[i + 1];
+                if (!f) continue;   // a bit no element has
+                const auto [ptr, ec] = std::from_chars(f->data(), f->data() + f->size(), got[i]);
+                if (ec != std::errc() || ptr != f->data() + f->size())
+                    return R::err(Errc::kRedisReplyType, "Hybrid::estimate: non-integer stats field");
+            }
+            return R::ok(std::move(got));
+        }
+    }
+
+    // not built yet (data from before the counts): one SCARD per posting
+    auto p = r.pipeline();
+    for (auto b : bits) (void)p.scard(b == kBits ? table.universe() : table.idx_bit(b));
+    if (auto ok = p.exec(); !ok) return R::err(ok.error().code, ok.error().msg);
+    for (std::size_t i = 0; i < bits.size(); ++i) {
+        auto n = p.integer(i);
+        if (!n) return R::err(n.error().code, n.error().msg);
+        got[i] = n.value();
+    }
+    return R::ok(std::move(got));
+}
+
+Result<std::shared_ptr<const Hybrid::Loaded>> Hybrid::route(RedisClient& r, const Node& node, const Plan& plan,
+                                                            std::size_t limit) noexcept {
+    using R = Result<std::shared_ptr<const Loaded>>;
+    std::shared_ptr<const Loaded> loaded;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        loaded = loaded_;
+    }
+    if (!loaded) return R::ok(nullptr);
+
+    auto est = estimate(r, node);
+    if (!est) return R::err(est.error().code, est.error().msg);
+    double rows = est.value();
+    if (limit > 0) rows = std::min(rows, static_cast<double>(limit));
+    if (rows < static_cast<double>(opts_.snapshot_rows)) return R::ok(nullptr);
+
+    if (plan.version_fields.empty()) return R::ok(std::move(loaded));
+    auto p = r.pipeline();
+    const auto slot = p.hmget(keys::KeyTable::of(prefix_).idx_versions(), plan.version_fields);
+    if (auto ok = p.exec(); !ok) return R::err(ok.error().code, ok.error().msg);
+    auto now = p.strings(slot);
+    if (!now) return R::err(now.error().code, now.error().msg);
+    for (std::size_t i = 0; i < plan.version_fields.size() && i < now.value().size(); ++i) {
+        const auto& v = now.value()[i];
+        if ((v ? std::string_view(*v) : std::string_view()) != loaded->versions[version_slot(plan.version_fields[i])]) {
+            r.record_op("QUERY:stale", 0);
+            return R::ok(nullptr);
+        }
+    }
+    return R::ok(std::move(loaded));
+}
+
+Result<long long> Hybrid::count(RedisClient& r, const Node& node, std::size_t limit, Path* path) noexcept {
+    using R = Result<long long>;
+    try {
+        const Plan plan = compile(node, prefix_);
+        auto where = route(r, node, plan, limit);
+        if (!where) return R::err(where.error().code, where.error().msg);
+
+        const auto t0 = Clock::now();
+        const bool local = where.value() != nullptr;
+        if (path) *path = local ? Path::kSnapshot : Path::kRedis;
+        if (!local) {
+            auto n = query::count(r, plan, limit, prefix_);
+            r.record_op("QUERY:redis", elapsed_ns(t0));
+            return n;
+        }
+        const auto n = scan_count(where.value()->snap, RowExpr(node), limit);
+        r.record_op("QUERY:snapshot", elapsed_ns(t0));
+        return R::ok(static_cast<long long>(n));
+    } catch (const std::bad_alloc&) {
+        return R::err(Errc::kInternal, "Hybrid::count: out of memory");
+    }
+}
+
+Result<std::vector<std::string>> Hybrid::members(RedisClient& r, const Node& node, std::size_t limit,
+                                                 Path* path) noexcept {
+    using R = Result<std::vector<std::string>>;
+    try {
+        const Plan plan = compile(node, prefix_);
+        auto where = route(r, node, plan, limit);
+        if (!where) return R::err(where.error().code, where.error().msg);
+
+        const auto t0 = Clock::now();
+        const bool local = where.value() != nullptr;
+        if (path) *path = local ? Path::kSnapshot : Path::kRedis;
+        if (!local) {
+            auto m = query::members(r, plan, limit, prefix_);
+            r.record_op("QUERY:redis", elapsed_ns(t0));
+            return m;
+        }
+        auto m = scan_members(where.value()->snap, RowExpr(node), limit);
+        r.record_op("QUERY:snapshot", elapsed_ns(t0));
+        return R::ok(std::move(m));
+    } catch (const std::bad_alloc&) {
+        return R::err(Errc::kInternal, "Hybrid::members: out of memory");
+    }
+}
+
+} // namespace er::query
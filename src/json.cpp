@@ -0,0 +1,298 @@
+#include "er/json.hpp"
+
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+
+namespace er::json {
+
+namespace {
+
+constexpr int kMaxDepth = 64;
+
+class Parser {
+public:
+    explicit Parser(std::string_view s) noexcept : s_(s) {}
+
+    Result<Value> document() {
+        Value v;
+        if (!value(v, 0)) return fail();
+        skip_ws();
+        if (pos_ != s_.size()) {
+            error_ = "trailing characters";
+            return fail();
+        }
+        return Result<Value>::ok(std::move(v));
+    }
+
+private:
+    Result<Value> fail() const {
+        return Result<Value>::err(Errc::kInvalidArg, "json: " + error_ + " at offset " + std::to_string(pos_));
+    }
+
+    bool bad(const char* what) {
+        error_ = what;
+        return false;
+    }
+
+    void skip_ws() noexcept {
+        while (pos_ < s_.size() && (s_[pos_] == ' ' || s_[pos_] == '\t' || s_[pos_] == '\n' || s_[pos_] == '\r'))
+            ++pos_;
+    }
+
+    bool literal(std::string_view word) noexcept {
+        if (s_.substr(pos_, word.size()) != word) return false;
+        pos_ += word.size();
+        return true;
+    }
+
+    bool value(Value& out, int depth) {
+        if (depth > kMaxDepth) return bad("nesting too deep");
+        skip_ws();
+        if (pos_ >= s_.size()) return bad("unexpected end");
+        switch (s_[pos_]) {
+        case '{': return object(out, depth);
+        case '[': return array(out, depth);
+        case '"':
+            out.kind = Value::Kind::kString;
+            return string(out.string);
+        case 't':
+            if (!literal("true")) return bad("invalid literal");
+            out.kind = Value::Kind::kBool;
+            out.boolean = true;
+            return true;
+        case 'f':
+            if (!literal("false")) return bad("invalid literal");
+            out.kind = Value::Kind::kBool;
+            return true;
+        case 'n':
+            if (!literal("null")) return bad("invalid literal");
+            out.kind = Value::Kind::kNull;
+            return true;
+        default: return number(out);
+        }
+    }
+
+    bool object(Value& out, int depth) {
+        out.kind = Value::Kind::kObject;
+        ++pos_;   // '{'
+        skip_ws();
+        if (pos_ < s_.size() && s_[pos_] == '}') {
+            ++pos_;
+            return true;
+        }
+        for (;;) {
+            skip_ws();
+            if (pos_ >= s_.size() || s_[pos_] != '"') return bad("expected object key");
+            std::string key;
+            if (!string(key)) return false;
+            skip_ws();
+            if (pos_ >= s_.size() || s_[pos_] != ':') return bad("expected ':'");
+            ++pos_;
+            Value v;
+            if (!value(v, depth + 1)) return false;
+            out.members.emplace_back(std::move(key), std::move(v));
+            skip_ws();
+            if (pos_ < s_.size() && s_[pos_] == ',') { ++pos_; continue; }
+            if (pos_ < s_.size() && s_[pos_] == '}') { ++pos_; return true; }
+            return bad("expected ',' or '}'");
+        }
+    }
+
+    bool array(Value& out, int depth) {
+        out.kind = Value::Kind::kArray;
+        ++pos_;   // '['
+        skip_ws();
+        if (pos_ < s_.size() && s_[pos_] == ']') {
+            ++pos_;
+            return true;
+        }
+        for (;;) {
+            Value v;
+            if (!value(v, depth + 1)) return false;
+            out.items.push_back(std::move(v));
+            skip_ws();
+            if (pos_ < s_.size() && s_[pos_] == ',') { ++pos_; continue; }
+            if (pos_ < s_.size() && s_[pos_] == ']') { ++pos_; return true; }
+            return bad("expected ',' or ']'");
+        }
+    }
+
+    bool hex4(std::uint32_t& cp) noexcept {
+        if (pos_ + 4 > s_.size()) return false;
+        auto [ptr, ec] = std::from_chars(s_.data() + pos_, s_.data() + pos_ + 4, cp, 16);
+        if (ec != std::errc() || ptr != s_.data() + pos_ + 4) return false;
+        pos_ += 4;
+        return true;
+    }
+
+    static void put_utf8(std::string& out, std::uint32_t cp) {
+        if (cp < 0x80) {
+            out.push_back(static_cast<char>(cp));
+        } else if (cp < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else {
+            out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    bool string(std::string& out) {
+        ++pos_;   // opening quote
+        while (pos_ < s_.size()) {
+            const char c = s_[pos_++];
+            if (c == '"') return true;
+            if (static_cast<unsigned char>(c) < 0x20) return bad("control character in string");
+            if (c != '\\') {
+                out.push_back(c);
+                continue;
+            }
+            if (pos_ >= s_.size()) break;
+            switch (s_[pos_++]) {
+            case '"': out.push_back('"'); break;
+            case '\\': out.push_back('\\'); break;
+            case '/': out.push_back('/'); break;
+            case 'b': out.push_back('\b'); break;
+            case 'f': out.push_back('\f'); break;
+            case 'n': out.push_back('\n'); break;
+            case 'r': out.push_back('\r'); break;
+            case 't': out.push_back('\t'); break;
+            case 'u': {
+                std::uint32_t cp = 0;
+                if (!hex4(cp)) return bad("invalid \\u escape");
+                if (cp >= 0xD800 && cp < 0xDC00) {
+                    // high surrogate: a low one must follow
+                    std::uint32_t lo = 0;
+                    if (!literal("\\u") || !hex4(lo) || lo < 0xDC00 || lo >= 0xE000) return bad("invalid surrogate pair");
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                } else if (cp >= 0xDC00 && cp < 0xE000) {
+                    return bad("invalid surrogate pair");
+                }
+                put_utf8(out, cp);
+                break;
+            }
+            default: return bad("invalid escape");
+            }
+        }
+        return bad("unterminated string");
+    }
+
+    bool number(Value& out) {
+        const std::size_t start = pos_;
+        if (pos_ < s_.size() && s_[pos_] == '-') ++pos_;
+        const std::size_t digits = pos_;
+        while (pos_ < s_.size() && s_[pos_] >= '0' && s_[pos_] <= '9') ++pos_;
+        if (pos_ == digits) return bad("invalid value");
+        if (s_[digits] == '0' && pos_ - digits > 1) return bad("leading zero");
+        if (pos_ < s_.size() && s_[pos_] == '.') {
+            const std::size_t frac = ++pos_;
+            while (pos_ < s_.size() && s_[pos_] >= '0' && s_[pos_] <= '9') ++pos_;
+            if (pos_ == frac) return bad("invalid number");
+        }
+        if (pos_ < s_.size() && (s_[pos_] == 'e' || s_[pos_] == 'E')) {
+            ++pos_;
+            if (pos_ < s_.size() && (s_[pos_] == '+' || s_[pos_] == '-')) ++pos_;
+            const std::size_t exp = pos_;
+            while (pos_ < s_.size() && s_[pos_] >= '0' && s_[pos_] <= '9') ++pos_;
+            if (pos_ == exp) return bad("invalid number");
+        }
+        auto [ptr, ec] = std::from_chars(s_.data() + start, s_.data() + pos_, out.number);
+        if (ec != std::errc() || ptr != s_.data() + pos_) return bad("number out of range");
+        out.kind = Value::Kind::kNumber;
+        return true;
+    }
+
+    std::string_view s_;
+    std::size_t pos_{0};
+    std::string error_{};
+};
+
+} // namespace
+
+const Value* Value::find(std::string_view key) const noexcept {
+    if (kind != Kind::kObject) return nullptr;
+    for (const auto& [k, v] : members) {
+        if (k == key) return &v;
+    }
+    return nullptr;
+}
+
+std::optional<std::int64_t> Value::integer(std::int64_t lo, std::int64_t hi) const noexcept {
+    if (kind != Kind::kNumber || number != std::floor(number)) return std::nullopt;
+    if (number < static_cast<double>(lo) || number > static_cast<double>(hi)) return std::nullopt;
+    return static_cast<std::int64_t>(number);
+}
+
+Result<Value> parse(std::string_view text) noexcept {
+    return Parser(text).document();
+}
+
+void append_string(std::string& out, std::string_view s) {
+    out.push_back('"');
+    for (const char c : s) {
+        switch (c) {
+        case '"': out.append("\\\""); break;
+        case '\\': out.append("\\\\"); break;
+        case '\n': out.append("\\n"); break;
+        case '\r': out.append("\\r"); break;
+        case '\t': out.append("\\t"); break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof buf, "\\u%04x", static_cast<unsigned>(c));
+                out.append(buf);
+            } else {
+                out.push_back(c);   // UTF-8 passes through
+            }
+        }
+    }
+    out.push_back('"');
+}
+
+void append_number(std::string& out, double v) {
+    if (!std::isfinite(v)) {
+        out.append("null");   // JSON has no NaN / Infinity
+        return;
+    }
+    char buf[32];
+    const bool integral = v == std::floor(v) && std::fabs(v) < 9007199254740992.0;   // 2^53
+    auto [ptr, ec] = integral ? std::to_chars(buf, buf + sizeof buf, static_cast<std::int64_t>(v))
+                              : std::to_chars(buf, buf + sizeof buf, v);
+    out.append(buf, ec == std::errc() ? ptr : buf);
+}
+
+void append(std::string& out, const Value& v) {
+    switch (v.kind) {
+    case Value::Kind::kNull: out.append("null"); break;
+    case Value::Kind::kBool: out.append(v.boolean ? "true" : "false"); break;
+    case Value::Kind::kNumber: append_number(out, v.number); break;
+    case Value::Kind::kString: append_string(out, v.string); break;
+    case Value::Kind::kArray:
+        out.push_back('[');
+        for (std::size_t i = 0; i < v.items.size(); ++i) {
+            if (i) out.push_back(',');
+            append(out, v.items[i]);
+        }
+        out.push_back(']');
+        break;
+    case Value::Kind::kObject:
+        out.push_back('{');
+        for (std::size_t i = 0; i < v.members.size(); ++i) {
+            if (i) out.push_back(',');
+            append_string(out, v.members[i].first);
+            out.push_back(':');
+            append(out, v.members[i].second);
+        }
+        out.push_back('}');
+        break;
+    }
+}
+
+} // namespace er::json
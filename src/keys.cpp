@@ -0,0 +1,86 @@
+#include "er/keys.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <unistd.h>
+
+namespace er::keys {
+
+std::string client_id() {
+    static const std::string host = [] {
+        char buf[256] = {};
+        if (gethostname(buf, sizeof(buf) - 1) != 0 || buf[0] == '\0') return std::string("localhost");
+        std::string s(buf);
+        // keep the key parseable: ':' separates the id fields
+        for (char& c : s) {
+            if (c == ':' || c == ' ') c = '_';
+        }
+        return s;
+    }();
+    // the pid is read per call, so a forked child does not reuse its parent's ids
+    std::string id = host;
+    id.push_back(':');
+    id.append(std::to_string(static_cast<long long>(getpid())));
+    return id;
+}
+
+std::string tmp(std::string_view tag, std::string_view prefix) {
+    static std::atomic<std::uint64_t> counter{0};
+    const std::uint64_t n = counter.fetch_add(1, std::memory_order_relaxed);
+    std::string k = tmp_prefix(prefix);
+    k.append(tag);
+    k.push_back(':');
+    k.append(client_id());
+    k.push_back(':');
+    k.append(std::to_string(n));
+    return k;
+}
+
+KeyTable::Strip::Strip(std::string_view head) {
+    buf_.reserve(kBits * (head.size() + 4));
+    for (std::size_t i = 0; i < kBits; ++i) {
+        off_[i] = static_cast<std::uint32_t>(buf_.size());
+        buf_.append(head);
+        buf_.append(std::to_string(i));
+    }
+    off_[kBits] = static_cast<std::uint32_t>(buf_.size());
+}
+
+KeyTable::KeyTable(std::string_view prefix)
+    : prefix_(prefix),
+      idx_(idx_bit_prefix(prefix)),
+      bm_(bm_bit_prefix(prefix)),
+      universe_(keys::universe(prefix)),
+      bm_universe_(keys::bm_universe(prefix)),
+      versions_(keys::idx_versions(prefix)),
+      stats_(keys::idx_stats(prefix)),
+      bm_stats_(keys::bm_stats(prefix)),
+      scratch_(keys::scratch(prefix)) {}
+
+const KeyTable& KeyTable::of(std::string_view prefix) {
+    // the last table this thread used: one compare for the common single-prefix case
+    thread_local const KeyTable* last = nullptr;
+    if (last && last->prefix_ == prefix) return *last;
+
+    static std::mutex mu;
+    // never destroyed: views handed out stay valid through static destruction
+    static auto* tables = new std::map<std::string, std::unique_ptr<const KeyTable>, std::less<>>();
+    std::lock_guard<std::mutex> lock(mu);
+    auto it = tables->find(prefix);
+    if (it == tables->end())
+        it = tables->emplace(std::string(prefix), std::unique_ptr<const KeyTable>(new KeyTable(prefix))).first;
+    last = it->second.get();
+    return *last;
+}
+
+std::string_view KeyTable::bit_field(std::size_t bit) noexcept {
+    static const Strip fields{std::string_view()};
+    return fields.at(bit);
+}
+
+} // namespace er::keys
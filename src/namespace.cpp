@@ -0,0 +1,50 @@
+#include "er/namespace.hpp"
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <new>
+
+namespace er {
+
+namespace {
+
+bool valid_prefix(std::string_view p) noexcept {
+    if (p.empty() || p.size() > Namespace::kMaxPrefix) return false;
+    bool word = false;   // inside a word: ':' may follow
+    for (const char c : p) {
+        const bool w = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-';
+        if (w) {
+            word = true;
+        } else if (c == ':' && word) {
+            word = false;
+        } else {
+            return false;
+        }
+    }
+    return word;   // no trailing ':'
+}
+
+} // namespace
+
+Result<Namespace> Namespace::open(std::string_view prefix) noexcept {
+    if (!valid_prefix(prefix))
+        return Result<Namespace>::err(Errc::kInvalidArg, "namespace: invalid prefix '" + std::string(prefix) + "'");
+    try {
+        static std::mutex mu;
+        // never destroyed, like the key tables the states point into
+        static auto* open_states = new std::map<std::string, std::shared_ptr<const State>, std::less<>>();
+        std::lock_guard<std::mutex> lock(mu);
+        auto it = open_states->find(prefix);
+        if (it == open_states->end()) {
+            auto st = std::make_shared<const State>(
+                State{std::string(prefix), &keys::KeyTable::of(prefix), std::make_shared<ScriptCache>()});
+            it = open_states->emplace(std::string(prefix), std::move(st)).first;
+        }
+        return Result<Namespace>::ok(Namespace(it->second));
+    } catch (const std::bad_alloc&) {
+        return Result<Namespace>::err(Errc::kInternal, "namespace: out of memory");
+    }
+}
+
+} // namespace er
@@ -0,0 +1,571 @@
+#include "er/query.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <utility>
+
+namespace er::query {
+
+namespace {
+
+constexpr std::size_t kMaxDepth = 256;
+
+class Parser {
+public:
+    explicit Parser(std::string_view s) noexcept : s_(s) {}
+
+    Result<Node> parse_all() {
+        auto n = parse_or(0);
+        if (!n) return n;
+        skip_ws();
+        if (pos_ != s_.size()) return fail("unexpected '" + std::string(1, s_[pos_]) + "'");
+        return n;
+    }
+
+private:
+    Result<Node> fail(std::string msg) const {
+        return Result<Node>::err(Errc::kInvalidArg, "query: " + msg + " at offset " + std::to_string(pos_));
+    }
+
+    void skip_ws() noexcept {
+        while (pos_ < s_.size() && (s_[pos_] == ' ' || s_[pos_] == '\t' || s_[pos_] == '\n' || s_[pos_] == '\r')) ++pos_;
+    }
+
+    bool eat(char c) noexcept {
+        skip_ws();
+        if (pos_ < s_.size() && s_[pos_] == c) {
+            ++pos_;
+            return true;
+        }
+        return false;
+    }
+
+    Result<Node> parse_or(std::size_t depth) {
+        auto lhs = parse_and(depth);
+        if (!lhs) return lhs;
+        if (!eat('|')) return lhs;
+        Node n{Node::Kind::kOr, 0, {}};
+        n.children.push_back(std::move(lhs).value());
+        do {
+            auto rhs = parse_and(depth);
+            if (!rhs) return rhs;
+            n.children.push_back(std::move(rhs).value());
+        } while (eat('|'));
+        return Result<Node>::ok(std::move(n));
+    }
+
+    Result<Node> parse_and(std::size_t depth) {
+        auto lhs = parse_unary(depth);
+        if (!lhs) return lhs;
+        if (!eat('&')) return lhs;
+        Node n{Node::Kind::kAnd, 0, {}};
+        n.children.push_back(std::move(lhs).value());
+        do {
+            auto rhs = parse_unary(depth);
+            if (!rhs) return rhs;
+            n.children.push_back(std::move(rhs).value());
+        } while (eat('&'));
+        return Result<Node>::ok(std::move(n));
+    }
+
+    Result<Node> parse_unary(std::size_t depth) {
+        if (depth >= kMaxDepth) return fail("expression nested too deeply");
+        if (eat('!')) {
+            auto inner = parse_unary(depth + 1);
+            if (!inner) return inner;
+            Node n{Node::Kind::kNot, 0, {}};
+            n.children.push_back(std::move(inner).value());
+            return Result<Node>::ok(std::move(n));
+        }
+        if (eat('(')) {
+            auto inner = parse_or(depth + 1);
+            if (!inner) return inner;
+            if (!eat(')')) return fail("expected ')'");
+            return inner;
+        }
+        skip_ws();
+        std::size_t bit = 0;
+        auto [ptr, ec] = std::from_chars(s_.data() + pos_, s_.data() + s_.size(), bit);
+        if (ec != std::errc() || ptr == s_.data() + pos_) {
+            if (pos_ >= s_.size()) return fail("unexpected end of expression");
+            return fail("expected bit, '!' or '('");
+        }
+        if (bit >= 4096) return fail("bit out of range (0..4095)");
+        pos_ = static_cast<std::size_t>(ptr - s_.data());
+        return Result<Node>::ok(Node{Node::Kind::kBit, bit, {}});
+    }
+
+    std::string_view s_;
+    std::size_t pos_{0};
+};
+
+class PlanBuilder {
+public:
+    explicit PlanBuilder(std::string_view prefix) : keys_(keys::KeyTable::of(prefix)) {}
+
+    void leaf(std::size_t bit) { push_key(keys_.idx_bit(bit), keys::KeyTable::bit_field(bit)); }
+    void universe() { push_key(keys_.universe(), keys::kUniverseVersionField); }
+
+    void op(const char* code, std::size_t n) {
+        plan_.program.emplace_back(code);
+        plan_.program.push_back(std::to_string(n));
+    }
+
+    void emit(const Node& n) {
+        switch (n.kind) {
+        case Node::Kind::kBit:
+            leaf(n.bit);
+            return;
+        case Node::Kind::kNot:
+            universe();
+            emit(n.children.front());
+            op("D", 2);
+            return;
+        case Node::Kind::kOr:
+            for (const auto& c : n.children) emit(c);
+            op("O", n.children.size());
+            return;
+        case Node::Kind::kAnd: {
+            std::vector<const Node*> pos;
+            std::vector<const Node*> neg;
+            for (const auto& c : n.children) {
+                (c.kind == Node::Kind::kNot ? neg : pos).push_back(&c);
+            }
+            if (pos.empty()) {
+                universe();
+            } else {
+                for (const auto* c : pos) emit(*c);
+                if (pos.size() > 1) op("I", pos.size());
+            }
+            if (!neg.empty()) {
+                for (const auto* c : neg) emit(c->children.front());
+                op("D", 1 + neg.size());
+            }
+            return;
+        }
+        }
+    }
+
+    Plan take() { return std::move(plan_); }
+
+private:
+    void push_key(std::string_view key, std::string_view version_field) {
+        auto it = key_index_.find(key);
+        if (it == key_index_.end()) {
+            plan_.keys.push_back(key);
+            plan_.version_fields.push_back(version_field);
+            it = key_index_.emplace(key, plan_.keys.size()).first;
+        }
+        plan_.program.emplace_back("K");
+        plan_.program.push_back(std::to_string(it->second));
+    }
+
+    const keys::KeyTable& keys_;
+    Plan plan_{};
+    std::map<std::string_view, std::size_t> key_index_{};   // key -> 1-based KEYS index
+};
+
+// KEYS: every key the program reads
+// ARGV: mode ('members' | 'count' | 'store'), scratch_base, out_key, n,
+//       versions_key, cache_key, n_fields, field..., program...
+//   n is the TTL in store mode and the result limit otherwise (0 = no limit).
+//   A non-empty versions_key (store mode) stores into the shared cache_key instead:
+//   "<cache_key>:ver" holds "<versions of the fields>|<card>" and a matching entry is
+//   reused. out_key then gets a copy, so a rebuild never changes a key a caller holds.
+// Returns the members, the cardinality (capped at the limit) or the stored cardinality.
+constexpr LuaScript kQueryLua{"query", R"lua(
+local mode    = ARGV[1]
+local scratch = ARGV[2]
+local out     = ARGV[3]
+local n4      = tonumber(ARGV[4])
+local ttl     = (mode == 'store') and n4 or nil
+local limit   = (mode ~= 'store' and n4 and n4 > 0) and n4 or nil
+local vkey    = ARGV[5]
+local entry   = ARGV[6]
+local nf      = tonumber(ARGV[7])
+local dst_key = out   -- where a final store op writes
+
+-- the caller's copy of the cache entry
+local function hand_out(card)
+  if card > 0 then
+    redis.call('SUNIONSTORE', out, entry)
+    redis.call('EXPIRE', out, ttl)
+  else
+    redis.call('DEL', out)
+  end
+  return card
+end
+-- other callers may have been promised a longer TTL: only ever extend it
+local function extend(k)
+  if redis.call('TTL', k) < ttl then redis.call('EXPIRE', k, ttl) end
+end
+
+local stamp_key, stamp = nil, nil
+if mode == 'store' and vkey ~= '' then
+  local v = {}
+  if nf > 0 then v = redis.call('HMGET', vkey, unpack(ARGV, 8, 7 + nf)) end
+  for i = 1, nf do v[i] = v[i] or '0' end
+  stamp = table.concat(v, ',')
+  stamp_key = entry .. ':ver'
+  dst_key = entry
+  local seen = redis.call('GET', stamp_key)
+  if seen then
+    local sep = string.find(seen, '|', 1, true)
+    local card = sep and tonumber(string.sub(seen, sep + 1))
+    if card and string.sub(seen, 1, sep - 1) == stamp and (card == 0 or redis.call('EXISTS', entry) == 1) then
+      extend(stamp_key)
+      if card > 0 then extend(entry) end
+      return hand_out(card)
+    end
+  end
+end
+
+local stack, tmps = {}, {}
+local function new_tmp()
+  local k = scratch .. ':' .. (#tmps + 1)
+  tmps[#tmps + 1] = k
+  return k
+end
+local function cleanup()
+  if #tmps > 0 then redis.call('DEL', unpack(tmps)) end
+end
+
+local EMPTY = { key = false, card = 0 }
+local direct = nil   -- result of the final op when it is not stored (members or count)
+
+-- Appends accepted members of src to res (deduplicated) until the limit is reached.
+local function scan_into(res, seen, src, accept)
+  local cursor = '0'
+  repeat
+    local page = redis.call('SSCAN', src, cursor, 'COUNT', 1000)
+    cursor = page[1]
+    for _, m in ipairs(page[2]) do
+      if not seen[m] and accept(m) then
+        seen[m] = true
+        res[#res + 1] = m
+        if #res >= limit then return end
+      end
+    end
+  until cursor == '0'
+end
+
+local function any_member(operands, from, m)
+  for i = from, #operands do
+    if redis.call('SISMEMBER', operands[i].key, m) == 1 then return true end
+  end
+  return false
+end
+
+-- First `limit` members of cmd over operands, without materializing the result.
+local function take(cmd, operands)
+  local res, seen = {}, {}
+  if cmd == 'SINTER' then
+    -- operands are sorted smallest first: scan it, probe the rest
+    scan_into(res, seen, operands[1].key, function(m)
+      for i = 2, #operands do
+        if redis.call('SISMEMBER', operands[i].key, m) == 0 then return false end
+      end
+      return true
+    end)
+  elseif cmd == 'SDIFF' then
+    scan_into(res, seen, operands[1].key, function(m) return not any_member(operands, 2, m) end)
+  else
+    for i = 1, #operands do
+      if #res >= limit then break end
+      scan_into(res, seen, operands[i].key, function() return true end)
+    end
+  end
+  return res
+end
+
+-- Runs cmd over operand keys: into out/scratch, or directly for a final members/count op.
+local function run(cmd, operands, final)
+  local ks = {}
+  for i = 1, #operands do ks[i] = operands[i].key end
+  if final and mode == 'members' then
+    direct = limit and take(cmd, operands) or redis.call(cmd, unpack(ks))
+    return { key = false, card = #direct }
+  end
+  if final and mode == 'count' and cmd == 'SINTER' then
+    local args = { 'SINTERCARD', #ks, unpack(ks) }
+    if limit then
+      args[#args + 1] = 'LIMIT'
+      args[#args + 1] = limit
+    end
+    local c = redis.pcall(unpack(args))
+    if type(c) == 'number' then
+      direct = c
+      return { key = false, card = c }
+    end
+    -- no SINTERCARD (Redis < 7): fall back to SINTERSTORE + its cardinality
+  end
+  local dst = (final and mode == 'store') and dst_key or new_tmp()
+  local card = redis.call(cmd .. 'STORE', dst, unpack(ks))
+  if card == 0 then return EMPTY end
+  return { key = dst, card = card, stored = final }
+end
+
+local last = #ARGV
+local pc = 8 + nf
+while pc <= last do
+  local op, n = ARGV[pc], tonumber(ARGV[pc + 1])
+  pc = pc + 2
+  local final = pc > last
+  local res
+  if op == 'K' then
+    local k = KEYS[n]
+    local card = redis.call('SCARD', k)
+    res = (card == 0) and EMPTY or { key = k, card = card }
+  else
+    local args = {}
+    for i = #stack - n + 1, #stack do args[#args + 1] = stack[i] end
+    for _ = 1, n do stack[#stack] = nil end
+
+    if op == 'I' then
+      -- smallest posting first; any empty operand empties the result
+      table.sort(args, function(a, b) return a.card < b.card end)
+      if args[1].card == 0 then res = EMPTY
+      elseif #args == 1 then res = args[1]
+      else res = run('SINTER', args, final) end
+    elseif op == 'O' then
+      local live = {}
+      for i = 1, #args do if args[i].card > 0 then live[#live + 1] = args[i] end end
+      if #live == 0 then res = EMPTY
+      elseif #live == 1 then res = live[1]
+      else res = run('SUNION', live, final) end
+    elseif op == 'D' then
+      local live = { args[1] }
+      for i = 2, #args do if args[i].card > 0 then live[#live + 1] = args[i] end end
+      if args[1].card == 0 then res = EMPTY
+      elseif #live == 1 then res = args[1]
+      else res = run('SDIFF', live, final) end
+    else
+      cleanup()
+      return redis.error_reply('query: bad opcode ' .. tostring(op))
+    end
+  end
+  stack[#stack + 1] = res
+end
+
+local top = stack[#stack]
+if mode == 'count' then
+  local c = direct or top.card
+  cleanup()
+  if limit and c > limit then c = limit end
+  return c
+end
+
+if mode == 'members' then
+  local m = direct
+  if not m then
+    if not top.key then m = {}
+    elseif limit then m = take('SUNION', { top })
+    else m = redis.call('SMEMBERS', top.key) end
+  end
+  cleanup()
+  return m
+end
+
+-- store
+if not top.key then
+  redis.call('DEL', dst_key)
+elseif not top.stored then
+  -- a leaf or pass-through operand: copy it
+  redis.call('SUNIONSTORE', dst_key, top.key)
+end
+if top.key and ttl and ttl > 0 then
+  redis.call('EXPIRE', dst_key, ttl)
+end
+cleanup()
+if stamp_key then
+  redis.call('SET', stamp_key, stamp .. '|' .. top.card, 'EX', ttl)
+  return hand_out(top.card)
+end
+return top.card
+)lua"};
+
+// ARGV of kQueryLua as views into the plan, the interned keys, out_key and the two
+// numbers formatted in place.
+struct QueryArgv {
+    QueryArgv(const Plan& plan, const char* mode, std::string_view prefix, std::string_view out_key, std::size_t n,
+              std::string_view cache_key = {}) {
+        const auto& table = keys::KeyTable::of(prefix);
+        const auto n_len = static_cast<std::size_t>(std::to_chars(n_buf, n_buf + sizeof(n_buf), n).ptr - n_buf);
+        argv.reserve(7 + plan.version_fields.size() + plan.program.size());
+        argv.emplace_back(mode);
+        argv.push_back(table.scratch());
+        argv.push_back(out_key);
+        argv.emplace_back(n_buf, n_len);
+        if (!cache_key.empty()) {
+            const auto nf_len = static_cast<std::size_t>(
+                std::to_chars(nf_buf, nf_buf + sizeof(nf_buf), plan.version_fields.size()).ptr - nf_buf);
+            argv.push_back(table.idx_versions());
+            argv.push_back(cache_key);
+            argv.emplace_back(nf_buf, nf_len);
+            // sorted, so every plan of the same canonical query yields the same stamp
+            const auto first = argv.insert(argv.end(), plan.version_fields.begin(), plan.version_fields.end());
+            std::sort(first, argv.end());
+        } else {
+            argv.emplace_back();
+            argv.emplace_back();
+            argv.emplace_back("0");
+        }
+        argv.insert(argv.end(), plan.program.begin(), plan.program.end());
+    }
+    QueryArgv(const QueryArgv&) = delete;
+    QueryArgv& operator=(const QueryArgv&) = delete;
+
+    char n_buf[24]{};
+    char nf_buf[24]{};
+    std::vector<std::string_view> argv{};
+};
+
+void append_canonical(const Node& n, std::string& out) {
+    switch (n.kind) {
+    case Node::Kind::kBit:
+        out.append(std::to_string(n.bit));
+        return;
+    case Node::Kind::kNot:
+        out.push_back('!');
+        append_canonical(n.children.front(), out);
+        return;
+    case Node::Kind::kAnd:
+    case Node::Kind::kOr: {
+        std::vector<std::string> parts;
+        parts.reserve(n.children.size());
+        for (const auto& c : n.children) {
+            std::string p;
+            append_canonical(c, p);
+            parts.push_back(std::move(p));
+        }
+        std::sort(parts.begin(), parts.end());
+        parts.erase(std::unique(parts.begin(), parts.end()), parts.end());
+        out.push_back(n.kind == Node::Kind::kAnd ? '&' : '|');
+        out.push_back('(');
+        for (std::size_t i = 0; i < parts.size(); ++i) {
+            if (i) out.push_back(',');
+            out.append(parts[i]);
+        }
+        out.push_back(')');
+        return;
+    }
+    }
+}
+
+// Expressions longer than this are cached under a hash of their canonical form.
+constexpr std::size_t kMaxReadableCacheId = 128;
+
+std::uint64_t fnv1a64(std::string_view s) noexcept {
+    std::uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+} // namespace
+
+Result<Node> parse(std::string_view expr) noexcept {
+    Parser p(expr);
+    auto n = p.parse_all();
+    if (!n) return n;
+    return Result<Node>::ok(normalize(std::move(n).value()));
+}
+
+Node normalize(Node node) {
+    for (auto& c : node.children) c = normalize(std::move(c));
+
+    if (node.kind == Node::Kind::kNot && node.children.front().kind == Node::Kind::kNot) {
+        return std::move(node.children.front().children.front());
+    }
+    if (node.kind == Node::Kind::kAnd || node.kind == Node::Kind::kOr) {
+        std::vector<Node> flat;
+        flat.reserve(node.children.size());
+        for (auto& c : node.children) {
+            if (c.kind == node.kind) {
+                for (auto& gc : c.children) flat.push_back(std::move(gc));
+            } else {
+                flat.push_back(std::move(c));
+            }
+        }
+        node.children = std::move(flat);
+    }
+    return node;
+}
+
+std::string canonical(const Node& node) {
+    std::string out;
+    append_canonical(node, out);
+    return out;
+}
+
+std::string cache_key(const Node& node, std::string_view prefix) {
+    std::string id = canonical(node);
+    if (id.size() > kMaxReadableCacheId) {
+        char buf[24];
+        std::snprintf(buf, sizeof(buf), "h%016llx", static_cast<unsigned long long>(fnv1a64(id)));
+        id = buf;
+    }
+    return keys::cache(id, prefix);
+}
+
+Plan compile(const Node& root, std::string_view prefix) {
+    PlanBuilder b(prefix);
+    b.emit(root);
+    return b.take();
+}
+
+Result<std::vector<std::string>> members(RedisClient& r, const Plan& plan, std::size_t limit,
+                                         std::string_view prefix) noexcept {
+    if (plan.program.empty()) return Result<std::vector<std::string>>::err(Errc::kInvalidArg, "query: empty plan");
+    return r.eval_strings(kQueryLua, plan.keys, QueryArgv(plan, "members", prefix, "", limit).argv);
+}
+
+Result<long long> count(RedisClient& r, const Plan& plan, std::size_t limit, std::string_view prefix) noexcept {
+    if (plan.program.empty()) return Result<long long>::err(Errc::kInvalidArg, "query: empty plan");
+    return r.eval_integer(kQueryLua, plan.keys, QueryArgv(plan, "count", prefix, "", limit).argv);
+}
+
+Result<long long> store(RedisClient& r, const Plan& plan, int ttl_seconds, std::string_view out_key,
+                        std::string_view prefix) noexcept {
+    if (plan.program.empty()) return Result<long long>::err(Errc::kInvalidArg, "query: empty plan");
+    if (ttl_seconds <= 0) return Result<long long>::err(Errc::kInvalidArg, "ttl_seconds must be > 0");
+    if (out_key.empty()) return Result<long long>::err(Errc::kInvalidArg, "query: empty out_key");
+    return r.eval_integer(kQueryLua, plan.keys, QueryArgv(plan, "store", prefix, out_key, static_cast<std::size_t>(ttl_seconds)).argv);
+}
+
+Result<long long> store_cached(RedisClient& r, const Plan& plan, int ttl_seconds, std::string_view cache_key,
+                               std::string_view out_key, std::string_view prefix) noexcept {
+    if (plan.program.empty()) return Result<long long>::err(Errc::kInvalidArg, "query: empty plan");
+    if (ttl_seconds <= 0) return Result<long long>::err(Errc::kInvalidArg, "ttl_seconds must be > 0");
+    if (out_key.empty() || cache_key.empty()) return Result<long long>::err(Errc::kInvalidArg, "query: empty out_key");
+    if (out_key == cache_key) return Result<long long>::err(Errc::kInvalidArg, "query: out_key must not be the cache entry");
+    return r.eval_integer(kQueryLua, plan.keys,
+                          QueryArgv(plan, "store", prefix, out_key, static_cast<std::size_t>(ttl_seconds), cache_key).argv);
+}
+
+Result<Unit> check_output_key(std::string_view key, std::string_view prefix) noexcept {
+    if (!keys::is_tmp(key, prefix))
+        return Result<Unit>::err(Errc::kInvalidArg, "output key must be under " + keys::tmp_prefix(prefix));
+    if (key.starts_with(keys::cache("", prefix)))
+        return Result<Unit>::err(Errc::kInvalidArg, "output key must not be a cache entry");
+    // the query script creates and DELs "<scratch>:<n>" inside every EVAL
+    const std::string scratch = keys::scratch(prefix);
+    if (key.starts_with(scratch) && (key.size() == scratch.size() || key[scratch.size()] == ':'))
+        return Result<Unit>::err(Errc::kInvalidArg, "output key must not be a scratch key");
+    return Result<Unit>::ok();
+}
+
+Result<long long> release(RedisClient& r, std::span<const std::string_view> keys, std::string_view prefix) noexcept {
+    for (const auto k : keys) {
+        if (auto ok = check_output_key(k, prefix); !ok)
+            return Result<long long>::err(Errc::kInvalidArg, "release: " + std::string(k) + ": " + ok.error().msg);
+    }
+    return r.unlink_keys(keys);
+}
+
+} // namespace er::query
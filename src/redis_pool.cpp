@@ -0,0 +1,193 @@
+#include "er/redis_pool.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <new>
+
+namespace er {
+
+struct RedisPool::State {
+    std::string host;
+    int port;
+    int timeout_ms;
+
+    std::mutex mu;
+    std::condition_variable freed;
+    // nullopt = dropped, reconnected on the next acquire. Slots are never added or
+    // removed, so a leased slot is only touched by its holder.
+    std::vector<std::optional<RedisClient>> slots;
+    std::vector<std::size_t> idle;   // free slot indices
+
+    std::atomic<bool> stats_on{false};
+    Stats stats;   // guarded by mu
+    std::shared_ptr<ScriptCache> scripts;   // guarded by mu
+
+    // Moves a returned client's counters into the pool's; caller holds mu.
+    void fold_stats(RedisClient& client) noexcept {
+        if (!client.stats() || client.stats()->empty()) return;
+        try {
+            stats.merge(*client.stats());
+        } catch (const std::bad_alloc&) {
+            // dropping one lease's counters beats failing the release
+        }
+        client.reset_stats();
+    }
+
+    void release(std::size_t slot) noexcept {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            if (slots[slot]) fold_stats(*slots[slot]);
+            idle.push_back(slot);
+        }
+        freed.notify_one();
+    }
+};
+
+Result<RedisPool> RedisPool::create(std::string host, int port, std::size_t size, int timeout_ms) noexcept {
+    if (size == 0) return Result<RedisPool>::err(Errc::kInvalidArg, "RedisPool: size must be > 0");
+
+    auto state = std::make_unique<State>();
+    state->host = std::move(host);
+    state->port = port;
+    state->timeout_ms = timeout_ms;
+    state->slots.reserve(size);
+    state->idle.reserve(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        auto c = RedisClient::connect(state->host, state->port, state->timeout_ms);
+        if (!c) return Result<RedisPool>::err(c.error().code, c.error().msg);
+        state->slots.emplace_back(std::move(c).value());
+        state->idle.push_back(size - 1 - i);   // hand out slot 0 first
+    }
+    return Result<RedisPool>::ok(RedisPool(std::move(state)));
+}
+
+RedisPool::RedisPool(std::unique_ptr<State> state) noexcept : state_(std::move(state)) {}
+RedisPool::~RedisPool() = default;
+RedisPool::RedisPool(RedisPool&&) noexcept = default;
+RedisPool& RedisPool::operator=(RedisPool&&) noexcept = default;
+
+std::size_t RedisPool::size() const noexcept {
+    return state_ ? state_->slots.size() : 0;
+}
+
+Result<RedisPool::Lease> RedisPool::acquire() noexcept {
+    if (!state_) return Result<Lease>::err(Errc::kInternal, "RedisPool: moved-from pool");
+    State& st = *state_;
+
+    std::size_t slot = 0;
+    bool sync_scripts = false;
+    std::shared_ptr<ScriptCache> scripts;
+    {
+        std::unique_lock<std::mutex> lock(st.mu);
+        st.freed.wait(lock, [&] { return !st.idle.empty(); });
+        slot = st.idle.back();
+        st.idle.pop_back();
+        if (!st.slots[slot] || st.slots[slot]->shared_scripts() != st.scripts) {
+            sync_scripts = true;
+            scripts = st.scripts;
+        }
+    }
+
+    // the slot is ours now: reconnect outside the lock
+    auto& client = st.slots[slot];
+    if (!client) {
+        auto c = RedisClient::connect(st.host, st.port, st.timeout_ms);
+        if (!c) {
+            st.release(slot);
+            return Result<Lease>::err(c.error().code, c.error().msg);
+        }
+        client.emplace(std::move(c).value());
+    }
+    if (sync_scripts) client->share_scripts(std::move(scripts));
+    const bool stats_on = st.stats_on.load(std::memory_order_relaxed);
+    if ((client->stats() != nullptr) != stats_on) client->enable_stats(stats_on);
+    return Result<Lease>::ok(Lease(&st, slot, &*client));
+}
+
+Result<std::size_t> RedisPool::health_check() noexcept {
+    if (!state_) return Result<std::size_t>::err(Errc::kInternal, "RedisPool: moved-from pool");
+    State& st = *state_;
+
+    // take the idle slots out so no one leases them mid-check; busy ones are skipped
+    std::vector<std::size_t> taken;
+    {
+        std::lock_guard<std::mutex> lock(st.mu);
+        taken.swap(st.idle);
+    }
+
+    std::size_t healthy = 0;
+    Error last{};
+    for (auto slot : taken) {
+        auto& client = st.slots[slot];
+        if (client) {
+            auto ok = client->ping();
+            if (ok) {
+                ++healthy;
+                continue;
+            }
+            last = ok.error();
+            client.reset();
+        }
+        auto c = RedisClient::connect(st.host, st.port, st.timeout_ms);
+        if (!c) { last = c.error(); continue; }
+        RedisClient fresh = std::move(c).value();
+        if (auto ok = fresh.ping(); !ok) { last = ok.error(); continue; }
+        client.emplace(std::move(fresh));
+        ++healthy;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(st.mu);
+        st.idle.insert(st.idle.end(), taken.begin(), taken.end());
+    }
+    st.freed.notify_all();
+
+    if (healthy == 0 && !taken.empty()) {
+        if (last.code == Errc::kOk) last = Error{Errc::kRedisIo, "RedisPool: no healthy connection"};
+        return Result<std::size_t>::err(last.code, last.msg);
+    }
+    return Result<std::size_t>::ok(healthy);
+}
+
+void RedisPool::enable_stats(bool on) noexcept {
+    if (!state_) return;
+    state_->stats_on.store(on, std::memory_order_relaxed);
+    if (!on) {
+        std::lock_guard<std::mutex> lock(state_->mu);
+        state_->stats.reset();
+    }
+}
+
+void RedisPool::share_scripts(std::shared_ptr<ScriptCache> cache) noexcept {
+    if (!state_) return;
+    std::lock_guard<std::mutex> lock(state_->mu);
+    state_->scripts = std::move(cache);
+}
+
+Stats RedisPool::stats() const {
+    if (!state_) return Stats{};
+    std::lock_guard<std::mutex> lock(state_->mu);
+    return state_->stats;
+}
+
+RedisPool::Lease::Lease(Lease&& other) noexcept
+    : state_(other.state_), slot_(other.slot_), client_(other.client_) {
+    other.state_ = nullptr;
+    other.client_ = nullptr;
+}
+
+RedisPool::Lease::~Lease() {
+    if (state_) state_->release(slot_);
+}
+
+void RedisPool::Lease::discard() noexcept {
+    if (!state_ || !client_) return;
+    {
+        std::lock_guard<std::mutex> lock(state_->mu);
+        state_->fold_stats(*client_);
+    }
+    state_->slots[slot_].reset();
+    client_ = nullptr;
+}
+
+} // namespace er
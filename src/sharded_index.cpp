@@ -0,0 +1,188 @@
+#include "er/sharded_index.hpp"
+
+#include <algorithm>
+#include <optional>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+namespace er {
+
+namespace {
+
+constexpr std::size_t kClusterSlots = 16384;
+
+template <class T>
+Result<T> shard_error(std::size_t shard, const Error& e) {
+    return Result<T>::err(e.code, "shard " + std::to_string(shard) + ": " + e.msg);
+}
+
+} // namespace
+
+std::uint16_t hash_slot(std::string_view key) noexcept {
+    // only the part between the first '{' and the next '}' is hashed, if non-empty
+    if (const auto open = key.find('{'); open != std::string_view::npos) {
+        const auto close = key.find('}', open + 1);
+        if (close != std::string_view::npos && close > open + 1) key = key.substr(open + 1, close - open - 1);
+    }
+    std::uint16_t crc = 0;
+    for (const char c : key) {
+        crc ^= static_cast<std::uint16_t>(static_cast<unsigned char>(c) << 8);
+        for (int i = 0; i < 8; ++i) crc = (crc & 0x8000) ? static_cast<std::uint16_t>((crc << 1) ^ 0x1021) : static_cast<std::uint16_t>(crc << 1);
+    }
+    return static_cast<std::uint16_t>(crc % kClusterSlots);
+}
+
+Result<ShardedIndex> ShardedIndex::build(const std::vector<Endpoint>& nodes, std::vector<std::size_t> node_of,
+                                         std::size_t connections_per_node, std::string_view prefix) noexcept {
+    if (node_of.empty()) return Result<ShardedIndex>::err(Errc::kInvalidArg, "ShardedIndex: shards must be > 0");
+    if (nodes.empty()) return Result<ShardedIndex>::err(Errc::kInvalidArg, "ShardedIndex: no nodes");
+    if (connections_per_node == 0)
+        return Result<ShardedIndex>::err(Errc::kInvalidArg, "ShardedIndex: connections_per_node must be > 0");
+
+    ShardedIndex idx;
+    idx.nodes_.reserve(nodes.size());
+    for (const auto& n : nodes) {
+        auto pool = RedisPool::create(n.host, n.port, connections_per_node);
+        if (!pool) {
+            return Result<ShardedIndex>::err(pool.error().code,
+                                             n.host + ":" + std::to_string(n.port) + ": " + pool.error().msg);
+        }
+        idx.nodes_.push_back(std::move(pool).value());
+    }
+    idx.node_shards_.resize(nodes.size());
+    idx.prefixes_.reserve(node_of.size());
+    for (std::size_t s = 0; s < node_of.size(); ++s) {
+        idx.node_shards_[node_of[s]].push_back(s);
+        idx.prefixes_.push_back(keys::shard_prefix(s, prefix));
+    }
+    idx.node_of_ = std::move(node_of);
+    return Result<ShardedIndex>::ok(std::move(idx));
+}
+
+Result<ShardedIndex> ShardedIndex::create(const std::vector<Endpoint>& nodes, std::size_t shards,
+                                          std::size_t connections_per_node, std::string_view prefix) noexcept {
+    std::vector<std::size_t> node_of(shards);
+    for (std::size_t s = 0; s < shards && !nodes.empty(); ++s) node_of[s] = s % nodes.size();
+    return build(nodes, std::move(node_of), connections_per_node, prefix);
+}
+
+Result<ShardedIndex> ShardedIndex::connect(const Endpoint& seed, std::size_t shards, std::size_t connections_per_node,
+                                           std::string_view prefix) noexcept {
+    auto c = RedisClient::connect(seed.host, seed.port);
+    if (!c) return Result<ShardedIndex>::err(c.error().code, c.error().msg);
+    RedisClient client = std::move(c).value();
+    auto slots = client.cluster_slots();
+    if (!slots) {
+        // an error reply: not a cluster node, so one node holds every shard
+        if (slots.error().code == Errc::kRedisProtocol) return create({seed}, shards, connections_per_node, prefix);
+        return Result<ShardedIndex>::err(slots.error().code, slots.error().msg);
+    }
+
+    // masters in first-seen order, and the one serving each shard's slot
+    std::vector<Endpoint> masters;
+    std::vector<std::size_t> node_of(shards);
+    for (std::size_t s = 0; s < shards; ++s) {
+        const std::uint16_t slot = hash_slot(keys::shard_prefix(s, prefix));
+        const auto range = std::find_if(slots.value().begin(), slots.value().end(),
+                                        [&](const SlotRange& r) { return r.first <= slot && slot <= r.last; });
+        if (range == slots.value().end())
+            return Result<ShardedIndex>::err(Errc::kRedisProtocol, "ShardedIndex: slot " + std::to_string(slot) + " is not served");
+        Endpoint ep{range->host.empty() ? seed.host : range->host, range->port};
+        const auto known = std::find_if(masters.begin(), masters.end(),
+                                        [&](const Endpoint& m) { return m.host == ep.host && m.port == ep.port; });
+        node_of[s] = static_cast<std::size_t>(known - masters.begin());
+        if (known == masters.end()) masters.push_back(std::move(ep));
+    }
+    return build(masters, std::move(node_of), connections_per_node, prefix);
+}
+
+std::size_t ShardedIndex::shard_of(std::string_view name) const noexcept {
+    std::uint64_t h = 1469598103934665603ull;
+    for (const char c : name) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ull;
+    }
+    return static_cast<std::size_t>(h % prefixes_.size());
+}
+
+template <class Fn>
+auto ShardedIndex::scatter(Fn&& fn) -> std::vector<std::invoke_result_t<Fn&, RedisClient&, std::size_t>> {
+    using R = std::invoke_result_t<Fn&, RedisClient&, std::size_t>;
+    std::vector<std::optional<R>> slots(shards());
+
+    const auto run_node = [&](std::size_t n) {
+        const auto& mine = node_shards_[n];
+        auto results = nodes_[n].map(mine.size(), [&](RedisClient& c, std::size_t i) { return fn(c, mine[i]); });
+        for (std::size_t i = 0; i < mine.size(); ++i) slots[mine[i]].emplace(std::move(results[i]));
+    };
+
+    // one thread per extra node; a node whose thread cannot start runs here
+    std::vector<std::thread> threads;
+    std::vector<std::size_t> inline_nodes{0};
+    threads.reserve(nodes_.size() - 1);
+    for (std::size_t n = 1; n < nodes_.size(); ++n) {
+        try {
+            threads.emplace_back(run_node, n);
+        } catch (const std::system_error&) {
+            inline_nodes.push_back(n);
+        }
+    }
+    for (std::size_t n : inline_nodes) run_node(n);
+    for (auto& t : threads) t.join();
+
+    std::vector<R> out;
+    out.reserve(slots.size());
+    for (auto& s : slots) out.push_back(std::move(*s));
+    return out;
+}
+
+Result<UpsertResult> ShardedIndex::put(std::string_view name, const Flags4096& flags) noexcept {
+    if (name.empty()) return Result<UpsertResult>::err(Errc::kInvalidArg, "put: empty name");
+    const std::size_t s = shard_of(name);
+    return nodes_[node_of_[s]].run(
+        [&](RedisClient& r) { return r.upsert_element(name, flags, IndexBackend::kSet, prefixes_[s]); });
+}
+
+Result<Flags4096> ShardedIndex::get(std::string_view name) noexcept {
+    const std::size_t s = shard_of(name);
+    return nodes_[node_of_[s]].run([&](RedisClient& r) { return r.element_flags(name, prefixes_[s]); });
+}
+
+Result<std::vector<std::string>> ShardedIndex::members(const query::Node& root, std::size_t limit) noexcept {
+    using R = Result<std::vector<std::string>>;
+    auto parts = scatter([&](RedisClient& r, std::size_t s) {
+        return query::members(r, query::compile(root, prefixes_[s]), limit, prefixes_[s]);
+    });
+
+    std::size_t total = 0;
+    for (std::size_t s = 0; s < parts.size(); ++s) {
+        if (!parts[s]) return shard_error<std::vector<std::string>>(s, parts[s].error());
+        total += parts[s].value().size();
+    }
+    std::vector<std::string> out;
+    out.reserve(limit > 0 ? std::min(total, limit) : total);
+    for (auto& part : parts) {
+        for (auto& m : std::move(part).value()) {
+            if (limit > 0 && out.size() == limit) return R::ok(std::move(out));
+            out.push_back(std::move(m));
+        }
+    }
+    return R::ok(std::move(out));
+}
+
+Result<long long> ShardedIndex::count(const query::Node& root, std::size_t limit) noexcept {
+    auto parts = scatter([&](RedisClient& r, std::size_t s) {
+        return query::count(r, query::compile(root, prefixes_[s]), limit, prefixes_[s]);
+    });
+
+    long long total = 0;
+    for (std::size_t s = 0; s < parts.size(); ++s) {
+        if (!parts[s]) return shard_error<long long>(s, parts[s].error());
+        total += parts[s].value();
+    }
+    if (limit > 0) total = std::min(total, static_cast<long long>(limit));
+    return Result<long long>::ok(total);
+}
+
+} // namespace er
@@ -0,0 +1,142 @@
+#include "er/similarity.hpp"
+
+#include <algorithm>
+#include <queue>
+
+#include "er/bitmap_index.hpp"
+#include "er/query.hpp"
+
+namespace er {
+
+namespace {
+
+// Candidate flags fetched per pipeline round trip.
+constexpr std::size_t kScorePage = 1000;
+
+struct Ranked {
+    double rank;   // higher is closer (Hamming distance is negated)
+    std::string name;
+};
+
+// a ranks before b: closer, then by name so ties are deterministic
+bool closer(const Ranked& a, const Ranked& b) noexcept {
+    return a.rank != b.rank ? a.rank > b.rank : a.name < b.name;
+}
+
+// Bounded heap of the k closest entries, furthest on top. A name is only copied
+// when the entry gets in.
+class TopK {
+public:
+    explicit TopK(std::size_t k) noexcept : k_(k) {}
+
+    void offer(double rank, std::string_view name) {
+        if (k_ == 0) return;
+        if (heap_.size() == k_) {
+            const Ranked& worst = heap_.top();
+            if (rank < worst.rank || (rank == worst.rank && name >= worst.name)) return;
+            heap_.pop();
+        }
+        heap_.push(Ranked{rank, std::string(name)});
+    }
+
+    void merge(TopK&& other) {
+        while (!other.heap_.empty()) {
+            Ranked r = other.heap_.top();
+            other.heap_.pop();
+            offer(r.rank, r.name);
+        }
+    }
+
+    std::vector<Match> take(Metric metric) {
+        std::vector<Match> out(heap_.size());
+        for (std::size_t i = out.size(); i-- > 0;) {
+            Ranked r = heap_.top();
+            heap_.pop();
+            out[i] = Match{std::move(r.name), metric == Metric::kHamming ? -r.rank : r.rank};
+        }
+        return out;
+    }
+
+private:
+    std::size_t k_;
+    std::priority_queue<Ranked, std::vector<Ranked>, decltype(&closer)> heap_{&closer};
+};
+
+// Jaccard with the query's popcount precomputed: |a|b| = |a| + |b| - |a&b|.
+double rank_of(Metric metric, const Flags4096& query, std::size_t query_pop, const Flags4096& row) noexcept {
+    if (metric == Metric::kHamming) return -static_cast<double>(query.xor_count(row));
+    const std::size_t inter = query.and_count(row);
+    const std::size_t uni = query_pop + row.popcount() - inter;
+    return uni == 0 ? 1.0 : static_cast<double>(inter) / static_cast<double>(uni);
+}
+
+} // namespace
+
+Result<Metric> parse_metric(std::string_view s) noexcept {
+    if (s == "jaccard") return Result<Metric>::ok(Metric::kJaccard);
+    if (s == "hamming") return Result<Metric>::ok(Metric::kHamming);
+    return Result<Metric>::err(Errc::kInvalidArg, "unknown metric (jaccard|hamming): " + std::string(s));
+}
+
+double similarity_score(Metric metric, const Flags4096& a, const Flags4096& b) noexcept {
+    const double r = rank_of(metric, a, a.popcount(), b);
+    return metric == Metric::kHamming ? -r : r;
+}
+
+Result<std::vector<Match>> similar(RedisClient& redis, const Flags4096& query, std::size_t k, Metric metric,
+                                   std::string_view exclude, IndexBackend backend, std::string_view prefix) noexcept {
+    using Out = std::vector<Match>;
+    const auto range = query.bits();
+    if (k == 0 || range.empty()) return Result<Out>::ok(Out{});
+
+    // candidates: the union of the query's postings
+    query::Node any{query::Node::Kind::kOr, 0, {}};
+    for (auto b : range) any.children.push_back(query::Node{query::Node::Kind::kBit, b, {}});
+    const auto plan = query::compile(query::normalize(std::move(any)), prefix);
+    auto names = (backend == IndexBackend::kBitmap) ? BitmapIndex(redis, prefix).members(plan)
+                                                    : query::members(redis, plan, 0, prefix);
+    if (!names) return Result<Out>::err(names.error().code, names.error().msg);
+
+    const std::size_t query_pop = query.popcount();
+    TopK top(k);
+    const auto& all = names.value();
+    for (std::size_t first = 0; first < all.size(); first += kScorePage) {
+        const std::size_t last = std::min(all.size(), first + kScorePage);
+        auto p = redis.pipeline();
+        for (std::size_t i = first; i < last; ++i) (void)p.element_flags(all[i], prefix);
+        if (auto ok = p.exec(); !ok) return Result<Out>::err(ok.error().code, ok.error().msg);
+
+        for (std::size_t i = first; i < last; ++i) {
+            if (all[i] == exclude) continue;
+            auto flags = p.stored_flags(i - first);
+            if (!flags) {
+                if (flags.error().code == Errc::kNotFound) continue;   // deleted meanwhile
+                return Result<Out>::err(flags.error().code, flags.error().msg);
+            }
+            top.offer(rank_of(metric, query, query_pop, flags.value()), all[i]);
+        }
+    }
+    return Result<Out>::ok(top.take(metric));
+}
+
+std::vector<Match> similar(const Snapshot& snap, const Flags4096& query, std::size_t k, Metric metric,
+                           std::string_view exclude, unsigned threads) {
+    if (k == 0 || snap.empty()) return {};
+
+    const std::size_t query_pop = query.popcount();
+    const unsigned parts = snap.partitions(threads);
+    std::vector<TopK> tops(parts, TopK(k));
+    snap.for_each_range(parts, [&](std::size_t begin, std::size_t end, unsigned part) {
+        auto& top = tops[part];
+        for (std::size_t i = begin; i < end; ++i) {
+            const auto name = snap.name(i);
+            if (name == exclude) continue;
+            top.offer(rank_of(metric, query, query_pop, snap.flags(i)), name);
+        }
+    });
+
+    for (unsigned t = 1; t < parts; ++t) tops[0].merge(std::move(tops[t]));
+    return tops[0].take(metric);
+}
+
+} // namespace er
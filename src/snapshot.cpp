@@ -0,0 +1,463 @@
+#include "er/snapshot.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "er/keys.hpp"
+
+namespace er {
+
+namespace {
+
+Result<Predicate> single_mask(std::span<const std::size_t> bits, Flags4096 Predicate::*mask) noexcept {
+    Predicate p;
+    for (auto b : bits) {
+        if (auto ok = (p.*mask).set(b); !ok) return Result<Predicate>::err(ok.error().code, ok.error().msg);
+    }
+    return Result<Predicate>::ok(std::move(p));
+}
+
+// A predicate reduced to the words it constrains. Typical queries name a handful of
+// bits, so a row check reads one or two cache lines of its 512 B instead of all eight.
+// Dense predicates use the full 64-word kernel, which the compiler vectorizes.
+class Matcher {
+public:
+    explicit Matcher(const Predicate& p) noexcept : pred_(&p) {
+        const auto& all = p.all.words();
+        const auto& any = p.any.words();
+        const auto& none = p.none.words();
+        for (std::size_t w = 0; w < Flags4096::kWords; ++w) {
+            if ((all[w] | any[w] | none[w]) == 0) continue;
+            terms_.push_back(Term{w, all[w], any[w], none[w]});
+            has_any_ = has_any_ || any[w] != 0;
+        }
+        dense_ = terms_.size() > kDenseTerms;
+    }
+
+    bool operator()(const Flags4096& row) const noexcept {
+        const auto& r = row.words();
+        std::uint64_t miss = 0;
+        std::uint64_t hit = 0;
+        if (dense_) {
+            const auto& all = pred_->all.words();
+            const auto& any = pred_->any.words();
+            const auto& none = pred_->none.words();
+            for (std::size_t w = 0; w < Flags4096::kWords; ++w) {
+                miss |= (all[w] & ~r[w]) | (none[w] & r[w]);
+                hit |= any[w] & r[w];
+            }
+        } else {
+            for (const auto& t : terms_) {
+                const std::uint64_t v = r[t.word];
+                miss |= (t.all & ~v) | (t.none & v);
+                hit |= t.any & v;
+            }
+        }
+        return miss == 0 && (!has_any_ || hit != 0);
+    }
+
+private:
+    static constexpr std::size_t kDenseTerms = 16;
+
+    struct Term {
+        std::size_t word;
+        std::uint64_t all;
+        std::uint64_t any;
+        std::uint64_t none;
+    };
+
+    const Predicate* pred_;
+    std::vector<Term> terms_{};
+    bool has_any_{false};
+    bool dense_{false};
+};
+
+// ---- snapshot files ----
+//
+//   offset 0                 FileHeader (64 B, little-endian fields)
+//   64                       rows x 512 B: each row's 64 words, word 0 (bits 0..63) first,
+//                            every word little-endian (Flags4096's in-memory layout)
+//   64 + rows * 512          (rows + 1) x u32 LE name offsets, first 0, last names_bytes
+//   ... + (rows + 1) * 4     names_bytes of names, back to back
+//
+// checksum covers every byte after the header. Rows are the scan data, so they come
+// first: the mapping is page aligned and each row keeps Flags4096's 64-byte alignment.
+constexpr char kMagic[8] = {'E', 'R', 'S', 'N', 'A', 'P', '\r', '\n'};
+constexpr std::uint32_t kVersion = 1;
+
+struct FileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t row_bytes;   // sizeof(Flags4096)
+    std::uint64_t rows;
+    std::uint64_t names_bytes;
+    std::uint64_t checksum;
+    std::uint8_t reserved[24];
+};
+static_assert(sizeof(FileHeader) == 64 && sizeof(Flags4096) == 512);
+
+// xxHash64's round over four lanes: fast enough to verify a multi-GB file at memory speed.
+class Checksum {
+public:
+    void update(const void* data, std::size_t len) noexcept {
+        if (len == 0) return;   // data may be null
+        const auto* p = static_cast<const unsigned char*>(data);
+        total_ += len;
+        if (fill_ > 0) {
+            const std::size_t n = std::min(len, sizeof(buf_) - fill_);
+            std::memcpy(buf_ + fill_, p, n);
+            fill_ += n;
+            p += n;
+            len -= n;
+            if (fill_ < sizeof(buf_)) return;
+            block(buf_);
+            fill_ = 0;
+        }
+        for (; len >= sizeof(buf_); p += sizeof(buf_), len -= sizeof(buf_)) block(p);
+        std::memcpy(buf_, p, len);
+        fill_ = len;
+    }
+
+    std::uint64_t digest() const noexcept {
+        std::uint64_t h = std::rotl(lane_[0], 1) + std::rotl(lane_[1], 7) + std::rotl(lane_[2], 12) +
+                          std::rotl(lane_[3], 18) + total_;
+        for (std::size_t i = 0; i < fill_; ++i) h = std::rotl(h ^ (buf_[i] * kP5), 11) * kP1;
+        h ^= h >> 33;
+        h *= kP2;
+        h ^= h >> 29;
+        h *= kP3;
+        return h ^ (h >> 32);
+    }
+
+private:
+    static constexpr std::uint64_t kP1 = 0x9E3779B185EBCA87ull;
+    static constexpr std::uint64_t kP2 = 0xC2B2AE3D27D4EB4Full;
+    static constexpr std::uint64_t kP3 = 0x165667B19E3779F9ull;
+    static constexpr std::uint64_t kP5 = 0x27D4EB2F165667C5ull;
+
+    void block(const unsigned char* p) noexcept {
+        for (std::size_t i = 0; i < 4; ++i) {
+            std::uint64_t w;
+            std::memcpy(&w, p + i * 8, sizeof(w));
+            lane_[i] = std::rotl(lane_[i] + w * kP2, 31) * kP1;
+        }
+    }
+
+    std::uint64_t lane_[4] = {kP1 + kP2, kP2, 0, 0 - kP1};
+    unsigned char buf_[32]{};
+    std::size_t fill_{0};
+    std::uint64_t total_{0};
+};
+
+Error os_error(std::string_view what, const std::string& path) {
+    const int e = errno;
+    return Error{e == ENOENT ? Errc::kNotFound : Errc::kInternal,
+                 std::string(what) + " " + path + ": " + std::strerror(e)};
+}
+
+bool write_all(int fd, const void* data, std::size_t len) noexcept {
+    const auto* p = static_cast<const char*>(data);
+    while (len > 0) {
+        const ssize_t n = ::write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        len -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+} // namespace
+
+struct Snapshot::Storage {
+    std::vector<Flags4096> rows{};
+    std::string names{};
+    std::vector<std::uint32_t> name_offsets{};
+    void* map{nullptr};   // or all three live in this read-only file mapping
+    std::size_t map_bytes{0};
+
+    Storage() = default;
+    Storage(const Storage&) = delete;
+    Storage& operator=(const Storage&) = delete;
+    ~Storage() {
+        if (map) ::munmap(map, map_bytes);
+    }
+
+    std::string_view name(std::size_t row) const noexcept {
+        const auto begin = name_offsets[row];
+        return std::string_view(names).substr(begin, name_offsets[row + 1] - begin);
+    }
+};
+
+Result<Predicate> Predicate::all_of(std::span<const std::size_t> bits) noexcept {
+    return single_mask(bits, &Predicate::all);
+}
+
+Result<Predicate> Predicate::any_of(std::span<const std::size_t> bits) noexcept {
+    return single_mask(bits, &Predicate::any);
+}
+
+Result<Predicate> Predicate::none_of(std::span<const std::size_t> bits) noexcept {
+    return single_mask(bits, &Predicate::none);
+}
+
+Result<Snapshot> Snapshot::load(RedisClient& redis, std::size_t page, std::string_view prefix) noexcept {
+    auto store = std::make_shared<Storage>();
+    Storage& st = *store;
+    st.name_offsets.push_back(0);
+
+    const std::string universe = keys::universe(prefix);
+    std::uint64_t cursor = 0;
+    do {
+        auto got = redis.sscan(universe, cursor, page);
+        if (!got) return Result<Snapshot>::err(got.error().code, got.error().msg);
+        auto& names = got.value().members;
+        cursor = got.value().cursor;
+        if (names.empty()) continue;
+
+        // one round trip per page for all of its flags
+        auto p = redis.pipeline();
+        for (const auto& n : names) (void)p.element_flags(n, prefix);
+        if (auto ok = p.exec(); !ok) return Result<Snapshot>::err(ok.error().code, ok.error().msg);
+
+        for (std::size_t i = 0; i < names.size(); ++i) {
+            auto row = p.stored_flags(i);
+            if (!row) {
+                if (row.error().code == Errc::kNotFound) continue;   // deleted since the scan returned it
+                return Result<Snapshot>::err(row.error().code, row.error().msg);
+            }
+
+            if (st.names.size() + names[i].size() > std::numeric_limits<std::uint32_t>::max()) {
+                return Result<Snapshot>::err(Errc::kInvalidArg, "Snapshot::load: name table exceeds 4 GiB");
+            }
+            st.rows.push_back(row.value());
+            st.names.append(names[i]);
+            st.name_offsets.push_back(static_cast<std::uint32_t>(st.names.size()));
+        }
+    } while (cursor != 0);
+
+    // SSCAN may return a member more than once across pages; keep its first row.
+    // Duplicates are rare (rehashing during the scan), so only the check is paid upfront.
+    std::vector<std::size_t> order(st.rows.size());
+    for (std::size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        const auto na = st.name(a), nb = st.name(b);
+        return na != nb ? na < nb : a < b;
+    });
+    bool dup = false;
+    for (std::size_t i = 1; i < order.size() && !dup; ++i) dup = st.name(order[i]) == st.name(order[i - 1]);
+    if (dup) {
+        std::vector<bool> keep(st.rows.size(), true);
+        for (std::size_t i = 1; i < order.size(); ++i) {
+            if (st.name(order[i]) == st.name(order[i - 1])) keep[order[i]] = false;
+        }
+        auto compact = std::make_shared<Storage>();
+        compact->name_offsets.push_back(0);
+        for (std::size_t i = 0; i < st.rows.size(); ++i) {
+            if (!keep[i]) continue;
+            compact->rows.push_back(st.rows[i]);
+            compact->names.append(st.name(i));
+            compact->name_offsets.push_back(static_cast<std::uint32_t>(compact->names.size()));
+        }
+        store = std::move(compact);
+    }
+
+    store->rows.shrink_to_fit();
+    store->names.shrink_to_fit();
+    store->name_offsets.shrink_to_fit();
+    Snapshot snap;
+    snap.rows_ = store->rows;
+    snap.names_ = store->names;
+    snap.name_offsets_ = store->name_offsets;
+    snap.store_ = std::move(store);
+    return Result<Snapshot>::ok(std::move(snap));
+}
+
+Result<Unit> Snapshot::save(const std::string& path) const noexcept {
+    using R = Result<Unit>;
+    if constexpr (std::endian::native != std::endian::little) {
+        return R::err(Errc::kInvalidArg, "Snapshot::save: snapshot files need a little-endian host");
+    }
+    const std::uint32_t no_names = 0;
+    const std::span<const std::uint32_t> offsets = empty() ? std::span<const std::uint32_t>(&no_names, 1) : name_offsets_;
+
+    FileHeader hdr{};
+    std::memcpy(hdr.magic, kMagic, sizeof(kMagic));
+    hdr.version = kVersion;
+    hdr.row_bytes = sizeof(Flags4096);
+    hdr.rows = size();
+    hdr.names_bytes = names_.size();
+    Checksum sum;
+    sum.update(rows_.data(), rows_.size_bytes());
+    sum.update(offsets.data(), offsets.size_bytes());
+    sum.update(names_.data(), names_.size());
+    hdr.checksum = sum.digest();
+
+    std::string tmp;
+    try {
+        tmp = path + ".tmp." + std::to_string(::getpid());
+    } catch (const std::bad_alloc&) {
+        return R::err(Errc::kInternal, "Snapshot::save: out of memory");
+    }
+    const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        const Error e = os_error("Snapshot::save: cannot create", tmp);
+        return R::err(e.code, e.msg);
+    }
+    const bool written = write_all(fd, &hdr, sizeof(hdr)) && write_all(fd, rows_.data(), rows_.size_bytes()) &&
+                         write_all(fd, offsets.data(), offsets.size_bytes()) &&
+                         write_all(fd, names_.data(), names_.size()) && ::fsync(fd) == 0;
+    const Error e = written ? Error{} : os_error("Snapshot::save: cannot write", tmp);
+    ::close(fd);
+    if (!written || ::rename(tmp.c_str(), path.c_str()) != 0) {
+        const Error err = written ? os_error("Snapshot::save: cannot rename to", path) : e;
+        ::unlink(tmp.c_str());
+        return R::err(err.code, err.msg);
+    }
+    return R::ok();
+}
+
+Result<Snapshot> Snapshot::open(const std::string& path, bool verify) noexcept {
+    using R = Result<Snapshot>;
+    if constexpr (std::endian::native != std::endian::little) {
+        return R::err(Errc::kInvalidArg, "Snapshot::open: snapshot files need a little-endian host");
+    }
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        const Error e = os_error("Snapshot::open: cannot open", path);
+        return R::err(e.code, e.msg);
+    }
+    struct stat sb {};
+    if (::fstat(fd, &sb) != 0) {
+        const Error e = os_error("Snapshot::open: cannot stat", path);
+        ::close(fd);
+        return R::err(e.code, e.msg);
+    }
+    const auto file_bytes = static_cast<std::size_t>(sb.st_size);
+    if (file_bytes < sizeof(FileHeader) + sizeof(std::uint32_t)) {
+        ::close(fd);
+        return R::err(Errc::kInvalidArg, "Snapshot::open: " + path + " is not a snapshot file (too short)");
+    }
+    void* map = ::mmap(nullptr, file_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    const Error map_error = map == MAP_FAILED ? os_error("Snapshot::open: cannot map", path) : Error{};
+    ::close(fd);
+    if (map == MAP_FAILED) return R::err(map_error.code, map_error.msg);
+
+    std::shared_ptr<Storage> store;
+    try {
+        store = std::make_shared<Storage>();
+    } catch (const std::bad_alloc&) {
+        ::munmap(map, file_bytes);
+        return R::err(Errc::kInternal, "Snapshot::open: out of memory");
+    }
+    store->map = map;
+    store->map_bytes = file_bytes;
+    // the whole file is about to be read: start the page-in now
+    (void)::madvise(map, file_bytes, MADV_WILLNEED);
+
+    const auto* base = static_cast<const unsigned char*>(map);
+    FileHeader hdr;
+    std::memcpy(&hdr, base, sizeof(hdr));
+    const auto bad = [&](std::string_view why) { return R::err(Errc::kInvalidArg, "Snapshot::open: " + path + ": " + std::string(why)); };
+    if (std::memcmp(hdr.magic, kMagic, sizeof(kMagic)) != 0) return bad("not a snapshot file");
+    if (hdr.version != kVersion) return bad("unsupported version " + std::to_string(hdr.version));
+    if (hdr.row_bytes != sizeof(Flags4096)) return bad("unsupported row size");
+    const std::size_t payload = file_bytes - sizeof(FileHeader);
+    if (hdr.rows > payload / sizeof(Flags4096) || hdr.names_bytes > std::numeric_limits<std::uint32_t>::max() ||
+        sizeof(Flags4096) * hdr.rows + sizeof(std::uint32_t) * (hdr.rows + 1) + hdr.names_bytes != payload) {
+        return bad("size does not match its header (truncated?)");
+    }
+    if (verify) {
+        Checksum sum;
+        sum.update(base + sizeof(FileHeader), payload);
+        if (sum.digest() != hdr.checksum) return bad("checksum mismatch");
+    }
+
+    const auto rows = static_cast<std::size_t>(hdr.rows);
+    const auto* row_base = reinterpret_cast<const Flags4096*>(base + sizeof(FileHeader));
+    const auto* offsets = reinterpret_cast<const std::uint32_t*>(row_base + rows);
+    const auto* names = reinterpret_cast<const char*>(offsets + rows + 1);
+    // name() trusts the offsets: check them even without verify
+    if (offsets[0] != 0 || offsets[rows] != hdr.names_bytes) return bad("corrupt name table");
+    for (std::size_t i = 0; i < rows; ++i) {
+        if (offsets[i] > offsets[i + 1]) return bad("corrupt name table");
+    }
+
+    Snapshot snap;
+    snap.rows_ = std::span<const Flags4096>(row_base, rows);
+    snap.names_ = std::string_view(names, static_cast<std::size_t>(hdr.names_bytes));
+    snap.name_offsets_ = std::span<const std::uint32_t>(offsets, rows + 1);
+    snap.store_ = std::move(store);
+    return R::ok(std::move(snap));
+}
+
+unsigned Snapshot::partitions(unsigned threads) const noexcept {
+    const unsigned n = threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+    const std::size_t useful = std::max<std::size_t>(1, rows_.size() / kMinRowsPerThread);
+    return static_cast<unsigned>(std::min<std::size_t>(n, useful));
+}
+
+std::string_view Snapshot::name(std::size_t row) const noexcept {
+    const auto begin = name_offsets_[row];
+    return std::string_view(names_).substr(begin, name_offsets_[row + 1] - begin);
+}
+
+std::vector<std::size_t> Snapshot::find(const Predicate& pred, std::size_t limit, unsigned threads) const {
+    const Matcher match(pred);
+    const unsigned parts = partitions(threads);
+
+    // each range collects its own matches (capped at the limit); concatenated in row order
+    std::vector<std::vector<std::size_t>> found(parts);
+    for_each_range(parts, [&](std::size_t begin, std::size_t end, unsigned part) {
+        auto& out = found[part];
+        for (std::size_t i = begin; i < end; ++i) {
+            if (!match(rows_[i])) continue;
+            out.push_back(i);
+            if (limit > 0 && out.size() >= limit) break;
+        }
+    });
+
+    std::vector<std::size_t> rows = std::move(found[0]);
+    for (unsigned t = 1; t < parts && (limit == 0 || rows.size() < limit); ++t) {
+        rows.insert(rows.end(), found[t].begin(), found[t].end());
+    }
+    if (limit > 0 && rows.size() > limit) rows.resize(limit);
+    return rows;
+}
+
+std::vector<std::string> Snapshot::find_names(const Predicate& pred, std::size_t limit, unsigned threads) const {
+    const auto rows = find(pred, limit, threads);
+    std::vector<std::string> out;
+    out.reserve(rows.size());
+    for (auto i : rows) out.emplace_back(name(i));
+    return out;
+}
+
+std::size_t Snapshot::count(const Predicate& pred, unsigned threads) const {
+    const Matcher match(pred);
+    const unsigned parts = partitions(threads);
+
+    std::vector<std::size_t> counts(parts, 0);
+    for_each_range(parts, [&](std::size_t begin, std::size_t end, unsigned part) {
+        std::size_t n = 0;
+        for (std::size_t i = begin; i < end; ++i) n += match(rows_[i]) ? 1 : 0;
+        counts[part] = n;
+    });
+
+    std::size_t total = 0;
+    for (auto n : counts) total += n;
+    return total;
+}
+
+} // namespace er
@@ -0,0 +1,134 @@
+#include "er/stats.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include "er/json.hpp"
+
+namespace er {
+
+std::size_t LatencyHistogram::bucket_of(std::uint64_t ns) noexcept {
+    constexpr std::uint64_t kSub = std::uint64_t{1} << kSubBits;
+    if (ns < kSub) return static_cast<std::size_t>(ns);   // exact below 16 ns
+    const unsigned e = static_cast<unsigned>(std::bit_width(ns)) - 1;
+    if (e > kMaxExponent) return kBuckets - 1;
+    const std::uint64_t sub = (ns >> (e - kSubBits)) & (kSub - 1);
+    return (static_cast<std::size_t>(e - kSubBits + 1) << kSubBits) + static_cast<std::size_t>(sub);
+}
+
+std::uint64_t LatencyHistogram::bucket_upper(std::size_t bucket) noexcept {
+    constexpr std::size_t kSub = std::size_t{1} << kSubBits;
+    if (bucket < kSub) return bucket;
+    const unsigned shift = static_cast<unsigned>(bucket >> kSubBits) - 1;   // e - kSubBits
+    const std::uint64_t lower = static_cast<std::uint64_t>(kSub + (bucket & (kSub - 1))) << shift;
+    return lower + (std::uint64_t{1} << shift) - 1;
+}
+
+void LatencyHistogram::record(std::uint64_t ns) noexcept {
+    ++buckets_[bucket_of(ns)];
+    ++count_;
+    max_ = std::max(max_, ns);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) noexcept {
+    for (std::size_t i = 0; i < kBuckets; ++i) buckets_[i] += other.buckets_[i];
+    count_ += other.count_;
+    max_ = std::max(max_, other.max_);
+}
+
+std::uint64_t LatencyHistogram::percentile(double p) const noexcept {
+    if (count_ == 0) return 0;
+    p = std::clamp(p, 0.0, 100.0);
+    const auto rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(p / 100.0 * static_cast<double>(count_))));
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < kBuckets; ++i) {
+        seen += buckets_[i];
+        if (seen >= rank) return i + 1 == kBuckets ? max_ : std::min(bucket_upper(i), max_);   // last: overflow
+    }
+    return max_;
+}
+
+CommandStats& Stats::at(std::string_view op) {
+    for (auto& [name, s] : commands_) {
+        if (name == op) return s;
+    }
+    return commands_.emplace_back(std::string(op), CommandStats{}).second;
+}
+
+void Stats::merge(const Stats& other) {
+    for (const auto& [name, o] : other.commands_) {
+        CommandStats& s = at(name);
+        s.calls += o.calls;
+        s.errors += o.errors;
+        s.bytes_sent += o.bytes_sent;
+        s.bytes_received += o.bytes_received;
+        s.reply_elements += o.reply_elements;
+        s.latency.merge(o.latency);
+        s.decode.merge(o.decode);
+    }
+}
+
+namespace {
+
+void append_field(std::string& out, const char* name, std::uint64_t v) {
+    out.push_back('"');
+    out.append(name);
+    out.append("\":");
+    out.append(std::to_string(v));
+}
+
+void append_us(std::string& out, const char* name, const LatencyHistogram& h) {
+    const auto us = [](std::uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+    out.push_back('"');
+    out.append(name);
+    out.append("\":{\"p50\":");
+    json::append_number(out, us(h.percentile(50)));
+    out.append(",\"p90\":");
+    json::append_number(out, us(h.percentile(90)));
+    out.append(",\"p99\":");
+    json::append_number(out, us(h.percentile(99)));
+    out.append(",\"p999\":");
+    json::append_number(out, us(h.percentile(99.9)));
+    out.append(",\"max\":");
+    json::append_number(out, us(h.max()));
+    out.push_back('}');
+}
+
+} // namespace
+
+void Stats::append_json(std::string& out) const {
+    out.push_back('{');
+    for (std::size_t i = 0; i < commands_.size(); ++i) {
+        const auto& [name, s] = commands_[i];
+        if (i) out.push_back(',');
+        json::append_string(out, name);
+        out.push_back(':');
+        out.push_back('{');
+        append_field(out, "calls", s.calls);
+        out.push_back(',');
+        append_field(out, "errors", s.errors);
+        out.push_back(',');
+        append_field(out, "bytes_sent", s.bytes_sent);
+        out.push_back(',');
+        append_field(out, "bytes_received", s.bytes_received);
+        out.push_back(',');
+        append_field(out, "reply_elements", s.reply_elements);
+        out.push_back(',');
+        append_us(out, "latency_us", s.latency);
+        if (s.decode.count() > 0) {
+            out.push_back(',');
+            append_us(out, "decode_us", s.decode);
+        }
+        out.push_back('}');
+    }
+    out.push_back('}');
+}
+
+std::string Stats::json() const {
+    std::string out;
+    append_json(out);
+    return out;
+}
+
+} // namespace er
@@ -0,0 +1,184 @@
+#include "er/write_behind.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+
+#include "er/Element.hpp"
+
+namespace er {
+
+struct WriteBehind::State {
+    using Clock = std::chrono::steady_clock;
+    using Batch = std::unordered_map<std::string, Flags4096>;
+
+    RedisPool* pool;
+    WriteBehindOptions opts;
+    std::string prefix;
+
+    mutable std::mutex mu;
+    std::condition_variable wake;       // drainer: work queued, flush waiting or stopping
+    std::condition_variable progress;   // put() / flush(): room freed, drain finished
+    Batch queue;                        // name -> last queued flags
+    Clock::time_point oldest{};         // when queue became non-empty
+    std::uint64_t enqueued{0};          // sequence number of the last put
+    std::uint64_t committed{0};         // every put up to this one is in Redis
+    std::size_t flushers{0};            // flush() calls waiting
+    bool stopping{false};
+    Error last_error{};
+    WriteBehindStats stats{};
+    std::thread drainer;
+
+    ~State() {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            stopping = true;
+        }
+        wake.notify_one();
+        progress.notify_all();
+        if (drainer.joinable()) drainer.join();
+    }
+
+    Result<Unit> write(const Batch& batch) noexcept {
+        return pool->run([&](RedisClient& r) -> Result<Unit> {
+            BulkWriter writer(r, opts.batch_size, prefix);
+            for (const auto& [name, flags] : batch) {
+                if (auto ok = writer.add(name, flags); !ok) return ok;
+            }
+            return writer.flush();
+        });
+    }
+
+    void run() noexcept {
+        std::unique_lock<std::mutex> lock(mu);
+        for (;;) {
+            wake.wait(lock, [&] { return stopping || !queue.empty(); });
+            if (queue.empty()) return;   // stopping, nothing left
+            wake.wait_until(lock, oldest + opts.max_latency,
+                            [&] { return stopping || flushers > 0 || queue.size() >= opts.batch_size; });
+
+            Batch batch;
+            batch.swap(queue);
+            const std::uint64_t upto = enqueued;
+            lock.unlock();
+            progress.notify_all();   // room for blocked puts while the batch is written
+            auto ok = write(batch);
+            lock.lock();
+
+            if (ok) {
+                committed = upto;
+                ++stats.batches;
+                stats.written += batch.size();
+            } else {
+                ++stats.failures;
+                last_error = ok.error();
+                // queue the batch again under any newer puts of the same names
+                try {
+                    for (auto& [name, flags] : batch) queue.try_emplace(name, flags);
+                } catch (const std::bad_alloc&) {
+                    last_error = Error{Errc::kInternal, "write-behind: out of memory, puts dropped"};
+                }
+                oldest = Clock::now();
+            }
+            progress.notify_all();
+            if (!ok) {
+                if (stopping) return;
+                // back off before the retry, also when a flush() is waiting
+                wake.wait_for(lock, opts.max_latency, [&] { return stopping; });
+            }
+        }
+    }
+};
+
+Result<WriteBehind> WriteBehind::start(RedisPool& pool, WriteBehindOptions opts, std::string_view prefix) noexcept {
+    if (opts.max_pending == 0) return Result<WriteBehind>::err(Errc::kInvalidArg, "WriteBehind: max_pending must be > 0");
+    if (opts.batch_size == 0) opts.batch_size = BulkWriter::kDefaultBatchSize;
+    try {
+        auto state = std::make_unique<State>();
+        state->pool = &pool;
+        state->opts = opts;
+        state->prefix = std::string(prefix);
+        state->queue.reserve(std::min(opts.max_pending, opts.batch_size));
+        State* st = state.get();
+        state->drainer = std::thread([st] { st->run(); });
+        return Result<WriteBehind>::ok(WriteBehind(std::move(state)));
+    } catch (const std::bad_alloc&) {
+        return Result<WriteBehind>::err(Errc::kInternal, "WriteBehind: out of memory");
+    } catch (const std::system_error& e) {
+        return Result<WriteBehind>::err(Errc::kInternal, std::string("WriteBehind: cannot start drain thread: ") + e.what());
+    }
+}
+
+WriteBehind::WriteBehind(std::unique_ptr<State> state) noexcept : state_(std::move(state)) {}
+WriteBehind::~WriteBehind() = default;
+WriteBehind::WriteBehind(WriteBehind&&) noexcept = default;
+WriteBehind& WriteBehind::operator=(WriteBehind&&) noexcept = default;
+
+Result<Unit> WriteBehind::put(std::string_view name, const Flags4096& flags) noexcept {
+    if (!state_) return Result<Unit>::err(Errc::kInternal, "WriteBehind: moved-from queue");
+    if (name.empty()) return Result<Unit>::err(Errc::kInvalidArg, "WriteBehind: empty element name");
+    State& st = *state_;
+    bool notify = false;
+    try {
+        // rejected here: the drainer has no caller to report a bad name to
+        if (auto e = Element::create(std::string(name)); !e) return Result<Unit>::err(e.error().code, e.error().msg);
+        std::string key(name);
+        std::unique_lock<std::mutex> lock(st.mu);
+        for (;;) {
+            if (st.stopping) return Result<Unit>::err(Errc::kInternal, "WriteBehind: stopped");
+            if (auto it = st.queue.find(key); it != st.queue.end()) {
+                it->second = flags;
+                ++st.stats.coalesced;
+                break;
+            }
+            if (st.queue.size() < st.opts.max_pending) {
+                st.queue.emplace(std::move(key), flags);
+                if (st.queue.size() == 1) st.oldest = State::Clock::now();
+                notify = st.queue.size() == 1 || st.queue.size() >= st.opts.batch_size;
+                break;
+            }
+            st.progress.wait(lock);
+        }
+        ++st.enqueued;
+        ++st.stats.puts;
+    } catch (const std::bad_alloc&) {
+        return Result<Unit>::err(Errc::kInternal, "WriteBehind: out of memory");
+    }
+    if (notify) st.wake.notify_one();
+    return Result<Unit>::ok();
+}
+
+Result<Unit> WriteBehind::flush() noexcept {
+    if (!state_) return Result<Unit>::err(Errc::kInternal, "WriteBehind: moved-from queue");
+    State& st = *state_;
+    std::unique_lock<std::mutex> lock(st.mu);
+    const std::uint64_t target = st.enqueued;
+    const std::uint64_t failures = st.stats.failures;
+    if (st.committed >= target) return Result<Unit>::ok();
+
+    ++st.flushers;
+    st.wake.notify_one();
+    st.progress.wait(lock, [&] { return st.committed >= target || st.stats.failures != failures; });
+    --st.flushers;
+    if (st.committed >= target) return Result<Unit>::ok();
+    return Result<Unit>::err(st.last_error.code, "write-behind: " + st.last_error.msg);
+}
+
+std::size_t WriteBehind::pending() const noexcept {
+    if (!state_) return 0;
+    std::lock_guard<std::mutex> lock(state_->mu);
+    return state_->queue.size();
+}
+
+WriteBehindStats WriteBehind::stats() const noexcept {
+    if (!state_) return WriteBehindStats{};
+    std::lock_guard<std::mutex> lock(state_->mu);
+    return state_->stats;
+}
+
+} // namespace er